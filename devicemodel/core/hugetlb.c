@@ -28,6 +28,9 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/vfs.h>
 #include <sys/mount.h>
@@ -39,6 +42,7 @@
 #include <linux/memfd.h>
 
 #include "vmmapi.h"
+#include "dm_string.h"
 
 extern char *vmname;
 
@@ -50,6 +54,10 @@ extern char *vmname;
 
 #define MAX_PATH_LEN 256
 
+#define PREFAULT_THREADS_MAX	64
+#define SYS_NODE_PATH	"/sys/devices/system/node/"
+#define NUMA_NODES_MAX	16
+
 /* HugePage Level 1 for 2M page, Level 2 for 1G page*/
 
 #define SYS_PATH_LV1  "/sys/kernel/mm/hugepages/hugepages-2048kB/"
@@ -133,11 +141,25 @@ struct vm_mmap_mem_region {
 	vm_paddr_t fd_offset;
 	char *hva_base;
 	int fd;
+	size_t pg_size;
 };
 
 static struct vm_mmap_mem_region mmap_mem_regions[16];
 static int mem_idx;
 
+/*
+ * Guest RAM is prefaulted by prefault_threads workers once all regions
+ * are mapped, or inline while mapping when there is only one.
+ */
+static int prefault_threads = 1;
+
+struct prefault_worker {
+	pthread_t tid;
+	size_t first;		/* first byte, counted across all regions */
+	size_t last;		/* one past the last byte */
+	int node;		/* NUMA node it's pinned to, -1 for none */
+};
+
 static void *ptr;
 static size_t total_size;
 static int hugetlb_lv_max;
@@ -237,9 +259,14 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 	mmap_mem_regions[mem_idx].fd = fd;
 	mmap_mem_regions[mem_idx].fd_offset = skip;
 	mmap_mem_regions[mem_idx].hva_base = addr;
+	mmap_mem_regions[mem_idx].pg_size = hugetlb_priv[level].pg_size;
 	mem_idx++;
 	pr_info("mmap 0x%lx@%p\n", len, addr);
 
+	/* the parallel prefault touches them once everything is mapped */
+	if (prefault_threads > 1)
+		return 0;
+
 	/* pre-allocate hugepages by touch them */
 	pagesz = hugetlb_priv[level].pg_size;
 
@@ -600,6 +627,173 @@ void uninit_hugetlb(void)
 	close(lock_fd);
 }
 
+/*
+ * Parse "--prefault <threads>". Guest RAM is touched by that many
+ * threads before the VM starts; 1 keeps doing it inline while mapping.
+ */
+int hugetlb_parse_prefault(const char *opt)
+{
+	int num;
+
+	if (dm_strtoi(opt, NULL, 0, &num) || num < 1 ||
+	    num > PREFAULT_THREADS_MAX)
+		return -1;
+
+	prefault_threads = num;
+	return 0;
+}
+
+/* Parse a sysfs cpu/node list like "0-3,8,10-11" into set. */
+static int parse_sys_list(const char *path, cpu_set_t *set)
+{
+	char buf[256], *str, *tok, *end;
+	int first, last, fd, n;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	CPU_ZERO(set);
+	str = buf;
+	while ((tok = strsep(&str, ",\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if (dm_strtoi(tok, &end, 10, &first))
+			return -1;
+		last = first;
+		if (*end == '-' && dm_strtoi(end + 1, NULL, 10, &last))
+			return -1;
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+	}
+	return 0;
+}
+
+/*
+ * Fill nodes with the online NUMA nodes that have CPUs and their cpu
+ * sets. Returns the number of nodes, 0 if the host isn't NUMA.
+ */
+static int get_numa_nodes(int *nodes, cpu_set_t *cpus, int max)
+{
+	char path[MAX_PATH_LEN];
+	cpu_set_t online;
+	int node, nr = 0;
+
+	if (parse_sys_list(SYS_NODE_PATH "online", &online) != 0)
+		return 0;
+
+	for (node = 0; node < CPU_SETSIZE && nr < max; node++) {
+		if (!CPU_ISSET(node, &online))
+			continue;
+		snprintf(path, sizeof(path), SYS_NODE_PATH "node%d/cpulist", node);
+		if (parse_sys_list(path, &cpus[nr]) != 0 ||
+		    CPU_COUNT(&cpus[nr]) == 0)
+			continue;
+		nodes[nr++] = node;
+	}
+
+	return nr > 1 ? nr : 0;
+}
+
+/*
+ * Touch the pages that start in bytes [first, last) of the mapped
+ * regions, counted in order.
+ */
+static void prefault_pages(size_t first, size_t last)
+{
+	struct vm_mmap_mem_region *rg;
+	size_t base, size, off;
+	char *addr;
+	int idx;
+
+	for (idx = 0, base = 0; idx < mem_idx && base < last; idx++) {
+		rg = &mmap_mem_regions[idx];
+		size = rg->gpa_end - rg->gpa_start;
+		off = (first > base) ? roundup(first - base, rg->pg_size) : 0;
+		for (; off < size && base + off < last; off += rg->pg_size) {
+			addr = rg->hva_base + off;
+			*(volatile char *)addr = *addr;
+		}
+		base += size;
+	}
+}
+
+static void *prefault_thread(void *arg)
+{
+	struct prefault_worker *w = arg;
+
+	prefault_pages(w->first, w->last);
+	return NULL;
+}
+
+/*
+ * Fault in every hugepage of guest RAM with prefault_threads workers.
+ * The kernel allocates and clears a hugepage on its first touch, so this
+ * zeroes the memory as well. Each worker takes a contiguous share of the
+ * pages. On a NUMA host the shares are handed out node by node and the
+ * workers are pinned to their node's CPUs, so every page is allocated
+ * on the node of the thread that touched it.
+ */
+static void hugetlb_prefault(void)
+{
+	struct prefault_worker workers[PREFAULT_THREADS_MAX];
+	cpu_set_t node_cpus[NUMA_NODES_MAX];
+	int nodes[NUMA_NODES_MAX];
+	pthread_attr_t attr;
+	size_t total, npages;
+	int i, n, nr_nodes;
+
+	/*
+	 * Shares are split by size, not page count, so that a worker with
+	 * 1G pages does not get 512 times the memory of one with 2M pages.
+	 */
+	for (i = 0, total = 0, npages = 0; i < mem_idx; i++) {
+		total += mmap_mem_regions[i].gpa_end - mmap_mem_regions[i].gpa_start;
+		npages += (mmap_mem_regions[i].gpa_end -
+			   mmap_mem_regions[i].gpa_start) /
+			  mmap_mem_regions[i].pg_size;
+	}
+
+	n = MIN((size_t)prefault_threads, npages);
+	nr_nodes = get_numa_nodes(nodes, node_cpus, NUMA_NODES_MAX);
+	pr_info("prefault %ld MB with %d threads on %d NUMA nodes\n",
+		total >> 20, n, nr_nodes);
+
+	for (i = 0; i < n; i++) {
+		workers[i].first = total * i / n;
+		workers[i].last = total * (i + 1) / n;
+		workers[i].node = -1;
+		workers[i].tid = 0;
+
+		pthread_attr_init(&attr);
+		if (nr_nodes > 0) {
+			workers[i].node = nodes[i * nr_nodes / n];
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t),
+					&node_cpus[i * nr_nodes / n]);
+		}
+		if (pthread_create(&workers[i].tid, &attr, prefault_thread,
+				&workers[i]) != 0) {
+			pr_warn("prefault thread %d create failed\n", i);
+			workers[i].tid = 0;
+			prefault_pages(workers[i].first, workers[i].last);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (workers[i].tid == 0)
+			continue;
+		pthread_join(workers[i].tid, NULL);
+		pr_dbg("prefault thread %d: bytes [0x%lx, 0x%lx) on node %d\n",
+			i, workers[i].first, workers[i].last, workers[i].node);
+	}
+}
+
 int hugetlb_setup_memory(struct vmctx *ctx)
 {
 	int level;
@@ -608,6 +802,7 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	int fd;
 	unsigned int seal_flag = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
 	size_t mem_size_level;
+	struct timespec t0, t1;
 
 	mem_idx = 0;
 	memset(&mmap_mem_regions, 0, sizeof(mmap_mem_regions));
@@ -734,6 +929,8 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	}
 	pr_info("mmap ptr 0x%p -> baseaddr 0x%p\n", ptr, ctx->baseaddr);
 
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
 	/* mmap lowmem */
 	if (mmap_hugetlbfs(ctx, 0, get_lowmem_param, adj_lowmem_param, NULL) < 0) {
 		pr_err("lowmem mmap failed");
@@ -761,6 +958,13 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		goto err_lock;
 	}
 
+	if (prefault_threads > 1)
+		hugetlb_prefault();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pr_notice("guest memory mapped and prefaulted in %ld ms\n",
+		(t1.tv_sec - t0.tv_sec) * 1000 +
+		(t1.tv_nsec - t0.tv_nsec) / 1000000);
+
 	/* resize the memfd to meet with the size requirement and add the
 	 * F_SEAL_SEAL flag
 	 */
@@ -877,6 +1081,7 @@ vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 		offset = gpa - mmap_region->gpa_start;
 		ret_region->fd = mmap_region->fd;
 		ret_region->fd_offset = offset + mmap_region->fd_offset;
+		ret_region->len = mmap_region->gpa_end - gpa;
 	} else
 		ret = false;
 
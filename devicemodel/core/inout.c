@@ -118,6 +118,21 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct acrn_pio_request *pio_reques
 	return retval;
 }
 
+/*
+ * The device behind port, as the handler's arg, or the handler itself
+ * for ports registered without one.  Only good for telling devices
+ * apart: it is never dereferenced.
+ */
+void *
+inout_owner(int port)
+{
+	if (port < 0 || port >= MAX_IOPORTS)
+		return NULL;
+
+	return inout_handlers[port].arg ? inout_handlers[port].arg :
+		(void *)inout_handlers[port].handler;
+}
+
 void
 init_inout(void)
 {
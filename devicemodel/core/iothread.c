@@ -8,8 +8,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <sys/queue.h>
 #include <pthread.h>
@@ -18,28 +21,81 @@
 #include "iothread.h"
 #include "log.h"
 #include "mevent.h"
+#include "dm_string.h"
 
 
 #define MEVENT_MAX 64
 #define MAX_EVENT_NUM 64
+/* Interval between the load reports a busy iothread prints while running */
+#define IOTHREAD_REPORT_NS (10UL * 1000000000UL)
 struct iothread_ctx {
 	pthread_t tid;
 	int epfd;
 	bool started;
 	pthread_mutex_t mtx;
+	int idx;
+	int cpu;		/* pCPU to pin to, -1 for none */
+	uint64_t busy_ns;	/* time spent running handlers */
+	uint64_t nr_runs;	/* handler invocations */
+	struct timespec start;
+	uint64_t report_ns;	/* time of the last load report */
+	uint64_t report_busy_ns;
+	uint64_t report_runs;
 };
-static struct iothread_ctx ioctx;
+static struct iothread_ctx ioctxs[IOTHREAD_NUM_MAX];
+static int iothread_num = 1;
+static int iothread_cpus[IOTHREAD_NUM_MAX] = {
+	[0 ... IOTHREAD_NUM_MAX - 1] = -1
+};
+static int iothread_next;
+
+static uint64_t
+iothread_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000UL + ts->tv_nsec;
+}
+
+/*
+ * Print the load of the last interval so that an overloaded iothread can be
+ * spotted, and the pool resized or repinned with --iothreads, while the VM is still
+ * running. Only called after a batch of events, so an idle thread stays quiet.
+ */
+static void
+iothread_report(struct iothread_ctx *ioctx, uint64_t now)
+{
+	uint64_t elapsed = now - ioctx->report_ns;
+	uint64_t busy;
+
+	if (elapsed < IOTHREAD_REPORT_NS)
+		return;
+
+	busy = ioctx->busy_ns - ioctx->report_busy_ns;
+	pr_info("iothread-%d: %lu runs, busy %lu ms of %lu ms (%lu%%)\n",
+		ioctx->idx, ioctx->nr_runs - ioctx->report_runs,
+		busy / 1000000, elapsed / 1000000, busy * 100 / elapsed);
+
+	ioctx->report_ns = now;
+	ioctx->report_busy_ns = ioctx->busy_ns;
+	ioctx->report_runs = ioctx->nr_runs;
+}
 
 static void *
 io_thread(void *arg)
 {
+	struct iothread_ctx *ioctx = arg;
 	struct epoll_event eventlist[MEVENT_MAX];
 	struct iothread_mevent *aevp;
+	struct timespec t0, t1;
 	int i, n, status;
 	char buf[MAX_EVENT_NUM];
 
-	while(ioctx.started) {
-		n = epoll_wait(ioctx.epfd, eventlist, MEVENT_MAX, -1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ioctx->report_ns = iothread_ns(&t0);
+	ioctx->report_busy_ns = 0;
+	ioctx->report_runs = 0;
+
+	while(ioctx->started) {
+		n = epoll_wait(ioctx->epfd, eventlist, MEVENT_MAX, -1);
 		if (n < 0) {
 			if (errno == EINTR)
 				pr_info("%s: exit from epoll_wait\n", __func__);
@@ -47,6 +103,7 @@ io_thread(void *arg)
 				pr_err("%s: return from epoll wait with errno %d\r\n", __func__, errno);
 			break;
 		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
 		for (i = 0; i < n; i++) {
 			aevp = eventlist[i].data.ptr;
 			if (aevp && aevp->run) {
@@ -57,42 +114,76 @@ io_thread(void *arg)
 				(*aevp->run)(aevp->arg);
 			}
 		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ioctx->busy_ns += iothread_ns(&t1) - iothread_ns(&t0);
+		ioctx->nr_runs += n;
+		iothread_report(ioctx, iothread_ns(&t1));
 	}
 
 	return NULL;
 }
 
 static int
-iothread_start(void)
+iothread_start(struct iothread_ctx *ioctx)
 {
-	pthread_mutex_lock(&ioctx.mtx);
+	char tname[MAXCOMLEN + 1];
+	cpu_set_t cpuset;
+
+	pthread_mutex_lock(&ioctx->mtx);
 
-	if (ioctx.started) {
-		pthread_mutex_unlock(&ioctx.mtx);
+	if (ioctx->started) {
+		pthread_mutex_unlock(&ioctx->mtx);
 		return 0;
 	}
 
-	if (pthread_create(&ioctx.tid, NULL, io_thread, NULL) != 0) {
-		pthread_mutex_unlock(&ioctx.mtx);
+	ioctx->started = true;
+	if (pthread_create(&ioctx->tid, NULL, io_thread, ioctx) != 0) {
+		ioctx->started = false;
+		pthread_mutex_unlock(&ioctx->mtx);
 		pr_err("%s", "iothread create failed\r\n");
 		return -1;
 	}
-	ioctx.started = true;
-	pthread_setname_np(ioctx.tid, "iothread");
-	pthread_mutex_unlock(&ioctx.mtx);
-	pr_info("iothread started\n");
+	snprintf(tname, sizeof(tname), "iothread-%d", ioctx->idx);
+	pthread_setname_np(ioctx->tid, tname);
+	if (ioctx->cpu >= 0) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(ioctx->cpu, &cpuset);
+		if (pthread_setaffinity_np(ioctx->tid, sizeof(cpuset), &cpuset))
+			pr_warn("%s: failed to pin %s to cpu %d\n",
+				__func__, tname, ioctx->cpu);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ioctx->start);
+	pthread_mutex_unlock(&ioctx->mtx);
+	pr_info("%s started\n", tname);
 	return 0;
 }
 
+/*
+ * Return iothread idx, or NULL if the pool has no such thread.  Pass
+ * a negative idx to get the threads handed out round-robin, which
+ * spreads devices without an explicit assignment across the pool.
+ */
+struct iothread_ctx *
+iothread_get(int idx)
+{
+	if (idx < 0) {
+		idx = iothread_next;
+		iothread_next = (iothread_next + 1) % iothread_num;
+	}
+	if (idx >= iothread_num)
+		return NULL;
+	return &ioctxs[idx];
+}
+
 int
-iothread_add(int fd, struct iothread_mevent *aevt)
+iothread_add(struct iothread_ctx *ioctx, int fd, struct iothread_mevent *aevt)
 {
 	struct epoll_event ee;
 	int ret;
 	/* Create a epoll instance before the first fd is added.*/
 	ee.events = EPOLLIN;
 	ee.data.ptr = aevt;
-	ret = epoll_ctl(ioctx.epfd, EPOLL_CTL_ADD, fd, &ee);
+	ret = epoll_ctl(ioctx->epfd, EPOLL_CTL_ADD, fd, &ee);
 	if (ret < 0) {
 		pr_err("%s: failed to add fd, error is %d\n",
 			__func__, errno);
@@ -100,7 +191,7 @@ iothread_add(int fd, struct iothread_mevent *aevt)
 	}
 
 	/* Start the iothread after the first fd is added.*/
-	ret = iothread_start();
+	ret = iothread_start(ioctx);
 	if (ret < 0) {
 		pr_err("%s: failed to start iothread thread\n",
 			__func__);
@@ -109,12 +200,12 @@ iothread_add(int fd, struct iothread_mevent *aevt)
 }
 
 int
-iothread_del(int fd)
+iothread_del(struct iothread_ctx *ioctx, int fd)
 {
 	int ret = 0;
 
-	if (ioctx.epfd) {
-		ret = epoll_ctl(ioctx.epfd, EPOLL_CTL_DEL, fd, NULL);
+	if (ioctx->epfd) {
+		ret = epoll_ctl(ioctx->epfd, EPOLL_CTL_DEL, fd, NULL);
 		if (ret < 0)
 			pr_err("%s: failed to delete fd from epoll fd, error is %d\n",
 				__func__, errno);
@@ -125,41 +216,101 @@ iothread_del(int fd)
 void
 iothread_deinit(void)
 {
+	struct iothread_ctx *ioctx;
+	struct timespec now;
+	uint64_t elapsed;
 	void *jval;
+	int i;
 
-	if (ioctx.tid > 0) {
-		pthread_mutex_lock(&ioctx.mtx);
-		ioctx.started = false;
-		pthread_mutex_unlock(&ioctx.mtx);
-		pthread_kill(ioctx.tid, SIGCONT);
-		pthread_join(ioctx.tid, &jval);
-	}
-	if (ioctx.epfd > 0) {
-		close(ioctx.epfd);
-		ioctx.epfd = -1;
+	for (i = 0; i < iothread_num; i++) {
+		ioctx = &ioctxs[i];
+		if (ioctx->tid > 0) {
+			pthread_mutex_lock(&ioctx->mtx);
+			ioctx->started = false;
+			pthread_mutex_unlock(&ioctx->mtx);
+			pthread_kill(ioctx->tid, SIGCONT);
+			pthread_join(ioctx->tid, &jval);
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = iothread_ns(&now) - iothread_ns(&ioctx->start);
+			pr_info("iothread-%d: %lu runs, busy %lu ms of %lu ms\n",
+				i, ioctx->nr_runs, ioctx->busy_ns / 1000000,
+				elapsed / 1000000);
+		}
+		if (ioctx->epfd > 0) {
+			close(ioctx->epfd);
+			ioctx->epfd = -1;
+		}
+		pthread_mutex_destroy(&ioctx->mtx);
 	}
-	pthread_mutex_destroy(&ioctx.mtx);
 	pr_info("iothread stop\n");
 }
 
 int
 iothread_init(void)
 {
+	struct iothread_ctx *ioctx;
 	pthread_mutexattr_t attr;
+	int i;
 
 	pthread_mutexattr_init(&attr);
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&ioctx.mtx, &attr);
+
+	iothread_next = 0;
+	for (i = 0; i < iothread_num; i++) {
+		ioctx = &ioctxs[i];
+		pthread_mutex_init(&ioctx->mtx, &attr);
+		ioctx->tid = 0;
+		ioctx->started = false;
+		ioctx->idx = i;
+		ioctx->cpu = iothread_cpus[i];
+		ioctx->busy_ns = 0;
+		ioctx->nr_runs = 0;
+		ioctx->epfd = epoll_create1(0);
+
+		if (ioctx->epfd < 0) {
+			pr_err("%s: failed to create epoll fd, error is %d\r\n",
+				__func__, errno);
+			pthread_mutexattr_destroy(&attr);
+			return -1;
+		}
+	}
 	pthread_mutexattr_destroy(&attr);
+	return 0;
+}
 
-	ioctx.tid = 0;
-	ioctx.started = false;
-	ioctx.epfd = epoll_create1(0);
+/*
+ * Parse "--iothreads <num>[,cpu=<cpu>[:<cpu>...]]".  The n'th cpu in
+ * the list is the pCPU iothread n gets pinned to.
+ */
+int
+iothread_parse_options(const char *opts)
+{
+	char *str, *tmp, *cpus, *cpu;
+	int num, i, ret = -1;
 
-	if (ioctx.epfd < 0) {
-		pr_err("%s: failed to create epoll fd, error is %d\r\n",
-			__func__, errno);
+	str = tmp = strdup(opts);
+	if (!str)
 		return -1;
+
+	if (dm_strtoi(strsep(&tmp, ","), NULL, 0, &num) ||
+	    num < 1 || num > IOTHREAD_NUM_MAX)
+		goto out;
+
+	if (tmp) {
+		if (strncmp(tmp, "cpu=", 4))
+			goto out;
+		cpus = tmp + 4;
+		for (i = 0; (cpu = strsep(&cpus, ":")) != NULL; i++) {
+			if (i >= num || dm_strtoi(cpu, NULL, 0, &iothread_cpus[i]) ||
+			    iothread_cpus[i] < 0)
+				goto out;
+		}
 	}
-	return 0;
+
+	iothread_num = num;
+	ret = 0;
+out:
+	free(str);
+	return ret;
 }
@@ -29,11 +29,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <err.h>
 #include <errno.h>
 #include <libgen.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sysexits.h>
 #include <stdbool.h>
 #include <getopt.h>
@@ -71,6 +73,7 @@
 #include "cmd_monitor.h"
 #include "vdisplay.h"
 #include "iothread.h"
+#include "dm_string.h"
 
 #define	VM_MAXCPU		16	/* maximum virtual cpus */
 
@@ -103,6 +106,9 @@ bool skip_pci_mem64bar_workaround = false;
 bool gfx_ui = false;
 
 static int guest_ncpus;
+static int ioreq_nthreads;
+/* when the current boot began, for the time to first instruction */
+static struct timespec boot_start;
 static int virtio_msix = 1;
 static bool debugexit_enabled;
 static int pm_notify_channel;
@@ -152,6 +158,8 @@ usage(int code)
 		"       %*s [--enable_trusty] [--intr_monitor param_setting]\n"
 		"       %*s [--acpidev_pt HID] [--mmiodev_pt MMIO_Regions]\n"
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval]\n"
+		"       %*s [--ioreq_threads num] [--iothreads num[,cpu=list]]\n"
+		"       %*s [--prefault threads]\n"
 		"       %*s [--cpu_affinity lapic_id] [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
 		"       %*s [--ssram] <vm>\n"
@@ -176,6 +184,9 @@ usage(int code)
 		"       --cmd_monitor: enable command monitor\n"
 		"            its params: unix domain socket path\n"
 		"       --virtio_poll: enable virtio poll mode with poll interval with ns\n"
+		"       --ioreq_threads: number of threads emulating vCPU I/O requests\n"
+		"       --iothreads: iothread pool size and optional cpu pinning\n"
+		"       --prefault: number of threads prefaulting guest memory before boot\n"
 		"       --acpidev_pt: ACPI device ID args: HID in ACPI Table\n"
 		"       --mmiodev_pt: MMIO resources args: physical MMIO regions\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
@@ -189,6 +200,7 @@ usage(int code)
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "");
 
 	exit(code);
@@ -699,9 +711,213 @@ vm_suspend_resume(struct vmctx *ctx)
 	vm_run(ctx);
 }
 
+/*
+ * With --ioreq_threads, vm_loop() keeps polling the HSM ioreq client but
+ * no longer emulates requests itself: each pending slot is rung on the
+ * doorbell of the thread serving the device it is for.  The device models
+ * expect a single emulation thread, so all requests for one device go to
+ * the same thread: the target of a PCI config access, else the owner of
+ * the MMIO range or I/O port.  A vCPU has one request at a time, so its
+ * requests stay in order, while a slow emulation on one device no longer
+ * holds up the others.
+ */
+struct ioreq_worker {
+	pthread_t	tid;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	uint32_t	doorbell;	/* vCPUs with a request for us */
+	bool		closing;
+	struct vmctx	*ctx;
+};
+
+/* Polls of the HSM client with every pending slot in flight */
+#define IOREQ_SPIN_POLLS	64
+#define IOREQ_POLL_US		20
+
+static struct ioreq_worker ioreq_workers[VM_MAXCPU];
+static uint32_t ioreq_inflight;		/* vCPU slots handed to a worker */
+static int ioreq_idle_polls;
+static pthread_mutex_t ioreq_done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioreq_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void *
+ioreq_worker_thread(void *param)
+{
+	struct ioreq_worker *w = param;
+	uint32_t bell;
+	int vcpu;
+
+	for (;;) {
+		pthread_mutex_lock(&w->mtx);
+		while (w->doorbell == 0 && !w->closing)
+			pthread_cond_wait(&w->cond, &w->mtx);
+		if (w->doorbell == 0) {
+			pthread_mutex_unlock(&w->mtx);
+			break;
+		}
+		bell = w->doorbell;
+		w->doorbell = 0;
+		pthread_mutex_unlock(&w->mtx);
+
+		while (bell) {
+			vcpu = ffs(bell) - 1;
+			bell &= ~(1U << vcpu);
+			handle_vmexit(w->ctx, &ioreq_buf[vcpu], vcpu);
+
+			pthread_mutex_lock(&ioreq_done_mtx);
+			ioreq_inflight &= ~(1U << vcpu);
+			pthread_cond_broadcast(&ioreq_done_cond);
+			pthread_mutex_unlock(&ioreq_done_mtx);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+ioreq_workers_stop(void)
+{
+	struct ioreq_worker *w;
+	int i;
+
+	for (i = 0; i < ioreq_nthreads; i++) {
+		w = &ioreq_workers[i];
+		if (!w->ctx)
+			continue;
+		pthread_mutex_lock(&w->mtx);
+		w->closing = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mtx);
+		pthread_join(w->tid, NULL);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->mtx);
+		w->ctx = NULL;
+	}
+	ioreq_inflight = 0;
+}
+
+static int
+ioreq_workers_start(struct vmctx *ctx)
+{
+	struct ioreq_worker *w;
+	char tname[MAXCOMLEN + 1];
+	int i;
+
+	if (ioreq_nthreads > guest_ncpus)
+		ioreq_nthreads = guest_ncpus;
+
+	for (i = 0; i < ioreq_nthreads; i++) {
+		w = &ioreq_workers[i];
+		w->doorbell = 0;
+		w->closing = false;
+		pthread_mutex_init(&w->mtx, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->tid, NULL, ioreq_worker_thread, w) != 0) {
+			pr_err("%s: failed to create ioreq thread %d\n", __func__, i);
+			pthread_cond_destroy(&w->cond);
+			pthread_mutex_destroy(&w->mtx);
+			ioreq_workers_stop();
+			return -1;
+		}
+		w->ctx = ctx;
+		snprintf(tname, sizeof(tname), "ioreq-%d", i);
+		pthread_setname_np(w->tid, tname);
+	}
+
+	return 0;
+}
+
+/* The worker serving the device io_req is for */
+static struct ioreq_worker *
+ioreq_route(struct acrn_io_request *io_req)
+{
+	void *owner = NULL;
+	uint64_t addr;
+
+	switch (io_req->type) {
+	case ACRN_IOREQ_TYPE_PORTIO:
+		owner = inout_owner(io_req->reqs.pio_request.address);
+		break;
+	case ACRN_IOREQ_TYPE_MMIO:
+		addr = io_req->reqs.mmio_request.address;
+		owner = pci_ecfg_vdev(addr);
+		if (owner == NULL)
+			owner = mem_owner(addr);
+		break;
+	case ACRN_IOREQ_TYPE_PCICFG:
+		owner = pci_cfg_vdev(io_req->reqs.pci_request.bus,
+				io_req->reqs.pci_request.dev,
+				io_req->reqs.pci_request.func);
+		break;
+	}
+
+	return &ioreq_workers[(((uintptr_t)owner * 0x9e3779b97f4a7c15UL) >> 32) %
+			ioreq_nthreads];
+}
+
+/*
+ * Ring the doorbells for every pending slot that is not already being
+ * emulated.  While all pending slots are in flight, the HSM client wakes
+ * us straight away again.  Keep polling it, so that new requests are
+ * still dispatched at once, but yield the CPU and then back off a little
+ * so that the workers get to run.
+ */
+static void
+ioreq_dispatch(void)
+{
+	struct acrn_io_request *io_req;
+	struct ioreq_worker *w;
+	uint32_t inflight;
+	int vcpu_id, dispatched = 0;
+
+	pthread_mutex_lock(&ioreq_done_mtx);
+	inflight = ioreq_inflight;
+	pthread_mutex_unlock(&ioreq_done_mtx);
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		io_req = &ioreq_buf[vcpu_id];
+		if ((atomic_load(&io_req->processed) != ACRN_IOREQ_STATE_PROCESSING)
+			|| io_req->kernel_handled
+			|| (inflight & (1U << vcpu_id)))
+			continue;
+
+		pthread_mutex_lock(&ioreq_done_mtx);
+		ioreq_inflight |= 1U << vcpu_id;
+		pthread_mutex_unlock(&ioreq_done_mtx);
+
+		w = ioreq_route(io_req);
+		pthread_mutex_lock(&w->mtx);
+		w->doorbell |= 1U << vcpu_id;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mtx);
+		dispatched++;
+	}
+
+	if (dispatched || inflight == 0) {
+		ioreq_idle_polls = 0;
+		return;
+	}
+
+	if (++ioreq_idle_polls < IOREQ_SPIN_POLLS)
+		sched_yield();
+	else
+		usleep(IOREQ_POLL_US);
+}
+
+/* Wait until the workers have finished every request handed to them. */
+static void
+ioreq_drain(void)
+{
+	pthread_mutex_lock(&ioreq_done_mtx);
+	while (ioreq_inflight != 0)
+		pthread_cond_wait(&ioreq_done_cond, &ioreq_done_mtx);
+	pthread_mutex_unlock(&ioreq_done_mtx);
+}
+
 static void
 vm_loop(struct vmctx *ctx)
 {
+	struct timespec now;
 	int error;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
@@ -710,10 +926,18 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_nthreads > 0 && ioreq_workers_start(ctx) != 0)
+		return;
+
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
+		ioreq_workers_stop();
 		return;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pr_notice("time to first instruction: %ld ms\n",
+		(now.tv_sec - boot_start.tv_sec) * 1000 +
+		(now.tv_nsec - boot_start.tv_nsec) / 1000000);
 
 	while (1) {
 		int vcpu_id;
@@ -723,11 +947,18 @@ vm_loop(struct vmctx *ctx)
 		if (error)
 			break;
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			io_req = &ioreq_buf[vcpu_id];
-			if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
-				&& !io_req->kernel_handled)
-				handle_vmexit(ctx, io_req, vcpu_id);
+		if (ioreq_nthreads > 0) {
+			ioreq_dispatch();
+			/* reset and suspend rewrite the ioreq slots */
+			if (vm_get_suspend_mode() != VM_SUSPEND_NONE)
+				ioreq_drain();
+		} else {
+			for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+				io_req = &ioreq_buf[vcpu_id];
+				if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
+					&& !io_req->kernel_handled)
+					handle_vmexit(ctx, io_req, vcpu_id);
+			}
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -744,6 +975,8 @@ vm_loop(struct vmctx *ctx)
 			vm_suspend_resume(ctx);
 		}
 	}
+	ioreq_drain();
+	ioreq_workers_stop();
 	pr_err("VM loop exit\n");
 }
 
@@ -790,6 +1023,9 @@ enum {
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
 	CMD_OPT_FORCE_VIRTIO_MSI,
+	CMD_OPT_IOREQ_THREADS,
+	CMD_OPT_IOTHREADS,
+	CMD_OPT_PREFAULT,
 };
 
 static struct option long_options[] = {
@@ -833,6 +1069,9 @@ static struct option long_options[] = {
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
 	{"virtio_msi",		no_argument,		0, CMD_OPT_FORCE_VIRTIO_MSI},
+	{"ioreq_threads",	required_argument,	0, CMD_OPT_IOREQ_THREADS},
+	{"iothreads",		required_argument,	0, CMD_OPT_IOTHREADS},
+	{"prefault",		required_argument,	0, CMD_OPT_PREFAULT},
 	{0,			0,			0,  0  },
 };
 
@@ -1043,6 +1282,19 @@ main(int argc, char *argv[])
 		case CMD_OPT_FORCE_VIRTIO_MSI:
 			virtio_msix = 0;
 			break;
+		case CMD_OPT_IOREQ_THREADS:
+			if (dm_strtoi(optarg, NULL, 0, &ioreq_nthreads) ||
+			    ioreq_nthreads < 0 || ioreq_nthreads > VM_MAXCPU)
+				errx(EX_USAGE, "invalid ioreq threads %s", optarg);
+			break;
+		case CMD_OPT_IOTHREADS:
+			if (iothread_parse_options(optarg) != 0)
+				errx(EX_USAGE, "invalid iothreads params %s", optarg);
+			break;
+		case CMD_OPT_PREFAULT:
+			if (hugetlb_parse_prefault(optarg) != 0)
+				errx(EX_USAGE, "invalid prefault threads %s", optarg);
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -1094,6 +1346,7 @@ main(int argc, char *argv[])
 	}
 
 	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &boot_start);
 		pr_notice("vm_create: %s\n", vmname);
 		ctx = vm_create(vmname, (unsigned long)ioreq_buf, &guest_ncpus);
 		if (!ctx) {
@@ -29,17 +29,20 @@
 /*
  * Memory ranges are represented with an RB tree. On insertion, the range
  * is checked for overlaps. On lookup, the key has the same base and limit
- * so it can be searched within the range.
+ * so it can be searched within the range. The emulation path searches a
+ * sorted copy of the trees instead, see struct mmio_snapshot.
  */
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
 
 #include "mem.h"
 #include "tree.h"
+#include "atomic.h"
 
 #define MEMNAMESZ (80)
 
@@ -54,13 +57,46 @@ static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
 RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
- * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
+ * The RB trees are only touched by register/unregister, under mmio_mtx.
+ * emulate_mem() instead searches an immutable, sorted snapshot of both
+ * trees that is republished on every change.  Readers announce the
+ * epoch they entered in.  A writer never waits for them: it queues the
+ * replaced snapshot, with the range it removed if any, and frees what
+ * was queued before once no reader is left in an older epoch.
  */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+struct mmio_snapshot {
+	struct mmio_snapshot	*next;		/* on mmio_retired */
+	uint64_t		retired;	/* epoch it was replaced in */
+	struct mmio_rb_range	*removed;	/* freed along with it */
+	int			nr_root;
+	int			nr_fallback;
+	struct mmio_rb_range	*ranges[];	/* root ranges, then fallback */
+};
+
+#define MMIO_READERS_MAX	64
 
-static pthread_rwlock_t mmio_rwlock;
+struct mmio_reader {
+	uint64_t	epoch;		/* 0 when not in emulate_mem() */
+	int		nesting;
+	int		used;
+} __aligned(64);
+
+static struct mmio_snapshot *mmio_snap;
+static struct mmio_snapshot *mmio_retired;	/* under mmio_mtx */
+static uint64_t mmio_epoch = 1;
+static struct mmio_reader mmio_readers[MMIO_READERS_MAX];
+static pthread_key_t mmio_reader_key;
+static pthread_mutex_t mmio_mtx;
+
+/*
+ * Per-thread cache. Since most accesses from a vCPU will be to
+ * consecutive addresses in a range, it makes sense to cache the
+ * result of a lookup.  Keeping it per thread means vCPUs hitting
+ * different BARs do not evict each other.  It is an index into the
+ * current snapshot and is range checked before use.
+ */
+static __thread int mmio_hint;
+static __thread struct mmio_reader *mmio_self;
 
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
@@ -116,17 +152,172 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 {
 	struct mmio_rb_range *np;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	RB_FOREACH(np, mmio_rb_tree, rbt) {
 		pr_dbg(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
 		       np->mr_param.name);
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 }
 #endif
 
 RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+static void
+mmio_reader_release(void *arg)
+{
+	struct mmio_reader *r = arg;
+
+	atomic_store(&r->used, 0);
+}
+
+static struct mmio_reader *
+mmio_reader_get(void)
+{
+	int i, unused;
+
+	if (mmio_self)
+		return mmio_self;
+
+	for (i = 0; i < MMIO_READERS_MAX; i++) {
+		unused = 0;
+		if (atomic_cmpxchg(&mmio_readers[i].used, &unused, 1)) {
+			mmio_self = &mmio_readers[i];
+			pthread_setspecific(mmio_reader_key, mmio_self);
+			break;
+		}
+	}
+	return mmio_self;
+}
+
+static void
+mmio_read_lock(struct mmio_reader *r)
+{
+	if (r->nesting++ == 0) {
+		atomic_store(&r->epoch, atomic_load(&mmio_epoch));
+		atomic_thread_fence();
+	}
+}
+
+static void
+mmio_read_unlock(struct mmio_reader *r)
+{
+	if (--r->nesting == 0)
+		atomic_store(&r->epoch, 0);
+}
+
+/*
+ * Queue old, replaced by the snapshot just published, and free every
+ * queued snapshot that no reader can still be searching.  A reader that
+ * entered in an epoch before old was retired may still hold it or the
+ * range removed with it; later readers only see the new snapshot.
+ * Called with mmio_mtx held.
+ */
+static void
+mmio_retire(struct mmio_snapshot *old, struct mmio_rb_range *removed)
+{
+	struct mmio_snapshot **pp, *snap;
+	uint64_t oldest = UINT64_MAX, e;
+	int i;
+
+	if (old) {
+		old->removed = removed;
+		old->retired = atomic_add_fetch(&mmio_epoch, 1);
+		old->next = mmio_retired;
+		mmio_retired = old;
+	}
+
+	for (i = 0; i < MMIO_READERS_MAX; i++) {
+		e = atomic_load(&mmio_readers[i].epoch);
+		if (e != 0 && e < oldest)
+			oldest = e;
+	}
+
+	pp = &mmio_retired;
+	while ((snap = *pp) != NULL) {
+		if (snap->retired <= oldest) {
+			*pp = snap->next;
+			free(snap->removed);
+			free(snap);
+		} else
+			pp = &snap->next;
+	}
+}
+
+/* Rebuild and publish the snapshot.  Called with mmio_mtx held. */
+static int
+mmio_publish(struct mmio_snapshot **old)
+{
+	struct mmio_snapshot *snap;
+	struct mmio_rb_range *np;
+	int n = 0;
+
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_root)
+		n++;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_fallback)
+		n++;
+
+	snap = malloc(sizeof(*snap) + n * sizeof(snap->ranges[0]));
+	if (!snap)
+		return -1;
+	snap->next = NULL;
+	snap->retired = 0;
+	snap->removed = NULL;
+
+	n = 0;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_root)
+		snap->ranges[n++] = np;
+	snap->nr_root = n;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_fallback)
+		snap->ranges[n++] = np;
+	snap->nr_fallback = n - snap->nr_root;
+
+	*old = atomic_xchg(&mmio_snap, snap);
+	return 0;
+}
+
+static struct mmio_rb_range *
+mmio_snap_lookup(struct mmio_rb_range **ranges, int nr, uint64_t addr,
+		int *idx)
+{
+	int lo = 0, hi = nr - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (addr < ranges[mid]->mr_base)
+			hi = mid - 1;
+		else if (addr > ranges[mid]->mr_end)
+			lo = mid + 1;
+		else {
+			*idx = mid;
+			return ranges[mid];
+		}
+	}
+	return NULL;
+}
+
+/* Look paddr up in snap, the per-thread hint first, then the fallbacks */
+static struct mmio_rb_range *
+mmio_find(struct mmio_snapshot *snap, uint64_t paddr)
+{
+	struct mmio_rb_range *entry;
+	int idx;
+
+	idx = mmio_hint;
+	if (idx < snap->nr_root && paddr >= snap->ranges[idx]->mr_base &&
+	    paddr <= snap->ranges[idx]->mr_end)
+		return snap->ranges[idx];
+
+	entry = mmio_snap_lookup(snap->ranges, snap->nr_root, paddr, &idx);
+	if (entry != NULL) {
+		mmio_hint = idx;
+		return entry;
+	}
+
+	return mmio_snap_lookup(snap->ranges + snap->nr_root,
+			snap->nr_fallback, paddr, &idx);
+}
+
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
 {
@@ -154,45 +345,73 @@ emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req)
 {
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
+	struct mmio_rb_range *entry = NULL;
+	struct mmio_snapshot *snap;
+	struct mmio_reader *r;
 	int err;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
-
-	/*
-	 * First check the per-VM cache
-	 */
-	hint = mmio_hint;
-
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
-		return -ESRCH;
-	}
-
-	pthread_rwlock_unlock(&mmio_rwlock);
+	/* out of reader slots: serialize against the writers instead */
+	r = mmio_reader_get();
+	if (r)
+		mmio_read_lock(r);
+	else
+		pthread_mutex_lock(&mmio_mtx);
 
+	snap = atomic_load(&mmio_snap);
+	entry = mmio_find(snap, paddr);
 	if (entry == NULL)
-		return -EINVAL;
-
-	if (mmio_req->direction == ACRN_IOREQ_DIR_READ)
+		err = -ESRCH;
+	else if (mmio_req->direction == ACRN_IOREQ_DIR_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
 				size, &entry->mr_param);
 	else
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
 				size, &entry->mr_param);
 
+	if (r)
+		mmio_read_unlock(r);
+	else
+		pthread_mutex_unlock(&mmio_mtx);
+
 	return err;
 }
 
+/*
+ * The device behind the range at paddr, as the handler's arg1, or the
+ * handler itself for ranges registered without one.  Only good for
+ * telling devices apart: it is never dereferenced.
+ */
+void *
+mem_owner(uint64_t paddr)
+{
+	struct mmio_rb_range *entry;
+	struct mmio_reader *r;
+	void *owner = NULL;
+
+	r = mmio_reader_get();
+	if (r)
+		mmio_read_lock(r);
+	else
+		pthread_mutex_lock(&mmio_mtx);
+
+	entry = mmio_find(atomic_load(&mmio_snap), paddr);
+	if (entry != NULL)
+		owner = entry->mr_param.arg1 ? entry->mr_param.arg1 :
+			(void *)entry->mr_param.handler;
+
+	if (r)
+		mmio_read_unlock(r);
+	else
+		pthread_mutex_unlock(&mmio_mtx);
+
+	return owner;
+}
+
 static int
 register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
 	struct mmio_rb_range *entry, *mrp;
+	struct mmio_snapshot *old;
 	int err;
 
 	err = -1;
@@ -203,11 +422,17 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_param = *memp;
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
+		pthread_mutex_lock(&mmio_mtx);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
-		if (err)
+		if (err == 0 && mmio_publish(&old) != 0) {
+			RB_REMOVE(mmio_rb_tree, rbt, mrp);
+			err = -1;
+		}
+		if (err == 0)
+			mmio_retire(old, NULL);
+		pthread_mutex_unlock(&mmio_mtx);
+		if (err != 0)
 			free(mrp);
 	}
 
@@ -231,9 +456,10 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
 	struct mem_range *mr;
 	struct mmio_rb_range *entry = NULL;
+	struct mmio_snapshot *old;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	err = mmio_rb_lookup(rbt, memp->base, &entry);
 	if (err == 0) {
 		mr = &entry->mr_param;
@@ -243,15 +469,16 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 			err = -1;
 		} else {
 			RB_REMOVE(mmio_rb_tree, rbt, entry);
-
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
-
-			free(entry);
+			if (mmio_publish(&old) != 0) {
+				mmio_rb_add(rbt, entry);
+				err = -1;
+			} else {
+				/* no reader can reach entry once they are all past old */
+				mmio_retire(old, entry);
+			}
 		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
@@ -271,7 +498,19 @@ unregister_mem_fallback(struct mem_range *memp)
 void
 init_mem(void)
 {
+	pthread_mutexattr_t attr;
+	struct mmio_snapshot *old;
+
 	RB_INIT(&mmio_rb_root);
 	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+
+	/* handlers may (un)register ranges from within emulate_mem() */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mmio_mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_key_create(&mmio_reader_key, mmio_reader_release);
+	if (mmio_publish(&old) == 0)
+		free(old);
 }
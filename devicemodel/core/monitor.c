@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
 #include <unistd.h>
@@ -20,6 +21,8 @@
 #include "dm.h"
 #include "dm_string.h"
 #include "monitor.h"
+#include "mevent.h"
+#include "pci_core.h"
 #include "acrn_mngr.h"
 #include "pm.h"
 #include "vmmapi.h"
@@ -32,6 +35,14 @@
 #define DELAY_DURATION	100000 /* 100ms of total duration for delay intr */
 #define TIME_TO_CHECK_AGAIN	2 /* 2seconds */
 
+#define INTR_STORM_WINDOW_US	1000 /* window the hypervisor counts in */
+/*
+ * Key of the ioeventfd the hypervisor signals on a storm. Nothing decodes
+ * the last dword of the ECAM window, so a guest write there costs at most
+ * one spurious check.
+ */
+#define INTR_STORM_NOTIFY_GPA	(PCI_EMUL_ECFG_BASE + 0xffffffcUL)
+
 struct intr_monitor_setting_t {
 	bool enable;
 	uint32_t threshold;    /* intr count in probe_period when intr storm happens */
@@ -48,6 +59,9 @@ union intr_monitor_t {
 static union intr_monitor_t intr_data;
 static uint64_t intr_cnt_buf[MAX_PTDEV_NUM * 2];
 static pthread_t intr_storm_monitor_pid;
+static struct mevent *intr_storm_mevp;
+static int intr_storm_fd = -1;
+static struct vmctx *intr_storm_ctx;
 
 static struct intr_monitor_setting_t intr_monitor_setting = {
 	.enable = false,
@@ -168,9 +182,112 @@ static void *intr_storm_monitor_thread(void *arg)
 	return NULL;
 }
 
+/*
+ * The hypervisor throttles a storming interrupt by itself; the event only
+ * tells which ones are held back, so they can be reported.
+ */
+static void intr_storm_event(int fd, enum ev_type t, void *arg)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	struct acrn_intr_monitor *hdr = &intr_data.monitor;
+	eventfd_t cnt;
+	int i;
+
+	if (eventfd_read(fd, &cnt) < 0)
+		return;
+
+	hdr->cmd = INTR_CMD_GET_STORM;
+	hdr->buf_cnt = MAX_PTDEV_NUM * 2;
+	if (vm_intr_monitor(ctx, hdr))
+		return;
+
+	for (i = 0; i < hdr->buf_cnt; i += 2)
+		pr_notice("irq=%ld storm, injection delayed %ldus\n",
+			hdr->buffer[i], hdr->buffer[i + 1]);
+}
+
+static int intr_storm_notify_assign(struct vmctx *ctx, int fd, bool assign)
+{
+	struct acrn_ioeventfd ioeventfd = {0};
+
+	ioeventfd.fd = fd;
+	ioeventfd.addr = INTR_STORM_NOTIFY_GPA;
+	ioeventfd.len = 4;
+	ioeventfd.flags = assign ? ACRN_IOEVENTFD_FLAG_ASYNCIO :
+		ACRN_IOEVENTFD_FLAG_DEASSIGN;
+	return vm_ioeventfd(ctx, &ioeventfd);
+}
+
+/*
+ * Arm storm detection in the hypervisor, which signals an eventfd when an
+ * interrupt crosses the threshold. Nothing runs here until that happens.
+ */
+static int start_intr_storm_event(struct vmctx *ctx)
+{
+	struct acrn_intr_monitor *hdr = &intr_data.monitor;
+	uint64_t per_window;
+	int fd;
+
+	per_window = (uint64_t)intr_monitor_setting.threshold /
+		intr_monitor_setting.probe_period * INTR_STORM_WINDOW_US / 1000000;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (intr_storm_notify_assign(ctx, fd, true))
+		goto close_fd;
+
+	hdr->cmd = INTR_CMD_SET_STORM;
+	hdr->buf_cnt = 4;
+	hdr->buffer[0] = per_window ? per_window : 1;
+	hdr->buffer[1] = INTR_STORM_WINDOW_US;
+	hdr->buffer[2] = intr_monitor_setting.delay_time * 1000;
+	hdr->buffer[3] = INTR_STORM_NOTIFY_GPA;
+	if (vm_intr_monitor(ctx, hdr))
+		goto deassign;
+
+	intr_storm_mevp = mevent_add(fd, EVF_READ, intr_storm_event, ctx,
+				     NULL, NULL);
+	if (!intr_storm_mevp)
+		goto disarm;
+
+	intr_storm_ctx = ctx;
+	intr_storm_fd = fd;
+	return 0;
+
+disarm:
+	hdr->buffer[0] = 0;
+	vm_intr_monitor(ctx, hdr);
+deassign:
+	intr_storm_notify_assign(ctx, fd, false);
+close_fd:
+	close(fd);
+	return -1;
+}
+
+static void stop_intr_storm_event(void)
+{
+	struct acrn_intr_monitor *hdr = &intr_data.monitor;
+
+	hdr->cmd = INTR_CMD_SET_STORM;
+	hdr->buf_cnt = 4;
+	hdr->buffer[0] = 0;
+	vm_intr_monitor(intr_storm_ctx, hdr);
+	intr_storm_notify_assign(intr_storm_ctx, intr_storm_fd, false);
+	mevent_delete_close(intr_storm_mevp);
+	intr_storm_mevp = NULL;
+	intr_storm_fd = -1;
+}
+
 static void start_intr_storm_monitor(struct vmctx *ctx)
 {
 	if (intr_monitor_setting.enable) {
+		if (start_intr_storm_event(ctx) == 0) {
+			pr_info("interrupt storm detection armed in the hypervisor\n");
+			return;
+		}
+
+		/* the hypervisor can't raise storm events, poll for them */
 		int ret = pthread_create(&intr_storm_monitor_pid, NULL, intr_storm_monitor_thread, ctx);
 		if (ret) {
 			pr_err("failed %s %d\n", __func__, __LINE__);
@@ -184,6 +301,9 @@ static void start_intr_storm_monitor(struct vmctx *ctx)
 
 static void stop_intr_storm_monitor(void)
 {
+	if (intr_storm_mevp)
+		stop_intr_storm_event();
+
 	if (intr_storm_monitor_pid) {
 		void *ret;
 
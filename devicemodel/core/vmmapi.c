@@ -368,6 +368,31 @@ vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	return error;
 }
 
+/*
+ * Guest RAM is a single mapping at baseaddr, split into the lowmem and
+ * highmem segments.  The bios and framebuffer ranges are left out on
+ * purpose, see vm_map_gpa().
+ */
+static void
+vm_setup_ram_regions(struct vmctx *ctx)
+{
+	struct vm_ram_region *r;
+
+	ctx->nr_ram_regions = 0;
+	if (ctx->lowmem > 0) {
+		r = &ctx->ram_regions[ctx->nr_ram_regions++];
+		r->gpa_start = 0;
+		r->gpa_end = ctx->lowmem;
+		r->hva = ctx->baseaddr;
+	}
+	if (ctx->highmem > 0) {
+		r = &ctx->ram_regions[ctx->nr_ram_regions++];
+		r->gpa_start = ctx->highmem_gpa_base;
+		r->gpa_end = ctx->highmem_gpa_base + ctx->highmem;
+		r->hva = ctx->baseaddr + ctx->highmem_gpa_base;
+	}
+}
+
 int
 vm_setup_memory(struct vmctx *ctx, size_t memsize)
 {
@@ -386,7 +411,11 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 	ctx->biosmem = high_bios_size();
 	ctx->fbmem = (16 * 1024 * 1024);
 
-	return hugetlb_setup_memory(ctx);
+	if (hugetlb_setup_memory(ctx))
+		return -1;
+
+	vm_setup_ram_regions(ctx);
+	return 0;
 }
 
 void
@@ -410,6 +439,7 @@ vm_unsetup_memory(struct vmctx *ctx)
 		bzero((void *)(ctx->baseaddr + ctx->highmem_gpa_base), ctx->highmem);
 	}
 
+	ctx->nr_ram_regions = 0;
 	hugetlb_unsetup_memory(ctx);
 }
 
@@ -423,19 +453,52 @@ vm_unsetup_memory(struct vmctx *ctx)
 void *
 vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
 {
+	return vm_map_gpa_hint(ctx, gaddr, len, NULL);
+}
 
-	if (ctx->lowmem > 0) {
-		if (gaddr < ctx->lowmem && len <= ctx->lowmem &&
-		    gaddr + len <= ctx->lowmem)
-			return (ctx->baseaddr + gaddr);
-	}
+static inline bool
+vm_ram_region_contains(struct vm_ram_region *r, vm_paddr_t gaddr, size_t len)
+{
+	return gaddr >= r->gpa_start && gaddr < r->gpa_end &&
+		len <= r->gpa_end - gaddr;
+}
 
-	if (ctx->highmem > 0) {
-		if (gaddr >= ctx->highmem_gpa_base) {
-			if (gaddr < ctx->highmem_gpa_base + ctx->highmem &&
-			    len <= ctx->highmem &&
-			    gaddr + len <= ctx->highmem_gpa_base + ctx->highmem)
-				return (ctx->baseaddr + gaddr);
+/*
+ * Same as vm_map_gpa(), but try the region in *hint first and store the
+ * region that matched back into it.  Callers walking a descriptor chain
+ * nearly always stay in one region, so a per-queue hint skips the
+ * search.  A buffer straddling two regions is rejected like any other
+ * invalid range.
+ */
+void *
+vm_map_gpa_hint(struct vmctx *ctx, vm_paddr_t gaddr, size_t len, int *hint)
+{
+	struct vm_ram_region *r;
+	int lo, hi, mid;
+
+	if (hint && *hint >= 0 && *hint < ctx->nr_ram_regions) {
+		r = &ctx->ram_regions[*hint];
+		if (vm_ram_region_contains(r, gaddr, len))
+			return r->hva + (gaddr - r->gpa_start);
+	}
+
+	/* find the last region starting at or below gaddr */
+	lo = 0;
+	hi = ctx->nr_ram_regions - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (ctx->ram_regions[mid].gpa_start <= gaddr)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (hi >= 0) {
+		r = &ctx->ram_regions[lo];
+		if (vm_ram_region_contains(r, gaddr, len)) {
+			if (hint)
+				*hint = lo;
+			return r->hva + (gaddr - r->gpa_start);
 		}
 	}
 
@@ -443,6 +506,31 @@ vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
 	return NULL;
 }
 
+/*
+ * Translate n guest buffers in place: on entry iov_base holds the gpa,
+ * on success it holds the host address.  Returns -1 as soon as one
+ * buffer is not backed by guest RAM, leaving the array partially
+ * translated.
+ */
+int
+vm_map_gpa_iov(struct vmctx *ctx, struct iovec *iov, int n, int *hint)
+{
+	int i, h;
+	void *hva;
+
+	h = hint ? *hint : 0;
+	for (i = 0; i < n; i++) {
+		hva = vm_map_gpa_hint(ctx, (vm_paddr_t)(uintptr_t)iov[i].iov_base,
+				iov[i].iov_len, &h);
+		if (!hva)
+			return -1;
+		iov[i].iov_base = hva;
+	}
+	if (hint)
+		*hint = h;
+	return 0;
+}
+
 size_t
 vm_get_lowmem_size(struct vmctx *ctx)
 {
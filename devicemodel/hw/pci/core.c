@@ -1482,6 +1482,34 @@ pci_emul_ecfg_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 	return 0;
 }
 
+/*
+ * The device a configuration access to bus:slot.func, or to the ECAM
+ * address addr, is for; NULL if there is none.
+ */
+struct pci_vdev *
+pci_cfg_vdev(int bus, int slot, int func)
+{
+	struct businfo *bi;
+
+	if (bus < 0 || bus >= MAXBUSES || slot < 0 || slot >= MAXSLOTS ||
+	    func < 0 || func >= MAXFUNCS)
+		return NULL;
+
+	bi = pci_businfo[bus];
+	return bi ? bi->slotinfo[slot].si_funcs[func].fi_devi : NULL;
+}
+
+struct pci_vdev *
+pci_ecfg_vdev(uint64_t addr)
+{
+	if (addr < PCI_EMUL_ECFG_BASE ||
+	    addr >= PCI_EMUL_ECFG_BASE + PCI_EMUL_ECFG_SIZE)
+		return NULL;
+
+	return pci_cfg_vdev((addr >> 20) & 0xff, (addr >> 15) & 0x1f,
+			(addr >> 12) & 0x7);
+}
+
 #define	BUSIO_ROUNDUP		32
 #define	BUSMEM_ROUNDUP		(1024 * 1024)
 
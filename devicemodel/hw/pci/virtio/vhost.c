@@ -10,6 +10,7 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -68,13 +69,6 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 	}
 }
 
-static int
-vhost_kernel_set_mem_table(struct vhost_dev *vdev,
-			   struct vhost_memory *mem)
-{
-	return vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
-}
-
 static int
 vhost_kernel_set_vring_addr(struct vhost_dev *vdev,
 			    struct vhost_vring_addr *addr)
@@ -154,6 +148,81 @@ vhost_kernel_reset_device(struct vhost_dev *vdev)
 	return vhost_kernel_ioctl(vdev, VHOST_RESET_OWNER, NULL);
 }
 
+static int
+vhost_kernel_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vmctx *ctx;
+	struct vhost_memory *mem;
+	uint32_t nregions = 0;
+	int rc;
+
+	ctx = vdev->base->dev->vmctx;
+	if (ctx->lowmem > 0)
+		nregions++;
+	if (ctx->highmem > 0)
+		nregions++;
+
+	mem = calloc(1, sizeof(struct vhost_memory) +
+		sizeof(struct vhost_memory_region) * nregions);
+	if (!mem) {
+		WPRINTF("out of memory\n");
+		return -1;
+	}
+
+	nregions = 0;
+	if (ctx->lowmem > 0) {
+		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
+		mem->regions[nregions].memory_size = ctx->lowmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)ctx->baseaddr;
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	if (ctx->highmem > 0) {
+		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
+		mem->regions[nregions].memory_size = ctx->highmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	mem->nregions = nregions;
+	mem->padding = 0;
+	rc = vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	free(mem);
+	if (rc < 0) {
+		WPRINTF("set_mem_table failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct vhost_ops vhost_kernel_ops = {
+	.set_mem_table = vhost_kernel_set_mem_table,
+	.set_vring_addr = vhost_kernel_set_vring_addr,
+	.set_vring_num = vhost_kernel_set_vring_num,
+	.set_vring_base = vhost_kernel_set_vring_base,
+	.get_vring_base = vhost_kernel_get_vring_base,
+	.set_vring_kick = vhost_kernel_set_vring_kick,
+	.set_vring_call = vhost_kernel_set_vring_call,
+	.set_vring_busyloop_timeout = vhost_kernel_set_vring_busyloop_timeout,
+	.set_features = vhost_kernel_set_features,
+	.get_features = vhost_kernel_get_features,
+	.set_owner = vhost_kernel_set_owner,
+	.reset_device = vhost_kernel_reset_device,
+};
+
 static int
 vhost_eventfd_test_and_clear(int fd)
 {
@@ -324,7 +393,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_NUM */
 	ring.index = idx;
 	ring.num = vqi->qsize;
-	rc = vhost_kernel_set_vring_num(vdev, &ring);
+	rc = vdev->ops->set_vring_num(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_num failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -332,7 +401,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 
 	/* VHOST_SET_VRING_BASE */
 	ring.num = vqi->last_avail;
-	rc = vhost_kernel_set_vring_base(vdev, &ring);
+	rc = vdev->ops->set_vring_base(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_base failed: idx = %d, last_avail = %d\n",
 			idx, vqi->last_avail);
@@ -346,7 +415,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	addr.used_user_addr = (uintptr_t)vqi->used;
 	addr.log_guest_addr = (uintptr_t)NULL;
 	addr.flags = 0;
-	rc = vhost_kernel_set_vring_addr(vdev, &addr);
+	rc = vdev->ops->set_vring_addr(vdev, &addr);
 	if (rc < 0) {
 		WPRINTF("set_vring_addr failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -355,7 +424,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_CALL */
 	file.index = idx;
 	file.fd = vq->call_fd;
-	rc = vhost_kernel_set_vring_call(vdev, &file);
+	rc = vdev->ops->set_vring_call(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_call failed\n");
 		goto fail_vring;
@@ -364,18 +433,26 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_KICK */
 	file.index = idx;
 	file.fd = vq->kick_fd;
-	rc = vhost_kernel_set_vring_kick(vdev, &file);
+	rc = vdev->ops->set_vring_kick(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_kick failed: idx = %d", idx);
 		goto fail_vring_kick;
 	}
 
+	if (vdev->ops->set_vring_enable) {
+		rc = vdev->ops->set_vring_enable(vdev, idx, 1);
+		if (rc < 0) {
+			WPRINTF("set_vring_enable failed: idx = %d", idx);
+			goto fail_vring_kick;
+		}
+	}
+
 	return 0;
 
 fail_vring_kick:
 	file.index = idx;
 	file.fd = -1;
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 fail_vring:
 	vhost_vq_register_eventfd(vdev, idx, false);
 fail:
@@ -409,14 +486,14 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	file.fd = -1;
 
 	/* VHOST_SET_VRING_KICK */
-	vhost_kernel_set_vring_kick(vdev, &file);
+	vdev->ops->set_vring_kick(vdev, &file);
 
 	/* VHOST_SET_VRING_CALL */
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 
 	/* VHOST_GET_VRING_BASE */
 	ring.index = idx;
-	rc = vhost_kernel_get_vring_base(vdev, &ring);
+	rc = vdev->ops->get_vring_base(vdev, &ring);
 	if (rc < 0)
 		WPRINTF("get_vring_base failed: idx = %d", idx);
 	else
@@ -433,66 +510,6 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	return rc;
 }
 
-static int
-vhost_set_mem_table(struct vhost_dev *vdev)
-{
-	struct vmctx *ctx;
-	struct vhost_memory *mem;
-	uint32_t nregions = 0;
-	int rc;
-
-	ctx = vdev->base->dev->vmctx;
-	if (ctx->lowmem > 0)
-		nregions++;
-	if (ctx->highmem > 0)
-		nregions++;
-
-	mem = calloc(1, sizeof(struct vhost_memory) +
-		sizeof(struct vhost_memory_region) * nregions);
-	if (!mem) {
-		WPRINTF("out of memory\n");
-		return -1;
-	}
-
-	nregions = 0;
-	if (ctx->lowmem > 0) {
-		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
-		mem->regions[nregions].memory_size = ctx->lowmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)ctx->baseaddr;
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	if (ctx->highmem > 0) {
-		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
-		mem->regions[nregions].memory_size = ctx->highmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	mem->nregions = nregions;
-	mem->padding = 0;
-	rc = vhost_kernel_set_mem_table(vdev, mem);
-	free(mem);
-	if (rc < 0) {
-		WPRINTF("set_mem_table failed\n");
-		return -1;
-	}
-
-	return 0;
-}
-
 /**
  * @brief vhost_dev initialization.
  *
@@ -519,6 +536,7 @@ vhost_dev_init(struct vhost_dev *vdev,
 	       uint32_t busyloop_timeout)
 {
 	uint64_t features;
+	struct stat st;
 	int i, rc;
 
 	/* sanity check */
@@ -539,7 +557,13 @@ vhost_dev_init(struct vhost_dev *vdev,
 
 	vhost_kernel_init(vdev, base, fd, vq_idx, busyloop_timeout);
 
-	rc = vhost_kernel_get_features(vdev, &features);
+	/* a socket is a vhost-user backend, anything else the vhost chardev */
+	if (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode))
+		vdev->ops = &vhost_user_ops;
+	else
+		vdev->ops = &vhost_kernel_ops;
+
+	rc = vdev->ops->get_features(vdev, &features);
 	if (rc < 0) {
 		WPRINTF("vhost_get_features failed\n");
 		goto fail;
@@ -557,6 +581,12 @@ vhost_dev_init(struct vhost_dev *vdev,
 	/* features supported by vhost */
 	vdev->vhost_features = vhost_features & features;
 
+	if (vdev->ops->init) {
+		rc = vdev->ops->init(vdev, features);
+		if (rc < 0)
+			goto fail;
+	}
+
 	/*
 	 * If the features bits are not supported by either vhost kernel
 	 * mediator or configuration of device model(specified by
@@ -634,7 +664,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	rc = vhost_kernel_set_owner(vdev);
+	rc = vdev->ops->set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
@@ -643,7 +673,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
-	rc = vhost_kernel_set_features(vdev, features);
+	rc = vdev->ops->set_features(vdev, features);
 	if (rc < 0) {
 		WPRINTF("set_features failed\n");
 		goto fail;
@@ -651,18 +681,18 @@ vhost_dev_start(struct vhost_dev *vdev)
 	DPRINTF("set_features: 0x%lx\n", features);
 
 	/* set memory table */
-	rc = vhost_set_mem_table(vdev);
+	rc = vdev->ops->set_mem_table(vdev);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
 		goto fail;
 	}
 
 	/* config busyloop timeout */
-	if (vdev->busyloop_timeout) {
+	if (vdev->busyloop_timeout && vdev->ops->set_vring_busyloop_timeout) {
 		state.num = vdev->busyloop_timeout;
 		for (i = 0; i < vdev->nvqs; i++) {
 			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
+			rc = vdev->ops->set_vring_busyloop_timeout(vdev,
 				&state);
 			if (rc < 0) {
 				WPRINTF("set_busyloop_timeout failed\n");
@@ -709,7 +739,7 @@ vhost_dev_stop(struct vhost_dev *vdev)
 	 * 1) resources of the vhost dev are freed
 	 * 2) vhost virtqueues are reset
 	 */
-	rc = vhost_kernel_reset_device(vdev);
+	rc = vdev->ops->reset_device(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_reset_device failed\n");
 		rc = -1;
@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * vhost-user frontend: the vhost requests of vhost.c sent over a unix
+ * socket to a backend in another process, which then serves the
+ * virtqueues straight from the guest memory memfds.
+ *
+ */
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "log.h"
+#include "vmmapi.h"
+#include "vhost.h"
+#include "vhost_user.h"
+
+static int vhost_user_debug;
+#define LOG_TAG "vhost-user: "
+#define DPRINTF(fmt, args...) \
+	do { if (vhost_user_debug) pr_dbg(LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) pr_err(LOG_TAG fmt, ##args)
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * VHOST_USER_MAX_REGIONS)];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	msg->flags = VHOST_USER_VERSION;
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	do {
+		rc = sendmsg(vdev->fd, &mh, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != iov.iov_len) {
+		WPRINTF("send request %u failed, rc = %ld, errno = %d\n",
+			msg->request, rc, errno);
+		return -1;
+	}
+	DPRINTF("sent request %u, size %u, %d fds\n",
+		msg->request, msg->size, nfds);
+	return 0;
+}
+
+static int
+vhost_user_read(int fd, void *buf, size_t len)
+{
+	ssize_t rc;
+	size_t done;
+
+	for (done = 0; done < len; done += rc) {
+		rc = read(fd, (uint8_t *)buf + done, len - done);
+		if (rc < 0 && errno == EINTR) {
+			rc = 0;
+			continue;
+		}
+		if (rc <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Read the reply to request into msg. */
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	if (vhost_user_read(vdev->fd, msg, VHOST_USER_HDR_SIZE) != 0) {
+		WPRINTF("read reply header to %u failed\n", request);
+		return -1;
+	}
+
+	if (msg->request != request ||
+	    (msg->flags & VHOST_USER_VERSION_MASK) != VHOST_USER_VERSION ||
+	    !(msg->flags & VHOST_USER_REPLY_MASK) ||
+	    msg->size > sizeof(msg->payload)) {
+		WPRINTF("bad reply: request %u/%u, flags 0x%x, size %u\n",
+			msg->request, request, msg->flags, msg->size);
+		return -1;
+	}
+
+	if (vhost_user_read(vdev->fd, &msg->payload, msg->size) != 0) {
+		WPRINTF("read reply payload to %u failed\n", request);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = val;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = 0;
+	if (vhost_user_send(vdev, &msg, NULL, 0) != 0 ||
+	    vhost_user_recv(vdev, &msg, request) != 0 ||
+	    msg.size != sizeof(msg.payload.u64))
+		return -1;
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_state(struct vhost_dev *vdev, uint32_t request,
+		     struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state = *ring;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_fd(struct vhost_dev *vdev, uint32_t request,
+			struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg;
+
+	/*
+	 * A kick without fd would switch the backend to polling the ring,
+	 * not stop it. Stopping is done by GET_VRING_BASE, so there's
+	 * nothing to send here.
+	 */
+	if (file->fd < 0)
+		return 0;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+	return vhost_user_send(vdev, &msg, &file->fd, 1);
+}
+
+/*
+ * Negotiate the protocol features. Only CONFIG is asked for, which lets
+ * a device such as vhost-user-blk report its own config space.
+ */
+static int
+vhost_user_init(struct vhost_dev *vdev, uint64_t features)
+{
+	uint64_t protocol_features;
+
+	vdev->protocol_features = 0;
+	if (!(features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+			&protocol_features) != 0)
+		return -1;
+
+	protocol_features &= (1UL << VHOST_USER_PROTOCOL_F_CONFIG);
+	if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+			protocol_features) != 0)
+		return -1;
+
+	vdev->protocol_features = protocol_features;
+	vdev->vhost_ext_features |= 1UL << VHOST_USER_F_PROTOCOL_FEATURES;
+	return 0;
+}
+
+/*
+ * Hand the guest RAM to the backend as (memfd, offset) pairs. A range
+ * may span several memfds when it is backed by more than one hugepage
+ * size.
+ */
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+	struct vhost_user_region *reg;
+	struct vm_mem_region mr;
+	struct vmctx *ctx;
+	uint64_t ranges[2][2], gpa, end;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, n;
+
+	ctx = vdev->base->dev->vmctx;
+	ranges[0][0] = 0;
+	ranges[0][1] = ctx->lowmem;
+	ranges[1][0] = ctx->highmem_gpa_base;
+	ranges[1][1] = ctx->highmem_gpa_base + ctx->highmem;
+
+	memset(&msg, 0, sizeof(msg));
+	n = 0;
+	for (i = 0; i < 2; i++) {
+		for (gpa = ranges[i][0], end = ranges[i][1]; gpa < end;
+				gpa += reg->memory_size) {
+			if (n == VHOST_USER_MAX_REGIONS ||
+			    !vm_find_memfd_region(ctx, gpa, &mr)) {
+				WPRINTF("guest memory at 0x%lx can't be shared\n", gpa);
+				return -1;
+			}
+			reg = &msg.payload.memory.regions[n];
+			reg->guest_phys_addr = gpa;
+			reg->memory_size = MIN(mr.len, end - gpa);
+			reg->userspace_addr = (uintptr_t)(ctx->baseaddr + gpa);
+			reg->mmap_offset = mr.fd_offset;
+			fds[n++] = mr.fd;
+			DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx] fd %d@0x%lx\n", n - 1,
+				reg->guest_phys_addr, reg->userspace_addr,
+				reg->memory_size, mr.fd, mr.fd_offset);
+		}
+	}
+
+	msg.request = VHOST_USER_SET_MEM_TABLE;
+	msg.payload.memory.nregions = n;
+	msg.size = offsetof(struct vhost_user_memory, regions) +
+		n * sizeof(struct vhost_user_region);
+	return vhost_user_send(vdev, &msg, fds, n);
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_VRING_ADDR;
+	msg.size = sizeof(msg.payload.addr);
+	msg.payload.addr = *addr;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_NUM, ring);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_BASE, ring);
+}
+
+/* Stops the ring in the backend and fetches where it stopped. */
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	if (vhost_user_set_state(vdev, VHOST_USER_GET_VRING_BASE, ring) != 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_VRING_BASE) != 0 ||
+	    msg.size != sizeof(msg.payload.state))
+		return -1;
+
+	ring->num = msg.payload.state.num;
+	return 0;
+}
+
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_fd(vdev, VHOST_USER_SET_VRING_KICK, file);
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_fd(vdev, VHOST_USER_SET_VRING_CALL, file);
+}
+
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev, int idx, int enable)
+{
+	struct vhost_vring_state state;
+
+	/* rings only start disabled once protocol features are agreed */
+	if (!(vdev->vhost_ext_features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	state.index = idx;
+	state.num = enable;
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_ENABLE, &state);
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	return vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, features);
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_RESET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+const struct vhost_ops vhost_user_ops = {
+	.init = vhost_user_init,
+	.set_mem_table = vhost_user_set_mem_table,
+	.set_vring_addr = vhost_user_set_vring_addr,
+	.set_vring_num = vhost_user_set_vring_num,
+	.set_vring_base = vhost_user_set_vring_base,
+	.get_vring_base = vhost_user_get_vring_base,
+	.set_vring_kick = vhost_user_set_vring_kick,
+	.set_vring_call = vhost_user_set_vring_call,
+	.set_vring_enable = vhost_user_set_vring_enable,
+	.set_features = vhost_user_set_features,
+	.get_features = vhost_user_get_features,
+	.set_owner = vhost_user_set_owner,
+	.reset_device = vhost_user_reset_device,
+};
+
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg;
+
+	if (!(vdev->protocol_features & (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) ||
+	    size > VHOST_USER_MAX_CONFIG_SIZE) {
+		WPRINTF("backend can't report its config space\n");
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_GET_CONFIG;
+	msg.size = VHOST_USER_CONFIG_HDR_SIZE + size;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	if (vhost_user_send(vdev, &msg, NULL, 0) != 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) != 0 ||
+	    msg.size != VHOST_USER_CONFIG_HDR_SIZE + size)
+		return -1;
+
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
+
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("socket path %s is too long\n", path);
+		return -1;
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF("connect to %s failed, errno = %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
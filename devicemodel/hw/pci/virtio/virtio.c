@@ -42,6 +42,7 @@
 #include "hsm_ioctl_defs.h"
 #include "iothread.h"
 #include "vmmapi.h"
+#include "dm_string.h"
 #include <errno.h>
 
 /*
@@ -105,13 +106,16 @@ virtio_set_iothread(struct virtio_base *base,
 			vq->viothrd.iomvt.arg = &vq->viothrd;
 			vq->viothrd.iomvt.run = iothread_handler;
 			vq->viothrd.iomvt.fd = vq->viothrd.kick_fd;
+			if (!vq->viothrd.ioctx)
+				vq->viothrd.ioctx = iothread_get(-1);
 
-			if (!iothread_add(vq->viothrd.kick_fd, &vq->viothrd.iomvt))
+			if (!iothread_add(vq->viothrd.ioctx, vq->viothrd.kick_fd,
+					&vq->viothrd.iomvt))
 				if (!virtio_register_ioeventfd(base, idx, true, vq->viothrd.kick_fd))
 					vq->viothrd.ioevent_started = true;
 		} else {
 			if (!virtio_register_ioeventfd(base, idx, false, vq->viothrd.kick_fd))
-				if (!iothread_del(vq->viothrd.kick_fd)) {
+				if (!iothread_del(vq->viothrd.ioctx, vq->viothrd.kick_fd)) {
 					vq->viothrd.ioevent_started = false;
 					if (vq->viothrd.kick_fd) {
 						close(vq->viothrd.kick_fd);
@@ -122,6 +126,27 @@ virtio_set_iothread(struct virtio_base *base,
 	}
 }
 
+int
+virtio_set_iothread_map(struct virtio_base *base, char *map)
+{
+	struct iothread_ctx *ioctx = NULL;
+	char *id;
+	int idx, i = 0, val;
+
+	while ((id = strsep(&map, ":")) != NULL && i < base->vops->nvq) {
+		if (dm_strtoi(id, NULL, 0, &val) ||
+		    (ioctx = iothread_get(val)) == NULL) {
+			pr_err("%s: invalid iothread id %s\n", __func__, id);
+			return -1;
+		}
+		base->queues[i++].viothrd.ioctx = ioctx;
+	}
+	for (idx = i; ioctx && idx < base->vops->nvq; idx++)
+		base->queues[idx].viothrd.ioctx = ioctx;
+
+	return 0;
+}
+
 static void
 virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -161,7 +186,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(base, vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -244,6 +269,8 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->flags = 0;
 		vq->last_avail = 0;
 		vq->save_used = 0;
+		vq->pending_used = 0;
+		vq->mem_hint = 0;
 		vq->pfn = 0;
 		vq->msix_idx = VIRTIO_MSI_NO_VECTOR;
 		vq->gpa_desc[0] = 0;
@@ -253,6 +280,9 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->packed = false;
+		free(vq->chains);
+		vq->chains = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -382,6 +412,7 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->pending_used = 0;
 
 	/* Mark queue as allocated after initialization is complete. */
 	mb();
@@ -394,6 +425,68 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Packed layout of virtio_vq_enable(): a single descriptor ring, with
+ * the avail and used gpas pointing at the driver and device event
+ * suppression structures.  Both wrap counters start at 1.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz;
+	uint64_t phys;
+	char *vb;
+
+	qsz = vq->qsize;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			qsz * sizeof(struct vring_packed_desc));
+	if (!vb)
+		goto error;
+	vq->pdesc = (struct vring_packed_desc *)vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		goto error;
+	vq->driver_event = (struct vring_packed_desc_event *)vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		goto error;
+	vq->device_event = (struct vring_packed_desc_event *)vb;
+
+	free(vq->chains);
+	vq->chains = calloc(qsz, sizeof(struct vq_packed_chain));
+	if (!vq->chains)
+		goto error;
+
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used = NULL;
+	vq->packed = true;
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_idx = 0;
+	vq->used_wrap = true;
+	vq->save_used = 0;
+	vq->pending_used = 0;
+	vq->last_id = 0;
+
+	vq->enabled = true;
+
+	mb();
+	vq->flags = VQ_ALLOC;
+	return;
+ error:
+	vq->flags = 0;
+	pr_err("%s: packed vq enable failed\n", __func__);
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -412,6 +505,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -440,6 +538,7 @@ virtio_vq_enable(struct virtio_base *base)
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->pending_used = 0;
 
 	/* Mark queue as enabled. */
 	vq->enabled = true;
@@ -460,20 +559,21 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
+_vq_record(int i, uint64_t addr, uint32_t len, uint16_t dflags,
+	   struct virtio_vq_info *vq, struct vmctx *ctx,
 	   struct iovec *iov, int n_iov, uint16_t *flags) {
 
 	void *host_addr;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	host_addr = vm_map_gpa_hint(ctx, addr, len, &vq->mem_hint);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
-		flags[i] = vd->flags;
+		flags[i] = dflags;
 	return 0;
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
@@ -517,6 +617,9 @@ _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
  * You are assumed to have done a vq_ring_ready() if needed (note
  * that vq_has_descs() does one).
  */
+static int vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		struct iovec *iov, int n_iov, uint16_t *flags);
+
 int
 vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	    struct iovec *iov, int n_iov, uint16_t *flags)
@@ -530,6 +633,9 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	struct virtio_base *base;
 	const char *name;
 
+	if (vq->packed)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
 	base = vq->base;
 	name = base->vops->name;
 
@@ -577,7 +683,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		}
 		vdir = &vq->desc[next];
 		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+			if (_vq_record(i, vdir->addr, vdir->len, vdir->flags,
+					vq, ctx, iov, n_iov, flags)) {
 				pr_err("%s: mapping to host failed\r\n", name);
 				return -1;
 			}
@@ -596,8 +703,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				    name, (u_int)vdir->len);
 				return -1;
 			}
-			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+			vindir = vm_map_gpa_hint(ctx,
+			    vdir->addr, vdir->len, &vq->mem_hint);
 
 			if (!vindir) {
 				pr_err("%s cannot get host memory\r\n", name);
@@ -619,7 +726,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 					    name);
 					return -1;
 				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+				if (_vq_record(i, vp->addr, vp->len, vp->flags,
+						vq, ctx, iov, n_iov, flags)) {
 					pr_err("%s: mapping to host failed\r\n", name);
 					return -1;
 				}
@@ -645,6 +753,143 @@ loopy:
 	return -1;
 }
 
+/*
+ * Drop a malformed chain from a packed ring, like the split ring drops
+ * the head it already took: skip its slots up to the first one without
+ * NEXT, so the next vq_getchain() does not parse it again.
+ */
+static void
+vq_skip_chain_packed(struct virtio_vq_info *vq)
+{
+	uint16_t n, dflags;
+
+	for (n = 0; n < vq->qsize && vq_has_descs(vq); n++) {
+		dflags = vq->pdesc[vq->last_avail].flags;
+		if (++vq->last_avail >= vq->qsize) {
+			vq->last_avail = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+	}
+}
+
+/*
+ * vq_getchain() for a packed ring.  A chain occupies consecutive ring
+ * slots linked by the NEXT flag; the buffer id lives in its last
+ * descriptor.  An INDIRECT descriptor takes one slot and its table is
+ * walked in order.  The driver makes the head available last, so
+ * once the head is valid the rest of the chain is too.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	int i;
+	u_int j, n_indir;
+	uint16_t idx, ndesc, id, dflags;
+	bool wrap;
+	volatile struct vring_packed_desc *vdir, *vindir, *vp;
+	struct vmctx *ctx;
+	struct virtio_base *base;
+	const char *name;
+
+	if (!vq_has_descs(vq))
+		return 0;
+
+	base = vq->base;
+	name = base->vops->name;
+	ctx = base->dev->vmctx;
+
+	/* read descriptor contents only after seeing the head flags */
+	rmb();
+
+	idx = vq->last_avail;
+	wrap = vq->avail_wrap;
+	i = 0;
+	for (ndesc = 1; ; ndesc++) {
+		if (ndesc > vq->qsize)
+			goto loopy;
+		vdir = &vq->pdesc[idx];
+		dflags = vdir->flags;
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vdir->addr, vdir->len, dflags,
+					vq, ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				goto bad;
+			}
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0 ||
+		    (dflags & VRING_DESC_F_NEXT)) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n",
+			    name);
+			goto bad;
+		} else {
+			n_indir = vdir->len / 16;
+			if ((vdir->len & 0xf) || n_indir == 0) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vdir->len);
+				goto bad;
+			}
+			vindir = vm_map_gpa_hint(ctx, vdir->addr, vdir->len,
+					&vq->mem_hint);
+			if (!vindir) {
+				pr_err("%s cannot get host memory\r\n", name);
+				goto bad;
+			}
+			for (j = 0; j < n_indir; j++) {
+				vp = &vindir[j];
+				if (vp->flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n",
+					    name);
+					goto bad;
+				}
+				if (_vq_record(i, vp->addr, vp->len, vp->flags,
+						vq, ctx, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n", name);
+					goto bad;
+				}
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+		}
+
+		id = vdir->id;
+		if (++idx >= vq->qsize) {
+			idx = 0;
+			wrap = !wrap;
+		}
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+	}
+
+	if (id >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range, driver confused?\r\n",
+		    name, id);
+		goto bad;
+	}
+
+	vq->chains[id].ndesc = ndesc;
+	vq->chains[id].prev = vq->last_id;
+	vq->last_id = id;
+	vq->last_avail = idx;
+	vq->avail_wrap = wrap;
+	*pidx = id;
+	return i;
+
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+bad:
+	vq_skip_chain_packed(vq);
+	return -1;
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -654,7 +899,21 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	struct vq_packed_chain *chain;
+
+	if (!vq->packed) {
+		vq->last_avail--;
+		return;
+	}
+
+	/* chains are handed back newest first, so unwind last_id */
+	chain = &vq->chains[vq->last_id];
+	if (vq->last_avail < chain->ndesc) {
+		vq->last_avail += vq->qsize;
+		vq->avail_wrap = !vq->avail_wrap;
+	}
+	vq->last_avail -= chain->ndesc;
+	vq->last_id = chain->prev;
 }
 
 /*
@@ -666,6 +925,53 @@ vq_retchain(struct virtio_vq_info *vq)
  */
 void
 vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	vq_relchain_prepare(vq, idx, iolen);
+	vq_relchain_publish(vq);
+}
+
+/*
+ * Packed flavour of vq_relchain_prepare(): write the used descriptor
+ * into the slot at used_idx.  The flags of the first slot in a batch
+ * are held back so the guest, which polls slots in order, sees the
+ * whole batch at once when vq_relchain_publish() writes them.
+ */
+static void
+vq_relchain_prepare_packed(struct virtio_vq_info *vq, uint16_t idx,
+		uint32_t iolen)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t flags;
+
+	vd = &vq->pdesc[vq->used_idx];
+	vd->id = idx;
+	vd->len = iolen;
+
+	flags = vq->used_wrap ? ((1 << VRING_PACKED_DESC_F_AVAIL) |
+			(1 << VRING_PACKED_DESC_F_USED)) : 0;
+	if (vq->pending_used == 0) {
+		vq->pending_slot = vq->used_idx;
+		vq->pending_flags = flags;
+	} else {
+		wmb();
+		vd->flags = flags;
+	}
+	vq->pending_used++;
+
+	vq->used_idx += vq->chains[idx].ndesc;
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+}
+
+/*
+ * Fill in the "used" ring entry for a request chain without moving
+ * used->idx, so that a batch of chains becomes visible to the guest
+ * with a single vq_relchain_publish().
+ */
+void
+vq_relchain_prepare(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 {
 	uint16_t uidx, mask;
 	volatile struct vring_used *vuh;
@@ -681,14 +987,71 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->packed) {
+		vq_relchain_prepare_packed(vq, idx, iolen);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
-	uidx = vuh->idx;
-	vue = &vuh->ring[uidx++ & mask];
+	uidx = vuh->idx + vq->pending_used;
+	vue = &vuh->ring[uidx & mask];
 	vue->id = idx;
 	vue->len = iolen;
-	vuh->idx = uidx;
+	vq->pending_used++;
+}
+
+/*
+ * Make all chains prepared since the last publish visible to the guest.
+ */
+void
+vq_relchain_publish(struct virtio_vq_info *vq)
+{
+	if (vq->pending_used == 0)
+		return;
+
+	if (vq->packed) {
+		wmb();
+		vq->pdesc[vq->pending_slot].flags = vq->pending_flags;
+		vq->pending_used = 0;
+		return;
+	}
+
+	vq->used->idx += vq->pending_used;
+	vq->pending_used = 0;
+}
+
+/*
+ * Interrupt decision for a packed ring, read from the driver event
+ * suppression area.  In DESC mode off_wrap names the used slot (and
+ * its wrap counter) the guest wants to be interrupted at.
+ */
+static int
+vq_packed_need_intr(struct virtio_vq_info *vq)
+{
+	uint16_t old_idx, new_idx, off_wrap, flags;
+	int event_off;
+
+	old_idx = vq->save_used;
+	vq->save_used = new_idx = vq->used_idx;
+	if (old_idx == new_idx)
+		return 0;
+
+	flags = vq->driver_event->flags;
+	if (flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return 0;
+	if (flags == VRING_PACKED_EVENT_FLAG_ENABLE ||
+	    !(vq->base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)))
+		return 1;
+
+	off_wrap = vq->driver_event->off_wrap;
+	event_off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if (!!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+		event_off -= vq->qsize;
+
+	return (uint16_t)(new_idx - event_off - 1) <
+		(uint16_t)(new_idx - old_idx);
 }
 
 /*
@@ -713,7 +1076,7 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	uint16_t event_idx, new_idx, old_idx;
 	int intr;
 
-	if (!vq || !vq->used)
+	if (!vq || (!vq->used && !vq->packed))
 		return;
 
 	/*
@@ -726,9 +1089,16 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	 * entire avail was processed, we need to interrupt always.
 	 */
 
+	vq_relchain_publish(vq);
 	atomic_thread_fence();
 
 	base = vq->base;
+	if (vq->packed) {
+		if (vq_packed_need_intr(vq))
+			vq_interrupt(base, vq);
+		return;
+	}
+
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
 	if (used_all_avail &&
@@ -769,7 +1139,39 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
+	if (vq->packed) {
+		if (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+			vq->device_event->off_wrap = vq->last_avail |
+				(vq->avail_wrap << VRING_PACKED_EVENT_F_WRAP_CTR);
+			wmb();
+			vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+		} else
+			vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+		return;
+	}
+
 	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+
+	/*
+	 * With EVENT_IDX the driver ignores the flag above and kicks
+	 * once avail->idx moves past avail_event.
+	 */
+	if (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX))
+		VQ_AVAIL_EVENT_IDX(vq) = vq->last_avail;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->packed)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
@@ -42,6 +42,7 @@
 #include "virtio.h"
 #include "block_if.h"
 #include "monitor.h"
+#include "vhost.h"
 
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
@@ -80,6 +81,16 @@
 	(VIRTIO_BLK_F_FLUSH |	\
 	VIRTIO_BLK_F_CONFIG_WCE)
 
+/*
+ * Capabilities a vhost-user backend may offer. The backend owns the
+ * cache mode, so CONFIG_WCE is left out: config writes stay here.
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS	\
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_FLUSH |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	VIRTIO_BLK_F_RO)
+
 /*
  * Config space "registers"
  */
@@ -163,12 +174,16 @@ struct virtio_blk {
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
 	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
+	bool use_vhost;		/* served by a vhost-user backend */
+	struct vhost_dev vhost;
+	struct vhost_vq vhost_vq;
 };
 
 static void virtio_blk_reset(void *);
 static void virtio_blk_notify(void *, struct virtio_vq_info *);
 static int virtio_blk_cfgread(void *, int, int, uint32_t *);
 static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
+static void virtio_blk_set_status(void *, uint64_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
@@ -179,7 +194,7 @@ static struct virtio_ops virtio_blk_ops = {
 	virtio_blk_cfgread,	/* read PCI config */
 	virtio_blk_cfgwrite,	/* write PCI config */
 	NULL,			/* apply negotiated features */
-	NULL,			/* called on guest set status */
+	virtio_blk_set_status,	/* called on guest set status */
 };
 
 static void
@@ -394,7 +409,7 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 	 * requests in virtqueue.
 	 * */
 	do {
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&blk->base, vq);
 		mb();
 		do {
 			virtio_blk_proc(blk, vq);
@@ -405,6 +420,56 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 	} while (vq_has_descs(vq));
 }
 
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+
+	if (!blk->use_vhost)
+		return;
+
+	if (status & VIRTIO_CONFIG_S_DRIVER_OK) {
+		if (vhost_dev_start(&blk->vhost) < 0)
+			WPRINTF(("virtio_blk: vhost start failed\n"));
+	} else if (blk->vhost.started) {
+		if (vhost_dev_stop(&blk->vhost) < 0)
+			WPRINTF(("virtio_blk: vhost stop failed\n"));
+	}
+}
+
+/*
+ * Hand the virtqueue to the vhost-user-blk backend listening on path.
+ * The disk lives in the backend, so the config space is read from it.
+ */
+static int
+virtio_blk_vhost_user_init(struct virtio_blk *blk, const char *path)
+{
+	int sockfd;
+
+	sockfd = vhost_user_connect(path);
+	if (sockfd < 0)
+		return -1;
+
+	/* vhost_dev_init trims these to what the backend offers */
+	blk->base.device_caps = VIRTIO_BLK_S_VHOSTCAPS;
+	blk->vhost.nvqs = 1;
+	blk->vhost.vqs = &blk->vhost_vq;
+	if (vhost_dev_init(&blk->vhost, &blk->base, sockfd, 0,
+			VIRTIO_BLK_S_VHOSTCAPS, 0, 0) < 0) {
+		WPRINTF(("virtio_blk: vhost-user init on %s failed\n", path));
+		return -1;
+	}
+
+	if (vhost_user_get_config(&blk->vhost, &blk->cfg,
+			sizeof(blk->cfg)) < 0) {
+		WPRINTF(("virtio_blk: no config from %s\n", path));
+		vhost_dev_deinit(&blk->vhost);
+		return -1;
+	}
+
+	return 0;
+}
+
 static uint64_t
 virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 {
@@ -467,7 +532,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	bool use_iothread;
+	bool use_iothread, use_vhost;
+	char *iothread_map = NULL;
 	int i;
 	pthread_mutexattr_t attr;
 	int rc;
@@ -476,6 +542,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* Assume the bctxt is valid, until identified otherwise */
 	dummy_bctxt = false;
 	use_iothread = false;
+	use_vhost = false;
 
 	if (opts == NULL) {
 		pr_err("virtio_blk: backing device required\n");
@@ -500,10 +567,17 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		WPRINTF(("%s: strdup failed\n", __func__));
 		return -1;
 	}
-	if (strstr(opts, "nodisk") == NULL) {
+	if (strncmp(opts, "vhost-user=", 11) == 0) {
+		/* no local disk, a vhost-user backend serves the queue */
+		use_vhost = true;
+		dummy_bctxt = true;
+	} else if (strstr(opts, "nodisk") == NULL) {
 		opt = strsep(&opts_tmp, ",");
 		if (strcmp("iothread", opt) == 0) {
 			use_iothread = true;
+		} else if (strncmp("iothread=", opt, 9) == 0) {
+			use_iothread = true;
+			iothread_map = strdup(opt + 9);
 		} else {
 			/* The opts_start is truncated by strsep, opts_tmp is also
 			 * changed by strsetp, so use opts which points to the
@@ -514,6 +588,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		bctxt = blockif_open(opts_tmp, bident);
 		if (bctxt == NULL) {
 			pr_err("Could not open backing file");
+			free(iothread_map);
 			free(opts_start);
 			return -1;
 		}
@@ -527,12 +602,14 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk = calloc(1, sizeof(struct virtio_blk));
 	if (!blk) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		free(iothread_map);
 		return -1;
 	}
 
 	blk->bc = bctxt;
 	/* Update virtio-blk device struct of dummy ctxt*/
 	blk->dummy_bctxt = dummy_bctxt;
+	blk->use_vhost = use_vhost;
 
 	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
 		struct virtio_blk_ioreq *io = &blk->ios[i];
@@ -558,9 +635,20 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					"error %d!\n", rc));
 
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq,
+		      use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.iothread = use_iothread;
 	blk->base.mtx = &blk->mtx;
+	if (iothread_map) {
+		rc = virtio_set_iothread_map(&blk->base, iothread_map);
+		free(iothread_map);
+		if (rc) {
+			if (!blk->dummy_bctxt)
+				blockif_close(blk->bc);
+			free(blk);
+			return -1;
+		}
+	}
 
 	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
 	/* blk->vq.vq_notify = we have no per-queue notify */
@@ -588,7 +676,12 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		WPRINTF(("virtio_blk: device name is invalid!\n"));
 
 	/* Setup virtio block config space only for valid backend file*/
-	if (!blk->dummy_bctxt)
+	if (blk->use_vhost) {
+		if (virtio_blk_vhost_user_init(blk, opts + 11) < 0) {
+			free(blk);
+			return -1;
+		}
+	} else if (!blk->dummy_bctxt)
 		virtio_blk_update_config_space(blk);
 
 	/*
@@ -609,6 +702,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
 			blockif_close(blk->bc);
+		if (blk->use_vhost)
+			vhost_dev_deinit(&blk->vhost);
 		free(blk);
 		return -1;
 	}
@@ -644,6 +739,11 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
 			blockif_close(bctxt);
 		}
+		if (blk->use_vhost) {
+			if (blk->vhost.started)
+				vhost_dev_stop(&blk->vhost);
+			vhost_dev_deinit(&blk->vhost);
+		}
 		virtio_reset_dev(&blk->base);
 		free(blk);
 	}
@@ -737,7 +837,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	 * user has passed empty file during VM launch and wants to update it.
 	 * If this is the case, blk->bc would be null.
 	 */
-	if (blk->bc) {
+	if (blk->bc || blk->use_vhost) {
 		pr_err("Replacing valid backend file not supported!\n");
 		goto end;
 	}
@@ -51,6 +51,8 @@
 #define	VIRTIO_CONSOLE_RINGSZ	64
 #define	VIRTIO_CONSOLE_MAXPORTS	16
 #define	VIRTIO_CONSOLE_MAXQ	(VIRTIO_CONSOLE_MAXPORTS * 2 + 2)
+#define	VIRTIO_CONSOLE_MAXSEGS	8	/* descriptors mapped per chain */
+#define	VIRTIO_CONSOLE_BATCH	16	/* chains moved per readv/writev */
 
 #define	VIRTIO_CONSOLE_DEVICE_READY	0
 #define	VIRTIO_CONSOLE_DEVICE_ADD	1
@@ -79,8 +81,12 @@ static int virtio_console_debug;
 struct virtio_console;
 struct virtio_console_port;
 struct virtio_console_config;
-typedef void (virtio_console_cb_t)(struct virtio_console_port *, void *,
-				   struct iovec *, int);
+/*
+ * Returns the number of bytes taken from iov. Taking less blocks the port:
+ * the rest stays queued in the guest's ring until tx_blocked is cleared.
+ */
+typedef ssize_t (virtio_console_cb_t)(struct virtio_console_port *, void *,
+				      struct iovec *, int);
 
 enum virtio_console_be_type {
 	VIRTIO_CONSOLE_BE_STDIO = 0,
@@ -100,6 +106,9 @@ struct virtio_console_port {
 	bool			is_console;
 	bool			rx_ready;
 	bool			open;
+	bool			bulk;		/* flow control instead of dropping data */
+	bool			tx_blocked;
+	size_t			tx_off;		/* bytes of the first queued chain already taken */
 	int			rxq;
 	int			txq;
 	void			*arg;
@@ -110,6 +119,8 @@ struct virtio_console_backend {
 	struct virtio_console_port	*port;
 	struct mevent			*evp;
 	struct mevent			*conn_evp;
+	struct mevent			*wr_evp;	/* bulk: waits for fd to drain */
+	bool				rx_blocked;	/* bulk: reading is paused */
 	int				fd;
 	int				server_fd;
 	bool				open;
@@ -271,20 +282,24 @@ virtio_console_add_port(struct virtio_console *console, const char *name,
 	return port;
 }
 
-static void
+static ssize_t
 virtio_console_control_tx(struct virtio_console_port *port, void *arg,
-			  struct iovec *iov, int niov __attribute__((unused)))
+			  struct iovec *iov, int niov)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *tmp;
 	struct virtio_console_control resp, *ctrl;
+	ssize_t len = 0;
 	int i;
 
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+
 	console = port->console;
 	ctrl = (struct virtio_console_control *)iov->iov_base;
 
 	if ((console == NULL) || (ctrl == NULL))
-		return;
+		return len;
 
 	switch (ctrl->event) {
 	case VIRTIO_CONSOLE_DEVICE_READY:
@@ -304,7 +319,7 @@ virtio_console_control_tx(struct virtio_console_port *port, void *arg,
 		if (ctrl->id >= console->nports) {
 			WPRINTF(("VTCONSOLE_PORT_READY for unknown port %d\n",
 			    ctrl->id));
-			return;
+			return len;
 		}
 
 		tmp = &console->ports[ctrl->id];
@@ -316,6 +331,8 @@ virtio_console_control_tx(struct virtio_console_port *port, void *arg,
 		}
 		break;
 	}
+
+	return len;
 }
 
 static void
@@ -379,39 +396,105 @@ virtio_console_control_send(struct virtio_console *console,
 	vq_endchains(vq, 1);
 }
 
+/*
+ * Drop the first off bytes of iov, which the port has taken already.
+ * Returns the index of the first segment left with data.
+ */
+static int
+virtio_console_iov_skip(struct iovec *iov, int niov, size_t off)
+{
+	int i;
+
+	for (i = 0; i < niov && off >= iov[i].iov_len; i++)
+		off -= iov[i].iov_len;
+	if (i < niov) {
+		iov[i].iov_base = (char *)iov[i].iov_base + off;
+		iov[i].iov_len -= off;
+	}
+	return i;
+}
+
 static void
 virtio_console_notify_tx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
-	struct iovec iov[1];
-	uint16_t idx;
-	uint16_t flags[8];
+	struct iovec iov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_MAXSEGS];
+	uint16_t idx[VIRTIO_CONSOLE_BATCH];
+	size_t len[VIRTIO_CONSOLE_BATCH];
+	size_t taken;
+	ssize_t ret;
+	int batch, nchains, niov, n, first, i;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
 
-	while (vq_has_descs(vq)) {
-		if (vq_getchain(vq, &idx, iov, 1, flags) < 1) {
-			pr_err("%s: fail to getchain!\n", __func__);
-			break;
+	/* control messages are parsed one per chain */
+	batch = (port == &console->control_port) ? 1 : VIRTIO_CONSOLE_BATCH;
+
+	while (!port->tx_blocked && vq_has_descs(vq)) {
+		/*
+		 * Hand the backend as many chains as are queued in one
+		 * writev, rather than a syscall per chain.
+		 */
+		nchains = 0;
+		niov = 0;
+		while (nchains < batch && vq_has_descs(vq)) {
+			n = vq_getchain(vq, &idx[nchains], &iov[niov],
+					VIRTIO_CONSOLE_MAXSEGS, NULL);
+			if (n < 1) {
+				pr_err("%s: fail to getchain!\n", __func__);
+				break;
+			}
+			n = MIN(n, VIRTIO_CONSOLE_MAXSEGS);
+			len[nchains] = 0;
+			for (i = niov; i < niov + n; i++)
+				len[nchains] += iov[i].iov_len;
+			niov += n;
+			nchains++;
 		}
-		if ((port != NULL) && (port->cb != NULL))
-			port->cb(port, port->arg, iov, 1);
+		if (nchains == 0)
+			break;
+
+		first = virtio_console_iov_skip(iov, niov, port->tx_off);
+		if (port->cb != NULL)
+			ret = port->cb(port, port->arg, iov + first, niov - first);
+		else
+			ret = -1;
+		taken = port->tx_off + ((ret < 0) ? 0 : ret);
+		if (!port->bulk || ret < 0)
+			taken = SIZE_MAX;
 
 		/*
-		 * Release this chain and handle more
+		 * Release the chains taken in full. A bulk port that is
+		 * blocked keeps the rest queued, to go on from tx_off.
 		 */
-		vq_relchain(vq, idx, 0);
+		for (i = 0; i < nchains && taken >= len[i]; i++) {
+			taken -= len[i];
+			vq_relchain_prepare(vq, idx[i], 0);
+		}
+		port->tx_off = (i < nchains) ? taken : 0;
+		for (n = nchains - 1; n >= i; n--)
+			vq_retchain(vq);
+		if (i < nchains)
+			break;
 	}
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
 
+static struct mevent *
+virtio_console_backend_read_evp(struct virtio_console_backend *be)
+{
+	/* a server socket reads the accepted connection */
+	return be->conn_evp ? be->conn_evp : be->evp;
+}
+
 static void
 virtio_console_notify_rx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
+	struct virtio_console_backend *be;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
@@ -419,9 +502,31 @@ virtio_console_notify_rx(void *vdev, struct virtio_vq_info *vq)
 	if (!port->rx_ready) {
 		port->rx_ready = 1;
 		if (vq_has_descs(vq)) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+			vq_set_used_ring_flags(&console->base, vq);
 		}
 	}
+
+	/* the guest posted buffers, a paused bulk port can read again */
+	be = port->arg;
+	if (port != &console->control_port && be != NULL && be->rx_blocked) {
+		be->rx_blocked = false;
+		if (virtio_console_backend_read_evp(be))
+			mevent_enable(virtio_console_backend_read_evp(be));
+	}
+}
+
+static void
+virtio_console_backend_stop_wait(struct virtio_console_backend *be)
+{
+	if (be->wr_evp) {
+		mevent_delete_close(be->wr_evp);
+		be->wr_evp = NULL;
+	}
+	be->rx_blocked = false;
+	if (be->port) {
+		be->port->tx_blocked = false;
+		be->port->tx_off = 0;
+	}
 }
 
 static void
@@ -430,6 +535,7 @@ virtio_console_reset_backend(struct virtio_console_backend *be)
 	if (!be)
 		return;
 
+	virtio_console_backend_stop_wait(be);
 	if (be->evp)
 		mevent_disable(be->evp);
 	if (be->fd != STDIN_FILENO)
@@ -441,6 +547,7 @@ virtio_console_reset_backend(struct virtio_console_backend *be)
 static void
 virtio_console_socket_clear(struct virtio_console_backend *be)
 {
+	virtio_console_backend_stop_wait(be);
 	if (be->conn_evp) {
 		mevent_delete(be->conn_evp);
 		be->conn_evp = NULL;
@@ -452,21 +559,32 @@ virtio_console_socket_clear(struct virtio_console_backend *be)
 }
 
 static void
-virtio_console_backend_read(int fd __attribute__((unused)),
-			    enum ev_type t __attribute__((unused)),
-			    void *arg)
+virtio_console_backend_rx(struct virtio_console_backend *be)
 {
 	struct virtio_console_port *port;
-	struct virtio_console_backend *be = arg;
 	struct virtio_vq_info *vq;
-	struct iovec iov;
+	struct iovec iov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_MAXSEGS];
+	uint16_t idx[VIRTIO_CONSOLE_BATCH];
+	size_t size[VIRTIO_CONSOLE_BATCH], total, left;
 	static char dummybuf[2048];
-	int len, n;
-	uint16_t idx;
+	int len, n, niov, nchains, i;
 
 	port = be->port;
 	vq = virtio_console_port_to_vq(port, true);
 
+	/*
+	 * A bulk port leaves the data in the backend until the guest has
+	 * buffers for it; notify_rx resumes reading.
+	 */
+	if (port->bulk && be->open &&
+	    (!port->rx_ready || !vq_ring_ready(vq) || !vq_has_descs(vq))) {
+		be->rx_blocked = true;
+		mevent_disable(virtio_console_backend_read_evp(be));
+		if (vq_ring_ready(vq))
+			vq_endchains(vq, 1);
+		return;
+	}
+
 	if (!be->open || !port->rx_ready || !vq_ring_ready(vq)) {
 		len = read(be->fd, dummybuf, sizeof(dummybuf));
 		if (len == 0)
@@ -483,14 +601,32 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	}
 
 	do {
-		n = vq_getchain(vq, &idx, &iov, 1, NULL);
-		if (n < 1){
-			pr_err("%s: fail to getchain!\n", __func__);
-			break;
+		/* fill as many guest buffers as are posted with one readv */
+		nchains = 0;
+		niov = 0;
+		total = 0;
+		while (nchains < VIRTIO_CONSOLE_BATCH && vq_has_descs(vq)) {
+			n = vq_getchain(vq, &idx[nchains], &iov[niov],
+					VIRTIO_CONSOLE_MAXSEGS, NULL);
+			if (n < 1) {
+				pr_err("%s: fail to getchain!\n", __func__);
+				break;
+			}
+			n = MIN(n, VIRTIO_CONSOLE_MAXSEGS);
+			size[nchains] = 0;
+			for (i = niov; i < niov + n; i++)
+				size[nchains] += iov[i].iov_len;
+			total += size[nchains];
+			niov += n;
+			nchains++;
 		}
-		len = readv(be->fd, &iov, n);
+		if (nchains == 0)
+			break;
+
+		len = readv(be->fd, iov, niov);
 		if (len <= 0) {
-			vq_retchain(vq);
+			for (i = 0; i < nchains; i++)
+				vq_retchain(vq);
 			vq_endchains(vq, 0);
 
 			/* no data available */
@@ -506,8 +642,15 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 			goto close;
 		}
 
-		vq_relchain(vq, idx, len);
-	} while (vq_has_descs(vq));
+		/* the data fills the chains in order, hand back the rest */
+		left = len;
+		for (i = 0; i < nchains && left > 0; i++) {
+			vq_relchain_prepare(vq, idx[i], MIN(left, size[i]));
+			left -= MIN(left, size[i]);
+		}
+		for (n = nchains - 1; n >= i; n--)
+			vq_retchain(vq);
+	} while ((size_t)len == total && vq_has_descs(vq));
 
 	vq_endchains(vq, 1);
 	return;
@@ -529,18 +672,85 @@ clear:
 }
 
 static void
+virtio_console_backend_read(int fd __attribute__((unused)),
+			    enum ev_type t __attribute__((unused)),
+			    void *arg)
+{
+	struct virtio_console_backend *be = arg;
+	struct virtio_console *console = be->port->console;
+
+	/* bulk ports pause and resume reading against notify_rx */
+	pthread_mutex_lock(&console->mtx);
+	virtio_console_backend_rx(be);
+	pthread_mutex_unlock(&console->mtx);
+}
+
+static void
+virtio_console_backend_writable(int fd __attribute__((unused)),
+				enum ev_type t __attribute__((unused)),
+				void *arg)
+{
+	struct virtio_console_backend *be = arg;
+	struct virtio_console_port *port = be->port;
+	struct virtio_console *console = port->console;
+
+	pthread_mutex_lock(&console->mtx);
+	if (be->wr_evp) {
+		mevent_delete_close(be->wr_evp);
+		be->wr_evp = NULL;
+	}
+	port->tx_blocked = false;
+	virtio_console_notify_tx(console, virtio_console_port_to_vq(port, false));
+	pthread_mutex_unlock(&console->mtx);
+}
+
+/*
+ * Block the port until the backend can take more. epoll takes each fd
+ * once and the reader may be watching be->fd, so watch a dup of it.
+ */
+static int
+virtio_console_backend_wait_writable(struct virtio_console_backend *be)
+{
+	int fd;
+
+	if (be->wr_evp == NULL) {
+		fd = dup(be->fd);
+		if (fd < 0)
+			return -1;
+		be->wr_evp = mevent_add(fd, EVF_WRITE,
+				virtio_console_backend_writable, be, NULL, NULL);
+		if (be->wr_evp == NULL) {
+			close(fd);
+			return -1;
+		}
+	}
+	be->port->tx_blocked = true;
+	return 0;
+}
+
+static ssize_t
 virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 			     struct iovec *iov, int niov)
 {
 	struct virtio_console_backend *be;
-	int ret;
+	ssize_t ret, len = 0;
+	int i;
 
 	be = arg;
 
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+
 	if (be->fd == -1)
-		return;
+		return len;
 
 	ret = writev(be->fd, iov, niov);
+	if (port->bulk && ret < len && (ret >= 0 || errno == EAGAIN)) {
+		/* keep the rest in the ring rather than drop it */
+		if (virtio_console_backend_wait_writable(be) == 0)
+			return (ret < 0) ? 0 : ret;
+		WPRINTF(("vtcon: can't wait for backend, data dropped\n"));
+	}
 	if (ret <= 0) {
 		/* Case 1:backend cannot receive more data. For example when pts is
 		 * not connected to any client, its tty buffer will become full.
@@ -558,18 +768,19 @@ virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 		 * acts as a client connects to this socket.
 		 */
 		if (ret == -1 && (errno == EAGAIN || errno == ENOTCONN))
-			return;
+			return len;
 
 		if (ret == -1 && errno == EBADF) {
 			if (be->be_type == VIRTIO_CONSOLE_BE_SOCKET && (be->socket_type == NULL
 				|| !strcmp(be->socket_type,"server"))) {
 				virtio_console_socket_clear(be);
-				return;
+				return len;
 			}
 		}
 		virtio_console_reset_backend(be);
 		WPRINTF(("vtcon: be write failed! errno = %d\n", errno));
 	}
+	return len;
 }
 
 static void
@@ -829,6 +1040,8 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 	char *portname = NULL;
 	char *portpath = NULL;
 	char *socket_type = NULL;
+	char *suffix;
+	bool bulk = false;
 	enum virtio_console_be_type be_type = VIRTIO_CONSOLE_BE_INVALID;
 
 	backend = strsep(&opt, ":");
@@ -852,6 +1065,13 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 		goto parse_fail;
 	}
 
+	/* a trailing ":bulk" asks for flow control instead of dropping data */
+	suffix = opt ? strrchr(opt, ':') : NULL;
+	if (suffix != NULL && !strcmp(suffix, ":bulk")) {
+		*suffix = '\0';
+		bulk = true;
+	}
+
 	if (opt != NULL) {
 		if (be_type == VIRTIO_CONSOLE_BE_SOCKET) {
 			portname = strsep(&opt, "=");
@@ -912,6 +1132,7 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 		error = -1;
 		goto out;
 	}
+	be->port->bulk = bulk;
 
 	if (virtio_console_backend_can_read(be_type)) {
 		if (be->be_type == VIRTIO_CONSOLE_BE_SOCKET && (be->socket_type == NULL
@@ -968,8 +1189,8 @@ virtio_console_add_backends(struct virtio_console *console, char *opts)
 {
 	char *opt;
 
-	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
-	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type]]
+	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath][:bulk]
+	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type][:bulk]]
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
 		if (virtio_console_add_backend(console, opt))
@@ -984,6 +1205,7 @@ virtio_console_close_backend(struct virtio_console_backend *be)
 	if (!be)
 		return;
 
+	virtio_console_backend_stop_wait(be);
 	switch (be->be_type) {
 	case VIRTIO_CONSOLE_BE_PTY:
 		if (be->pts_fd > 0) {
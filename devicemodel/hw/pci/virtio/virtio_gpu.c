@@ -15,6 +15,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <vmmapi.h>
@@ -56,6 +57,7 @@
  * Host capabilities
  */
 #define VIRTIO_GPU_S_HOSTCAPS	(1UL << VIRTIO_F_VERSION_1) | \
+				(1UL << VIRTIO_F_RING_PACKED) | \
 				(1UL << VIRTIO_GPU_F_EDID)
 
 
@@ -84,6 +86,17 @@
 #define VIRTIO_GPU_CAP_ISR_OFFSET	0x1800
 #define VIRTIO_GPU_CAP_ISR_SIZE	0x800
 
+/*
+ * The VBE framebuffer is mapped straight into the guest, so its writes
+ * never trap.  Damage is found by hashing it in tiles, and the scan
+ * backs off from VGA_SCAN_MIN_MS to VGA_SCAN_MAX_MS while it is idle.
+ */
+#define VGA_TILE_WIDTH		64
+#define VGA_TILE_HEIGHT		16
+#define VGA_DAMAGE_RECTS_MAX	64
+#define VGA_SCAN_MIN_MS		16
+#define VGA_SCAN_MAX_MS		128
+
 /*
  * Config space "registers"
  */
@@ -217,6 +230,7 @@ struct virtio_gpu_resource_2d {
 	pixman_image_t *image;
 	struct iovec *iov;
 	uint32_t iovcnt;
+	size_t *iov_off;	/* offset of each iov in the backing store */
 	bool blob;
 	struct dma_buf_info *dma_info;
 	LIST_ENTRY(virtio_gpu_resource_2d) link;
@@ -374,10 +388,27 @@ struct virtio_gpu {
 	struct vga vga;
 	pthread_mutex_t	vga_thread_mtx;
 	int32_t vga_thread_status;
+	/* protects the tile tables and vga_kicked */
+	pthread_mutex_t vga_damage_mtx;
+	pthread_cond_t vga_kick_cond;
+	bool vga_kicked;
+	uint32_t *vga_shadow;
+	uint8_t *vga_tile_dirty;
+	int vga_tiles_x;
+	int vga_tiles_y;
+	int vga_shadow_width;
+	int vga_shadow_height;
 	uint8_t edid[VIRTIO_GPU_EDID_SIZE];
 	bool is_blob_supported;
 	int scanout_num;
 	struct virtio_gpu_scanout *gpu_scanouts;
+	/* check_transfer: 2D transfers checked against a per-row iov walk */
+	bool check_transfer;
+	uint64_t xfer_nr;
+	uint64_t xfer_bytes;
+	uint64_t xfer_copy_ns;
+	uint64_t xfer_walk_ns;
+	uint64_t xfer_bad_rows;
 };
 
 struct virtio_gpu_command {
@@ -396,6 +427,7 @@ static int virtio_gpu_cfgwrite(void *, int, int, uint32_t);
 static void virtio_gpu_neg_features(void *, uint64_t);
 static void virtio_gpu_set_status(void *, uint64_t);
 static void * virtio_gpu_vga_render(void *param);
+static void virtio_gpu_vga_kick(struct virtio_gpu *gpu);
 
 static struct virtio_ops virtio_gpu_ops = {
 	"virtio-gpu",			/* our name */
@@ -435,6 +467,128 @@ static void virtio_gpu_dmabuf_unref(struct dma_buf_info *info)
 	}
 }
 
+static void
+virtio_gpu_free_backing(struct virtio_gpu_resource_2d *r2d)
+{
+	free(r2d->iov);
+	free(r2d->iov_off);
+	r2d->iov = NULL;
+	r2d->iov_off = NULL;
+	r2d->iovcnt = 0;
+}
+
+/*
+ * Index the backing store by the byte offset each iov starts at, so a
+ * transfer can seek to a row with a binary search instead of walking
+ * the iov array from the start for every row.
+ */
+static int
+virtio_gpu_index_backing(struct virtio_gpu_resource_2d *r2d)
+{
+	uint32_t i;
+
+	r2d->iov_off = malloc((r2d->iovcnt + 1) * sizeof(size_t));
+	if (!r2d->iov_off)
+		return -1;
+
+	r2d->iov_off[0] = 0;
+	for (i = 0; i < r2d->iovcnt; i++)
+		r2d->iov_off[i + 1] = r2d->iov_off[i] + r2d->iov[i].iov_len;
+	return 0;
+}
+
+/*
+ * Copy len bytes at offset of the backing store to dst.  *cursor is the
+ * iov the previous copy ended in; transfers walk rows forward, so it is
+ * tried before falling back to a binary search.  Returns the number of
+ * bytes copied, short if the backing store ends first.
+ */
+static size_t
+virtio_gpu_copy_backing(struct virtio_gpu_resource_2d *r2d, size_t offset,
+			uint8_t *dst, size_t len, uint32_t *cursor)
+{
+	uint32_t i = *cursor, lo, hi, mid;
+	size_t done = 0, skip, bytes;
+
+	if (i >= r2d->iovcnt || offset < r2d->iov_off[i] ||
+	    offset >= r2d->iov_off[i + 1]) {
+		if (offset >= r2d->iov_off[r2d->iovcnt])
+			return 0;
+		lo = 0;
+		hi = r2d->iovcnt - 1;
+		while (lo < hi) {
+			mid = (lo + hi + 1) / 2;
+			if (r2d->iov_off[mid] <= offset)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		i = lo;
+	}
+
+	for (skip = offset - r2d->iov_off[i]; i < r2d->iovcnt && done < len;
+	     i++, skip = 0) {
+		bytes = r2d->iov[i].iov_len - skip;
+		if (bytes > len - done)
+			bytes = len - done;
+		memcpy(dst + done, (uint8_t *)r2d->iov[i].iov_base + skip, bytes);
+		done += bytes;
+		if (skip + bytes < r2d->iov[i].iov_len)
+			break;
+	}
+
+	*cursor = i;
+	return done;
+}
+
+static uint64_t
+virtio_gpu_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Reference for the check_transfer option: compare each row of a transfer
+ * with the backing store, walking the iovs from the start for every row.
+ * Returns the number of rows that differ.
+ */
+static uint32_t
+virtio_gpu_check_rows(struct virtio_gpu_resource_2d *r2d, uint8_t *img_data,
+		      uint64_t offset, uint32_t stride, uint32_t dst_offset,
+		      uint32_t row_len, uint32_t height)
+{
+	uint64_t src_offset;
+	uint32_t h, i, done, bytes, bad = 0;
+	bool diff;
+
+	for (h = 0; h < height; h++) {
+		src_offset = offset + (uint64_t)stride * h;
+		diff = false;
+		done = 0;
+		for (i = 0; i < r2d->iovcnt && done < row_len; i++) {
+			if (src_offset >= r2d->iov[i].iov_len) {
+				src_offset -= r2d->iov[i].iov_len;
+				continue;
+			}
+			bytes = MIN(row_len - done,
+				    r2d->iov[i].iov_len - src_offset);
+			if (memcmp(img_data + dst_offset + done,
+				   (uint8_t *)r2d->iov[i].iov_base + src_offset,
+				   bytes))
+				diff = true;
+			src_offset = 0;
+			done += bytes;
+		}
+		if (diff)
+			bad++;
+		dst_offset += stride;
+	}
+	return bad;
+}
+
 static void
 virtio_gpu_set_status(void *vdev, uint64_t status)
 {
@@ -466,10 +620,7 @@ virtio_gpu_reset(void *vdev)
 				r2d->blob = false;
 			}
 			LIST_REMOVE(r2d, link);
-			if (r2d->iov) {
-				free(r2d->iov);
-				r2d->iov = NULL;
-			}
+			virtio_gpu_free_backing(r2d);
 			free(r2d);
 		}
 	}
@@ -755,10 +906,7 @@ virtio_gpu_cmd_resource_unref(struct virtio_gpu_command *cmd)
 			r2d->blob = false;
 		}
 		LIST_REMOVE(r2d, link);
-		if (r2d->iov) {
-			free(r2d->iov);
-			r2d->iov = NULL;
-		}
+		virtio_gpu_free_backing(r2d);
 		free(r2d);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
@@ -802,6 +950,11 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 
 	r2d = virtio_gpu_find_resource_2d(cmd->gpu, req.resource_id);
 	if (r2d && req.nr_entries > 0) {
+		/*
+		 * A re-attach replaces the old backing store; drop it and its
+		 * offset index so the index is rebuilt for the new iov.
+		 */
+		virtio_gpu_free_backing(r2d);
 		iov = malloc(req.nr_entries * sizeof(struct iovec));
 		if (!iov) {
 			resp.type = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
@@ -812,7 +965,7 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 		r2d->iovcnt = req.nr_entries;
 		entries = calloc(req.nr_entries, sizeof(struct virtio_gpu_mem_entry));
 		if (!entries) {
-			free(iov);
+			virtio_gpu_free_backing(r2d);
 			resp.type = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
 			goto exit;
 		}
@@ -822,13 +975,17 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 			pbuf += cmd->iov[i].iov_len;
 		}
 		for (i = 0; i < req.nr_entries; i++) {
-			r2d->iov[i].iov_base = paddr_guest2host(
-					cmd->gpu->base.dev->vmctx,
-					entries[i].addr,
-					entries[i].length);
+			r2d->iov[i].iov_base = (void *)(uintptr_t)entries[i].addr;
 			r2d->iov[i].iov_len = entries[i].length;
 		}
 		free(entries);
+		if (vm_map_gpa_iov(cmd->gpu->base.dev->vmctx, r2d->iov,
+				r2d->iovcnt, NULL)) {
+			pr_err("%s: invalid backing entry.\n", __func__);
+			virtio_gpu_free_backing(r2d);
+			resp.type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+			goto exit;
+		}
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
 		pr_err("%s: Illegal resource id %d\n", __func__, req.resource_id);
@@ -851,10 +1008,8 @@ virtio_gpu_cmd_resource_detach_backing(struct virtio_gpu_command *cmd)
 	memset(&resp, 0, sizeof(resp));
 
 	r2d = virtio_gpu_find_resource_2d(cmd->gpu, req.resource_id);
-	if (r2d && r2d->iov) {
-		free(r2d->iov);
-		r2d->iov = NULL;
-	}
+	if (r2d)
+		virtio_gpu_free_backing(r2d);
 
 	cmd->iolen = sizeof(resp);
 	resp.type = VIRTIO_GPU_RESP_OK_NODATA;
@@ -927,6 +1082,7 @@ virtio_gpu_cmd_set_scanout(struct virtio_gpu_command *cmd)
 
 	if(cmd->gpu->vga.enable) {
 		cmd->gpu->vga.enable = false;
+		virtio_gpu_vga_kick(cmd->gpu);
 	}
 }
 
@@ -936,10 +1092,10 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 	struct virtio_gpu_transfer_to_host_2d req;
 	struct virtio_gpu_resource_2d *r2d;
 	struct virtio_gpu_ctrl_hdr resp;
-	uint32_t src_offset, dst_offset, stride, bpp, h;
+	uint32_t src_offset, dst_offset, stride, bpp, h, cursor, bad;
 	pixman_format_code_t format;
-	void *img_data, *dst, *src;
-	int i, done, bytes, total;
+	uint64_t t0 = 0, t1;
+	uint8_t *img_data;
 	int width, height;
 
 	memcpy(&req, cmd->iov[0].iov_base, sizeof(req));
@@ -974,39 +1130,57 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 		stride = pixman_image_get_stride(r2d->image);
 		format = pixman_image_get_format(r2d->image);
 		bpp = PIXMAN_FORMAT_BPP(format) / 8;
-		img_data = pixman_image_get_data(r2d->image);
+		img_data = (uint8_t *)pixman_image_get_data(r2d->image);
 		width = (req.r.width < r2d->width) ? req.r.width : r2d->width;
 		height = (req.r.height < r2d->height) ? req.r.height : r2d->height;
-		for (h = 0; h < height; h++) {
-			src_offset = req.offset + stride * h;
-			dst_offset = (req.r.y + h) * stride + (req.r.x * bpp);
-			dst = img_data + dst_offset;
-			done = 0;
-			total = width * bpp;
-			for (i = 0; i < r2d->iovcnt; i++) {
-				if ((r2d->iov[i].iov_base == 0) || (r2d->iov[i].iov_len == 0)) {
-					continue;
-				}
+		if (r2d->iovcnt && !r2d->iov_off && virtio_gpu_index_backing(r2d)) {
+			pixman_image_unref(r2d->image);
+			resp.type = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+			goto out;
+		}
 
-				if (src_offset < r2d->iov[i].iov_len) {
-					src = r2d->iov[i].iov_base + src_offset;
-					bytes = ((total - done) < (r2d->iov[i].iov_len - src_offset)) ?
-						 (total - done) : (r2d->iov[i].iov_len - src_offset);
-					memcpy((dst + done), src, bytes);
-					src_offset = 0;
-					done += bytes;
-					if (done >= total) {
-						break;
-					}
-				} else {
-					src_offset -= r2d->iov[i].iov_len;
-				}
+		cursor = 0;
+		src_offset = req.offset;
+		dst_offset = req.r.y * stride + req.r.x * bpp;
+		if (cmd->gpu->check_transfer)
+			t0 = virtio_gpu_now_ns();
+		if (r2d->iovcnt == 0) {
+			/* no backing attached, nothing to copy */
+		} else if (req.r.x == 0 && width * bpp == stride) {
+			/* full rows: the rectangle is one contiguous run */
+			virtio_gpu_copy_backing(r2d, src_offset, img_data + dst_offset,
+					(size_t)stride * height, &cursor);
+		} else {
+			for (h = 0; h < height; h++) {
+				virtio_gpu_copy_backing(r2d, src_offset,
+						img_data + dst_offset,
+						width * bpp, &cursor);
+				src_offset += stride;
+				dst_offset += stride;
 			}
 		}
+		if (cmd->gpu->check_transfer) {
+			t1 = virtio_gpu_now_ns();
+			bad = virtio_gpu_check_rows(r2d, img_data, req.offset,
+					stride, req.r.y * stride + req.r.x * bpp,
+					width * bpp, height);
+			cmd->gpu->xfer_nr++;
+			cmd->gpu->xfer_bytes += (uint64_t)width * bpp * height;
+			cmd->gpu->xfer_copy_ns += t1 - t0;
+			cmd->gpu->xfer_walk_ns += virtio_gpu_now_ns() - t1;
+			cmd->gpu->xfer_bad_rows += bad;
+			if (bad)
+				pr_err("%s: resource %d: %d of %d rows differ "
+					"from the backing store after a %dx%d+%d+%d "
+					"transfer\n", __func__, req.resource_id,
+					bad, height, req.r.width, req.r.height,
+					req.r.x, req.r.y);
+		}
 		pixman_image_unref(r2d->image);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	}
 
+out:
 	cmd->iolen = sizeof(resp);
 	memcpy(cmd->iov[1].iov_base, &resp, sizeof(resp));
 }
@@ -1303,12 +1477,21 @@ virtio_gpu_cmd_create_blob(struct virtio_gpu_command *cmd)
 
 			r2d->iovcnt = req.nr_entries;
 			for (i = 0; i < req.nr_entries; i++) {
-				r2d->iov[i].iov_base = paddr_guest2host(
-						cmd->gpu->base.dev->vmctx,
-						entries[i].addr,
-						entries[i].length);
+				r2d->iov[i].iov_base =
+					(void *)(uintptr_t)entries[i].addr;
 				r2d->iov[i].iov_len = entries[i].length;
 			}
+			if (vm_map_gpa_iov(cmd->gpu->base.dev->vmctx, r2d->iov,
+					r2d->iovcnt, NULL)) {
+				pr_err("%s: invalid backing entry.\n", __func__);
+				pixman_image_unref(r2d->image);
+				free(iov);
+				free(entries);
+				free(r2d);
+				resp.type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+				memcpy(cmd->iov[cmd->iovcnt - 1].iov_base, &resp, sizeof(resp));
+				return;
+			}
 		}
 
 		free(entries);
@@ -1338,6 +1521,7 @@ virtio_gpu_cmd_set_scanout_blob(struct virtio_gpu_command *cmd)
 	virtio_gpu_update_resp_fence(&cmd->hdr, &resp);
 	if (cmd->gpu->vga.enable) {
 		cmd->gpu->vga.enable = false;
+		virtio_gpu_vga_kick(cmd->gpu);
 	}
 	if (req.scanout_id >= gpu->scanout_num) {
 		pr_err("%s: Invalid scanout_id %d\n", req.scanout_id);
@@ -1592,13 +1776,200 @@ virtio_gpu_notify_cursorq(void *vdev, struct virtio_vq_info *vq)
 	vdpy_submit_bh(gpu->vdpy_handle, &gpu->cursor_bh);
 }
 
+/*
+ * Compare the VBE framebuffer with the copy taken by the last scan and
+ * mark the tiles that changed dirty.  Returns true if anything is dirty.
+ */
+static bool
+virtio_gpu_vga_scan(struct virtio_gpu *gpu)
+{
+	struct gfx_ctx_image *img;
+	const uint32_t *row;
+	uint32_t *shadow;
+	uint8_t *dirty;
+	int tx, ty, ntx, nty, y, y_end, w;
+	bool damaged;
+
+	img = gpu->vga.gc->gc_image;
+	if (img->width <= 0 || img->height <= 0 ||
+	    (uint64_t)img->width * img->height * 4 > VIRTIO_GPU_VGA_FB_SIZE)
+		return false;
+
+	ntx = (img->width + VGA_TILE_WIDTH - 1) / VGA_TILE_WIDTH;
+	nty = (img->height + VGA_TILE_HEIGHT - 1) / VGA_TILE_HEIGHT;
+	damaged = false;
+
+	pthread_mutex_lock(&gpu->vga_damage_mtx);
+	if (ntx != gpu->vga_tiles_x || nty != gpu->vga_tiles_y ||
+	    img->width != gpu->vga_shadow_width ||
+	    img->height != gpu->vga_shadow_height) {
+		free(gpu->vga_shadow);
+		free(gpu->vga_tile_dirty);
+		gpu->vga_shadow = malloc((size_t)img->width * img->height * 4);
+		gpu->vga_tile_dirty = calloc(ntx * nty, sizeof(uint8_t));
+		if (!gpu->vga_shadow || !gpu->vga_tile_dirty) {
+			free(gpu->vga_shadow);
+			free(gpu->vga_tile_dirty);
+			gpu->vga_shadow = NULL;
+			gpu->vga_tile_dirty = NULL;
+			gpu->vga_tiles_x = 0;
+			gpu->vga_tiles_y = 0;
+			gpu->vga_shadow_width = 0;
+			gpu->vga_shadow_height = 0;
+			pthread_mutex_unlock(&gpu->vga_damage_mtx);
+			return false;
+		}
+		gpu->vga_tiles_x = ntx;
+		gpu->vga_tiles_y = nty;
+		gpu->vga_shadow_width = img->width;
+		gpu->vga_shadow_height = img->height;
+		memset(gpu->vga_tile_dirty, 1, ntx * nty);
+		memcpy(gpu->vga_shadow, img->data,
+			(size_t)img->width * img->height * 4);
+		pthread_mutex_unlock(&gpu->vga_damage_mtx);
+		return true;
+	}
+	pthread_mutex_unlock(&gpu->vga_damage_mtx);
+
+	/*
+	 * Only this thread resizes the tables and touches the shadow, so
+	 * they can be walked without the lock. An unchanged scanline costs
+	 * one memcmp; only a changed one is split into tiles, and tiles
+	 * already dirty in this scan are not compared again. The lock is
+	 * taken per tile row to mark the damage, which keeps the display
+	 * thread from waiting on a whole scan.
+	 */
+	for (ty = 0; ty < nty; ty++) {
+		dirty = gpu->vga_tile_dirty + ty * ntx;
+		y_end = MIN((ty + 1) * VGA_TILE_HEIGHT, img->height);
+		pthread_mutex_lock(&gpu->vga_damage_mtx);
+		for (y = ty * VGA_TILE_HEIGHT; y < y_end; y++) {
+			row = img->data + y * img->width;
+			shadow = gpu->vga_shadow + y * img->width;
+			if (!memcmp(row, shadow, img->width * 4))
+				continue;
+			for (tx = 0; tx < ntx; tx++) {
+				if (dirty[tx])
+					continue;
+				w = MIN(VGA_TILE_WIDTH, img->width - tx * VGA_TILE_WIDTH);
+				if (memcmp(row + tx * VGA_TILE_WIDTH,
+					   shadow + tx * VGA_TILE_WIDTH, w * 4))
+					dirty[tx] = 1;
+			}
+			memcpy(shadow, row, img->width * 4);
+			damaged = true;
+		}
+		pthread_mutex_unlock(&gpu->vga_damage_mtx);
+	}
+
+	return damaged;
+}
+
+/*
+ * Turn the dirty tiles into at most max rects and clear them. Runs of
+ * dirty tiles in a row become one rect, which grows downwards while the
+ * next row has the same run. Returns -1 if the damage needs more rects,
+ * the caller then updates the whole surface.
+ */
+static int
+virtio_gpu_vga_collect_damage(struct virtio_gpu *gpu, struct vdpy_rect *rects,
+		int max)
+{
+	struct vdpy_rect r;
+	uint32_t width, height;
+	uint8_t *dirty;
+	int tx, ty, run, i, nr;
+
+	width = gpu->vga.gc->gc_image->width;
+	height = gpu->vga.gc->gc_image->height;
+	nr = 0;
+
+	pthread_mutex_lock(&gpu->vga_damage_mtx);
+	for (ty = 0; ty < gpu->vga_tiles_y; ty++) {
+		dirty = gpu->vga_tile_dirty + ty * gpu->vga_tiles_x;
+		for (tx = 0; tx < gpu->vga_tiles_x; tx += run) {
+			for (run = 0; tx + run < gpu->vga_tiles_x &&
+					dirty[tx + run]; run++)
+				dirty[tx + run] = 0;
+			if (run == 0) {
+				run = 1;
+				continue;
+			}
+			/* tables from before a shrink the scan hasn't seen */
+			if (nr < 0 || tx * VGA_TILE_WIDTH >= width ||
+			    ty * VGA_TILE_HEIGHT >= height)
+				continue;
+
+			r.x = tx * VGA_TILE_WIDTH;
+			r.y = ty * VGA_TILE_HEIGHT;
+			r.width = MIN((tx + run) * VGA_TILE_WIDTH, width) - r.x;
+			r.height = MIN(VGA_TILE_HEIGHT, height - r.y);
+			for (i = nr - 1; i >= 0; i--) {
+				if (rects[i].x == r.x && rects[i].width == r.width &&
+				    rects[i].y + rects[i].height == r.y) {
+					rects[i].height += r.height;
+					break;
+				}
+			}
+			if (i >= 0)
+				continue;
+			if (nr == max)
+				nr = -1;
+			else
+				rects[nr++] = r;
+		}
+	}
+	pthread_mutex_unlock(&gpu->vga_damage_mtx);
+
+	return nr;
+}
+
+static void
+virtio_gpu_vga_kick(struct virtio_gpu *gpu)
+{
+	pthread_mutex_lock(&gpu->vga_damage_mtx);
+	gpu->vga_kicked = true;
+	pthread_cond_signal(&gpu->vga_kick_cond);
+	pthread_mutex_unlock(&gpu->vga_damage_mtx);
+}
+
+/* Sleep for ms or until kicked. Returns true if kicked. */
+static bool
+virtio_gpu_vga_wait(struct virtio_gpu *gpu, int ms)
+{
+	struct timespec ts;
+	bool kicked;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&gpu->vga_damage_mtx);
+	if (!gpu->vga_kicked)
+		pthread_cond_timedwait(&gpu->vga_kick_cond,
+				&gpu->vga_damage_mtx, &ts);
+	kicked = gpu->vga_kicked;
+	gpu->vga_kicked = false;
+	pthread_mutex_unlock(&gpu->vga_damage_mtx);
+
+	return kicked;
+}
+
 static void
 virtio_gpu_vga_bh(void *param)
 {
 	struct virtio_gpu *gpu;
+	struct vdpy_rect rects[VGA_DAMAGE_RECTS_MAX];
+	bool resized;
+	int nr;
 
 	gpu = (struct virtio_gpu*)param;
 
+	resized = false;
 	if ((gpu->vga.surf.width != gpu->vga.gc->gc_image->width) ||
 		(gpu->vga.surf.height != gpu->vga.gc->gc_image->height)) {
 		gpu->vga.surf.width = gpu->vga.gc->gc_image->width;
@@ -1608,20 +1979,34 @@ virtio_gpu_vga_bh(void *param)
 		gpu->vga.surf.surf_format = PIXMAN_a8r8g8b8;
 		gpu->vga.surf.surf_type = SURFACE_PIXMAN;
 		vdpy_surface_set(gpu->vdpy_handle, 0, &gpu->vga.surf);
+		resized = true;
 	}
 
-	vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf);
+	nr = virtio_gpu_vga_collect_damage(gpu, rects, VGA_DAMAGE_RECTS_MAX);
+	if (resized || nr < 0)
+		vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf);
+	else if (nr > 0)
+		vdpy_surface_update_rects(gpu->vdpy_handle, 0, &gpu->vga.surf,
+				rects, nr);
 }
 
 static void *
 virtio_gpu_vga_render(void *param)
 {
 	struct virtio_gpu *gpu;
+	int interval;
 
 	gpu = (struct virtio_gpu*)param;
 	gpu->vga.surf.width = 0;
 	gpu->vga.surf.stride = 0;
-	/* The below logic needs to be refined */
+
+	/* Start over with the whole framebuffer damaged */
+	pthread_mutex_lock(&gpu->vga_damage_mtx);
+	gpu->vga_tiles_x = 0;
+	gpu->vga_tiles_y = 0;
+	pthread_mutex_unlock(&gpu->vga_damage_mtx);
+
+	interval = VGA_SCAN_MIN_MS;
 	while(gpu->vga.enable) {
 		if ((gpu->vga.gc->gc_image->vgamode) && (gpu->vga.dev != NULL)) {
 			vga_render(gpu->vga.gc, gpu->vga.dev);
@@ -1632,8 +2017,16 @@ virtio_gpu_vga_render(void *param)
 		   gpu->vga.gc->gc_image->height != gpu->vga.vberegs.yres) {
 			gc_resize(gpu->vga.gc, gpu->vga.vberegs.xres, gpu->vga.vberegs.yres);
 		}
-		vdpy_submit_bh(gpu->vdpy_handle, &gpu->vga_bh);
-		usleep(33000);
+
+		/* Only wake the display when the guest drew something */
+		if (virtio_gpu_vga_scan(gpu)) {
+			vdpy_submit_bh(gpu->vdpy_handle, &gpu->vga_bh);
+			interval = VGA_SCAN_MIN_MS;
+		} else if (interval < VGA_SCAN_MAX_MS) {
+			interval <<= 1;
+		}
+		if (virtio_gpu_vga_wait(gpu, interval))
+			interval = VGA_SCAN_MIN_MS;
 	}
 
 	pthread_mutex_lock(&gpu->vga_thread_mtx);
@@ -1695,6 +2088,20 @@ virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			gpu->vq,
 			BACKEND_VBSU);
 
+	if (opts) {
+		char *str, *stropts, *tmp;
+
+		stropts = tmp = strdup(opts);
+		while (tmp && (str = strsep(&tmp, ",")) != NULL) {
+			/* the display options are parsed by vdisplay */
+			if (!strcasecmp(str, "check_transfer")) {
+				gpu->check_transfer = true;
+				pr_info("virtio-gpu: checking 2D transfers.\n");
+			}
+		}
+		free(stropts);
+	}
+
 	gpu->scanout_num = 1;
 	gpu->vdpy_handle = vdpy_init(&gpu->scanout_num);
 	gpu->base.mtx = &gpu->mtx;
@@ -1852,6 +2259,8 @@ virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 
 	pthread_mutex_init(&gpu->vga_thread_mtx, NULL);
+	pthread_mutex_init(&gpu->vga_damage_mtx, NULL);
+	pthread_cond_init(&gpu->vga_kick_cond, NULL);
 	/* VGA Compablility */
 	gpu->vga.enable = true;
 	gpu->vga.surf.width = 0;
@@ -1876,6 +2285,14 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return;
 
 	gpu->vga.enable = false;
+	virtio_gpu_vga_kick(gpu);
+
+	if (gpu->check_transfer)
+		pr_info("virtio-gpu: %lu 2D transfers, %lu KB, copy %lu us, "
+			"per-row walk %lu us, %lu rows differed\n",
+			gpu->xfer_nr, gpu->xfer_bytes >> 10,
+			gpu->xfer_copy_ns / 1000, gpu->xfer_walk_ns / 1000,
+			gpu->xfer_bad_rows);
 
 	pthread_mutex_lock(&gpu->vga_thread_mtx);
 	if (atomic_load(&gpu->vga_thread_status) != VGA_THREAD_EOL) {
@@ -1911,6 +2328,10 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	gpu->gpu_scanouts = NULL;
 
 	pthread_mutex_destroy(&gpu->vga_thread_mtx);
+	pthread_mutex_destroy(&gpu->vga_damage_mtx);
+	pthread_cond_destroy(&gpu->vga_kick_cond);
+	free(gpu->vga_shadow);
+	free(gpu->vga_tile_dirty);
 	while (LIST_FIRST(&gpu->r2d_list)) {
 		r2d = LIST_FIRST(&gpu->r2d_list);
 		if (r2d) {
@@ -1924,10 +2345,7 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				r2d->blob = false;
 			}
 			LIST_REMOVE(r2d, link);
-			if (r2d->iov) {
-				free(r2d->iov);
-				r2d->iov = NULL;
-			}
+			virtio_gpu_free_backing(r2d);
 			free(r2d);
 		}
 	}
@@ -1994,6 +2412,8 @@ virtio_gpu_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 				       VIRTIO_GPU_VGA_VBE_SIZE))) {
 			offset -= VIRTIO_GPU_VGA_VBE_OFFSET;
 			vga_vbe_write(ctx, vcpu, &gpu->vga, offset, size, value);
+			/* mode and enable changes need a rescan right away */
+			virtio_gpu_vga_kick(gpu);
 			if ((offset == VBE_DISPI_INDEX_ENABLE) && (value & VBE_DISPI_ENABLED)) {
 				pthread_mutex_lock(&gpu->vga_thread_mtx);
 				if (atomic_load(&gpu->vga_thread_status) == VGA_THREAD_EOL) {
@@ -80,6 +80,7 @@ static int virtio_i2c_debug=0;
 
 #define VIRTIO_I2C_F_ZERO_LENGTH_REQUEST 0
 #define VIRTIO_I2C_HOSTCAPS   (1UL << VIRTIO_F_VERSION_1) | \
+                              (1UL << VIRTIO_F_RING_PACKED) | \
                               (1UL << VIRTIO_I2C_F_ZERO_LENGTH_REQUEST)
 
 static int acpi_i2c_adapter_num = 0;
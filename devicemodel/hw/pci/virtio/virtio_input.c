@@ -46,7 +46,8 @@ static int virtio_input_debug;
 /*
  * Host capabilities
  */
-#define VIRTIO_INPUT_S_HOSTCAPS		(1UL << VIRTIO_F_VERSION_1)
+#define VIRTIO_INPUT_S_HOSTCAPS		((1UL << VIRTIO_F_VERSION_1) | \
+					(1UL << VIRTIO_F_RING_PACKED))
 
 enum virtio_input_config_select {
 	VIRTIO_INPUT_CFG_UNSET		= 0x00,
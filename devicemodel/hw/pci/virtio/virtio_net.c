@@ -29,6 +29,7 @@
 #include <sys/uio.h>
 #include <net/ethernet.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +39,8 @@
 #include <openssl/evp.h>
 #endif
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/errno.h>
 #include <net/if.h>
@@ -51,10 +54,15 @@
 #include "virtio.h"
 #include "vhost.h"
 #include "dm_string.h"
+#include "atomic.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
 
+/* chains completed before the used ring is published */
+#define VIRTIO_NET_RX_BATCH	64
+#define VIRTIO_NET_TX_BATCH	64
+
 /*
  * Host capabilities.  Note that we only offer a few of these.
  */
@@ -77,10 +85,12 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* host supports multiple VQ pairs */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
-	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
+	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1 << VIRTIO_RING_F_EVENT_IDX))
 
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
@@ -90,22 +100,70 @@
 /* is address mcast/bcast? */
 #define ETHER_IS_MULTICAST(addr) (*(addr) & 0x01)
 
+/*
+ * Offloads offered when the tap passes the virtio_net_hdr through.
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS	\
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_HOST_ECN | VIRTIO_NET_F_GUEST_TSO4 | \
+	VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_GUEST_ECN)
+
+#define VIRTIO_NET_F_GUEST_GSO	\
+	(VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)
+
+/*
+ * Largest frame the tap hands over with and without guest GSO
+ */
+#define VIRTIO_NET_MAX_GSO_FRAME	(65535 + ETHER_HDR_LEN)
+#define VIRTIO_NET_MAX_FRAME		(ETHER_MAX_LEN - ETHER_CRC_LEN)
+
+/*
+ * Capabilities only offered when more than one queue pair is configured.
+ */
+#define VIRTIO_NET_S_MQCAPS	(VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ)
+
 /*
  * PCI config-space "registers"
  */
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
  * Queue definitions.
+ *
+ * Queue pair N uses RX queue 2N and TX queue 2N + 1. When VIRTIO_NET_F_MQ
+ * is offered the control queue follows the last pair, but a guest that
+ * does not negotiate MQ expects it at index 2.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_CTLQ	2
+
+#define VIRTIO_NET_MAX_QP	8	/* max queue pairs */
+#define VIRTIO_NET_MAXQ		(VIRTIO_NET_MAX_QP * 2 + 1)
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_RXQ_IDX(qp)	((qp) * 2 + VIRTIO_NET_RXQ)
+#define VIRTIO_NET_TXQ_IDX(qp)	((qp) * 2 + VIRTIO_NET_TXQ)
+
+/*
+ * Control queue definitions
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK		0
+#define VIRTIO_NET_ERR		1
+
+#define VIRTIO_NET_CTRL_MQ	4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN		1
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX		0x8000
 
 /*
  * Fixed network header size
@@ -132,23 +190,67 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* one rx/tx queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
+/*
+ * Per-queue-pair struct. Each pair owns one queue of the multiqueue
+ * tap, an RX event source and a TX thread.
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;		/* queue pair index */
+	int		tapfd;
+	bool		tap_detached;	/* TUNSETQUEUE'd off the tap */
+	struct mevent	*mevp;
+
+	int		rx_ready;
+	int		rx_blocked;	/* tap reads wait for rx buffers */
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	rx_tid;		/* multiqueue only, else on mevp */
+	int		rx_kick_fd;	/* wakes rx_tid */
+	bool		rx_started;
+
+	/*
+	 * A frame read ahead into rx_buf and the rx chains gathered for
+	 * it so far, see virtio_net_rx_deliver().
+	 */
+	uint8_t		*rx_buf;
+	int		rx_pending;	/* bytes in rx_buf, 0 if none */
+	struct iovec	rx_iov[VIRTIO_NET_MAXSEGS];
+	uint16_t	rx_heads[VIRTIO_NET_MAXSEGS];
+	uint16_t	rx_first[VIRTIO_NET_MAXSEGS];	/* first iov of a chain */
+	uint32_t	rx_caps[VIRTIO_NET_MAXSEGS];
+	int		rx_niov;
+	int		rx_nchains;
+	uint32_t	rx_cap;
+
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+	bool		tx_started;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	struct virtio_ops ops;		/* nvq depends on queue pairs */
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
-
-	int		rx_ready;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_QP];
+	int		max_qpairs;	/* queue pairs offered to the guest */
+	int		curr_qpairs;	/* queue pairs enabled by the guest */
+	int		ctlq;		/* index of control queue, or -1 */
+	int		nr_mevents;	/* registered rx events to tear down */
 
 	volatile int	resetting;	/* set and checked outside lock */
 	volatile int	closing;	/* stop the tx i/o thread */
@@ -157,17 +259,13 @@ struct virtio_net {
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_maxframe;	/* largest frame the tap may deliver */
+	bool		vnet_hdr;	/* tap passes virtio_net_hdr through */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
 	struct vhost_net *vhost_net;
@@ -175,7 +273,7 @@ struct virtio_net {
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -183,6 +281,7 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
+static void virtio_net_rx_teardown(void *param);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
 	int tapfd, int vq_idx);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
@@ -191,7 +290,7 @@ static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 2 virtqueues without mq */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -268,36 +367,147 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach or detach one queue of a multiqueue tap, so that the host
+ * only steers packets to queue pairs the guest is polling.
+ */
+static int
+virtio_net_tap_set_queue(struct virtio_net_qpair *qp, bool enable)
+{
+	struct ifreq ifr;
+
+	/* tun refuses to attach or detach a queue twice */
+	if (qp->net->max_qpairs == 1 || qp->tapfd == -1 ||
+	    qp->tap_detached == !enable)
+		return 0;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = enable ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+	if (ioctl(qp->tapfd, TUNSETQUEUE, (void *)&ifr) < 0) {
+		WPRINTF(("vtnet: %s tap queue %d failed: %d\n",
+			enable ? "attach" : "detach", qp->idx, errno));
+		return -1;
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	qp->tap_detached = !enable;
+
+	return 0;
+}
+
+static int
+virtio_net_set_qpairs(struct virtio_net *net, int qpairs)
+{
+	int i;
+
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (virtio_net_tap_set_queue(&net->qpairs[i], i < qpairs) < 0)
+			return -1;
+	}
+	net->curr_qpairs = qpairs;
+
+	return 0;
+}
+
+/*
+ * Match the tap's vnet header size to the header the guest uses, and
+ * let the tap deliver partial checksums and GSO frames only when the
+ * guest negotiated them.
+ */
+static void
+virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	unsigned int offload = 0;
+	int i, hdrlen;
+
+	if (!net->vnet_hdr)
+		return;
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+		if ((net->features & VIRTIO_NET_F_GUEST_ECN) &&
+		    (offload & (TUN_F_TSO4 | TUN_F_TSO6)))
+			offload |= TUN_F_TSO_ECN;
+	}
+
+	hdrlen = net->rx_vhdrlen;
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (net->qpairs[i].tapfd == -1)
+			continue;
+
+		if (ioctl(net->qpairs[i].tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0)
+			WPRINTF(("vtnet: TUNSETVNETHDRSZ failed: %d\n", errno));
+		if (ioctl(net->qpairs[i].tapfd, TUNSETOFFLOAD, offload) < 0)
+			WPRINTF(("vtnet: TUNSETOFFLOAD failed: %d\n", errno));
+	}
+
+	net->rx_maxframe = (offload & (TUN_F_TSO4 | TUN_F_TSO6)) ?
+		VIRTIO_NET_MAX_GSO_FRAME : VIRTIO_NET_MAX_FRAME;
+}
+
+/*
+ * Map the queues to their handlers. Without VIRTIO_NET_F_MQ the guest
+ * looks for the control queue right after the first queue pair.
+ */
+static void virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq);
+static void virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq);
+static void virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq);
+
+static void
+virtio_net_setup_queues(struct virtio_net *net, bool mq)
+{
+	int i;
+
+	for (i = 0; i < net->max_qpairs; i++) {
+		net->queues[VIRTIO_NET_RXQ_IDX(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_RXQ_IDX(i)].notify = virtio_net_ping_rxq;
+		net->queues[VIRTIO_NET_TXQ_IDX(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_TXQ_IDX(i)].notify = virtio_net_ping_txq;
+	}
+
+	if (net->max_qpairs == 1) {
+		net->ctlq = -1;
+		return;
+	}
+
+	net->ctlq = mq ? net->max_qpairs * 2 : VIRTIO_NET_CTLQ;
+	net->queues[net->ctlq].qsize = VIRTIO_NET_RINGSZ;
+	net->queues[net->ctlq].notify = virtio_net_ping_ctlq;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -307,15 +517,29 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->max_qpairs; i++) {
+		virtio_net_txwait(&net->qpairs[i]);
+		virtio_net_rxwait(&net->qpairs[i]);
+		net->qpairs[i].rx_ready = 0;
+		/* the held chains go away with the rings */
+		net->qpairs[i].rx_pending = 0;
+		net->qpairs[i].rx_nchains = 0;
+		net->qpairs[i].rx_niov = 0;
+		net->qpairs[i].rx_cap = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
+	virtio_net_setup_queues(net, true);
+
+	net->features = 0;
+	virtio_net_tap_set_offload(net);
+
+	/* the guest starts over with a single queue pair */
+	virtio_net_set_qpairs(net, 1);
 
 	net->resetting = 0;
 	net->closing = 0;
@@ -325,29 +549,33 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (!qp->tx_started)
+		return;
+
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
+	qp->tx_started = false;
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -360,7 +588,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -368,10 +596,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
  *  Called when there is read activity on the tap file descriptor.
  * Each buffer posted by the guest is assumed to be able to contain
  * an entire ethernet frame + rx header.
- *  MP note: the dummybuf is only used for discarding frames, so there
- * is no need for it to be per-vtnet or locked.
  */
-static uint8_t dummybuf[2048];
 
 static inline struct iovec *
 rx_iov_trim(struct iovec *iov, int *niov, int tlen)
@@ -400,54 +625,87 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+/*
+ * Let the tap reader of the pair run again after virtio_net_rx_block().
+ */
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_rx_resume(struct virtio_net_qpair *qp)
 {
+	if (qp->mevp)
+		mevent_enable(qp->mevp);
+	else if (qp->rx_started)
+		eventfd_write(qp->rx_kick_fd, 1);
+}
+
+/*
+ * Stop reading the tap until the guest posts rx buffers. Frames are
+ * left queued in the tap instead of being dropped, and the rxq kick
+ * in virtio_net_ping_rxq() resumes reading.
+ */
+static void
+virtio_net_rx_block(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	if (qp->mevp == NULL && !qp->rx_started)
+		return;
+
+	/* the rx thread stops polling the tap once it sees rx_blocked */
+	if (qp->mevp)
+		mevent_disable(qp->mevp);
+	atomic_store(&qp->rx_blocked, 1);
+
+	if (vq_ring_ready(vq) && qp->rx_ready) {
+		vq_clear_used_ring_flags(&qp->net->base, vq);
+		/* memory barrier */
+		mb();
+		/* catch buffers posted before notification was enabled */
+		if (vq_has_descs(vq) && atomic_xchg(&qp->rx_blocked, 0))
+			virtio_net_rx_resume(qp);
+	}
+}
+
+static void
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
+{
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
 	struct virtio_vq_info *vq;
 	void *vrx;
-	int len, n;
+	int len, n, batch;
 	uint16_t idx;
-	ssize_t ret;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
 
+	vq = &net->queues[VIRTIO_NET_RXQ_IDX(qp->idx)];
+
 	/*
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
-		/*
-		 * Drop the packet and try later.
-		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
+	if (!qp->rx_ready || net->resetting) {
+		virtio_net_rx_block(qp, vq);
 		return;
 	}
 
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
-		 * Drop the packet and try later.  Interrupt on
-		 * empty, if that's negotiated.
+		 * Leave the frame in the tap and wait for buffers.
+		 * Interrupt on empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
+		virtio_net_rx_block(qp, vq);
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	batch = 0;
 	do {
 		/*
 		 * Get descriptor chain.
@@ -455,6 +713,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
 		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
 			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
+			vq_endchains(vq, 0);
 			return;
 		}
 		/*
@@ -463,16 +722,20 @@ virtio_net_tap_rx(struct virtio_net *net)
 		 */
 		vrx = iov[0].iov_base;
 		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
+		if (riov == NULL) {
+			vq_endchains(vq, 0);
 			return;
+		}
 
-		len = readv(net->tapfd, riov, n);
+		len = readv(qp->tapfd, riov, n);
 
-		if (len < 0 && errno == EWOULDBLOCK) {
+		if (len < 0) {
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
+			if (errno != EWOULDBLOCK)
+				WPRINTF(("vtnet: tap read failed: %d\n", errno));
 			vq_retchain(vq);
 			vq_endchains(vq, 0);
 			return;
@@ -492,25 +755,250 @@ virtio_net_tap_rx(struct virtio_net *net)
 		}
 
 		/*
-		 * Release this chain and handle more chains.
+		 * Complete this chain and handle more chains. The used
+		 * ring is published once per batch.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
+		vq_relchain_prepare(vq, idx, len + net->rx_vhdrlen);
+		if (++batch == VIRTIO_NET_RX_BATCH) {
+			vq_relchain_publish(vq);
+			batch = 0;
+		}
 	} while (vq_has_descs(vq));
 
-	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	/*
+	 * The ring ran dry with frames possibly still queued in the tap.
+	 * Interrupt if needed, including for NOTIFY_ON_EMPTY.
+	 */
+	virtio_net_rx_block(qp, vq);
+	vq_endchains(vq, 1);
+}
+
+/*
+ * Hand the frame held in rx_buf to the guest. Chains are gathered until
+ * they hold it and stay gathered, across calls, while the guest has
+ * too few buffers, so vq_has_descs() only reports buffers added since.
+ * Returns the number of chains completed, 0 if the frame still waits
+ * for buffers, or -1 if it was dropped.
+ */
+static int
+virtio_net_rx_deliver(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = qp->net;
+	uint8_t *src = qp->rx_buf;
+	uint32_t len, cap, m;
+	int n, i, c, used;
+
+	while (qp->rx_cap < (uint32_t)qp->rx_pending &&
+	       (net->rx_merge || qp->rx_nchains == 0) &&
+	       qp->rx_niov < VIRTIO_NET_MAXSEGS) {
+		if (!vq_has_descs(vq))
+			return 0;
+
+		c = qp->rx_nchains;
+		n = vq_getchain(vq, &qp->rx_heads[c], &qp->rx_iov[qp->rx_niov],
+				VIRTIO_NET_MAXSEGS - qp->rx_niov, NULL);
+		if (n < 1) {
+			WPRINTF(("vtnet: virtio_net_rx_deliver: vq_getchain = %d\n", n));
+			/*
+			 * vq_getchain() dropped the failing chain, so the
+			 * ones taken before it can't be rewound; complete
+			 * them empty so the guest gets them back.
+			 */
+			for (i = 0; i < c; i++)
+				vq_relchain_prepare(vq, qp->rx_heads[i], 0);
+			goto drop;
+		}
+
+		qp->rx_first[c] = qp->rx_niov;
+		qp->rx_caps[c] = 0;
+		for (i = qp->rx_niov; i < qp->rx_niov + n; i++)
+			qp->rx_caps[c] += qp->rx_iov[i].iov_len;
+		qp->rx_cap += qp->rx_caps[c];
+		qp->rx_niov += n;
+		qp->rx_nchains++;
+	}
+
+	if (qp->rx_cap < (uint32_t)qp->rx_pending) {
+		WPRINTF(("vtnet: %d byte frame does not fit the rx buffers\n",
+			qp->rx_pending));
+		while (qp->rx_nchains-- > 0)
+			vq_retchain(vq);
+		goto drop;
+	}
+
+	if (net->rx_merge)
+		((struct virtio_net_rxhdr *)src)->vrh_bufs = qp->rx_nchains;
+
+	len = qp->rx_pending;
+	for (c = 0; c < qp->rx_nchains; c++) {
+		cap = len < qp->rx_caps[c] ? len : qp->rx_caps[c];
+		len -= cap;
+		vq_relchain_prepare(vq, qp->rx_heads[c], cap);
+
+		for (i = qp->rx_first[c]; cap > 0; i++) {
+			m = cap < qp->rx_iov[i].iov_len ? cap : qp->rx_iov[i].iov_len;
+			memcpy(qp->rx_iov[i].iov_base, src, m);
+			src += m;
+			cap -= m;
+		}
+	}
+	used = qp->rx_nchains;
+
+	qp->rx_pending = 0;
+	qp->rx_nchains = 0;
+	qp->rx_niov = 0;
+	qp->rx_cap = 0;
+	return used;
+
+drop:
+	qp->rx_pending = 0;
+	qp->rx_nchains = 0;
+	qp->rx_niov = 0;
+	qp->rx_cap = 0;
+	return -1;
+}
+
+/*
+ * The first chain of the next frame, n iovs holding cap bytes, may be
+ * too small for it. Read the frame into rx_buf instead and hold the
+ * chain for virtio_net_rx_deliver(). The caller returns the chain if
+ * nothing could be read.
+ */
+static int
+virtio_net_rx_read_aside(struct virtio_net_qpair *qp, int n, uint32_t cap)
+{
+	struct virtio_net *net = qp->net;
+	int len;
+
+	if (qp->rx_buf == NULL) {
+		qp->rx_buf = malloc(VIRTIO_NET_MAX_GSO_FRAME +
+				    sizeof(struct virtio_net_rxhdr));
+		if (qp->rx_buf == NULL) {
+			WPRINTF(("vtnet: no memory for rx_buf\n"));
+			return -1;
+		}
+	}
+
+	len = read(qp->tapfd, qp->rx_buf, net->rx_maxframe + net->rx_vhdrlen);
+	if (len < 0) {
+		if (errno != EWOULDBLOCK)
+			WPRINTF(("vtnet: tap read failed: %d\n", errno));
+		return -1;
+	}
+
+	qp->rx_pending = len;
+	qp->rx_first[0] = 0;
+	qp->rx_caps[0] = cap;
+	qp->rx_cap = cap;
+	qp->rx_niov = n;
+	qp->rx_nchains = 1;
+	return 0;
+}
+
+/*
+ * Receive path for a tap opened with IFF_VNET_HDR. The tap writes the
+ * virtio_net_hdr itself. A chain that can hold the largest frame the
+ * tap may deliver gets it read straight in, header included. Otherwise
+ * the frame is read into rx_buf first, to learn its size, and copied
+ * into as many merged rx buffers as it needs; their count goes into
+ * the header. A frame is never read into buffers that could truncate it.
+ */
+static void
+virtio_net_tap_rx_vnet(struct virtio_net_qpair *qp)
+{
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq;
+	int len, n, i, used, batch;
+	uint32_t cap;
+
+	if (qp->tapfd == -1) {
+		WPRINTF(("vtnet: tapfd == -1\n"));
+		return;
+	}
+
+	vq = &net->queues[VIRTIO_NET_RXQ_IDX(qp->idx)];
+
+	if (!qp->rx_ready || net->resetting) {
+		virtio_net_rx_block(qp, vq);
+		return;
+	}
+
+	if (!vq_has_descs(vq)) {
+		virtio_net_rx_block(qp, vq);
+		vq_endchains(vq, 1);
+		return;
+	}
+
+	batch = 0;
+	do {
+		if (qp->rx_pending == 0) {
+			n = vq_getchain(vq, &qp->rx_heads[0], qp->rx_iov,
+					VIRTIO_NET_MAXSEGS, NULL);
+			if (n < 1) {
+				WPRINTF(("vtnet: virtio_net_tap_rx_vnet: vq_getchain = %d\n", n));
+				vq_endchains(vq, 0);
+				return;
+			}
+
+			if (qp->rx_iov[0].iov_len < net->rx_vhdrlen) {
+				WPRINTF(("vtnet: rx header does not fit in %lu bytes\n",
+					qp->rx_iov[0].iov_len));
+				vq_retchain(vq);
+				vq_endchains(vq, 0);
+				return;
+			}
+
+			cap = 0;
+			for (i = 0; i < n; i++)
+				cap += qp->rx_iov[i].iov_len;
+
+			if (cap < net->rx_maxframe + net->rx_vhdrlen) {
+				if (virtio_net_rx_read_aside(qp, n, cap) < 0) {
+					vq_retchain(vq);
+					vq_endchains(vq, 0);
+					return;
+				}
+			} else {
+				len = readv(qp->tapfd, qp->rx_iov, n);
+				if (len < 0) {
+					if (errno != EWOULDBLOCK)
+						WPRINTF(("vtnet: tap read failed: %d\n", errno));
+					vq_retchain(vq);
+					vq_endchains(vq, 0);
+					return;
+				}
+				if (net->rx_merge)
+					((struct virtio_net_rxhdr *)qp->rx_iov[0].iov_base)->vrh_bufs = 1;
+				vq_relchain_prepare(vq, qp->rx_heads[0], len);
+			}
+		}
+
+		used = qp->rx_pending ? virtio_net_rx_deliver(qp, vq) : 1;
+		if (used == 0)
+			break;
+		if (used < 0)
+			continue;
+		batch += used;
+		if (batch >= VIRTIO_NET_RX_BATCH) {
+			vq_relchain_publish(vq);
+			batch = 0;
+		}
+	} while (vq_has_descs(vq));
+
+	virtio_net_rx_block(qp, vq);
 	vq_endchains(vq, 1);
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
@@ -518,20 +1006,80 @@ static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[vq->num / 2];
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		if (vq->used != NULL) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
+		if (vq_ring_ready(vq)) {
+			vq_set_used_ring_flags(&net->base, vq);
 		}
 	}
+
+	/*
+	 * The guest posted buffers, resume reading from the tap.
+	 */
+	if (atomic_xchg(&qp->rx_blocked, 0)) {
+		if (vq_ring_ready(vq))
+			vq_set_used_ring_flags(&net->base, vq);
+		virtio_net_rx_resume(qp);
+	}
+}
+
+/*
+ * With several queue pairs each one reads its tap queue on its own
+ * thread, so receive scales with the pairs instead of sharing the
+ * mevent thread. rx_kick_fd wakes it up to resume or to exit.
+ */
+static void *
+virtio_net_rx_thread(void *param)
+{
+	struct virtio_net_qpair *qp = param;
+	struct pollfd pfd[2];
+	eventfd_t val;
+
+	pfd[0].fd = qp->tapfd;
+	pfd[1].fd = qp->rx_kick_fd;
+	pfd[1].events = POLLIN;
+
+	while (!qp->net->closing) {
+		pfd[0].events = atomic_load(&qp->rx_blocked) ? 0 : POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			WPRINTF(("vtnet: rx%d poll failed: %d\n", qp->idx, errno));
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			eventfd_read(qp->rx_kick_fd, &val);
+		if (pfd[0].revents & POLLIN)
+			virtio_net_rx_callback(qp->tapfd, EVF_READ, qp);
+	}
+
+	return NULL;
+}
+
+static void
+virtio_net_rx_stop(struct virtio_net_qpair *qp)
+{
+	void *jval;
+
+	if (!qp->rx_started)
+		return;
+
+	qp->net->closing = 1;
+	eventfd_write(qp->rx_kick_fd, 1);
+	pthread_join(qp->rx_tid, &jval);
+	close(qp->rx_kick_fd);
+	qp->rx_kick_fd = -1;
+	qp->rx_started = false;
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
 	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
 	int i, n;
@@ -556,16 +1104,21 @@ virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
 	}
 
 	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	if (qp->net->vnet_hdr)
+		/* the tap consumes the header as is */
+		qp->net->virtio_net_tx(qp, iov, n, plen);
+	else
+		qp->net->virtio_net_tx(qp, &iov[1], n - 1, plen);
 
 	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	vq_relchain_prepare(vq, idx, tlen);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[vq->num / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -574,11 +1127,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	vq_set_used_ring_flags(&net->base, vq);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -587,27 +1140,29 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ_IDX(qp->idx)];
+	int batch;
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -621,44 +1176,121 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(&net->base, vq);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
+		batch = 0;
 		do {
 			/*
 			 * Run through entries, placing them into
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
+
+			/* let the guest reclaim buffers once per batch */
+			if (++batch == VIRTIO_NET_TX_BATCH) {
+				vq_relchain_publish(vq);
+				batch = 0;
+			}
 		} while (vq_has_descs(vq));
 
 		/*
-		 * Generate an interrupt if needed.
+		 * Publish the rest and generate an interrupt if needed.
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
 }
 
-#ifdef notyet
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, uint8_t cmd, struct iovec *iov,
+		   int n)
+{
+	uint16_t qpairs;
+
+	if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET || n < 1 ||
+	    iov[0].iov_len < sizeof(qpairs))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&qpairs, iov[0].iov_base, sizeof(qpairs));
+	if (qpairs < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
+	    qpairs > net->max_qpairs ||
+	    !(net->features & VIRTIO_NET_F_MQ))
+		return VIRTIO_NET_ERR;
+
+	DPRINTF(("vtnet: guest enables %d queue pairs\n\r", qpairs));
+	if (virtio_net_set_qpairs(net, qpairs) < 0)
+		return VIRTIO_NET_ERR;
+
+	return VIRTIO_NET_OK;
+}
+
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	uint8_t *ack;
+	uint16_t idx;
+	int n;
+
+	while (vq_has_descs(vq)) {
+		/*
+		 * A control command is a readable header, the command
+		 * specific data and a writable ack byte.
+		 */
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, flags);
+		if (n <= 0 || n > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n", n));
+			break;
+		}
+
+		ack = iov[n - 1].iov_base;
+		if (n < 2 || iov[0].iov_len < sizeof(*hdr) ||
+		    (flags[n - 1] & VRING_DESC_F_WRITE) == 0) {
+			WPRINTF(("vtnet: malformed control command\n"));
+			/* fail the command if there is room for the ack at all */
+			if ((flags[n - 1] & VRING_DESC_F_WRITE) &&
+			    iov[n - 1].iov_len >= sizeof(*ack)) {
+				*ack = VIRTIO_NET_ERR;
+				vq_relchain(vq, idx, sizeof(*ack));
+			} else
+				vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = iov[0].iov_base;
+
+		switch (hdr->class) {
+		case VIRTIO_NET_CTRL_MQ:
+			*ack = virtio_net_ctrl_mq(net, hdr->cmd, &iov[1], n - 2);
+			break;
+		default:
+			DPRINTF(("vtnet: unsupported control class %d\n\r",
+				hdr->class));
+			*ack = VIRTIO_NET_ERR;
+			break;
+		}
+
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
+
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -738,10 +1370,11 @@ virtio_net_is_macvtap(char *devname, int *ifindex)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool mq, bool *vnet_hdr)
 {
 	char tbuf[IFNAMSIZ];
 	int tunfd, rc, macvtap_index;
+	unsigned int features;
 	struct ifreq ifr;
 
 	/*Check if tun/tap or macvtap interface is used */
@@ -764,6 +1397,16 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (mq)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+
+	if (*vnet_hdr) {
+		if (ioctl(tunfd, TUNGETFEATURES, &features) < 0 ||
+		    !(features & IFF_VNET_HDR))
+			*vnet_hdr = false;
+		else
+			ifr.ifr_flags |= IFF_VNET_HDR;
+	}
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -782,38 +1425,72 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Open one tap queue per queue pair. If the tap refuses some of
+ * them, the device is offered with the pairs that could be opened.
+ */
+static int
+virtio_net_tap_open_queues(struct virtio_net *net, char *devname)
+{
+	struct virtio_net_qpair *qp;
+	int opt = 1;
+	int i;
+
+	for (i = 0; i < net->max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->tapfd = virtio_net_tap_open(devname, net->max_qpairs > 1,
+						&net->vnet_hdr);
+		if (qp->tapfd == -1)
+			break;
+
+		/*
+		 * Set non-blocking and register for read
+		 * notifications with the event loop
+		 */
+		if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			close(qp->tapfd);
+			qp->tapfd = -1;
+			break;
+		}
+	}
+
+	if (i > 0 && i < net->max_qpairs) {
+		WPRINTF(("vtnet: only %d of %d tap queues opened\n",
+			i, net->max_qpairs));
+		net->max_qpairs = i;
+	}
+
+	return i;
+}
+
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[IFNAMSIZ];
+	struct virtio_net_qpair *qp;
 	int vhost_fd = -1;
-	int rc;
+	int rc, i;
 
 	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
 		WPRINTF(("Failed to set tap device name %s\n", tbuf));
 
-	net->virtio_net_rx = virtio_net_tap_rx;
-	net->virtio_net_tx = virtio_net_tap_tx;
-
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
+	/*
+	 * vhost-net owns the virtio_net_hdr itself, so the tap only
+	 * carries it for the userspace backend.
+	 */
+	net->vnet_hdr = !net->use_vhost;
+	if (virtio_net_tap_open_queues(net, tbuf) == 0) {
 		WPRINTF(("open of tap device %s failed\n", tbuf));
+		net->vnet_hdr = false;
 		return;
 	}
 	DPRINTF(("open of tap device %s success!\n", tbuf));
 
-	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
-	 */
-	int opt = 1;
-
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
-	}
+	net->virtio_net_rx = net->vnet_hdr ? virtio_net_tap_rx_vnet :
+		virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
 
 	if (net->use_vhost) {
 		vhost_fd = open("/dev/vhost-net", O_RDWR);
@@ -821,7 +1498,7 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->qpairs[0].tapfd, 0);
 			if (!net->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
@@ -831,18 +1508,46 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 		}
 	}
 
-	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+	/* multiqueue pairs get their own rx thread in virtio_net_init() */
+	if (vhost_fd >= 0 || net->max_qpairs > 1)
+		return;
+
+	for (i = 0; i < net->max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->mevp = mevent_add(qp->tapfd, EVF_READ,
+				      virtio_net_rx_callback, qp,
+				      virtio_net_rx_teardown, qp);
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+			close(qp->tapfd);
+			qp->tapfd = -1;
+			continue;
 		}
+		net->nr_mevents++;
 	}
 }
 
+/*
+ * Hand both rings to a vhost-user backend listening on path. There is
+ * no tap on our side; the backend owns the packet path end to end.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, char *path)
+{
+	int sockfd;
+
+	sockfd = vhost_user_connect(path);
+	if (sockfd < 0) {
+		WPRINTF(("vtnet: connect to vhost-user %s failed\n", path));
+		return;
+	}
+
+	net->vhost_net = vhost_net_init(&net->base, sockfd, -1, 0);
+	/* a failed vhost_dev_init has closed the socket already */
+	if (!net->vhost_net)
+		WPRINTF(("vtnet: vhost-user init on %s failed\n", path));
+}
+
 static int
 virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -860,7 +1565,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int rc, i;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -887,6 +1593,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 */
 	mac_provided = 0;
 	net->vhost_net = NULL;
+	net->max_qpairs = 1;
 	if (opts != NULL) {
 		int err;
 
@@ -897,7 +1604,9 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			return -1;
 		}
 
-		(void) strsep(&vtopts, ",");
+		/* the first token names the backend */
+		if (!strncmp(strsep(&vtopts, ","), "vhost-user=", 11))
+			net->use_vhost = true;
 
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
@@ -911,28 +1620,48 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					return err;
 				}
 				mac_provided = 1;
+			} else if (!strncmp(opt, "mq=", 3)) {
+				if (dm_strtoi(opt + 3, NULL, 10,
+					&net->max_qpairs) ||
+				    net->max_qpairs < 1 ||
+				    net->max_qpairs > VIRTIO_NET_MAX_QP) {
+					WPRINTF(("virtio_net: invalid mq %s, "
+						"range is 1-%d\n", opt + 3,
+						VIRTIO_NET_MAX_QP));
+					free(devopts);
+					free(net);
+					return -1;
+				}
 			}
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	if (net->use_vhost && net->max_qpairs > 1) {
+		WPRINTF(("virtio_net: vhost supports a single queue pair, "
+			"mq is ignored\n"));
+		net->max_qpairs = 1;
+	}
+
+	/*
+	 * Each device carries its own ops so that the number of
+	 * virtqueues follows the configured queue pairs.
+	 */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = net->max_qpairs * 2 + 1;
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
-	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+
+	for (i = 0; i < VIRTIO_NET_MAX_QP; i++) {
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+	}
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
 
 	if (!devopts) {
 		WPRINTF(("virtio_net: invalid optional argument\n"));
@@ -944,7 +1673,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		vtopts = tmp = strdup(opts);
 	}
 
-	if ((tmp != NULL) && (strncmp(tmp, "tap", 3) == 0)) {
+	if ((tmp != NULL) && ((strncmp(tmp, "tap", 3) == 0) ||
+	    (strncmp(tmp, "vhost-user=", 11) == 0))) {
 		type = strsep(&tmp, "=");
 		name = strsep(&tmp, ",");
 	}
@@ -958,6 +1688,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 		if (strcmp(type, "tap") == 0) {
 			virtio_net_tap_setup(net, name);
+		} else if (strcmp(type, "vhost-user") == 0) {
+			virtio_net_vhost_user_setup(net, name);
 		}
 	}
 
@@ -997,6 +1729,33 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	free(vtopts);
 	free(devopts);
 
+	/*
+	 * The tap may have granted fewer queues than requested, so the
+	 * queue layout is only fixed now.
+	 */
+	if (net->max_qpairs > 1) {
+		net->ops.nvq = net->max_qpairs * 2 + 1;
+		net->ops.cfgsize = sizeof(struct virtio_net_config);
+		net->base.device_caps = VIRTIO_NET_S_HOSTCAPS |
+			VIRTIO_NET_S_MQCAPS;
+		net->config.max_virtqueue_pairs = net->max_qpairs;
+	} else {
+		net->ops.nvq = 2;
+		net->ops.cfgsize = offsetof(struct virtio_net_config,
+			max_virtqueue_pairs);
+		net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	}
+	if (net->vnet_hdr)
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+	virtio_net_setup_queues(net, true);
+	/*
+	 * Only the first pair runs until the guest enables more with
+	 * VIRTIO_NET_CTRL_MQ, so keep the tap from steering flows to the
+	 * other queues.
+	 */
+	if (virtio_net_set_qpairs(net, 1) < 0)
+		net->curr_qpairs = 1;
+
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_NET);
 	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
@@ -1008,7 +1767,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -1025,22 +1784,51 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	virtio_net_tap_set_offload(net);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphore & spawn one TX processing thread
+	 * per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		if (pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+				   (void *)qp)) {
+			WPRINTF(("vtnet: tx thread %d create failed\n", i));
+			continue;
+		}
+		qp->tx_started = true;
+		if (i == 0)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		pthread_setname_np(qp->tx_tid, tname);
+
+		if (qp->tapfd < 0 || qp->mevp != NULL || net->vhost_net)
+			continue;
+		qp->rx_kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (qp->rx_kick_fd < 0 ||
+		    pthread_create(&qp->rx_tid, NULL, virtio_net_rx_thread,
+				   (void *)qp)) {
+			WPRINTF(("vtnet: rx thread %d create failed\n", i));
+			if (qp->rx_kick_fd >= 0)
+				close(qp->rx_kick_fd);
+			qp->rx_kick_fd = -1;
+			continue;
+		}
+		qp->rx_started = true;
+		snprintf(tname, sizeof(tname), "vtnet-%d:%d rx%d",
+			 dev->slot, dev->func, i);
+		pthread_setname_np(qp->rx_tid, tname);
+	}
 
 	return 0;
 }
@@ -1092,6 +1880,12 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	if (net->max_qpairs > 1)
+		virtio_net_setup_queues(net,
+			(net->features & VIRTIO_NET_F_MQ) != 0);
+
+	virtio_net_tap_set_offload(net);
 }
 
 static void
@@ -1105,8 +1899,8 @@ virtio_net_set_status(void *vdev, uint64_t status)
 
 	if (!net->vhost_net->vhost_started &&
 		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+		if (net->qpairs[0].mevp)
+			mevent_disable(net->qpairs[0].mevp);
 
 		rc = vhost_net_start(net->vhost_net);
 		if (rc < 0) {
@@ -1125,30 +1919,59 @@ static void
 virtio_net_teardown(void *param)
 {
 	struct virtio_net *net;
+	int i;
 
 	net = (struct virtio_net *)param;
 	if (!net)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
+	if (net->qpairs[0].tapfd < 0)
 		pr_err("net->tapfd is -1!\n");
 
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (net->qpairs[i].tapfd >= 0) {
+			close(net->qpairs[i].tapfd);
+			net->qpairs[i].tapfd = -1;
+		}
+		free(net->qpairs[i].rx_buf);
+	}
+
 	virtio_reset_dev(&net->base);
 	free(net);
 }
 
+/*
+ * Teardown of one rx event. The device goes away with the last one.
+ */
+static void
+virtio_net_rx_teardown(void *param)
+{
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+
+	if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
+	}
+
+	if (atomic_sub_fetch(&net->nr_mevents, 1) == 0)
+		virtio_net_teardown(net);
+}
+
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct mevent *mevps[VIRTIO_NET_MAX_QP];
+	int i, nr_mevps = 0;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < net->max_qpairs; i++) {
+			virtio_net_tx_stop(&net->qpairs[i]);
+			virtio_net_rx_stop(&net->qpairs[i]);
+		}
 
 		if (net->vhost_net) {
 			vhost_net_stop(net->vhost_net);
@@ -1157,9 +1980,18 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			net->vhost_net = NULL;
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
+		/*
+		 * The last deleted event frees net, so collect them first.
+		 */
+		for (i = 0; i < net->max_qpairs; i++) {
+			if (net->qpairs[i].mevp != NULL)
+				mevps[nr_mevps++] = net->qpairs[i].mevp;
+		}
+
+		if (nr_mevps > 0) {
+			for (i = 0; i < nr_mevps; i++)
+				mevent_delete(mevps[i]);
+		} else
 			virtio_net_teardown(net);
 
 		DPRINTF(("%s: done\n", __func__));
@@ -1172,10 +2004,18 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
-	uint64_t vhost_ext_features =  1 << VHOST_NET_F_VIRTIO_NET_HDR;
+	uint64_t vhost_ext_features = 0;
 	uint32_t busyloop_timeout = 0;
 	int rc;
 
+	/*
+	 * VHOST_NET_F_VIRTIO_NET_HDR only means something to the vhost-net
+	 * kernel driver. A vhost-user backend, which has no tap on our side,
+	 * would read the same bit 27 as ANY_LAYOUT.
+	 */
+	if (tapfd >= 0)
+		vhost_ext_features = 1 << VHOST_NET_F_VIRTIO_NET_HDR;
+
 	vhost_net = calloc(1, sizeof(struct vhost_net));
 	if (!vhost_net) {
 		WPRINTF(("vhost init out of memory\n"));
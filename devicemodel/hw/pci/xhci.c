@@ -443,6 +443,9 @@ struct pci_xhci_vdev {
 	struct pci_xhci_native_port native_ports[XHCI_MAX_VIRT_PORTS];
 	struct timespec init_time;
 	uint32_t	quirks;
+
+	uint64_t	intr_raised;	/* interrupts sent to the guest */
+	uint64_t	intr_coalesced;	/* folded into a pending one */
 };
 
 /* portregs and devices arrays are set up to start from idx=1 */
@@ -1215,6 +1218,7 @@ pci_xhci_reset(struct pci_xhci_vdev *xdev)
 	xdev->rtsregs.er_enq_idx = 0;
 	xdev->rtsregs.er_enq_seg = 0;
 	xdev->rtsregs.event_pcs = 1;
+	xdev->rtsregs.intrreg.erdp &= ~XHCI_ERDP_LO_BUSY;
 	struct pci_xhci_dev_emu *dev;
 
 	for (i = 1; i <= XHCI_MAX_DEVS; i++)
@@ -1568,14 +1572,25 @@ pci_xhci_trb_next(struct pci_xhci_vdev *xdev,
 static void
 pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
 {
+	/*
+	 * While the event handler busy bit is set, the guest has yet to
+	 * consume the events of the last interrupt and will find the new
+	 * ones with them. Don't interrupt again until it clears the bit
+	 * (xHCI 4.17.2), which coalesces a burst of completions into one.
+	 */
+	if (xdev->rtsregs.intrreg.erdp & XHCI_ERDP_LO_BUSY) {
+		xdev->intr_coalesced++;
+		return;
+	}
 
-	xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
 	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
 	xdev->opregs.usbsts |= XHCI_STS_EINT;
 
 	/* only trigger interrupt if permitted */
 	if ((xdev->opregs.usbcmd & XHCI_CMD_INTE) &&
 	    (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_ENA)) {
+		xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
+		xdev->intr_raised++;
 		if (pci_msi_enabled(xdev->dev))
 			pci_generate_msi(xdev->dev, 0);
 		else
@@ -1583,6 +1598,21 @@ pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
 	}
 }
 
+/* Whether the event ring holds events past the guest's dequeue pointer */
+static bool
+pci_xhci_event_pending(struct pci_xhci_vdev *xdev)
+{
+	struct pci_xhci_rtsregs *rts = &xdev->rtsregs;
+	uint64_t enq;
+
+	if (rts->erstba_p == NULL)
+		return false;
+
+	enq = rts->erstba_p[rts->er_enq_seg].qwRingSegBase +
+		rts->er_enq_idx * sizeof(struct xhci_trb);
+	return (rts->intrreg.erdp & ~0xFUL) != enq;
+}
+
 static void
 pci_xhci_deassert_interrupt(struct pci_xhci_vdev *xdev)
 {
@@ -2976,8 +3006,9 @@ pci_xhci_xfer_complete(struct pci_xhci_vdev *xdev, struct usb_xfer *xfer,
 			edtla = 0;
 		}
 
+		/* the caller interrupts once for all events of this xfer */
 		*do_intr = 1;
-		if (pci_xhci_insert_event(xdev, &evtrb, 1) != 0) {
+		if (pci_xhci_insert_event(xdev, &evtrb, 0) != 0) {
 			UPRINTF(LFTL, "Failed to inject xfer complete event!\r\n");
 			return err;
 		}
@@ -3304,8 +3335,18 @@ retry:
 		/* handle current batch that requires interrupt on complete */
 		if (trbflags & XHCI_TRB_3_IOC_BIT) {
 			UPRINTF(LDBG, "trb IOC bit set\r\n");
-			do_retry = 1;
-			break;
+			if (epid == 1) {
+				do_retry = 1;
+				break;
+			}
+
+			/*
+			 * A data TD ends here. Keep collecting the TDs queued
+			 * behind it, they are all submitted together below as
+			 * one native request each.
+			 */
+			if (xfer_block)
+				xfer_block->xfer_end = 1;
 		}
 	}
 
@@ -3536,12 +3577,15 @@ pci_xhci_rtsregs_write(struct pci_xhci_vdev *xdev,
 			MASK_64_HI(xdev->rtsregs.intrreg.erdp) |
 			(rts->intrreg.erdp & XHCI_ERDP_LO_BUSY) |
 			(value & ~0xF);
+		rts->er_deq_seg = XHCI_ERDP_LO_SINDEX(value);
 		if (value & XHCI_ERDP_LO_BUSY) {
 			rts->intrreg.erdp &= ~XHCI_ERDP_LO_BUSY;
 			rts->intrreg.iman &= ~XHCI_IMAN_INTR_PEND;
-		}
 
-		rts->er_deq_seg = XHCI_ERDP_LO_SINDEX(value);
+			/* events queued after the guest stopped reading */
+			if (pci_xhci_event_pending(xdev))
+				pci_xhci_assert_interrupt(xdev);
+		}
 		break;
 
 	case 0x1C:
@@ -4679,7 +4723,8 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	xdev = dev->arg;
 
-	UPRINTF(LINF, "de-initialization\r\n");
+	UPRINTF(LINF, "de-initialization, %lu interrupts raised, %lu coalesced\r\n",
+		xdev->intr_raised, xdev->intr_coalesced);
 
 	for (i = 1; i <= XHCI_MAX_DEVS; ++i) {
 		de = xdev->devices[i];
@@ -375,35 +375,41 @@ usb_dev_prepare_xfer(struct usb_xfer *xfer, int *head, int *tail)
 	idx = xfer->head;
 	first = -1;
 	size = 0;
+	*head = -1;
 	if (idx < 0 || idx >= xfer->max_blk_cnt)
 		return -1;
 
+	*tail = xfer->tail;
 	for (i = 0; i < xfer->ndata;
 		i++, idx = index_inc(idx, xfer->max_blk_cnt)) {
 		block = &xfer->data[idx];
-		if (block->stat == USB_BLOCK_HANDLED ||
-				block->stat == USB_BLOCK_HANDLING)
-			continue;
-
-		first = (first < 0) ? idx : first;
+		if (block->stat != USB_BLOCK_HANDLED &&
+				block->stat != USB_BLOCK_HANDLING) {
+			first = (first < 0) ? idx : first;
+
+			switch (block->type) {
+			case USB_DATA_PART:
+			case USB_DATA_FULL:
+				size += block->blen;
+				block->stat = USB_BLOCK_HANDLING;
+				break;
+			case USB_DATA_NONE:
+				block->stat = USB_BLOCK_HANDLED;
+				break;
+			default:
+				UPRINTF(LFTL, "%s error stat %d\r\n",
+						__func__, block->type);
+			}
+		}
 
-		switch (block->type) {
-		case USB_DATA_PART:
-		case USB_DATA_FULL:
-			size += block->blen;
-			block->stat = USB_BLOCK_HANDLING;
+		/* the HCD wants a completion here, end this request */
+		if (block->xfer_end && first >= 0) {
+			*tail = index_inc(idx, xfer->max_blk_cnt);
 			break;
-		case USB_DATA_NONE:
-			block->stat = USB_BLOCK_HANDLED;
-			continue;
-		default:
-			UPRINTF(LFTL, "%s error stat %d\r\n",
-					__func__, block->type);
 		}
 	}
 
 	*head = first;
-	*tail = xfer->tail;
 	return size;
 }
 
@@ -746,27 +752,23 @@ usb_dev_reset(void *pdata)
 	return rc;
 }
 
-int
-usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+/* submit the blocks [head, tail) of xfer as one libusb transfer */
+static int
+usb_dev_submit(struct usb_dev *udev, struct usb_xfer *xfer, int dir, int epctx,
+		int head, int tail, int size)
 {
-	struct usb_dev *udev;
 	struct usb_dev_req *r;
 	struct usb_native_devinfo *info;
 	int rc = 0, epid;
 	uint8_t type;
-	int i, idx, buf_idx, head, tail, size;
+	int i, idx, buf_idx;
 	struct usb_block *b;
 	static const char * const type_str[] = {"CTRL", "ISO", "BULK", "INT"};
 	static const char * const dir_str[] = {"OUT", "IN"};
 	int framelen = 0, framecnt = 0;
 	uint16_t maxp;
 
-	udev = pdata;
 	info = &udev->info;
-	xfer->status = USB_ERR_NORMAL_COMPLETION;
-	size = usb_dev_prepare_xfer(xfer, &head, &tail);
-	if (size <= 0)
-		goto done;
 
 	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
 	if (type > USB_ENDPOINT_INT) {
@@ -877,12 +879,14 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 
 	} else {
 		UPRINTF(LFTL, "%s: wrong endpoint type %d\r\n", __func__, type);
+		xfer->reqs[head] = NULL;
 		if (r->buffer)
 			free(r->buffer);
 		if (r->trn)
 			libusb_free_transfer(r->trn);
 		free(r);
 		xfer->status = USB_ERR_INVAL;
+		goto done;
 	}
 
 	rc = libusb_submit_transfer(r->trn);
@@ -894,6 +898,30 @@ done:
 	return xfer->status;
 }
 
+int
+usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+{
+	int head, tail, size;
+
+	xfer->status = USB_ERR_NORMAL_COMPLETION;
+
+	/*
+	 * The HCD may queue several requests per doorbell, each ending at a
+	 * block marked xfer_end. Submit them back to back so the device
+	 * always has the next one queued.
+	 */
+	for (;;) {
+		size = usb_dev_prepare_xfer(xfer, &head, &tail);
+		if (head < 0)
+			break;
+		if (size > 0 && usb_dev_submit(pdata, xfer, dir, epctx, head,
+					tail, size) != USB_ERR_NORMAL_COMPLETION)
+			break;
+	}
+
+	return xfer->status;
+}
+
 static void
 clear_uas_desc(struct usb_dev *udev, uint8_t *data, int len)
 {
@@ -119,6 +119,7 @@ usb_block_append(struct usb_xfer *xfer, void *buf, int blen, void *hcb,
 	xb->stat = USB_BLOCK_FREE;
 	xb->bdone = 0;
 	xb->type = USB_DATA_NONE;
+	xb->xfer_end = 0;
 	xfer->ndata++;
 	xfer->tail = index_inc(xfer->tail, xfer->max_blk_cnt);
 	return xb;
@@ -8,6 +8,7 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <SDL.h>
 #include <SDL_syswm.h>
@@ -42,6 +43,7 @@ struct state {
 	bool is_wayland;
 	bool is_x11;
 	bool is_fullscreen;
+	bool is_headless;
 	uint64_t updates;
 	int n_connect;
 };
@@ -70,6 +72,10 @@ struct vscreen {
 	SDL_Texture *bogus_tex;
 	int surf_updates;
 	int cur_updates;
+	/* damage accounting, also the only output of the headless mode */
+	uint64_t nr_updates;
+	uint64_t nr_rects;
+	uint64_t bytes_copied;
 	SDL_Window *win;
 	SDL_Renderer *renderer;
 	pixman_image_t *img;
@@ -660,6 +666,18 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 
 	vscr = vdpy.vscrs + scanout_id;
 
+	if (vdpy.s.is_headless) {
+		if (surf) {
+			vscr->surf = *surf;
+			vscr->guest_width = surf->width;
+			vscr->guest_height = surf->height;
+		} else {
+			vscr->surf.width = 0;
+			vscr->surf.height = 0;
+		}
+		return;
+	}
+
 	if (surf == NULL ) {
 		vscr->surf.width = 0;
 		vscr->surf.height = 0;
@@ -816,11 +834,19 @@ vdpy_cursor_position_transformation(struct display *vdpy, int scanout_id, SDL_Re
 	rect->h = (vscr->cur.height * vscr->height) / vscr->guest_height;
 }
 
+/*
+ * Upload the damaged rects of a pixman surface into its texture and
+ * present it.  A NULL rect list means the whole surface is damaged.
+ */
 void
-vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
+vdpy_surface_update_rects(int handle, int scanout_id, struct surface *surf,
+		const struct vdpy_rect *rects, int nr_rects)
 {
-	SDL_Rect cursor_rect;
+	SDL_Rect cursor_rect, rect;
 	struct vscreen *vscr;
+	uint32_t bpp;
+	uint8_t *pixel;
+	int i;
 
 	if (handle != vdpy.s.n_connect) {
 		return;
@@ -842,10 +868,42 @@ vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
 	}
 
 	vscr = vdpy.vscrs + scanout_id;
-	if (surf->surf_type == SURFACE_PIXMAN)
-		SDL_UpdateTexture(vscr->surf_tex, NULL,
-			  surf->pixel,
-			  surf->stride);
+	vscr->nr_updates++;
+	if (surf->surf_type == SURFACE_PIXMAN) {
+		bpp = PIXMAN_FORMAT_BPP(surf->surf_format) / 8;
+		if (rects == NULL) {
+			vscr->nr_rects++;
+			vscr->bytes_copied += (uint64_t)surf->stride * surf->height;
+			if (!vdpy.s.is_headless)
+				SDL_UpdateTexture(vscr->surf_tex, NULL,
+					  surf->pixel,
+					  surf->stride);
+		}
+		for (i = 0; rects && i < nr_rects; i++) {
+			if (rects[i].x + rects[i].width > surf->width ||
+			    rects[i].y + rects[i].height > surf->height)
+				continue;
+			vscr->nr_rects++;
+			vscr->bytes_copied += (uint64_t)rects[i].width * bpp *
+					rects[i].height;
+			pr_dbg("%s: scanout %d damage [%u,%u,%u,%u]\n", __func__,
+				scanout_id, rects[i].x, rects[i].y,
+				rects[i].width, rects[i].height);
+			if (vdpy.s.is_headless)
+				continue;
+			rect.x = rects[i].x;
+			rect.y = rects[i].y;
+			rect.w = rects[i].width;
+			rect.h = rects[i].height;
+			pixel = (uint8_t *)surf->pixel + rects[i].y * surf->stride +
+					rects[i].x * bpp;
+			SDL_UpdateTexture(vscr->surf_tex, &rect, pixel,
+					surf->stride);
+		}
+	}
+
+	if (vdpy.s.is_headless)
+		return;
 
 	sdl_gl_prepare_draw(vscr);
 	SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
@@ -865,6 +923,12 @@ vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
 	clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
 }
 
+void
+vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
+{
+	vdpy_surface_update_rects(handle, scanout_id, surf, NULL, 0);
+}
+
 void
 vdpy_cursor_define(int handle, int scanout_id, struct cursor *cur)
 {
@@ -884,7 +948,7 @@ vdpy_cursor_define(int handle, int scanout_id, struct cursor *cur)
 		return;
 	}
 
-	if (cur->data == NULL)
+	if (cur->data == NULL || vdpy.s.is_headless)
 		return;
 
 	vscr = vdpy.vscrs + scanout_id;
@@ -1091,12 +1155,13 @@ vdpy_sdl_display_thread(void *data)
 		vscr->info.width = vscr->guest_width;
 		vscr->info.height = vscr->guest_height;
 
-		if (vdpy_create_vscreen_window(vscr)) {
+		if (!vdpy.s.is_headless && vdpy_create_vscreen_window(vscr)) {
 			goto sdl_fail;
 		}
 		clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
 	}
-	sdl_gl_display_init();
+	if (!vdpy.s.is_headless)
+		sdl_gl_display_init();
 	pthread_mutex_init(&vdpy.vdisplay_mutex, NULL);
 	pthread_cond_init(&vdpy.vdisplay_signal, NULL);
 	TAILQ_INIT(&vdpy.request_list);
@@ -1154,6 +1219,8 @@ vdpy_sdl_display_thread(void *data)
 
 	for (i = 0; i < vdpy.vscrs_num; i++) {
 		vscr = vdpy.vscrs + i;
+		pr_info("vscreen %d: %lu updates, %lu rects, %lu bytes copied\n",
+			i, vscr->nr_updates, vscr->nr_rects, vscr->bytes_copied);
 		if (vscr->img) {
 			pixman_image_unref(vscr->img);
 			vscr->img = NULL;
@@ -1193,7 +1260,8 @@ sdl_fail:
 	/* This is used to workaround the TLS issue of libEGL + libGLdispatch
 	 * after unloading library.
 	 */
-	eglReleaseThread();
+	if (!vdpy.s.is_headless)
+		eglReleaseThread();
 	return NULL;
 }
 
@@ -1291,6 +1359,15 @@ gfx_ui_init()
 	struct vscreen *vscr;
 	int i;
 
+	if (vdpy.s.is_headless) {
+		if (vdpy.vscrs_num <= 0) {
+			pr_err("Incorrect geometry parameter for virtio-gpu\n");
+			return -1;
+		}
+		vdpy.s.is_ui_realized = true;
+		return 0;
+	}
+
 	setenv("SDL_VIDEO_X11_FORCE_EGL", "1", 1);
 	setenv("SDL_OPENGL_ES_DRIVER", "1", 1);
 	setenv("SDL_RENDER_DRIVER", "opengles2", 1);
@@ -1357,6 +1434,8 @@ gfx_ui_deinit()
 	}
 
 	free(vdpy.vscrs);
+	if (vdpy.s.is_headless)
+		return;
 	SDL_Quit();
 	pr_info("SDL_Quit\r\n");
 }
@@ -1378,7 +1457,11 @@ int vdpy_parse_cmd_option(const char *opts)
 	stropts = strdup(opts);
 	while ((str = strsep(&stropts, ",")) != NULL) {
 		vscr = vdpy.vscrs + vdpy.vscrs_num;
-		if ((tmp = strcasestr(str, "geometry=fullscreen")) != NULL) {
+		if (!strcasecmp(str, "headless")) {
+			/* no window: surfaces are only accounted, never shown */
+			vdpy.s.is_headless = true;
+			pr_info("virtual display: headless.\n");
+		} else if ((tmp = strcasestr(str, "geometry=fullscreen")) != NULL) {
 			snum = sscanf(tmp, "geometry=fullscreen:%d", &vscr->pscreen_id);
 			if (snum != 1) {
 				vscr->pscreen_id = 0;
@@ -1414,5 +1497,9 @@ int vdpy_parse_cmd_option(const char *opts)
 	}
 	free(stropts);
 
+	/* headless needs no monitor, give it one default sized vscreen */
+	if (vdpy.s.is_headless && vdpy.vscrs_num == 0)
+		vdpy.vscrs_num = 1;
+
 	return error;
 }
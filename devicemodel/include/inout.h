@@ -71,6 +71,7 @@ struct inout_port {
 
 void	init_inout(void);
 int	emulate_inout(struct vmctx *ctx, int *pvcpu, struct acrn_pio_request *req);
+void	*inout_owner(int port);
 int	register_inout(struct inout_port *iop);
 int	unregister_inout(struct inout_port *iop);
 
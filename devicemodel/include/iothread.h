@@ -7,14 +7,20 @@
 #ifndef	_iothread_CTX_H_
 #define	_iothread_CTX_H_
 
+#define IOTHREAD_NUM_MAX	16
+
+struct iothread_ctx;
+
 struct iothread_mevent {
 	void (*run)(void *);
 	void *arg;
 	int fd;
 };
-int iothread_add(int fd, struct iothread_mevent *aevt);
-int iothread_del(int fd);
+struct iothread_ctx *iothread_get(int idx);
+int iothread_add(struct iothread_ctx *ioctx, int fd, struct iothread_mevent *aevt);
+int iothread_del(struct iothread_ctx *ioctx, int fd);
 int iothread_init(void);
 void iothread_deinit(void);
+int iothread_parse_options(const char *opts);
 
 #endif
@@ -51,6 +51,7 @@ struct mem_range {
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
 
 int	emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req);
+void	*mem_owner(uint64_t paddr);
 int	register_mem(struct mem_range *memp);
 int	register_mem_fallback(struct mem_range *memp);
 int	unregister_mem(struct mem_range *memp);
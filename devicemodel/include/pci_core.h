@@ -400,6 +400,8 @@ int	pciaccess_init(void);
 void	pciaccess_cleanup(void);
 int	parse_bdf(char *s, int *bus, int *dev, int *func, int base);
 struct pci_vdev *pci_get_vdev_info(int slot);
+struct pci_vdev *pci_cfg_vdev(int bus, int slot, int func);
+struct pci_vdev *pci_ecfg_vdev(uint64_t addr);
 
 
 /**
@@ -137,6 +137,9 @@ static inline uint16_t ffs64(uint64_t value)
 
 /* memory barrier */
 #define mb()    ({ asm volatile("mfence" ::: "memory"); (void)0; })
+/* x86 keeps loads and stores in order, only the compiler needs fencing */
+#define rmb()   ({ asm volatile("" ::: "memory"); (void)0; })
+#define wmb()   ({ asm volatile("" ::: "memory"); (void)0; })
 
 static inline void
 do_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
@@ -161,6 +161,7 @@ struct usb_block {
 	int			bdone;	   /* bytes transferred */
 	enum usb_block_stat	stat;      /* processed status */
 	enum usb_block_type	type;
+	int			xfer_end;  /* last block of a native request */
 	void                    *hcb;      /* host controller block */
 };
 
@@ -14,6 +14,7 @@
 #ifndef __VHOST_H__
 #define __VHOST_H__
 
+#include <linux/vhost.h>
 #include "virtio.h"
 
 /**
@@ -30,6 +31,38 @@ struct vhost_vq {
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
 };
 
+struct vhost_dev;
+
+/**
+ * @brief vhost backend operations
+ *
+ * The vhost kernel module and vhost-user backends take the same requests,
+ * only carried over ioctls or over a unix socket.
+ */
+struct vhost_ops {
+	int (*init)(struct vhost_dev *vdev, uint64_t features);
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+	int (*set_vring_enable)(struct vhost_dev *vdev, int idx, int enable);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+};
+
 struct vhost_dev {
 	/**
 	 * backpointer to virtio_base
@@ -47,10 +80,20 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or the socket of a vhost-user backend
 	 */
 	int fd;
 
+	/**
+	 * backend operations, picked from the type of fd
+	 */
+	const struct vhost_ops *ops;
+
+	/**
+	 * vhost-user protocol features agreed with the backend
+	 */
+	uint64_t protocol_features;
+
 	/**
 	 * first vq's index in virtio_vq_info
 	 */
@@ -86,7 +129,8 @@ struct vhost_dev {
  *
  * @param vdev Pointer to struct vhost_dev.
  * @param base Pointer to struct virtio_base.
- * @param fd fd of the vhost chardev.
+ * @param fd fd of the vhost chardev, or a socket connected to a vhost-user
+ *           backend (see vhost_user_connect).
  * @param vq_idx The first virtqueue which would be used by this vhost dev.
  * @param vhost_features Subset of vhost features which would be enabled.
  * @param vhost_ext_features Specific vhost internal features to be enabled.
@@ -143,4 +187,28 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  * @return 0 on success and -1 on failure.
  */
 int vhost_kernel_ioctl(struct vhost_dev *vdev, unsigned long int request, void *arg);
+
+extern const struct vhost_ops vhost_user_ops;
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * @param path Path of the unix socket the backend listens on.
+ *
+ * @return the connected socket on success and -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
+/**
+ * @brief read the device config space from a vhost-user backend.
+ *
+ * Needs the VHOST_USER_PROTOCOL_F_CONFIG protocol feature.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer for the config space.
+ * @param size Number of bytes to read from offset 0.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size);
 #endif /* __VHOST_H__ */
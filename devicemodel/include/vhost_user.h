@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @file vhost_user.h
+ *
+ * @brief vhost-user protocol definitions, shared by the acrn-dm frontend
+ *	  and the vhost-user backends built from this tree.
+ */
+
+#ifndef __VHOST_USER_H__
+#define __VHOST_USER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/vhost.h>
+
+#define VHOST_USER_GET_FEATURES			1
+#define VHOST_USER_SET_FEATURES			2
+#define VHOST_USER_SET_OWNER			3
+#define VHOST_USER_RESET_OWNER			4
+#define VHOST_USER_SET_MEM_TABLE		5
+#define VHOST_USER_SET_VRING_NUM		8
+#define VHOST_USER_SET_VRING_ADDR		9
+#define VHOST_USER_SET_VRING_BASE		10
+#define VHOST_USER_GET_VRING_BASE		11
+#define VHOST_USER_SET_VRING_KICK		12
+#define VHOST_USER_SET_VRING_CALL		13
+#define VHOST_USER_GET_PROTOCOL_FEATURES	15
+#define VHOST_USER_SET_PROTOCOL_FEATURES	16
+#define VHOST_USER_SET_VRING_ENABLE		18
+#define VHOST_USER_GET_CONFIG			24
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_VERSION_MASK		0x3
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+/* no fd is passed with SET_VRING_KICK/CALL */
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+
+/* virtio feature bit telling that protocol features can be negotiated */
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+
+#define VHOST_USER_MAX_REGIONS		8
+#define VHOST_USER_MAX_CONFIG_SIZE	256
+
+struct vhost_user_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+};
+
+#define VHOST_USER_CONFIG_HDR_SIZE	offsetof(struct vhost_user_config, region)
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* of the payload that follows */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE		offsetof(struct vhost_user_msg, payload)
+
+#endif /* __VHOST_USER_H__ */
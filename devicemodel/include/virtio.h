@@ -403,6 +403,18 @@ struct virtio_ops {
 
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+
+/**
+ * @brief Ring slots taken by an outstanding packed chain
+ *
+ * Indexed by buffer id: vq_relchain() needs the slot count to move the
+ * used index and vq_retchain() walks back through prev.
+ */
+struct vq_packed_chain {
+	uint16_t ndesc;		/**< ring slots consumed by the chain */
+	uint16_t prev;		/**< buffer id fetched before this one */
+};
+
 /**
  * @brief Virtqueue data structure
  *
@@ -427,6 +439,7 @@ struct virtio_iothread {
 	int idx;
 	int kick_fd;
 	bool	ioevent_started;
+	struct iothread_ctx *ioctx;	/* pool thread serving this vq */
 	struct iothread_mevent iomvt;
 	void (*iothread_run)(void *, struct virtio_vq_info *);
 };
@@ -443,7 +456,9 @@ struct virtio_vq_info {
 	uint16_t flags;		/**< flags (see above) */
 	uint16_t last_avail;	/**< a recent value of avail->idx */
 	uint16_t save_used;	/**< saved used->idx; see vq_endchains */
+	uint16_t pending_used;	/**< used entries not yet published */
 	uint16_t msix_idx;	/**< MSI-X index, or VIRTIO_MSI_NO_VECTOR */
+	int	mem_hint;	/**< last guest memory region, see vm_map_gpa_hint */
 
 	uint32_t pfn;		/**< PFN of virt queue (not shifted!) */
 	struct virtio_iothread viothrd;
@@ -459,6 +474,22 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	bool packed;		/**< VIRTIO_F_RING_PACKED layout in use */
+	bool avail_wrap;	/**< packed: wrap counter of last_avail */
+	bool used_wrap;		/**< packed: wrap counter of used_idx */
+	uint16_t used_idx;	/**< packed: next slot to write as used */
+	uint16_t pending_slot;	/**< packed: first unpublished used slot */
+	uint16_t pending_flags;	/**< packed: flags held back for it */
+	uint16_t last_id;	/**< packed: buffer id of the last getchain */
+	struct vq_packed_chain *chains;
+				/**< packed: per buffer id bookkeeping */
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< packed: driver event suppression */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< packed: device event suppression */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -493,6 +524,20 @@ static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
 	bool ret = false;
+	uint16_t flags;
+
+	if (vq_ring_ready(vq) && vq->packed) {
+		/*
+		 * A packed descriptor is available when its AVAIL bit
+		 * matches our wrap counter and differs from its USED bit.
+		 */
+		flags = vq->pdesc[vq->last_avail].flags;
+		return (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) ==
+				vq->avail_wrap) &&
+			(!!(flags & (1 << VRING_PACKED_DESC_F_USED)) !=
+				vq->avail_wrap);
+	}
+
 	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
 		if ((uint16_t)((u_int)vq->avail->idx - vq->last_avail) > vq->qsize)
 			pr_err ("%s: no valid descriptor\n", vq->base->vops->name);
@@ -663,6 +708,27 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Fill in the used ring entry of a request chain without
+ * publishing it to the guest.
+ *
+ * Lets a driver complete a batch of chains and move used->idx once
+ * with vq_relchain_publish(). vq_endchains() publishes as well.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Pointer to available ring position, returned by vq_getchain().
+ * @param iolen Number of data bytes to be returned to frontend.
+ */
+void vq_relchain_prepare(struct virtio_vq_info *vq, uint16_t idx,
+			 uint32_t iolen);
+
+/**
+ * @brief Publish the chains filled in by vq_relchain_prepare().
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_relchain_publish(struct virtio_vq_info *vq);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -686,6 +752,18 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the guest not to kick this virtqueue. Driver should always use
+ * this helper instead of touching the used ring, since a packed ring
+ * keeps the flag in its device event suppression area.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
@@ -757,4 +835,15 @@ int virtio_set_modern_pio_bar(
 		struct virtio_base *base, int barnum);
 
 int virtio_register_ioeventfd(struct virtio_base *base, int idx, bool is_register, int fd);
+
+/**
+ * @brief Assign the virtqueues of a device to iothreads.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param map Colon separated iothread ids, one per virtqueue in order.
+ * The last id is used for the remaining virtqueues.
+ *
+ * @return 0 on success and -1 on an unknown iothread id.
+ */
+int virtio_set_iothread_map(struct virtio_base *base, char *map);
 #endif	/* _VIRTIO_H_ */
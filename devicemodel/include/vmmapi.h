@@ -30,6 +30,7 @@
 #define	_VMMAPI_H_
 
 #include <sys/param.h>
+#include <sys/uio.h>
 #include "types.h"
 #include "macros.h"
 #include "pm.h"
@@ -45,6 +46,17 @@
 
 #define CMOS_BUF_SIZE		256
 
+#define VM_RAM_REGION_MAX	4
+
+/*
+ * A guest RAM segment that is backed by host memory, see vm_map_gpa().
+ */
+struct vm_ram_region {
+	uint64_t gpa_start;
+	uint64_t gpa_end;	/* exclusive */
+	char	*hva;		/* host address of gpa_start */
+};
+
 struct vmctx {
 	int     fd;
 	int     vmid;
@@ -58,6 +70,13 @@ struct vmctx {
 	char    *baseaddr;
 	char    *name;
 
+	/*
+	 * Sorted by gpa_start. Built once the memory is set up and left
+	 * untouched while devices run, so lookups take no lock.
+	 */
+	struct vm_ram_region ram_regions[VM_RAM_REGION_MAX];
+	int	nr_ram_regions;
+
 	/* fields to track virtual devices */
 	void *atkbdc_base;
 	void *vrtc;
@@ -90,6 +109,7 @@ struct vm_isa_irq {
 
 struct vm_mem_region {
 	uint64_t fd_offset;
+	uint64_t len;		/* bytes left in this mapping from the gpa */
 	int fd;
 };
 bool	vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
@@ -125,7 +145,11 @@ bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
+int	hugetlb_parse_prefault(const char *opt);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
+void	*vm_map_gpa_hint(struct vmctx *ctx, vm_paddr_t gaddr, size_t len,
+	int *hint);
+int	vm_map_gpa_iov(struct vmctx *ctx, struct iovec *iov, int n, int *hint);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
 size_t	vm_get_highmem_size(struct vmctx *ctx);
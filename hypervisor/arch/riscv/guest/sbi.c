@@ -5,6 +5,7 @@
  */
 
 #include <lib/types.h>
+#include <util.h>
 #include <asm/lib/bits.h>
 #include <asm/cpu.h>
 #include <asm/irq.h>
@@ -12,9 +13,15 @@
 #include <asm/smp.h>
 #include <asm/notify.h>
 #include <asm/cache.h>
+#include <asm/timer.h>
 #include <asm/guest/vcpu.h>
+#include <asm/guest/vmcs.h>
 #include <asm/guest/vm.h>
 #include <asm/guest/vclint.h>
+#include <asm/guest/vpmu.h>
+#include <sprintf.h>
+#include <logmsg.h>
+#include <trace.h>
 #include "sbi.h"
 
 static void sbi_ecall_base_probe(unsigned long id, unsigned long *out_val)
@@ -25,6 +32,9 @@ static void sbi_ecall_base_probe(unsigned long id, unsigned long *out_val)
 	case SBI_ID_IPI:
 	case SBI_ID_RFENCE:
 	case SBI_ID_TIMER:
+	case SBI_ID_HSM:
+	case SBI_ID_PMU:
+	case SBI_ID_SRST:
 		*out_val = 1;
 		break;
 	default:
@@ -82,19 +92,19 @@ static void sbi_timer_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 {
 	unsigned long *ret = &regs->a0;
 	unsigned long funcid = regs->a6;
-	struct run_context *ctx =
-		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	bool sstc = false;
 
 #ifdef RUN_ON_QEMU
 	sstc = !!(cpu_csr_read(menvcfg) & 0x8000000000000000);
 #endif
 	if (funcid == SBI_TYPE_TIME_SET_TIMER) {
+		vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_SET_TIMER);
 		if (sstc) {
 			cpu_csr_write(stimecmp, regs->a0);
 			*ret = SBI_SUCCESS;
 		} else {
-			ctx->sip &= ~CLINT_VECTOR_STI;
+			vcpu_set_vcsr(vcpu, VCSR_SIP,
+				vcpu_get_vcsr(vcpu, VCSR_SIP) & ~CLINT_VECTOR_STI);
 			cpu_csr_clear(mip, CLINT_VECTOR_STI);
 			vclint_write_tmr(vcpu_vclint(vcpu), vcpu->vcpu_id, regs->a0);
 			*ret = SBI_SUCCESS;
@@ -128,6 +138,7 @@ static void sbi_ipi_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 	unsigned long funcid = regs->a6;
 
 	if (funcid == SBI_TYPE_IPI_SEND_IPI) {
+		vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_IPI_SENT);
 		send_vipi_mask(vcpu, regs->a0, regs->a1);
 		*ret = SBI_SUCCESS;
 	} else {
@@ -193,14 +204,17 @@ static void sbi_rfence_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 	switch (funcid) {
 	case SBI_TYPE_RFENCE_FNECE_I:
 		func = (smp_call_func_t)sbi_rcall_fence_i;
+		vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_FENCE_I_SENT);
 		break;
 	case SBI_TYPE_RFENCE_SFNECE_VMA:
 		func = (smp_call_func_t)sbi_rcall_sfence_vma;
+		vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_SFENCE_VMA_SENT);
 		rcall.base = regs->a2;
 		rcall.size = regs->a3;
 		break;
 	case SBI_TYPE_RFENCE_SFNECE_VMA_ASID:
 		func = (smp_call_func_t)sbi_rcall_sfence_vma_asid;
+		vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_SFENCE_VMA_ASID_SENT);
 		rcall.base = regs->a2;
 		rcall.size = regs->a3;
 		rcall.asid = regs->a4;
@@ -226,23 +240,227 @@ static void sbi_rfence_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 	return;
 }
 
+static spinlock_t sbi_hsm_lock = { .head = 0U, .tail = 0U, };
+
+/*
+ * Enter the guest at addr the way SBI HSM requires: satp and sstatus.SIE
+ * cleared, a0 = hartid, a1 = opaque.
+ */
+static void sbi_hsm_enter(struct acrn_vcpu *vcpu, uint64_t addr, uint64_t opaque)
+{
+	vcpu_set_rip(vcpu, addr);
+	vcpu_set_gpreg(vcpu, CPU_REG_A0, vcpu->vcpu_id);
+	vcpu_set_gpreg(vcpu, CPU_REG_A1, opaque);
+	vcpu_set_vcsr(vcpu, VCSR_SATP, 0UL);
+	vcpu_set_vcsr(vcpu, VCSR_SSTATUS,
+		vcpu_get_vcsr(vcpu, VCSR_SSTATUS) & ~HV_ARCH_VCPU_STATUS_SIE);
+#ifdef CONFIG_MACRN
+	/* sstatus is a view of mstatus, which vmx_vmrun loads from here */
+	vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx.cpu_gp_regs.regs.status &=
+		~HV_ARCH_VCPU_STATUS_SIE;
+#endif
+}
+
+static int64_t sbi_hsm_hart_start(struct acrn_vcpu *vcpu, uint64_t hartid,
+		uint64_t addr, uint64_t opaque)
+{
+	struct acrn_vcpu *t;
+	bool first = false;
+	int64_t ret = SBI_SUCCESS;
+
+	if (hartid >= vcpu->vm->hw.created_vcpus)
+		return SBI_EINVAL_PARAM;
+
+	t = &vcpu->vm->hw.vcpu[hartid];
+	spinlock_obtain(&sbi_hsm_lock);
+	if (t->arch.hsm_state == SBI_HSM_STATE_STOPPED) {
+		t->arch.hsm_state = SBI_HSM_STATE_START_PENDING;
+		t->arch.hsm_start_addr = addr;
+		t->arch.hsm_opaque = opaque;
+		first = (t->state == VCPU_INIT);
+	} else {
+		ret = SBI_EAVAILABLE;
+	}
+	spinlock_release(&sbi_hsm_lock);
+
+	if (ret != SBI_SUCCESS)
+		return ret;
+
+	if (first) {
+		/* never ran: its thread is idle, set it up from here */
+		sbi_hsm_enter(t, addr, opaque);
+		t->arch.hsm_state = SBI_HSM_STATE_STARTED;
+		launch_vcpu(t);
+	} else {
+		/* blocked in sbi_hsm_hart_stop() */
+		signal_event(&t->events[VCPU_EVENT_HSM_START]);
+	}
+
+	return SBI_SUCCESS;
+}
+
+/*
+ * A stopped vCPU sleeps on VCPU_EVENT_HSM_START, its thread is off the
+ * runqueue until another hart starts it again. Returns only then, with
+ * the guest registers set up for the new start.
+ */
+static void sbi_hsm_hart_stop(struct acrn_vcpu *vcpu)
+{
+	vcpu->arch.hsm_state = SBI_HSM_STATE_STOPPED;
+	wait_event(&vcpu->events[VCPU_EVENT_HSM_START]);
+	if (!vcpu->launched)
+		return;	/* rebooted meanwhile, see sbi_srst_handler() */
+
+	sbi_hsm_enter(vcpu, vcpu->arch.hsm_start_addr, vcpu->arch.hsm_opaque);
+	vcpu->arch.hsm_state = SBI_HSM_STATE_STARTED;
+}
+
+static int64_t sbi_hsm_hart_suspend(struct acrn_vcpu *vcpu, uint64_t type,
+		uint64_t addr, uint64_t opaque)
+{
+	bool retentive = ((type & SBI_HSM_SUSPEND_NON_RET_DEFAULT) == 0UL);
+
+	if ((type & ~SBI_HSM_SUSPEND_NON_RET_DEFAULT) != 0UL) {
+		if ((type & ~SBI_HSM_SUSPEND_NON_RET_DEFAULT) < SBI_HSM_SUSPEND_RET_PLATFORM)
+			return SBI_EINVAL_PARAM;
+		return SBI_ENOTSUPP;
+	}
+
+	/* same as WFI: wait for an interrupt for this vCPU */
+	vcpu->arch.hsm_state = SBI_HSM_STATE_SUSPENDED;
+	if ((vcpu->arch.pending_req == 0UL) && (!vclint_has_pending_intr(vcpu))) {
+		wait_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+	}
+	if (!vcpu->launched)
+		return SBI_SUCCESS;	/* rebooted meanwhile */
+	vcpu->arch.hsm_state = SBI_HSM_STATE_STARTED;
+
+	if (!retentive)
+		sbi_hsm_enter(vcpu, addr, opaque);
+
+	return SBI_SUCCESS;
+}
+
 static void sbi_hsm_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 {
-	regs->a0 = SBI_ENOTSUPP;
+	uint64_t funcid = regs->a6;
+	int64_t ret = SBI_SUCCESS;
+
+	switch (funcid) {
+	case SBI_TYPE_HSM_HART_START:
+		ret = sbi_hsm_hart_start(vcpu, regs->a0, regs->a1, regs->a2);
+		break;
+	case SBI_TYPE_HSM_HART_STOP:
+		/* no return to the caller, a0/a1 were set for the next start */
+		sbi_hsm_hart_stop(vcpu);
+		return;
+	case SBI_TYPE_HSM_HART_GET_STATUS:
+		if (regs->a0 >= vcpu->vm->hw.created_vcpus) {
+			ret = SBI_EINVAL_PARAM;
+		} else {
+			regs->a1 = vcpu->vm->hw.vcpu[regs->a0].arch.hsm_state;
+		}
+		break;
+	case SBI_TYPE_HSM_HART_SUSPEND:
+		if ((regs->a0 & SBI_HSM_SUSPEND_NON_RET_DEFAULT) != 0UL) {
+			/* a0/a1 are set for the resume, if it succeeds */
+			ret = sbi_hsm_hart_suspend(vcpu, regs->a0, regs->a1, regs->a2);
+			if (ret == SBI_SUCCESS)
+				return;
+		} else {
+			ret = sbi_hsm_hart_suspend(vcpu, regs->a0, 0UL, 0UL);
+			if (!vcpu->launched)
+				return;
+		}
+		break;
+	default:
+		ret = SBI_ENOTSUPP;
+		break;
+	}
+
+	regs->a0 = ret;
 
 	return;
 }
 
+/*
+ * Shutdown pauses the VM. Reboot resets it in place, see reboot_vm(); the
+ * calling vCPU leaves here with its fresh state, which must not be
+ * touched, and other vCPUs of the VM waiting in an SBI call find
+ * vcpu->launched cleared when they wake up.
+ */
 static void sbi_srst_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 {
-	regs->a0 = SBI_ENOTSUPP;
+	uint64_t funcid = regs->a6;
+	uint64_t type = regs->a0;
+	int64_t ret = SBI_SUCCESS;
+
+	if (funcid != SBI_TYPE_SRST_SYSTEM_RESET) {
+		regs->a0 = SBI_ENOTSUPP;
+		return;
+	}
+
+	switch (type) {
+	case SBI_SRST_TYPE_SHUTDOWN:
+		pr_info("VM%d: shutdown, reason %lx", vcpu->vm->vm_id, regs->a1);
+		pause_vm(vcpu->vm);
+		vcpu->vm->state = VM_POWERED_OFF;
+		return;
+	case SBI_SRST_TYPE_COLD_REBOOT:
+	case SBI_SRST_TYPE_WARM_REBOOT:
+		pr_info("VM%d: reboot, reason %lx", vcpu->vm->vm_id, regs->a1);
+		if (reboot_vm(vcpu->vm, (type == SBI_SRST_TYPE_COLD_REBOOT) ?
+				COLD_RESET : WARM_RESET) == 0)
+			return;
+		ret = SBI_EFAILURE;
+		break;
+	default:
+		ret = (type >= SBI_SRST_TYPE_VENDOR) ? SBI_ENOTSUPP : SBI_EINVAL_PARAM;
+		break;
+	}
+
+	regs->a0 = ret;
 
 	return;
 }
 
 static void sbi_pmu_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 {
-	regs->a0 = SBI_ENOTSUPP;
+	uint64_t funcid = regs->a6;
+	int64_t ret;
+
+	switch (funcid) {
+	case SBI_TYPE_PMU_NUM_COUNTERS:
+		regs->a1 = VPMU_NR_COUNTERS;
+		ret = SBI_SUCCESS;
+		break;
+	case SBI_TYPE_PMU_COUNTER_GET_INFO:
+		ret = vpmu_counter_info(regs->a0, &regs->a1);
+		break;
+	case SBI_TYPE_PMU_COUNTER_CFG_MATCH:
+		ret = vpmu_config_matching(vcpu, regs->a0, regs->a1, regs->a2,
+				regs->a3, regs->a4, &regs->a1);
+		break;
+	case SBI_TYPE_PMU_COUNTER_START:
+		ret = vpmu_counter_start(vcpu, regs->a0, regs->a1, regs->a2, regs->a3);
+		break;
+	case SBI_TYPE_PMU_COUNTER_STOP:
+		ret = vpmu_counter_stop(vcpu, regs->a0, regs->a1, regs->a2);
+		break;
+	case SBI_TYPE_PMU_COUNTER_FW_READ:
+		ret = vpmu_fw_read(vcpu, regs->a0, &regs->a1);
+		break;
+	case SBI_TYPE_PMU_COUNTER_FW_READ_HI:
+		/* the counters are 64-bit, this is for RV32 only */
+		regs->a1 = 0UL;
+		ret = SBI_SUCCESS;
+		break;
+	default:
+		ret = SBI_ENOTSUPP;
+		break;
+	}
+
+	regs->a0 = ret;
 
 	return;
 }
@@ -254,49 +472,154 @@ static void sbi_undefined_handler(struct acrn_vcpu *vcpu, struct cpu_regs *regs)
 	return;
 }
 
-static const struct sbi_ecall_dispatch sbi_dispatch_table[NR_HX_EXIT_REASONS] = {
-	[SBI_TYPE_BASE] = {
+/*
+ * The extension IDs implemented here all differ in bits [2:0] once bits
+ * [5:3] are folded in, so the folded ID indexes sbi_dispatch_table
+ * directly. The slot's ext_id tells whether the ID really is the one
+ * implemented, any other ID goes to sbi_undefined.
+ */
+#define SBI_EXT_SLOTS		8U
+#define SBI_EXT_SLOT(id)	(((id) ^ ((id) >> 3U)) & (SBI_EXT_SLOTS - 1U))
+
+static const struct sbi_ecall_dispatch sbi_dispatch_table[SBI_EXT_SLOTS] = {
+	[SBI_EXT_SLOT(SBI_ID_BASE)] = {
 		.ext_id = SBI_ID_BASE,
+		.type = SBI_TYPE_BASE,
 		.handler = sbi_base_handler},
-	[SBI_TYPE_TIMER] = {
+	[SBI_EXT_SLOT(SBI_ID_TIMER)] = {
 		.ext_id = SBI_ID_TIMER,
+		.type = SBI_TYPE_TIMER,
 		.handler = sbi_timer_handler},
-	[SBI_TYPE_IPI] = {
+	[SBI_EXT_SLOT(SBI_ID_IPI)] = {
 		.ext_id = SBI_ID_IPI,
+		.type = SBI_TYPE_IPI,
 		.handler = sbi_ipi_handler},
-	[SBI_TYPE_RFENCE] = {
+	[SBI_EXT_SLOT(SBI_ID_RFENCE)] = {
 		.ext_id = SBI_ID_RFENCE,
+		.type = SBI_TYPE_RFENCE,
 		.handler = sbi_rfence_handler},
-	[SBI_TYPE_HSM] = {
+	[SBI_EXT_SLOT(SBI_ID_HSM)] = {
 		.ext_id = SBI_ID_HSM,
+		.type = SBI_TYPE_HSM,
 		.handler = sbi_hsm_handler},
-	[SBI_TYPE_SRST] = {
+	[SBI_EXT_SLOT(SBI_ID_SRST)] = {
 		.ext_id = SBI_ID_SRST,
+		.type = SBI_TYPE_SRST,
 		.handler = sbi_srst_handler},
-	[SBI_TYPE_PMU] = {
+	[SBI_EXT_SLOT(SBI_ID_PMU)] = {
 		.ext_id = SBI_ID_PMU,
+		.type = SBI_TYPE_PMU,
 		.handler = sbi_pmu_handler},
-	[SBI_MAX_TYPES] = {
-		.ext_id = SBI_VENDOR_START,
+	/* slot 1 is free, ext_id 0 folds to slot 0 so it never matches */
+	[1] = {
+		.ext_id = 0,
+		.type = SBI_MAX_TYPES,
 		.handler = sbi_undefined_handler},
 };
 
+static const struct sbi_ecall_dispatch sbi_undefined = {
+	.ext_id = SBI_VENDOR_START,
+	.type = SBI_MAX_TYPES,
+	.handler = sbi_undefined_handler,
+};
+
+static const char *const sbi_type_name[VCPU_SBI_STAT_EXTS] = {
+	[SBI_TYPE_BASE] = "BASE",
+	[SBI_TYPE_TIMER] = "TIME",
+	[SBI_TYPE_IPI] = "IPI",
+	[SBI_TYPE_RFENCE] = "RFNC",
+	[SBI_TYPE_HSM] = "HSM",
+	[SBI_TYPE_SRST] = "SRST",
+	[SBI_TYPE_PMU] = "PMU",
+	[SBI_MAX_TYPES] = "OTHER",
+};
+
+/*
+ * The cycles of a call include the time a blocking one (HSM stop or
+ * suspend) spends descheduled.
+ */
+static void sbi_stat_update(struct acrn_vcpu *vcpu, const struct sbi_ecall_dispatch *d,
+		unsigned long id, unsigned long funcid, uint64_t cycles)
+{
+	struct vcpu_sbi_stat *stat;
+
+	stat = &vcpu->arch.sbi_stat[d->type][min(funcid, VCPU_SBI_STAT_FUNCS - 1U)];
+	stat->count++;
+	stat->cycles += cycles;
+
+	TRACE_4I(TRACE_SBI_CALL, (uint32_t)id, (uint32_t)funcid,
+		(uint32_t)cycles, (uint32_t)vcpu->vcpu_id);
+}
+
 int sbi_ecall_handler(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	struct cpu_regs *regs = &ctx->cpu_gp_regs.regs;
-	uint32_t id = regs->a7;
-	const struct sbi_ecall_dispatch *d = &sbi_dispatch_table[SBI_MAX_TYPES];
+	unsigned long id = regs->a7;
+	unsigned long funcid = regs->a6;
+	const struct sbi_ecall_dispatch *d = &sbi_dispatch_table[SBI_EXT_SLOT(id)];
+	uint64_t start;
 
-	for (uint32_t i = 0; i < SBI_MAX_TYPES; i++) {
-		if (id == sbi_dispatch_table[i].ext_id) {
-			d = &sbi_dispatch_table[i];
-			break;
-		}
-	}
+	if (d->ext_id != id)
+		d = &sbi_undefined;
 
+	vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_SBI_CALL);
+	start = get_cycles();
 	d->handler(vcpu, regs);
+	sbi_stat_update(vcpu, d, id, funcid, get_cycles() - start);
 
 	return 0;
 }
+
+/**
+ * @brief Get the SBI call statistics of the vCPUs of a VM
+ *
+ * It's for debug only.
+ *
+ * @param[in]	str_max	The max size of the string containing the statistics
+ * @param[inout]	str_arg	Pointer to the output information
+ * @param[in]	vm_id	The VM to dump
+ */
+void get_sbi_stat_info(char *str_arg, size_t str_max, uint16_t vm_id)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
+	struct acrn_vcpu *vcpu;
+	struct vcpu_sbi_stat *stat;
+	uint16_t i;
+	uint32_t ext, func;
+
+	len = snprintf(str, size, "\r\nVCPU\tEXT\tFID\tCOUNT\t\tAVG CYCLES");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		for (ext = 0U; ext < VCPU_SBI_STAT_EXTS; ext++) {
+			for (func = 0U; func < VCPU_SBI_STAT_FUNCS; func++) {
+				stat = &vcpu->arch.sbi_stat[ext][func];
+				if (stat->count == 0UL) {
+					continue;
+				}
+				len = snprintf(str, size, "\r\n%hu\t%s\t%u%s\t%lu\t\t%lu",
+					vcpu->vcpu_id, sbi_type_name[ext], func,
+					(func == (VCPU_SBI_STAT_FUNCS - 1U)) ? "+" : "",
+					stat->count, stat->cycles / stat->count);
+				if (len >= size) {
+					goto overflow;
+				}
+				size -= len;
+				str += len;
+			}
+		}
+	}
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
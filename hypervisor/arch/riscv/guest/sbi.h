@@ -53,6 +53,74 @@ enum sbi_id {
 #define SBI_TYPE_RFENCE_SFNECE_VMA		0x1
 #define SBI_TYPE_RFENCE_SFNECE_VMA_ASID		0x2
 
+/* SBI function IDs for HSM extension*/
+#define SBI_TYPE_HSM_HART_START			0x0
+#define SBI_TYPE_HSM_HART_STOP			0x1
+#define SBI_TYPE_HSM_HART_GET_STATUS		0x2
+#define SBI_TYPE_HSM_HART_SUSPEND		0x3
+
+/* SBI HSM hart states */
+#define SBI_HSM_STATE_STARTED			0x0
+#define SBI_HSM_STATE_STOPPED			0x1
+#define SBI_HSM_STATE_START_PENDING		0x2
+#define SBI_HSM_STATE_STOP_PENDING		0x3
+#define SBI_HSM_STATE_SUSPENDED			0x4
+#define SBI_HSM_STATE_SUSPEND_PENDING		0x5
+#define SBI_HSM_STATE_RESUME_PENDING		0x6
+
+/* SBI HSM suspend types */
+#define SBI_HSM_SUSPEND_RET_DEFAULT		0x00000000UL
+#define SBI_HSM_SUSPEND_RET_PLATFORM		0x10000000UL
+#define SBI_HSM_SUSPEND_NON_RET_DEFAULT		0x80000000UL
+#define SBI_HSM_SUSPEND_NON_RET_PLATFORM	0x90000000UL
+
+/* SBI function IDs for SRST extension*/
+#define SBI_TYPE_SRST_SYSTEM_RESET		0x0
+
+/* SBI SRST reset types */
+#define SBI_SRST_TYPE_SHUTDOWN			0x0UL
+#define SBI_SRST_TYPE_COLD_REBOOT		0x1UL
+#define SBI_SRST_TYPE_WARM_REBOOT		0x2UL
+#define SBI_SRST_TYPE_VENDOR			0xf0000000UL
+
+/* SBI function IDs for PMU extension*/
+#define SBI_TYPE_PMU_NUM_COUNTERS		0x0
+#define SBI_TYPE_PMU_COUNTER_GET_INFO		0x1
+#define SBI_TYPE_PMU_COUNTER_CFG_MATCH		0x2
+#define SBI_TYPE_PMU_COUNTER_START		0x3
+#define SBI_TYPE_PMU_COUNTER_STOP		0x4
+#define SBI_TYPE_PMU_COUNTER_FW_READ		0x5
+#define SBI_TYPE_PMU_COUNTER_FW_READ_HI		0x6
+
+/* SBI PMU event types, in event_idx[19:16] */
+#define SBI_PMU_EVENT_TYPE_HW			0x0
+#define SBI_PMU_EVENT_TYPE_HW_CACHE		0x1
+#define SBI_PMU_EVENT_TYPE_HW_RAW		0x2
+#define SBI_PMU_EVENT_TYPE_FW			0xf
+
+/* SBI PMU hardware general events */
+#define SBI_PMU_HW_CPU_CYCLES			0x1
+#define SBI_PMU_HW_INSTRUCTIONS			0x2
+
+/* SBI PMU firmware events */
+#define SBI_PMU_FW_SET_TIMER			0x5
+#define SBI_PMU_FW_IPI_SENT			0x6
+#define SBI_PMU_FW_FENCE_I_SENT			0x8
+#define SBI_PMU_FW_SFENCE_VMA_SENT		0xa
+#define SBI_PMU_FW_SFENCE_VMA_ASID_SENT		0xc
+#define SBI_PMU_FW_PLATFORM			0xffff
+
+/* event_data of SBI_PMU_FW_PLATFORM, ACRN specific */
+#define SBI_PMU_ACRN_MMIO_EXIT			0x0
+#define SBI_PMU_ACRN_SBI_CALL			0x1
+
+/* SBI PMU flags */
+#define SBI_PMU_CFG_FLAG_SKIP_MATCH		(1UL << 0U)
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE		(1UL << 1U)
+#define SBI_PMU_CFG_FLAG_AUTO_START		(1UL << 2U)
+#define SBI_PMU_START_FLAG_SET_INIT_VALUE	(1UL << 0U)
+#define SBI_PMU_STOP_FLAG_RESET			(1UL << 0U)
+
 /* SBI return error codes */
 #define SBI_SUCCESS				0
 #define SBI_EFAILURE				-1
@@ -79,6 +147,7 @@ enum sbi_type {
 
 struct sbi_ecall_dispatch {
 	enum sbi_id ext_id;
+	enum sbi_type type;
 	void (*handler)(struct acrn_vcpu *, struct cpu_regs *regs);
 };
 
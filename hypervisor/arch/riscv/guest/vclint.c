@@ -374,11 +374,10 @@ bool vclint_find_deliverable_intr(const struct acrn_vcpu *vcpu, uint32_t *vector
 
 void vcpu_inject_intr(struct acrn_vcpu *vcpu)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
 	uint32_t vector = 0U;
 
 	if (vclint_find_deliverable_intr(vcpu, &vector))
-		ctx->run_ctx.sip |= vector;
+		vcpu_set_vcsr(vcpu, VCSR_SIP, vcpu_get_vcsr(vcpu, VCSR_SIP) | vector);
 }
 
 bool vclint_has_pending_intr(struct acrn_vcpu *vcpu)
@@ -91,24 +91,12 @@ void vcpu_set_sp(struct acrn_vcpu *vcpu, uint64_t val)
 
 uint64_t vcpu_get_status(struct acrn_vcpu *vcpu)
 {
-	struct run_context *ctx =
-		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
-
-#ifndef CONFIG_MACRN
-	if (!bitmap_test(CPU_REG_STATUS, &vcpu->reg_updated) &&
-		!bitmap_test_and_set_lock(CPU_REG_STATUS,
-			&vcpu->reg_cached) && vcpu->launched) {
-		ctx->sstatus = cpu_csr_read(vsstatus);
-	}
-#endif
-
-	return ctx->sstatus;
+	return vcpu_get_vcsr(vcpu, VCSR_SSTATUS);
 }
 
 void vcpu_set_status(struct acrn_vcpu *vcpu, uint64_t val)
 {
-	vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx.sstatus = val;
-	bitmap_set_lock(CPU_REG_STATUS, &vcpu->reg_updated);
+	vcpu_set_vcsr(vcpu, VCSR_SSTATUS, val);
 }
 
 uint64_t vcpu_get_guest_csr(const struct acrn_vcpu *vcpu, uint32_t csr)
@@ -194,7 +182,12 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	for (i = 0; i < NR_WORLD; i++) {
 		(void)memset((void *)(&vcpu->arch.contexts[i]), 0U,
 			sizeof(struct run_context));
+		(void)memset((void *)(&vcpu->arch.contexts[i].ext_ctx.fpu), 0U,
+			sizeof(struct fpu_context));
 	}
+	vcpu->arch.vcsr_cached = VCSR_ALL;
+	vcpu->arch.vcsr_dirty = VCSR_ALL;
+	vpmu_reset(vcpu);
 
 	vclint = vcpu_vclint(vcpu);
 	vclint_reset(vclint, vclint_ops, mode);
@@ -380,6 +373,10 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
 	vclint_free(vcpu);
+	release_vmcs(vcpu);
+	if (per_cpu(fpu_owner, pcpuid_from_vcpu(vcpu)) == vcpu) {
+		per_cpu(fpu_owner, pcpuid_from_vcpu(vcpu)) = NULL;
+	}
 	per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 
 	/* This operation must be atomic to avoid contention with posted interrupt handler */
@@ -433,17 +430,56 @@ void zombie_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 	}
 }
 
-/* TODO:
- * Now we have switch_out and switch_in callbacks for each thread_object, and schedule
- * will call them every thread switch. We can implement lazy context swtich , which
- * only do context swtich when really need.
+/*
+ * The F/D registers are switched lazily, driven by the FS field the guest
+ * runs with: they are saved only when the vCPU dirtied them, and loaded
+ * only when the vCPU uses them and another vCPU may have used the FPU of
+ * this pCPU in between. fpu_owner is the vCPU whose values are in there.
+ *
+ * With CONFIG_MACRN that FS is the guest's own mstatus.FS, which the guest
+ * may set to Clean over registers it changed, so it only tells whether the
+ * FPU is on: the registers are saved whenever it is.
  */
 static void context_switch_out(struct thread_object *prev)
 {
+	struct acrn_vcpu *vcpu = container_of(prev, struct acrn_vcpu, thread_obj);
+	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
+	uint64_t status = ctx->run_ctx.cpu_gp_regs.regs.status;
+
+#ifdef CONFIG_MACRN
+	if ((status & STATUS_FS) != STATUS_FS_OFF) {
+#else
+	if ((status & STATUS_FS) == STATUS_FS_DIRTY) {
+#endif
+		cpu_csr_set(CSR_STATUS, STATUS_FS_CLEAN);
+		fpu_save(&ctx->ext_ctx.fpu);
+		ctx->run_ctx.cpu_gp_regs.regs.status = (status & ~STATUS_FS) | STATUS_FS_CLEAN;
+		get_cpu_var(fpu_owner) = vcpu;
+		vcpu->arch.nr_fpu_save++;
+	}
+
+	vpmu_save(vcpu);
 }
 
 static void context_switch_in(struct thread_object *next)
 {
+	struct acrn_vcpu *vcpu = container_of(next, struct acrn_vcpu, thread_obj);
+	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
+	uint64_t status = ctx->run_ctx.cpu_gp_regs.regs.status;
+	struct acrn_vcpu **owner = &get_cpu_var(fpu_owner);
+
+	if ((status & STATUS_FS) == STATUS_FS_OFF) {
+		/* the guest may turn the FPU on and overwrite it */
+		*owner = NULL;
+	} else if (*owner != vcpu) {
+		cpu_csr_set(CSR_STATUS, STATUS_FS_CLEAN);
+		fpu_restore(&ctx->ext_ctx.fpu);
+		ctx->run_ctx.cpu_gp_regs.regs.status = (status & ~STATUS_FS) | STATUS_FS_CLEAN;
+		*owner = vcpu;
+		vcpu->arch.nr_fpu_restore++;
+	}
+
+	vpmu_restore(vcpu);
 }
 
 /**
@@ -470,6 +506,12 @@ int create_vcpu(struct acrn_vm *vm, uint16_t vcpu_id)
 	char thread_name[16];
 
 	pcpu_id = vcpu_id + vm->vm_id * CONFIG_MAX_VCPU;
+#ifdef CONFIG_KTEST_SHARED_PCPU
+	/* time-share one pCPU between the vCPUs of the fake kernel */
+	if (!is_service_vm(vm)) {
+		pcpu_id = vm->vm_id * CONFIG_MAX_VCPU;
+	}
+#endif
 
 	/*
 	 * vcpu->vcpu_id = vm->hw.created_vcpus;
@@ -9,6 +9,7 @@
 #include <asm/lib/atomic.h>
 #include <asm/apicreg.h>
 #include <asm/guest/vcpu.h>
+#include <asm/guest/vmcs.h>
 #include <asm/guest/vm.h>
 #include <asm/guest/vpci.h>
 #include <asm/guest/instr_emul.h>
@@ -103,18 +104,21 @@ int32_t mmio_access_vmexit_handler(struct acrn_vcpu *vcpu)
 	uint64_t exit_qual;
 	uint64_t gva, gpa;
 	uint32_t ins, xlen;
+	uint64_t satp = vcpu_get_vcsr(vcpu, VCSR_SATP);
 	struct io_request *io_req = &vcpu->req;
 	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
+	vpmu_fw_event(&vcpu->arch.pmu, VPMU_FW_MMIO_EXIT);
+
 	/* Handle page fault from guest */
 	exit_qual = vcpu->arch.exit_qualification;
 	ins = get_instruction(ctx->cpu_gp_regs.regs.status,
 			      ctx->cpu_gp_regs.regs.ip, &xlen);
 	gva = ctx->cpu_gp_regs.regs.tval;
-	if (need_pagetable_walk(ctx->satp))
-		gpa = get_gpa(satp_to_vpn3_page(ctx->satp), gva);
+	if (need_pagetable_walk(satp))
+		gpa = get_gpa(satp_to_vpn3_page(satp), gva);
 	else
 		gpa = gva;
 
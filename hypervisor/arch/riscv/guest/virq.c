@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <asm/lib/bits.h>
 #include <asm/irq.h>
+#include <asm/tlb.h>
 #include <asm/vmx.h>
 #include <asm/guest/vcpu.h>
 #include <asm/guest/vmcs.h>
@@ -86,10 +87,8 @@ static uint8_t get_exception_type(uint32_t vector)
 static bool is_guest_irq_enabled(struct acrn_vcpu *vcpu)
 {
 	uint64_t ie = 0;
-	struct run_context *ctx =
-		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
-	ie = ctx->sie & 0x222;
+	ie = vcpu_get_vcsr(vcpu, VCSR_SIE) & 0x222;
 	pr_dbg("%s: ie 0x%lx", __func__, ie);
 
 	return !!ie;
@@ -368,7 +367,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 		}
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, pending_req_bits)) {
-			//invept(vcpu->vm->arch_vm.s2ptp);
+			flush_guest_tlb_local();
 		}
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,	pending_req_bits)) {
@@ -21,7 +21,19 @@
 #include <asm/image.h>
 #include <asm/guest/vuart.h>
 #include <asm/guest/vpci.h>
+#include <asm/guest/virq.h>
+#include <asm/guest/vplic.h>
+#include <asm/cpumask.h>
+#include <asm/notify.h>
+#include <asm/pgtable.h>
+#include <asm/lib/string.h>
+#include <asm/setup.h>
+#include <rtl.h>
+#include <schedule.h>
+#include <ticks.h>
+#include <util.h>
 #include <vmcs9900.h>
+#include "sbi.h"
 
 static struct acrn_vm vm_array[CONFIG_MAX_VM_NUM] __aligned(PAGE_SIZE);
 struct acrn_vm_config vm_configs[CONFIG_MAX_VM_NUM] = {
@@ -139,6 +151,7 @@ static int kernel_header_parse(struct kernel_info *info)
 
 	info->text_offset = 0;
 	//info->text_offset = bimage.text_offset;
+	info->image_size = bimage.image_size;
 	pr_info("bimage addr %lx text_offset %x", addr, info->text_offset);
 	return 0;
 }
@@ -225,6 +238,247 @@ static void dtb_load(struct dtb_info *info)
 #endif
 }
 
+#define FDT_MAGIC		0xd00dfeedU
+
+static uint32_t fdt_totalsize(uint64_t dtb_hpa)
+{
+	const uint32_t *hdr = (const uint32_t *)hpa2hva(dtb_hpa);
+
+	/* the header is big-endian: magic, totalsize, ... */
+	if (__builtin_bswap32(hdr[0]) != FDT_MAGIC)
+		return 0U;
+
+	return __builtin_bswap32(hdr[1]);
+}
+
+#define FDT_BEGIN_NODE		1U
+#define FDT_END_NODE		2U
+#define FDT_PROP		3U
+#define FDT_NOP			4U
+
+static uint64_t fdt_read_cells(const uint32_t *cell, uint32_t nr)
+{
+	uint64_t val = 0UL;
+
+	while (nr-- > 0U)
+		val = (val << 32U) | __builtin_bswap32(*cell++);
+	return val;
+}
+
+/*
+ * Whether [base, base + size) lies in one bank of the top-level memory
+ * nodes of the DTB, read with the root's #address-cells/#size-cells.
+ */
+static bool fdt_ram_covers(uint64_t dtb_hpa, uint64_t base, uint64_t size)
+{
+	const uint8_t *fdt = (const uint8_t *)hpa2hva(dtb_hpa);
+	const uint32_t *hdr = (const uint32_t *)fdt;
+	const uint32_t *p, *end, *reg;
+	const char *strings, *name;
+	uint32_t total = fdt_totalsize(dtb_hpa);
+	uint32_t len, i, depth = 0U, ac = 2U, sc = 1U;
+	uint64_t start, bank;
+	bool in_mem = false;
+
+	if (total == 0U)
+		return false;
+
+	p = (const uint32_t *)(fdt + __builtin_bswap32(hdr[2]));
+	strings = (const char *)(fdt + __builtin_bswap32(hdr[3]));
+	end = (const uint32_t *)(fdt + total);
+
+	while (p < end) {
+		switch (__builtin_bswap32(*p++)) {
+		case FDT_BEGIN_NODE:
+			name = (const char *)p;
+			depth++;
+			in_mem = (depth == 2U) && (strncmp(name, "memory", 6U) == 0) &&
+				((name[6] == '\0') || (name[6] == '@'));
+			p += (strnlen_s(name, DT_MAX_NAME) + 4U) / 4U;
+			break;
+		case FDT_END_NODE:
+			depth--;
+			in_mem = false;
+			break;
+		case FDT_PROP:
+			len = __builtin_bswap32(p[0]);
+			name = strings + __builtin_bswap32(p[1]);
+			reg = p + 2;
+			if (depth == 1U) {
+				if (strcmp(name, "#address-cells") == 0)
+					ac = __builtin_bswap32(*reg);
+				else if (strcmp(name, "#size-cells") == 0)
+					sc = __builtin_bswap32(*reg);
+			} else if (in_mem && (strcmp(name, "reg") == 0) &&
+					(ac - 1U < 2U) && (sc - 1U < 2U)) {
+				for (i = 0U; (i + ac + sc) * 4U <= len; i += ac + sc) {
+					start = fdt_read_cells(reg + i, ac);
+					bank = fdt_read_cells(reg + i + ac, sc);
+					if ((base >= start) && (base + size <= start + bank))
+						return true;
+				}
+			}
+			p += 2U + (len + 3U) / 4U;
+			break;
+		case FDT_NOP:
+			break;
+		default:
+			/* FDT_END, or something we can't walk */
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * The image cache is board configuration, so check once that it is RAM
+ * at all, as the SOS DTB describes it, and that no guest memory overlaps
+ * it. Otherwise no VM can be rebooted in place.
+ */
+static bool image_cache_usable = true;
+
+static void check_image_cache(struct acrn_vm *vm)
+{
+	struct kernel_info *kinfo = &vm->sw.kernel_info;
+	struct dtb_info *dinfo = &vm->sw.dtb_info;
+
+	if (is_service_vm(vm) &&
+	    !fdt_ram_covers(dinfo->dtb_addr, CONFIG_IMAGE_CACHE_BASE, CONFIG_IMAGE_CACHE_SIZE)) {
+		pr_warn("image cache %lx-%lx is not in RAM, can't reboot in place",
+			CONFIG_IMAGE_CACHE_BASE, CONFIG_IMAGE_CACHE_BASE + CONFIG_IMAGE_CACHE_SIZE);
+		image_cache_usable = false;
+	}
+
+	if ((kinfo->mem_start_gpa < CONFIG_IMAGE_CACHE_BASE + CONFIG_IMAGE_CACHE_SIZE) &&
+	    (CONFIG_IMAGE_CACHE_BASE < kinfo->mem_start_gpa + kinfo->mem_size_gpa)) {
+		pr_warn("VM%d memory %lx-%lx overlaps the image cache, can't reboot in place",
+			vm->vm_id, kinfo->mem_start_gpa, kinfo->mem_start_gpa + kinfo->mem_size_gpa);
+		image_cache_usable = false;
+	}
+}
+
+/* Images smaller than this are not worth an IPI round trip */
+#define IMAGE_COPY_PARALLEL_MIN	(2UL * 1024UL * 1024UL)
+
+struct image_copy_info {
+	void *dst;
+	const void *src;
+	uint64_t size;
+	uint64_t chunk;		/* bytes per pCPU, page aligned */
+	uint64_t cpus;		/* pCPUs taking part in the copy */
+};
+
+/* Each pCPU copies the chunk given by its rank among the participating pCPUs */
+static void image_copy_chunk(void *data)
+{
+	struct image_copy_info *info = (struct image_copy_info *)data;
+	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t off = bit_weight(info->cpus & ((1UL << pcpu_id) - 1UL)) * info->chunk;
+
+	if (off < info->size)
+		memcpy(info->dst + off, info->src + off, min(info->chunk, info->size - off));
+}
+
+/*
+ * Copy an image between hypervisor and guest memory, split over the
+ * calling pCPU and every pCPU that currently runs its idle thread; at boot
+ * and on an in-place reboot those are usually all of them.
+ */
+static void image_copy(void *dst, const void *src, uint64_t size)
+{
+	struct image_copy_info info = {
+		.dst = dst,
+		.src = src,
+		.size = size,
+		.cpus = 1UL << get_pcpu_id(),
+	};
+	uint16_t pcpu_id;
+	uint32_t nr;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		if (cpu_online(pcpu_id) && is_idle_thread(sched_get_current(pcpu_id)))
+			info.cpus |= 1UL << pcpu_id;
+	}
+
+	nr = bit_weight(info.cpus);
+	if ((nr == 1U) || (size < IMAGE_COPY_PARALLEL_MIN)) {
+		memcpy(dst, src, size);
+	} else {
+		/* kick the other pCPUs first, then copy the local chunk */
+		info.chunk = round_page_up((size + nr - 1U) / nr);
+		smp_call_function_async(info.cpus & ~(1UL << get_pcpu_id()), image_copy_chunk, &info);
+		image_copy_chunk(&info);
+		smp_call_function_wait();
+	}
+}
+
+/*
+ * Keep pristine copies of the kernel and DTB in the image cache, taken
+ * before the guest runs, for reboot_vm(). Each VM gets an equal share of
+ * the cache; if its images don't fit, or the kernel size is unknown, the
+ * VM can't be rebooted in place.
+ */
+static void cache_vm_images(struct acrn_vm *vm)
+{
+	struct kernel_info *kinfo = &vm->sw.kernel_info;
+	struct dtb_info *dinfo = &vm->sw.dtb_info;
+	struct vm_image_cache *cache = &vm->sw.image_cache;
+	uint64_t base = CONFIG_IMAGE_CACHE_BASE +
+		vm->vm_id * (CONFIG_IMAGE_CACHE_SIZE / CONFIG_MAX_VM_NUM);
+	uint64_t size = CONFIG_IMAGE_CACHE_SIZE / CONFIG_MAX_VM_NUM;
+	uint64_t start;
+
+	cache->valid = false;
+	check_image_cache(vm);
+#ifdef CONFIG_KTEST
+	/* the fake kernel is hypervisor text and has no DTB */
+	if (!is_service_vm(vm)) {
+		cache->kernel_size = 0UL;
+		cache->dtb_size = 0UL;
+		cache->valid = true;
+		return;
+	}
+#endif
+
+	if (!image_cache_usable)
+		return;
+
+	cache->kernel_size = kinfo->image_size;
+	cache->dtb_size = (dinfo->dtb_addr != 0UL) ? fdt_totalsize(dinfo->dtb_addr) : 0UL;
+	if ((cache->kernel_size == 0UL) || (cache->kernel_size + cache->dtb_size > size)) {
+		pr_warn("VM%d: no room to cache kernel %lx + dtb %lx, can't reboot in place",
+			vm->vm_id, cache->kernel_size, cache->dtb_size);
+		return;
+	}
+
+	start = cpu_ticks();
+	cache->kernel_hpa = base;
+	cache->dtb_hpa = base + cache->kernel_size;
+	image_copy(hpa2hva(cache->kernel_hpa),
+			hpa2hva(kinfo->mem_start_gpa + kinfo->text_offset), cache->kernel_size);
+	if (cache->dtb_size != 0UL)
+		image_copy(hpa2hva(cache->dtb_hpa), hpa2hva(dinfo->dtb_start_gpa), cache->dtb_size);
+	cache->valid = true;
+	pr_info("VM%d: cached kernel %lx + dtb %lx in %lu us", vm->vm_id,
+		cache->kernel_size, cache->dtb_size, ticks_to_us(cpu_ticks() - start));
+}
+
+static void restore_vm_images(struct acrn_vm *vm)
+{
+	struct kernel_info *kinfo = &vm->sw.kernel_info;
+	struct dtb_info *dinfo = &vm->sw.dtb_info;
+	struct vm_image_cache *cache = &vm->sw.image_cache;
+	uint64_t start = cpu_ticks();
+
+	if (cache->kernel_size != 0UL)
+		image_copy(hpa2hva(kinfo->mem_start_gpa + kinfo->text_offset),
+				hpa2hva(cache->kernel_hpa), cache->kernel_size);
+	if (cache->dtb_size != 0UL)
+		image_copy(hpa2hva(dinfo->dtb_start_gpa), hpa2hva(cache->dtb_hpa), cache->dtb_size);
+	pr_info("VM%d: restored images in %lu us", vm->vm_id, ticks_to_us(cpu_ticks() - start));
+}
+
 static void allocate_guest_memory(struct acrn_vm *vm, struct kernel_info *info)
 {
 	uint64_t gpa = info->mem_start_gpa;
@@ -303,6 +557,7 @@ int create_vm(struct acrn_vm *vm)
 	pr_info("load kernel and dtb");
 	kernel_load(kinfo);
 	dtb_load(dinfo);
+	cache_vm_images(vm);
 
 	if (is_service_vm(vm)) {
 		pr_info("passthru devices");
@@ -379,7 +634,8 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 void pause_vm(struct acrn_vm *vm)
 {
 	/* For RTVM, we can only pause its vCPUs when it is powering off by itself */
-	zombie_vcpu(&vm->hw.vcpu[0], VCPU_ZOMBIE);
+	for (int i = 0; i < vm->hw.created_vcpus; i++)
+		zombie_vcpu(&vm->hw.vcpu[i], VCPU_ZOMBIE);
 	vm->state = VM_PAUSED;
 }
 
@@ -395,12 +651,55 @@ int32_t reset_vm(struct acrn_vm *vm)
 	return 0;
 }
 
+/*
+ * Reboot vm in place, for an SBI SRST reboot from one of its vCPUs: the
+ * vCPUs, the vPLIC/vCLINT and the I/O requests are reset where they are,
+ * the kernel and DTB come back from the image cache, and the stage-2
+ * mappings are kept, they only depend on the VM configuration. The
+ * calling vCPU returns from its exit handler with its fresh state.
+ */
+int32_t reboot_vm(struct acrn_vm *vm, enum reset_mode mode)
+{
+	struct acrn_vcpu *vcpu;
+
+	if (!image_cache_usable || !vm->sw.image_cache.valid)
+		return -ENODEV;
+
+	pause_vm(vm);
+	reset_vm_ioreqs(vm);
+	vplic_reset(&vm->vplic, vm->vplic.ops, mode);
+	restore_vm_images(vm);
+
+	for (int i = 0; i < vm->hw.created_vcpus; i++) {
+		vcpu = &vm->hw.vcpu[i];
+		reset_vcpu(vcpu, mode);
+		vcpu_set_rip(vcpu, vm->sw.kernel_info.entry);
+		vcpu_set_gpreg(vcpu, CPU_REG_A0, vcpu->vcpu_id);
+		vcpu_set_gpreg(vcpu, CPU_REG_A1, vm->sw.dtb_info.dtb_addr);
+		vcpu_make_request(vcpu, ACRN_REQUEST_INIT_VMCS);
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+
+	start_vm(vm);
+
+	return 0;
+}
+
 void start_vm(struct acrn_vm *vm)
 {
 	vm->state = VM_RUNNING;
 
-	for (int i = 0; i < vm->hw.created_vcpus; i++)
-		launch_vcpu(&vm->hw.vcpu[i]);
+	/* secondary vCPUs stay stopped until the guest starts them by SBI HSM */
+	for (int i = 0; i < vm->hw.created_vcpus; i++) {
+		struct acrn_vcpu *vcpu = &vm->hw.vcpu[i];
+
+		if (is_vcpu_bsp(vcpu)) {
+			vcpu->arch.hsm_state = SBI_HSM_STATE_STARTED;
+			launch_vcpu(vcpu);
+		} else {
+			vcpu->arch.hsm_state = SBI_HSM_STATE_STOPPED;
+		}
+	}
 }
 
 void start_sos_vm(void)
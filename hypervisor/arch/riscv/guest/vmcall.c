@@ -11,9 +11,12 @@
 #include <asm/guest/vm.h>
 #include <asm/guest/vmexit.h>
 #include <asm/guest/virq.h>
+#include <asm/guest/guest_memory.h>
 #include <acrn_hv_defs.h>
 #include <hypercall.h>
 #include <trace.h>
+#include <sbuf.h>
+#include <profiling.h>
 #include <logmsg.h>
 #include "sbi.h"
 
@@ -33,6 +36,78 @@ int32_t hcall_set_irqline(__unused struct acrn_vcpu *vcpu, struct acrn_vm *targe
 	return ret;
 }
 
+/**
+ * @brief Set up a shared buffer, e.g. the per-pCPU trace and profiling sbufs
+ *
+ * @param param2 guest physical address of struct acrn_sbuf_param
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_setup_sbuf(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+	__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_sbuf_param asp;
+	uint64_t *hva;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &asp, param2, sizeof(asp)) == 0) {
+		if (asp.gpa != 0U) {
+			hva = (uint64_t *)gpa2hva(vm, asp.gpa);
+			ret = sbuf_setup_common(target_vm, asp.cpu_id, asp.sbuf_id, hva);
+		}
+	}
+
+	return ret;
+}
+
+#ifdef PROFILING_ON
+/**
+ * @brief Execute profiling operation, the subset arch/riscv/profiling.c
+ * implements
+ *
+ * @param param1 profiling command to be executed
+ * @param param2 guest physical address of the data of the command
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+	uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	int32_t ret;
+
+	switch (param1) {
+	case PROFILING_GET_VMINFO:
+		ret = profiling_vm_list_info(vm, param2);
+		break;
+	case PROFILING_GET_VERSION:
+		ret = profiling_get_version_info(vm, param2);
+		break;
+	case PROFILING_GET_CONTROL_SWITCH:
+		ret = profiling_get_control(vm, param2);
+		break;
+	case PROFILING_SET_CONTROL_SWITCH:
+		ret = profiling_set_control(vm, param2);
+		break;
+	case PROFILING_CONFIG_PMI:
+		ret = profiling_configure_pmi(vm, param2);
+		break;
+	case PROFILING_GET_STATUS:
+		ret = profiling_get_status_info(vm, param2);
+		break;
+	default:
+		pr_err("%s: unsupported profiling command %lu", __func__, param1);
+		ret = -1;
+		break;
+	}
+
+	return ret;
+}
+#endif
+
 static int32_t dispatch_sos_hypercall(struct acrn_vcpu *vcpu, uint64_t hypcall_id)
 {
 	struct acrn_vm *sos_vm = vcpu->vm;
@@ -204,6 +279,17 @@ static int32_t dispatch_sos_hypercall(struct acrn_vcpu *vcpu, uint64_t hypcall_i
 		}
 		break;
 
+	case HC_SETUP_SBUF:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vm_id < CONFIG_MAX_VM_NUM) {
+			ret = hcall_setup_sbuf(vcpu, target_vm, param1, param2);
+		}
+		break;
+
+	case HC_PROFILING_OPS:
+		ret = hcall_profiling_ops(vcpu, sos_vm, param1, param2);
+		break;
+
 	case HC_PM_GET_CPU_STATE:
 //		ret = hcall_get_cpu_pm_state(vcpu, sos_vm, param1, param2);
 		break;
@@ -36,34 +36,74 @@ static void init_guest_state(struct acrn_vcpu *vcpu)
 	cpu_csr_write(vsatp, ctx->run_ctx.satp);
 }
 
-static void load_guest_state(struct acrn_vcpu *vcpu)
+static uint64_t read_vcsr(uint32_t csr)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
+	uint64_t val;
 
-	cpu_csr_write(vsstatus, ctx->run_ctx.sstatus);
-	cpu_csr_write(vsepc, ctx->run_ctx.sepc);
-	cpu_csr_write(vsip, ctx->run_ctx.sip);
-	cpu_csr_write(vsie, ctx->run_ctx.sie);
-	cpu_csr_write(vstvec, ctx->run_ctx.stvec);
-	cpu_csr_write(vsscratch, ctx->run_ctx.sscratch);
-	cpu_csr_write(vstval, ctx->run_ctx.stval);
-	cpu_csr_write(vscause, ctx->run_ctx.scause);
-	cpu_csr_write(vsatp, ctx->run_ctx.satp);
+	switch (csr) {
+	case VCSR_SSTATUS:
+		val = cpu_csr_read(vsstatus);
+		break;
+	case VCSR_SEPC:
+		val = cpu_csr_read(vsepc);
+		break;
+	case VCSR_SIP:
+		val = cpu_csr_read(vsip);
+		break;
+	case VCSR_SIE:
+		val = cpu_csr_read(vsie);
+		break;
+	case VCSR_STVEC:
+		val = cpu_csr_read(vstvec);
+		break;
+	case VCSR_SSCRATCH:
+		val = cpu_csr_read(vsscratch);
+		break;
+	case VCSR_STVAL:
+		val = cpu_csr_read(vstval);
+		break;
+	case VCSR_SCAUSE:
+		val = cpu_csr_read(vscause);
+		break;
+	default:
+		val = cpu_csr_read(vsatp);
+		break;
+	}
+
+	return val;
 }
 
-static void save_guest_state(struct acrn_vcpu *vcpu)
+static void write_vcsr(__unused struct acrn_vcpu *vcpu, uint32_t csr, uint64_t val)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
-
-	ctx->run_ctx.sstatus = cpu_csr_read(vsstatus);
-	ctx->run_ctx.sepc = cpu_csr_read(vsepc);
-	ctx->run_ctx.sip = cpu_csr_read(vsip);
-	ctx->run_ctx.sie = cpu_csr_read(vsie);
-	ctx->run_ctx.stvec = cpu_csr_read(vstvec);
-	ctx->run_ctx.sscratch = cpu_csr_read(vsscratch);
-	ctx->run_ctx.stval = cpu_csr_read(vstval);
-	ctx->run_ctx.scause = cpu_csr_read(vscause);
-	ctx->run_ctx.satp = cpu_csr_read(vsatp);
+	switch (csr) {
+	case VCSR_SSTATUS:
+		cpu_csr_write(vsstatus, val);
+		break;
+	case VCSR_SEPC:
+		cpu_csr_write(vsepc, val);
+		break;
+	case VCSR_SIP:
+		cpu_csr_write(vsip, val);
+		break;
+	case VCSR_SIE:
+		cpu_csr_write(vsie, val);
+		break;
+	case VCSR_STVEC:
+		cpu_csr_write(vstvec, val);
+		break;
+	case VCSR_SSCRATCH:
+		cpu_csr_write(vsscratch, val);
+		break;
+	case VCSR_STVAL:
+		cpu_csr_write(vstval, val);
+		break;
+	case VCSR_SCAUSE:
+		cpu_csr_write(vscause, val);
+		break;
+	default:
+		cpu_csr_write(vsatp, val);
+		break;
+	}
 }
 
 static void init_host_state(struct acrn_vcpu *vcpu)
@@ -102,37 +142,77 @@ static void init_guest_state(struct acrn_vcpu *vcpu)
 	cpu_csr_write(satp, ctx->run_ctx.satp);
 }
 
-static void load_guest_state(struct acrn_vcpu *vcpu)
+static uint64_t read_vcsr(uint32_t csr)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
+	uint64_t val;
 
-	cpu_csr_write(sstatus, ctx->run_ctx.sstatus);
-	cpu_csr_write(sepc, ctx->run_ctx.sepc);
-	if (is_service_vm(vcpu->vm))
-		cpu_csr_set(mip, (ctx->run_ctx.sip & 0x22));
-	else
-		cpu_csr_set(mip, ctx->run_ctx.sip);
-	cpu_csr_write(sie, ctx->run_ctx.sie);
-	cpu_csr_write(stvec, ctx->run_ctx.stvec);
-	cpu_csr_write(sscratch, ctx->run_ctx.sscratch);
-	cpu_csr_write(stval, ctx->run_ctx.stval);
-	cpu_csr_write(scause, ctx->run_ctx.scause);
-	cpu_csr_write(satp, ctx->run_ctx.satp);
+	switch (csr) {
+	case VCSR_SSTATUS:
+		val = cpu_csr_read(sstatus);
+		break;
+	case VCSR_SEPC:
+		val = cpu_csr_read(sepc);
+		break;
+	case VCSR_SIP:
+		val = cpu_csr_read(sip);
+		break;
+	case VCSR_SIE:
+		val = cpu_csr_read(sie);
+		break;
+	case VCSR_STVEC:
+		val = cpu_csr_read(stvec);
+		break;
+	case VCSR_SSCRATCH:
+		val = cpu_csr_read(sscratch);
+		break;
+	case VCSR_STVAL:
+		val = cpu_csr_read(stval);
+		break;
+	case VCSR_SCAUSE:
+		val = cpu_csr_read(scause);
+		break;
+	default:
+		val = cpu_csr_read(satp);
+		break;
+	}
+
+	return val;
 }
 
-static void save_guest_state(struct acrn_vcpu *vcpu)
+static void write_vcsr(struct acrn_vcpu *vcpu, uint32_t csr, uint64_t val)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
-
-	ctx->run_ctx.sstatus = cpu_csr_read(sstatus);
-	ctx->run_ctx.sepc = cpu_csr_read(sepc);
-	ctx->run_ctx.sip = cpu_csr_read(sip);
-	ctx->run_ctx.sie = cpu_csr_read(sie);
-	ctx->run_ctx.stvec = cpu_csr_read(stvec);
-	ctx->run_ctx.sscratch = cpu_csr_read(sscratch);
-	ctx->run_ctx.stval = cpu_csr_read(stval);
-	ctx->run_ctx.scause = cpu_csr_read(scause);
-	ctx->run_ctx.satp = cpu_csr_read(satp);
+	switch (csr) {
+	case VCSR_SSTATUS:
+		cpu_csr_write(sstatus, val);
+		break;
+	case VCSR_SEPC:
+		cpu_csr_write(sepc, val);
+		break;
+	case VCSR_SIP:
+		if (is_service_vm(vcpu->vm))
+			cpu_csr_set(mip, (val & 0x22));
+		else
+			cpu_csr_set(mip, val);
+		break;
+	case VCSR_SIE:
+		cpu_csr_write(sie, val);
+		break;
+	case VCSR_STVEC:
+		cpu_csr_write(stvec, val);
+		break;
+	case VCSR_SSCRATCH:
+		cpu_csr_write(sscratch, val);
+		break;
+	case VCSR_STVAL:
+		cpu_csr_write(stval, val);
+		break;
+	case VCSR_SCAUSE:
+		cpu_csr_write(scause, val);
+		break;
+	default:
+		cpu_csr_write(satp, val);
+		break;
+	}
 }
 
 static void init_host_state(struct acrn_vcpu *vcpu)
@@ -195,6 +275,134 @@ void load_guest_pmp(struct acrn_vcpu *vcpu)
 }
 #endif
 
+/* the run_context field holding the saved copy of csr */
+static uint64_t *vcsr_slot(struct acrn_vcpu *vcpu, uint32_t csr)
+{
+	struct run_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
+	uint64_t *slot;
+
+	switch (csr) {
+	case VCSR_SSTATUS:
+		slot = &ctx->sstatus;
+		break;
+	case VCSR_SEPC:
+		slot = &ctx->sepc;
+		break;
+	case VCSR_SIP:
+		slot = &ctx->sip;
+		break;
+	case VCSR_SIE:
+		slot = &ctx->sie;
+		break;
+	case VCSR_STVEC:
+		slot = &ctx->stvec;
+		break;
+	case VCSR_SSCRATCH:
+		slot = &ctx->sscratch;
+		break;
+	case VCSR_STVAL:
+		slot = &ctx->stval;
+		break;
+	case VCSR_SCAUSE:
+		slot = &ctx->scause;
+		break;
+	default:
+		slot = &ctx->satp;
+		break;
+	}
+
+	return slot;
+}
+
+/*
+ * Pull the CSRs of a resident vCPU that were not read since its last exit
+ * into its run_context, so they can be taken over by another vCPU.
+ */
+static void flush_guest_state(struct acrn_vcpu *vcpu)
+{
+	uint32_t csr;
+
+	for (csr = 0U; csr < NUM_VCSRS; csr++) {
+		if ((vcpu->arch.vcsr_cached & (1U << csr)) == 0U) {
+			*vcsr_slot(vcpu, csr) = read_vcsr(csr);
+		}
+	}
+	vcpu->arch.vcsr_cached = VCSR_ALL;
+}
+
+/*
+ * Make vcpu the owner of the guest CSRs of this pCPU. If another vCPU held
+ * them, its values are saved first and all of them must be loaded.
+ */
+static void claim_guest_state(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu **owner = &get_cpu_var(vcsr_owner);
+
+	if (*owner != vcpu) {
+		if (*owner != NULL) {
+			flush_guest_state(*owner);
+		}
+		*owner = vcpu;
+		vcpu->arch.vcsr_dirty = VCSR_ALL;
+	}
+}
+
+/*
+ * The guest CSRs stay in hardware while the hypervisor handles a VM exit,
+ * so only the ones it changed are written back on the next entry; a vCPU
+ * re-entering on the same pCPU reloads nothing else.
+ */
+static void load_guest_state(struct acrn_vcpu *vcpu)
+{
+	uint32_t csr, dirty;
+
+	claim_guest_state(vcpu);
+
+	dirty = vcpu->arch.vcsr_dirty;
+	for (csr = 0U; dirty != 0U; csr++, dirty >>= 1U) {
+		if ((dirty & 1U) != 0U) {
+			write_vcsr(vcpu, csr, *vcsr_slot(vcpu, csr));
+		}
+	}
+	vcpu->arch.vcsr_dirty = 0U;
+}
+
+/*
+ * Nothing is read on exit: the guest may have changed any of the CSRs, so
+ * the run_context copies are stale until vcpu_get_vcsr() fetches them.
+ */
+static void save_guest_state(struct acrn_vcpu *vcpu)
+{
+	vcpu->arch.vcsr_cached = 0U;
+}
+
+/**
+ * @pre vcpu != NULL && csr < NUM_VCSRS
+ * @pre vcpu is resident on the current pCPU or not resident at all
+ */
+uint64_t vcpu_get_vcsr(struct acrn_vcpu *vcpu, uint32_t csr)
+{
+	uint64_t *val = vcsr_slot(vcpu, csr);
+
+	if (((vcpu->arch.vcsr_cached & (1U << csr)) == 0U) &&
+			(get_cpu_var(vcsr_owner) == vcpu)) {
+		*val = read_vcsr(csr);
+		vcpu->arch.vcsr_cached |= (1U << csr);
+	}
+
+	return *val;
+}
+
+/**
+ * @pre vcpu != NULL && csr < NUM_VCSRS
+ */
+void vcpu_set_vcsr(struct acrn_vcpu *vcpu, uint32_t csr, uint64_t val)
+{
+	*vcsr_slot(vcpu, csr) = val;
+	vcpu->arch.vcsr_cached |= (1U << csr);
+	vcpu->arch.vcsr_dirty |= (1U << csr);
+}
+
 /**
  * @pre vcpu != NULL
  */
@@ -204,9 +412,13 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 
 	/* Log message */
 	pr_dbg("Initializing VMCS");
+	claim_guest_state(vcpu);
 	/* Initialize the Virtual Machine Control Structure (VMCS) */
 	init_host_state(vcpu);
 	init_guest_state(vcpu);
+	/* the first entry loads all of run_context */
+	vcpu->arch.vcsr_cached = VCSR_ALL;
+	vcpu->arch.vcsr_dirty = VCSR_ALL;
 	*vcpu_ptr = (void *)vcpu;
 }
 
@@ -226,3 +438,16 @@ void save_vmcs(struct acrn_vcpu *vcpu)
 {
 	save_guest_state(vcpu);
 }
+
+/*
+ * Drop the CSRs of a vCPU going offline, its successor in the same slot
+ * must not mistake them for its own.
+ */
+void release_vmcs(struct acrn_vcpu *vcpu)
+{
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+
+	if (per_cpu(vcsr_owner, pcpu_id) == vcpu) {
+		per_cpu(vcsr_owner, pcpu_id) = NULL;
+	}
+}
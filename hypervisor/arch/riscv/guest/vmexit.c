@@ -28,6 +28,12 @@ static int32_t mti_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+/* the hypervisor's own overflow, sampled once vm_exit enables the interrupts */
+static int32_t lcofi_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	return 0;
+}
+
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	pr_fatal("Error: Unhandled VM exit condition from guest at 0x%016lx ",
@@ -126,6 +132,8 @@ static const struct vm_exit_dispatch interrupt_dispatch_table[NR_HX_EXIT_IRQ_REA
 		.handler = undefined_vmexit_handler},
 	[HX_EXIT_IRQ_MEXT] = {
 		.handler = mexti_vmexit_handler},
+	[HX_EXIT_IRQ_LCOF] = {
+		.handler = lcofi_vmexit_handler},
 	[HX_EXIT_IRQ_GUEST_SEXT] = {
 		.handler = unhandled_vmexit_handler},
 };
@@ -309,9 +309,31 @@ void vplic_accept_intr(struct acrn_vcpu *vcpu, uint32_t vector, bool level)
 	spin_unlock_irqrestore(&vplic->lock, flags);
 }
 
+/*
+ * Raise several level interrupts at once, as claimed back to back from the
+ * physical PLIC in one trap: one vPLIC lock round trip and one update of
+ * the vCPUs for the whole batch.
+ */
+void vplic_accept_intrs(struct acrn_vcpu *vcpu, const uint32_t *vectors, uint32_t nr)
+{
+	struct acrn_vplic *vplic;
+	uint64_t flags;
+	uint32_t i;
+
+	vplic = vcpu_vplic(vcpu);
+	spin_lock_irqsave(&vplic->lock, &flags);
+	for (i = 0U; i < nr; i++) {
+		if (vectors[i] < PLIC_NUM_SOURCES)
+			vplic_set_pending(&vplic->regs, vectors[i]);
+		else
+			dev_dbg(DBG_LEVEL_VPLIC, "vplic ignoring interrupt to vector %u", vectors[i]);
+	}
+	vplic_update(vplic);
+	spin_unlock_irqrestore(&vplic->lock, flags);
+}
+
 void vcpu_inject_extint(struct acrn_vcpu *vcpu)
 {
-	struct guest_cpu_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context];
 	struct acrn_vplic *vplic = vcpu_vplic(vcpu);
 	uint32_t irq;
 	uint64_t value = cpu_csr_read(mip);
@@ -320,10 +342,12 @@ void vcpu_inject_extint(struct acrn_vcpu *vcpu)
 	spin_lock_irqsave(&vplic->lock, &flags);
 	irq = vplic_get_deliverable_irq(vplic, vcpu->vcpu_id);
 	if (irq) {
-		ctx->run_ctx.sip |= CLINT_VECTOR_SEI;
+		vcpu_set_vcsr(vcpu, VCSR_SIP,
+			vcpu_get_vcsr(vcpu, VCSR_SIP) | CLINT_VECTOR_SEI);
 		cpu_csr_write(mip, value | CLINT_VECTOR_SEI);
 	} else {
-		ctx->run_ctx.sip &= ~CLINT_VECTOR_SEI;
+		vcpu_set_vcsr(vcpu, VCSR_SIP,
+			vcpu_get_vcsr(vcpu, VCSR_SIP) & ~CLINT_VECTOR_SEI);
 		cpu_csr_write(mip, value & ~CLINT_VECTOR_SEI);
 	}
 	spin_unlock_irqrestore(&vplic->lock, flags);
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/cpu.h>
+#include <asm/lib/bits.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/vpmu.h>
+#include <logmsg.h>
+#include "sbi.h"
+
+/*
+ * Paravirtual PMU, driven by the guest through the SBI PMU extension.
+ *
+ * Hardware counters (MACRN only, where the hypervisor owns the M-mode
+ * counter CSRs) are programmed directly: the guest reads them with the
+ * user counter CSRs, enabled in mcounteren, and they are saved and
+ * restored with the vCPU. Stopped counters are held in mcountinhibit.
+ *
+ * Firmware counters count events emulated by the hypervisor. Each vCPU
+ * counts all of them all the time, see vpmu_fw_event(), so that a
+ * firmware counter is just an offset into those counts.
+ */
+
+#define SBI_PMU_EVENT_TYPE(idx)		(((idx) >> 16U) & 0xfUL)
+#define SBI_PMU_EVENT_CODE(idx)		((idx) & 0xffffUL)
+#define SBI_PMU_INFO_FW			(1UL << 63U)
+#define SBI_PMU_INFO_WIDTH		(63UL << 12U)
+#define CSR_CYCLE_NUM			0xc00UL
+
+#define HPM_EVENT_OF			(1UL << 63U)
+#define HPM_EVENT_MINH			(1UL << 62U)
+#define MIP_LCOFIP			(1UL << 13U)
+
+/* the Sscofpmf extension, for overflow interrupts, only on QEMU */
+#ifdef RUN_ON_QEMU
+#define VPMU_SSCOFPMF
+#endif
+
+#define VPMU_FW_INVALID			0xffffffffU
+
+#ifdef CONFIG_MACRN
+static uint64_t hpm_read(uint32_t idx)
+{
+	uint64_t val = 0UL;
+
+	switch (idx) {
+	case VPMU_CYCLE:
+		val = cpu_csr_read(mcycle);
+		break;
+	case VPMU_INSTRET:
+		val = cpu_csr_read(minstret);
+		break;
+	case 3U:
+		val = cpu_csr_read(mhpmcounter3);
+		break;
+	case 4U:
+		val = cpu_csr_read(mhpmcounter4);
+		break;
+	case 5U:
+		val = cpu_csr_read(mhpmcounter5);
+		break;
+	case 6U:
+		val = cpu_csr_read(mhpmcounter6);
+		break;
+	default:
+		break;
+	}
+
+	return val;
+}
+
+static void hpm_write(uint32_t idx, uint64_t val)
+{
+	switch (idx) {
+	case VPMU_CYCLE:
+		cpu_csr_write(mcycle, val);
+		break;
+	case VPMU_INSTRET:
+		cpu_csr_write(minstret, val);
+		break;
+	case 3U:
+		cpu_csr_write(mhpmcounter3, val);
+		break;
+	case 4U:
+		cpu_csr_write(mhpmcounter4, val);
+		break;
+	case 5U:
+		cpu_csr_write(mhpmcounter5, val);
+		break;
+	case 6U:
+		cpu_csr_write(mhpmcounter6, val);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint64_t hpm_read_event(uint32_t idx)
+{
+	uint64_t val = 0UL;
+
+	switch (idx) {
+	case 3U:
+		val = cpu_csr_read(mhpmevent3);
+		break;
+	case 4U:
+		val = cpu_csr_read(mhpmevent4);
+		break;
+	case 5U:
+		val = cpu_csr_read(mhpmevent5);
+		break;
+	case 6U:
+		val = cpu_csr_read(mhpmevent6);
+		break;
+	default:
+		break;
+	}
+
+	return val;
+}
+
+static void hpm_write_event(uint32_t idx, uint64_t val)
+{
+	switch (idx) {
+	case 3U:
+		cpu_csr_write(mhpmevent3, val);
+		break;
+	case 4U:
+		cpu_csr_write(mhpmevent4, val);
+		break;
+	case 5U:
+		cpu_csr_write(mhpmevent5, val);
+		break;
+	case 6U:
+		cpu_csr_write(mhpmevent6, val);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline uint64_t hpm_mask(void)
+{
+	return VPMU_HW_MASK & ~((1UL << VPMU_HPM_BASE) - 1UL);
+}
+
+static inline void vpmu_update_inhibit(const struct acrn_vpmu *pmu)
+{
+	cpu_csr_write(mcountinhibit, pmu->used & ~pmu->running & VPMU_HW_MASK);
+}
+
+/*
+ * @pre vcpu is the vCPU running on this pCPU, before it is switched out
+ */
+void vpmu_save(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	uint32_t i;
+
+	if ((pmu->used & VPMU_HW_MASK) == 0UL)
+		return;
+
+	for (i = 0U; i < VPMU_NR_HW_COUNTERS; i++) {
+		if ((pmu->used & (1UL << i)) != 0UL) {
+			pmu->hw_value[i] = hpm_read(i);
+			if (i >= VPMU_HPM_BASE)
+				pmu->hpm_event[i - VPMU_HPM_BASE] = hpm_read_event(i);
+		}
+	}
+
+	/* keep the programmable counters from counting, or overflowing, for others */
+	cpu_csr_write(mcountinhibit, pmu->used & hpm_mask());
+	if ((cpu_csr_read(mip) & MIP_LCOFIP) != 0UL) {
+		cpu_csr_clear(mip, MIP_LCOFIP);
+		pmu->lcofip = true;
+	}
+}
+
+/*
+ * @pre vcpu is the vCPU to run on this pCPU, after it is switched in
+ */
+void vpmu_restore(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	uint32_t i;
+
+	if ((pmu->used & VPMU_HW_MASK) == 0UL)
+		return;
+
+	for (i = 0U; i < VPMU_NR_HW_COUNTERS; i++) {
+		if ((pmu->used & (1UL << i)) != 0UL) {
+			if (i >= VPMU_HPM_BASE)
+				hpm_write_event(i, pmu->hpm_event[i - VPMU_HPM_BASE]);
+			hpm_write(i, pmu->hw_value[i]);
+		}
+	}
+
+	vpmu_update_inhibit(pmu);
+	if (pmu->lcofip) {
+		cpu_csr_set(mip, MIP_LCOFIP);
+		pmu->lcofip = false;
+	}
+}
+
+static uint32_t vpmu_match_hw(const struct acrn_vpmu *pmu, uint64_t base,
+		uint64_t mask, uint64_t event_idx)
+{
+	uint64_t type = SBI_PMU_EVENT_TYPE(event_idx);
+	uint64_t code = SBI_PMU_EVENT_CODE(event_idx);
+	uint64_t candidates = 0UL;
+	uint32_t idx = VPMU_NR_COUNTERS;
+	uint16_t offset;
+
+	if (type == SBI_PMU_EVENT_TYPE_HW) {
+		if (code == SBI_PMU_HW_CPU_CYCLES)
+			candidates = 1UL << VPMU_CYCLE;
+		else if (code == SBI_PMU_HW_INSTRUCTIONS)
+			candidates = 1UL << VPMU_INSTRET;
+	} else if (type == SBI_PMU_EVENT_TYPE_HW_RAW) {
+		candidates = hpm_mask();
+	}
+
+	candidates &= ~pmu->used;
+	offset = ffs64(mask);
+	while (offset < 64U) {
+		if ((base + offset) < VPMU_NR_HW_COUNTERS &&
+		    (candidates & (1UL << (base + offset))) != 0UL) {
+			idx = (uint32_t)(base + offset);
+			break;
+		}
+		clear_bit(offset, &mask);
+		offset = ffs64(mask);
+	}
+
+	return idx;
+}
+
+static void vpmu_config_hw(struct acrn_vcpu *vcpu, uint32_t idx,
+		uint64_t event_idx, uint64_t event_data)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	uint64_t event;
+
+	if (idx >= VPMU_HPM_BASE) {
+		/* raw events are the vendor specific mhpmevent value */
+		event = event_data & ~(HPM_EVENT_OF | HPM_EVENT_MINH);
+#ifdef VPMU_SSCOFPMF
+		event |= HPM_EVENT_MINH;
+#endif
+		pmu->hpm_event[idx - VPMU_HPM_BASE] = event;
+		hpm_write_event(idx, event);
+	}
+	vpmu_update_inhibit(pmu);
+}
+
+static void vpmu_start_hw(struct acrn_vcpu *vcpu, uint32_t idx, bool set, uint64_t value)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+
+#ifdef VPMU_SSCOFPMF
+	if (idx >= VPMU_HPM_BASE) {
+		pmu->hpm_event[idx - VPMU_HPM_BASE] &= ~HPM_EVENT_OF;
+		hpm_write_event(idx, pmu->hpm_event[idx - VPMU_HPM_BASE]);
+	}
+#endif
+	if (set)
+		hpm_write(idx, value);
+	vpmu_update_inhibit(pmu);
+}
+#else
+/* the H-extension build leaves the hardware counters alone */
+void vpmu_save(__unused struct acrn_vcpu *vcpu) {}
+void vpmu_restore(__unused struct acrn_vcpu *vcpu) {}
+
+static uint32_t vpmu_match_hw(__unused const struct acrn_vpmu *pmu,
+		__unused uint64_t base, __unused uint64_t mask,
+		__unused uint64_t event_idx)
+{
+	return VPMU_NR_COUNTERS;
+}
+
+static void vpmu_config_hw(__unused struct acrn_vcpu *vcpu, __unused uint32_t idx,
+		__unused uint64_t event_idx, __unused uint64_t event_data) {}
+static void vpmu_start_hw(__unused struct acrn_vcpu *vcpu, __unused uint32_t idx,
+		__unused bool set, __unused uint64_t value) {}
+static void vpmu_update_inhibit(__unused const struct acrn_vpmu *pmu) {}
+#endif
+
+static uint32_t vpmu_fw_event_id(uint64_t event_idx, uint64_t event_data)
+{
+	uint32_t id = VPMU_FW_INVALID;
+
+	if (SBI_PMU_EVENT_TYPE(event_idx) != SBI_PMU_EVENT_TYPE_FW)
+		return id;
+
+	switch (SBI_PMU_EVENT_CODE(event_idx)) {
+	case SBI_PMU_FW_SET_TIMER:
+		id = VPMU_FW_SET_TIMER;
+		break;
+	case SBI_PMU_FW_IPI_SENT:
+		id = VPMU_FW_IPI_SENT;
+		break;
+	case SBI_PMU_FW_FENCE_I_SENT:
+		id = VPMU_FW_FENCE_I_SENT;
+		break;
+	case SBI_PMU_FW_SFENCE_VMA_SENT:
+		id = VPMU_FW_SFENCE_VMA_SENT;
+		break;
+	case SBI_PMU_FW_SFENCE_VMA_ASID_SENT:
+		id = VPMU_FW_SFENCE_VMA_ASID_SENT;
+		break;
+	case SBI_PMU_FW_PLATFORM:
+		if (event_data == SBI_PMU_ACRN_MMIO_EXIT)
+			id = VPMU_FW_MMIO_EXIT;
+		else if (event_data == SBI_PMU_ACRN_SBI_CALL)
+			id = VPMU_FW_SBI_CALL;
+		break;
+	default:
+		break;
+	}
+
+	return id;
+}
+
+static inline bool is_fw_counter(uint64_t idx)
+{
+	return (idx >= VPMU_NR_HW_COUNTERS) && (idx < VPMU_NR_COUNTERS);
+}
+
+static uint64_t vpmu_fw_value(const struct acrn_vpmu *pmu, uint32_t idx)
+{
+	uint32_t i = idx - VPMU_NR_HW_COUNTERS;
+	uint64_t val = pmu->fw_value[i];
+
+	if ((pmu->running & (1UL << idx)) != 0UL)
+		val += pmu->fw_events[pmu->fw_event[i]];
+
+	return val;
+}
+
+static void vpmu_start_fw(struct acrn_vpmu *pmu, uint32_t idx, bool set, uint64_t value)
+{
+	uint32_t i = idx - VPMU_NR_HW_COUNTERS;
+
+	if (!set)
+		value = pmu->fw_value[i];
+	pmu->fw_value[i] = value - pmu->fw_events[pmu->fw_event[i]];
+}
+
+static void vpmu_stop_fw(struct acrn_vpmu *pmu, uint32_t idx)
+{
+	uint32_t i = idx - VPMU_NR_HW_COUNTERS;
+
+	pmu->fw_value[i] += pmu->fw_events[pmu->fw_event[i]];
+}
+
+/* the counters selected by base/mask must all exist */
+static bool vpmu_valid_mask(uint64_t base, uint64_t mask)
+{
+	return (mask != 0UL) && (base < VPMU_NR_COUNTERS) &&
+		((mask >> (VPMU_NR_COUNTERS - base)) == 0UL);
+}
+
+void vpmu_reset(struct acrn_vcpu *vcpu)
+{
+	(void)memset(&vcpu->arch.pmu, 0U, sizeof(struct acrn_vpmu));
+}
+
+int64_t vpmu_counter_info(uint64_t idx, uint64_t *info)
+{
+	if (idx >= VPMU_NR_COUNTERS)
+		return SBI_EINVAL_PARAM;
+
+	if (is_fw_counter(idx))
+		*info = SBI_PMU_INFO_FW;
+	else
+		*info = SBI_PMU_INFO_WIDTH | (CSR_CYCLE_NUM + idx);
+
+	return SBI_SUCCESS;
+}
+
+int64_t vpmu_config_matching(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags, uint64_t event_idx,
+		uint64_t event_data, uint64_t *idx)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	uint32_t fw_id = vpmu_fw_event_id(event_idx, event_data);
+	uint32_t i = VPMU_NR_COUNTERS;
+	uint16_t offset;
+
+	if (!vpmu_valid_mask(base, mask))
+		return SBI_EINVAL_PARAM;
+
+	if ((flags & SBI_PMU_CFG_FLAG_SKIP_MATCH) != 0UL) {
+		/* reuse the counter the guest configured before */
+		i = (uint32_t)(base + ffs64(mask));
+		if ((pmu->used & (1UL << i)) == 0UL)
+			return SBI_EINVAL_PARAM;
+	} else if (fw_id != VPMU_FW_INVALID) {
+		offset = ffs64(mask);
+		while (offset < 64U) {
+			if (is_fw_counter(base + offset) &&
+			    (pmu->used & (1UL << (base + offset))) == 0UL) {
+				i = (uint32_t)(base + offset);
+				break;
+			}
+			clear_bit(offset, &mask);
+			offset = ffs64(mask);
+		}
+		if (i == VPMU_NR_COUNTERS)
+			return SBI_ENOTSUPP;
+
+		pmu->fw_event[i - VPMU_NR_HW_COUNTERS] = fw_id;
+		pmu->fw_value[i - VPMU_NR_HW_COUNTERS] = 0UL;
+		pmu->used |= 1UL << i;
+	} else {
+		i = vpmu_match_hw(pmu, base, mask, event_idx);
+		if (i == VPMU_NR_COUNTERS)
+			return SBI_ENOTSUPP;
+
+		pmu->used |= 1UL << i;
+		vpmu_config_hw(vcpu, i, event_idx, event_data);
+	}
+
+	if ((flags & SBI_PMU_CFG_FLAG_AUTO_START) != 0UL) {
+		pmu->running |= 1UL << i;
+		if (is_fw_counter(i))
+			vpmu_start_fw(pmu, i, (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE) != 0UL, 0UL);
+		else
+			vpmu_start_hw(vcpu, i, (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE) != 0UL, 0UL);
+	} else if ((flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE) != 0UL) {
+		if (is_fw_counter(i))
+			pmu->fw_value[i - VPMU_NR_HW_COUNTERS] = 0UL;
+		else
+			vpmu_start_hw(vcpu, i, true, 0UL);
+	}
+
+	*idx = i;
+
+	return SBI_SUCCESS;
+}
+
+int64_t vpmu_counter_start(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags, uint64_t value)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	bool set = ((flags & SBI_PMU_START_FLAG_SET_INIT_VALUE) != 0UL);
+	int64_t ret = SBI_SUCCESS;
+	uint16_t offset;
+	uint32_t i;
+
+	if (!vpmu_valid_mask(base, mask))
+		return SBI_EINVAL_PARAM;
+
+	offset = ffs64(mask);
+	while (offset < 64U) {
+		i = (uint32_t)(base + offset);
+		clear_bit(offset, &mask);
+		offset = ffs64(mask);
+
+		if ((pmu->used & (1UL << i)) == 0UL) {
+			ret = SBI_EINVAL_PARAM;
+			continue;
+		}
+		if ((pmu->running & (1UL << i)) != 0UL) {
+			ret = SBI_ESTARTED;
+			continue;
+		}
+
+		pmu->running |= 1UL << i;
+		if (is_fw_counter(i))
+			vpmu_start_fw(pmu, i, set, value);
+		else
+			vpmu_start_hw(vcpu, i, set, value);
+	}
+
+	return ret;
+}
+
+int64_t vpmu_counter_stop(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+	int64_t ret = SBI_SUCCESS;
+	uint16_t offset;
+	uint32_t i;
+
+	if (!vpmu_valid_mask(base, mask))
+		return SBI_EINVAL_PARAM;
+
+	offset = ffs64(mask);
+	while (offset < 64U) {
+		i = (uint32_t)(base + offset);
+		clear_bit(offset, &mask);
+		offset = ffs64(mask);
+
+		if ((pmu->used & (1UL << i)) == 0UL) {
+			ret = SBI_EINVAL_PARAM;
+			continue;
+		}
+
+		if ((pmu->running & (1UL << i)) == 0UL) {
+			ret = SBI_ESTOPPED;
+		} else {
+			pmu->running &= ~(1UL << i);
+			if (is_fw_counter(i))
+				vpmu_stop_fw(pmu, i);
+		}
+		if ((flags & SBI_PMU_STOP_FLAG_RESET) != 0UL)
+			pmu->used &= ~(1UL << i);
+	}
+	vpmu_update_inhibit(pmu);
+
+	return ret;
+}
+
+int64_t vpmu_fw_read(struct acrn_vcpu *vcpu, uint64_t idx, uint64_t *value)
+{
+	struct acrn_vpmu *pmu = &vcpu->arch.pmu;
+
+	if (!is_fw_counter(idx) || ((pmu->used & (1UL << idx)) == 0UL))
+		return SBI_EINVAL_PARAM;
+
+	*value = vpmu_fw_value(pmu, (uint32_t)idx);
+
+	return SBI_SUCCESS;
+}
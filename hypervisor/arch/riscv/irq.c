@@ -14,7 +14,6 @@
 
 const unsigned int nr_irqs = NR_IRQS;
 
-static spinlock_t riscv_irq_spinlock = { .head = 0U, .tail = 0U, };
 static struct arch_irq_desc irq_data[NR_IRQS];
 static struct irq_desc irq_desc[NR_IRQS];
 
@@ -31,16 +30,17 @@ static int arch_data_init_one_irq_desc(struct irq_desc *desc)
 	return 0;
 }
 
+/*
+ * The vector is published once, in init_irq_descs_arch() on the BSP before
+ * the other pCPUs start, and never changes afterwards, so a single aligned
+ * load is enough and no lock is needed to read it.
+ */
 uint32_t irq_to_vector(uint32_t irq)
 {
-	uint64_t rflags;
 	uint32_t ret = VECTOR_INVALID;
 
-	if (irq < NR_IRQS) {
-		spinlock_irqsave_obtain(&riscv_irq_spinlock, &rflags);
-		ret = irq_data[irq].vector;
-		spinlock_irqrestore_release(&riscv_irq_spinlock, rflags);
-	}
+	if (irq < NR_IRQS)
+		ret = *(volatile uint32_t *)&irq_data[irq].vector;
 
 	return ret;
 }
@@ -154,22 +154,31 @@ void dispatch_interrupt(struct cpu_regs *regs)
 	} while (1);
 }
 
+/* Max sources claimed before they are handed to the vPLIC in one go */
+#define MEXTI_CLAIM_BATCH	16U
+
 void handle_mexti(void)
 {
-	uint32_t irq;
+	uint32_t irqs[MEXTI_CLAIM_BATCH];
+	uint32_t irq, nr = 0U;
 	struct acrn_vm *sos_vm;
 	struct acrn_vcpu *vcpu;
 
 	sos_vm = get_sos_vm();
 	vcpu = vcpu_from_vid(sos_vm, BSP_CPU_ID);
 
+	/* claim until the PLIC has nothing pending, inject in batches */
 	do {
 		irq = acrn_irqchip->get_irq();
-		if (irq == 0)
-			break;
-		pr_dbg("Inject interrupt: %d", irq);
-		vplic_accept_intr(vcpu, irq, true);
-	} while (1);
+		if (irq != 0U) {
+			pr_dbg("Inject interrupt: %d", irq);
+			irqs[nr++] = irq;
+		}
+		if ((nr == MEXTI_CLAIM_BATCH) || ((irq == 0U) && (nr != 0U))) {
+			vplic_accept_intrs(vcpu, irqs, nr);
+			nr = 0U;
+		}
+	} while (irq != 0U);
 }
 
 void init_irq_descs_arch(struct irq_desc descs[])
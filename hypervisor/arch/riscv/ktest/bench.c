@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+
+/*
+ * Trap round trip microbenchmark, run by the fake kernel before it starts
+ * the other vCPUs: each round is an SBI base GET_SPEC_VERSION ecall, the
+ * cheapest VM exit the hypervisor handles. There is no console in the
+ * fake kernel, read the result with gdb at trap_bench_done:
+ *
+ *   b trap_bench_done
+ *   p trap_bench
+ */
+
+#define TRAP_BENCH_ROUNDS	10000UL
+#define SBI_ID_BASE		0x10UL
+
+struct trap_bench_result {
+	uint64_t rounds;
+	uint64_t min;		/* in cycles */
+	uint64_t max;
+	uint64_t avg;
+};
+
+struct trap_bench_result trap_bench;
+
+static inline uint64_t read_cycle(void)
+{
+	uint64_t v;
+
+	asm volatile ("rdcycle %0" : "=r"(v) :: "memory");
+	return v;
+}
+
+static inline void sbi_get_spec_version(void)
+{
+	register uint64_t a0 asm("a0") = 0UL;
+	register uint64_t a1 asm("a1") = 0UL;
+	register uint64_t a6 asm("a6") = 0UL;
+	register uint64_t a7 asm("a7") = SBI_ID_BASE;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a6), "r"(a7)
+			: "memory");
+}
+
+void __attribute__((noinline)) trap_bench_done(struct trap_bench_result *res)
+{
+	asm volatile ("" :: "r"(res) : "memory");
+}
+
+void trap_bench_run(void)
+{
+	uint64_t i, start, cycles, total = 0UL;
+
+	trap_bench.min = ~0UL;
+	trap_bench.max = 0UL;
+	for (i = 0UL; i < TRAP_BENCH_ROUNDS; i++) {
+		start = read_cycle();
+		sbi_get_spec_version();
+		cycles = read_cycle() - start;
+
+		total += cycles;
+		if (cycles < trap_bench.min)
+			trap_bench.min = cycles;
+		if (cycles > trap_bench.max)
+			trap_bench.max = cycles;
+	}
+	trap_bench.rounds = TRAP_BENCH_ROUNDS;
+	trap_bench.avg = total / TRAP_BENCH_ROUNDS;
+
+	trap_bench_done(&trap_bench);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+
+/*
+ * FP context switch test, run by every vCPU of the fake kernel: fill the
+ * F/D registers with a per-vCPU pattern, take a VM exit, and check that
+ * the pattern survived. With CONFIG_KTEST_SHARED_PCPU both vCPUs share a
+ * pCPU, so the round trips include the vCPU switches; comparing the cycles
+ * per round with a build without it gives the switch cost.
+ *
+ * A second run of rounds sets FS back to Clean before each exit, as a
+ * guest kernel does once it has saved the registers itself. The pattern
+ * must survive that too, since the guest can't vouch for the FPU state
+ * of other vCPUs. Read the result with gdb at fp_test_done:
+ *
+ *   b fp_test_done
+ *   p fp_test
+ */
+
+#define FP_TEST_ROUNDS		100000UL
+#define FP_TEST_MAX_VCPUS	8U
+#define SBI_ID_BASE		0x10UL
+#define STATUS_FS_INITIAL	(0x1UL << 13U)
+#define STATUS_FS_CLEAN		(0x2UL << 13U)
+#define STATUS_FS		(0x3UL << 13U)
+
+struct fp_test_result {
+	uint64_t rounds;
+	uint64_t errors;
+	uint64_t clean_errors;	/* in the rounds with FS set to Clean */
+	uint64_t cycles;	/* average per round */
+};
+
+struct fp_test_result fp_test[FP_TEST_MAX_VCPUS];
+
+#define FP_SET(n)	asm volatile ("fmv.d.x f" #n ", %0" :: "r"(seed + n##UL))
+#define FP_GET(n)	asm volatile ("fmv.x.d %0, f" #n : "=r"(regs[n]))
+
+static void fp_fill(uint64_t seed)
+{
+	FP_SET(0);  FP_SET(1);  FP_SET(2);  FP_SET(3);
+	FP_SET(4);  FP_SET(5);  FP_SET(6);  FP_SET(7);
+	FP_SET(8);  FP_SET(9);  FP_SET(10); FP_SET(11);
+	FP_SET(12); FP_SET(13); FP_SET(14); FP_SET(15);
+	FP_SET(16); FP_SET(17); FP_SET(18); FP_SET(19);
+	FP_SET(20); FP_SET(21); FP_SET(22); FP_SET(23);
+	FP_SET(24); FP_SET(25); FP_SET(26); FP_SET(27);
+	FP_SET(28); FP_SET(29); FP_SET(30); FP_SET(31);
+}
+
+static bool fp_check(uint64_t seed)
+{
+	uint64_t regs[32];
+	uint64_t i;
+
+	FP_GET(0);  FP_GET(1);  FP_GET(2);  FP_GET(3);
+	FP_GET(4);  FP_GET(5);  FP_GET(6);  FP_GET(7);
+	FP_GET(8);  FP_GET(9);  FP_GET(10); FP_GET(11);
+	FP_GET(12); FP_GET(13); FP_GET(14); FP_GET(15);
+	FP_GET(16); FP_GET(17); FP_GET(18); FP_GET(19);
+	FP_GET(20); FP_GET(21); FP_GET(22); FP_GET(23);
+	FP_GET(24); FP_GET(25); FP_GET(26); FP_GET(27);
+	FP_GET(28); FP_GET(29); FP_GET(30); FP_GET(31);
+
+	for (i = 0UL; i < 32UL; i++) {
+		if (regs[i] != (seed + i))
+			return false;
+	}
+
+	return true;
+}
+
+static inline uint64_t read_cycle(void)
+{
+	uint64_t v;
+
+	asm volatile ("rdcycle %0" : "=r"(v) :: "memory");
+	return v;
+}
+
+static inline void vm_exit(void)
+{
+	register uint64_t a0 asm("a0") = 0UL;
+	register uint64_t a1 asm("a1") = 0UL;
+	register uint64_t a6 asm("a6") = 0UL;
+	register uint64_t a7 asm("a7") = SBI_ID_BASE;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a6), "r"(a7)
+			: "memory");
+}
+
+void __attribute__((noinline)) fp_test_done(struct fp_test_result *res)
+{
+	asm volatile ("" :: "r"(res) : "memory");
+}
+
+void fp_test_run(void)
+{
+	struct fp_test_result *res;
+	uint64_t id, i, seed, start;
+
+	asm volatile ("csrr %0, sscratch" : "=r"(id));
+	if (id >= FP_TEST_MAX_VCPUS)
+		return;
+
+	res = &fp_test[id];
+	asm volatile ("csrs sstatus, %0" :: "r"(STATUS_FS_INITIAL));
+
+	start = read_cycle();
+	for (i = 0UL; i < FP_TEST_ROUNDS; i++) {
+		seed = (id << 48U) | (i << 8U);
+		fp_fill(seed);
+		vm_exit();
+		if (!fp_check(seed))
+			res->errors++;
+	}
+	res->cycles = (read_cycle() - start) / FP_TEST_ROUNDS;
+
+	for (i = 0UL; i < FP_TEST_ROUNDS; i++) {
+		seed = (id << 48U) | (i << 8U) | 0x80UL;
+		fp_fill(seed);
+		asm volatile ("csrc sstatus, %0" :: "r"(STATUS_FS));
+		asm volatile ("csrs sstatus, %0" :: "r"(STATUS_FS_CLEAN));
+		vm_exit();
+		if (!fp_check(seed))
+			res->clean_errors++;
+	}
+	res->rounds = FP_TEST_ROUNDS;
+
+	fp_test_done(res);
+}
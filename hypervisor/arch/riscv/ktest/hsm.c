@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+
+/*
+ * SBI HSM up/down loop, run by the fake kernel before it starts the other
+ * vCPUs: hart 1 is started at _vhsm_test, reports in and stops itself
+ * again, HSM_TEST_ROUNDS times. start is the cycles from the HART_START
+ * ecall until hart 1 runs guest code, stop the cycles from there until
+ * HART_GET_STATUS reports it stopped. Read the result with gdb at
+ * hsm_test_done:
+ *
+ *   b hsm_test_done
+ *   p hsm_test
+ */
+
+#define HSM_TEST_ROUNDS		1000UL
+#define HSM_TEST_HART		1UL
+#define SBI_ID_HSM		0x48534DUL
+#define SBI_HSM_HART_START	0x0UL
+#define SBI_HSM_HART_STOP	0x1UL
+#define SBI_HSM_HART_GET_STATUS	0x2UL
+#define SBI_HSM_STATE_STOPPED	0x1UL
+
+struct hsm_test_result {
+	uint64_t rounds;
+	uint64_t errors;
+	uint64_t start_min;	/* in cycles */
+	uint64_t start_max;
+	uint64_t start_avg;
+	uint64_t stop_avg;
+};
+
+struct hsm_test_result hsm_test;
+static volatile uint64_t hsm_test_ack;
+
+extern char _vhsm_test[];
+
+static inline uint64_t read_cycle(void)
+{
+	uint64_t v;
+
+	asm volatile ("rdcycle %0" : "=r"(v) :: "memory");
+	return v;
+}
+
+static inline int64_t sbi_hsm_call(uint64_t funcid, uint64_t arg0, uint64_t arg1,
+		uint64_t arg2, uint64_t *value)
+{
+	register uint64_t a0 asm("a0") = arg0;
+	register uint64_t a1 asm("a1") = arg1;
+	register uint64_t a2 asm("a2") = arg2;
+	register uint64_t a6 asm("a6") = funcid;
+	register uint64_t a7 asm("a7") = SBI_ID_HSM;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a2), "r"(a6), "r"(a7)
+			: "memory");
+	*value = a1;
+	return (int64_t)a0;
+}
+
+/* entered from _vhsm_test with a stack, opaque is the round number */
+void hsm_test_secondary(uint64_t hartid, uint64_t opaque)
+{
+	uint64_t value;
+
+	hsm_test_ack = opaque;
+	(void)sbi_hsm_call(SBI_HSM_HART_STOP, 0UL, 0UL, 0UL, &value);
+
+	/* HART_STOP does not return */
+	hsm_test.errors++;
+	while (1)
+		asm volatile ("wfi");
+}
+
+void __attribute__((noinline)) hsm_test_done(struct hsm_test_result *res)
+{
+	asm volatile ("" :: "r"(res) : "memory");
+}
+
+void hsm_test_run(void)
+{
+	uint64_t i, start, cycles, value, start_total = 0UL, stop_total = 0UL;
+
+	hsm_test.start_min = ~0UL;
+	hsm_test.start_max = 0UL;
+	for (i = 1UL; i <= HSM_TEST_ROUNDS; i++) {
+		start = read_cycle();
+		if (sbi_hsm_call(SBI_HSM_HART_START, HSM_TEST_HART,
+				(uint64_t)_vhsm_test, i, &value) != 0L) {
+			hsm_test.errors++;
+			break;
+		}
+		while (hsm_test_ack != i)
+			;
+		cycles = read_cycle() - start;
+
+		start_total += cycles;
+		if (cycles < hsm_test.start_min)
+			hsm_test.start_min = cycles;
+		if (cycles > hsm_test.start_max)
+			hsm_test.start_max = cycles;
+
+		start = read_cycle();
+		do {
+			(void)sbi_hsm_call(SBI_HSM_HART_GET_STATUS, HSM_TEST_HART,
+					0UL, 0UL, &value);
+		} while (value != SBI_HSM_STATE_STOPPED);
+		stop_total += read_cycle() - start;
+		hsm_test.rounds++;
+	}
+	if (hsm_test.rounds != 0UL) {
+		hsm_test.start_avg = start_total / hsm_test.rounds;
+		hsm_test.stop_avg = stop_total / hsm_test.rounds;
+	}
+
+	hsm_test_done(&hsm_test);
+}
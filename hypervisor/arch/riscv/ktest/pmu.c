@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+
+/*
+ * vPMU firmware counter check, run by the fake kernel before it starts
+ * the other vCPUs: count the SBI calls and remote FENCE.I requests around
+ * a known number of them, and check the counter stays put once stopped.
+ * Read the result with gdb at pmu_test_done:
+ *
+ *   b pmu_test_done
+ *   p pmu_test
+ */
+
+#define PMU_TEST_ROUNDS			1000UL
+#define SBI_ID_BASE			0x10UL
+#define SBI_ID_RFENCE			0x52464E43UL
+#define SBI_ID_PMU			0x504D55UL
+#define SBI_PMU_NUM_COUNTERS		0x0UL
+#define SBI_PMU_COUNTER_CFG_MATCH	0x2UL
+#define SBI_PMU_COUNTER_STOP		0x4UL
+#define SBI_PMU_COUNTER_FW_READ		0x5UL
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE	(1UL << 1U)
+#define SBI_PMU_CFG_FLAG_AUTO_START	(1UL << 2U)
+#define SBI_PMU_STOP_FLAG_RESET		(1UL << 0U)
+#define SBI_PMU_EVENT_FW_FENCE_I_SENT	0xf0008UL
+#define SBI_PMU_EVENT_FW_PLATFORM	0xfffffUL
+#define SBI_PMU_ACRN_SBI_CALL		0x1UL
+
+struct pmu_test_result {
+	uint64_t counters;
+	uint64_t sbi_calls;	/* expected PMU_TEST_ROUNDS + 1, the read */
+	uint64_t fence_i;	/* expected PMU_TEST_ROUNDS */
+	uint64_t stopped;	/* expected 2 * PMU_TEST_ROUNDS + 4 */
+	uint64_t errors;
+};
+
+struct pmu_test_result pmu_test;
+
+static inline int64_t sbi_call(uint64_t ext, uint64_t funcid, uint64_t arg0,
+		uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4,
+		uint64_t *value)
+{
+	register uint64_t a0 asm("a0") = arg0;
+	register uint64_t a1 asm("a1") = arg1;
+	register uint64_t a2 asm("a2") = arg2;
+	register uint64_t a3 asm("a3") = arg3;
+	register uint64_t a4 asm("a4") = arg4;
+	register uint64_t a6 asm("a6") = funcid;
+	register uint64_t a7 asm("a7") = ext;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a2), "r"(a3), "r"(a4), "r"(a6), "r"(a7)
+			: "memory");
+	*value = a1;
+	return (int64_t)a0;
+}
+
+static uint64_t pmu_test_config(uint64_t event_idx, uint64_t event_data)
+{
+	uint64_t idx;
+
+	if (sbi_call(SBI_ID_PMU, SBI_PMU_COUNTER_CFG_MATCH, 0UL,
+			(1UL << pmu_test.counters) - 1UL,
+			SBI_PMU_CFG_FLAG_CLEAR_VALUE | SBI_PMU_CFG_FLAG_AUTO_START,
+			event_idx, event_data, &idx) != 0L) {
+		pmu_test.errors++;
+		idx = ~0UL;
+	}
+
+	return idx;
+}
+
+static uint64_t pmu_test_read(uint64_t idx)
+{
+	uint64_t value;
+
+	if (sbi_call(SBI_ID_PMU, SBI_PMU_COUNTER_FW_READ, idx,
+			0UL, 0UL, 0UL, 0UL, &value) != 0L) {
+		pmu_test.errors++;
+		value = 0UL;
+	}
+
+	return value;
+}
+
+void __attribute__((noinline)) pmu_test_done(struct pmu_test_result *res)
+{
+	asm volatile ("" :: "r"(res) : "memory");
+}
+
+void pmu_test_run(void)
+{
+	uint64_t i, calls, fence, value;
+
+	(void)sbi_call(SBI_ID_PMU, SBI_PMU_NUM_COUNTERS, 0UL, 0UL, 0UL, 0UL, 0UL,
+			&pmu_test.counters);
+
+	calls = pmu_test_config(SBI_PMU_EVENT_FW_PLATFORM, SBI_PMU_ACRN_SBI_CALL);
+	for (i = 0UL; i < PMU_TEST_ROUNDS; i++)
+		(void)sbi_call(SBI_ID_BASE, 0UL, 0UL, 0UL, 0UL, 0UL, 0UL, &value);
+	pmu_test.sbi_calls = pmu_test_read(calls);
+
+	/* remote FENCE.I to this hart only */
+	fence = pmu_test_config(SBI_PMU_EVENT_FW_FENCE_I_SENT, 0UL);
+	for (i = 0UL; i < PMU_TEST_ROUNDS; i++)
+		(void)sbi_call(SBI_ID_RFENCE, 0UL, 1UL, 0UL, 0UL, 0UL, 0UL, &value);
+	pmu_test.fence_i = pmu_test_read(fence);
+
+	/*
+	 * the calls counter went on with the 3 calls around the fence loop
+	 * and the loop itself, and counts the stop call, but no more
+	 */
+	(void)sbi_call(SBI_ID_PMU, SBI_PMU_COUNTER_STOP, calls, 1UL, 0UL,
+			0UL, 0UL, &value);
+	for (i = 0UL; i < PMU_TEST_ROUNDS; i++)
+		(void)sbi_call(SBI_ID_BASE, 0UL, 0UL, 0UL, 0UL, 0UL, 0UL, &value);
+	pmu_test.stopped = pmu_test_read(calls);
+
+	(void)sbi_call(SBI_ID_PMU, SBI_PMU_COUNTER_STOP, 0UL,
+			(1UL << pmu_test.counters) - 1UL, SBI_PMU_STOP_FLAG_RESET,
+			0UL, 0UL, &value);
+
+	if (pmu_test.sbi_calls != PMU_TEST_ROUNDS + 1UL)
+		pmu_test.errors++;
+	if (pmu_test.fence_i != PMU_TEST_ROUNDS)
+		pmu_test.errors++;
+	if (pmu_test.stopped != 2UL * PMU_TEST_ROUNDS + 4UL)
+		pmu_test.errors++;
+
+	pmu_test_done(&pmu_test);
+}
@@ -5,12 +5,31 @@
  */
 
 #include <asm/smp.h>
+#include <asm/init.h>
+
+#define SBI_ID_HSM		0x48534DUL
+#define SBI_HSM_HART_START	0x0UL
 
 int g_vcpus = 1;
 
-void smp_start_cpus(int cpus)
+static inline void sbi_hart_start(uint64_t hartid, uint64_t addr, uint64_t opaque)
+{
+	register uint64_t a0 asm("a0") = hartid;
+	register uint64_t a1 asm("a1") = addr;
+	register uint64_t a2 asm("a2") = opaque;
+	register uint64_t a6 asm("a6") = SBI_HSM_HART_START;
+	register uint64_t a7 asm("a7") = SBI_ID_HSM;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a2), "r"(a6), "r"(a7)
+			: "memory");
+}
+
+/* secondary vCPUs are stopped until started here, they enter at _vboot */
+void smp_start_cpus(void)
 {
-	for (int i = 1; i < cpus; i++) {
-		do_swi(i);
+	for (uint64_t i = 1UL; i < CONFIG_MAX_VCPU; i++) {
+		sbi_hart_start(i, (uint64_t)_vboot, 0UL);
 	}
 }
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+
+/*
+ * SBI SRST reboot loop, run first thing by the fake kernel: it reboots
+ * its VM SRST_TEST_ROUNDS times and measures the cycles from the reboot
+ * ecall until it runs again. The fake kernel is hypervisor text, so the
+ * result survives the reboots. Read it with gdb at srst_test_done:
+ *
+ *   b srst_test_done
+ *   p srst_test
+ */
+
+#define SRST_TEST_ROUNDS		100UL
+#define SBI_ID_SRST			0x53525354UL
+#define SBI_SRST_SYSTEM_RESET		0x0UL
+#define SBI_SRST_TYPE_COLD_REBOOT	0x1UL
+
+struct srst_test_result {
+	uint64_t rounds;
+	uint64_t errors;
+	uint64_t min;		/* in cycles */
+	uint64_t max;
+	uint64_t avg;
+	uint64_t total;
+	uint64_t start;
+};
+
+struct srst_test_result srst_test = { .min = ~0UL };
+
+static inline uint64_t read_cycle(void)
+{
+	uint64_t v;
+
+	asm volatile ("rdcycle %0" : "=r"(v) :: "memory");
+	return v;
+}
+
+static inline void sbi_system_reset(uint64_t type)
+{
+	register uint64_t a0 asm("a0") = type;
+	register uint64_t a1 asm("a1") = 0UL;
+	register uint64_t a6 asm("a6") = SBI_SRST_SYSTEM_RESET;
+	register uint64_t a7 asm("a7") = SBI_ID_SRST;
+
+	asm volatile ("ecall"
+			: "+r"(a0), "+r"(a1)
+			: "r"(a6), "r"(a7)
+			: "memory");
+}
+
+void __attribute__((noinline)) srst_test_done(struct srst_test_result *res)
+{
+	asm volatile ("" :: "r"(res) : "memory");
+}
+
+void srst_test_run(void)
+{
+	uint64_t cycles;
+
+	if (srst_test.start != 0UL) {
+		/* back from a reboot */
+		cycles = read_cycle() - srst_test.start;
+		srst_test.start = 0UL;
+		srst_test.total += cycles;
+		if (cycles < srst_test.min)
+			srst_test.min = cycles;
+		if (cycles > srst_test.max)
+			srst_test.max = cycles;
+		srst_test.rounds++;
+	}
+
+	if (srst_test.rounds < SRST_TEST_ROUNDS) {
+		srst_test.start = read_cycle();
+		sbi_system_reset(SBI_SRST_TYPE_COLD_REBOOT);
+		/* only back here if the reboot failed */
+		srst_test.start = 0UL;
+		srst_test.errors++;
+	}
+
+	if (srst_test.rounds != 0UL)
+		srst_test.avg = srst_test.total / srst_test.rounds;
+	srst_test_done(&srst_test);
+}
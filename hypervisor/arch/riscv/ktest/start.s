@@ -24,6 +24,7 @@ _vkernel:
 	li a0, 0
 	csrw sie, a0
 	call setup_vtrap
+	call srst_test_run
 	#jal setup_mmu
 #	la a0, _vkernel_api
 #	li a7, 0x0A000000
@@ -32,8 +33,11 @@ _vkernel:
 	call get_tick
 	la a0, _vkernel_msg
 #	call early_printk
-	lw a0, g_vcpus
+	call trap_bench_run
+	call pmu_test_run
+	call hsm_test_run
 	call smp_start_cpus
+	call fp_test_run
 	li a0, 0x100
 	csrc sstatus, a0
 	la a0, guest
@@ -48,7 +52,7 @@ _vsecondary:
 	addi t0, t0, 1
 	sw t0, g_vcpus, t1
 	call setup_vtrap
-	jal boot_idle
+	call fp_test_run
 	li a0, 0x100
 	csrc sstatus, a0
 	la a0, guest
@@ -56,6 +60,15 @@ _vsecondary:
 	li a0, 0
 	sret
 
+	.globl _vhsm_test
+_vhsm_test:
+	csrw sscratch, a0
+	jal init_vstack
+	call hsm_test_secondary
+1:
+	wfi
+	j 1b
+
 init_vstack:
 	li sp, ACRN_VSTACK_TOP
 	li t0, ACRN_VSTACK_SIZE
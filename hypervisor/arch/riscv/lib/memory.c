@@ -27,6 +27,19 @@ void *memset_s(void *base, uint8_t v, size_t n)
 
 void memcpy(void *d, const void *s, size_t slen)
 {
+	/* copy 8 bytes at a time when both sides are equally aligned */
+	if ((((uint64_t)d ^ (uint64_t)s) & 7UL) == 0UL) {
+		while ((((uint64_t)d & 7UL) != 0UL) && (slen != 0U)) {
+			*(uint8_t *)d++ = *(uint8_t *)s++;
+			slen--;
+		}
+		for (; slen >= 8U; slen -= 8U) {
+			*(uint64_t *)d = *(const uint64_t *)s;
+			d += 8;
+			s += 8;
+		}
+	}
+
 	for (size_t i = 0; i < slen; i++) {
 		*(uint8_t *)d++ = *(uint8_t *)s++;
 	}
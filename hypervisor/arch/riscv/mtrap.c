@@ -14,6 +14,7 @@
 #include <asm/lib/bits.h>
 #include <debug/logmsg.h>
 #include <softirq.h>
+#include <profiling.h>
 #include "uart.h"
 #include "trap.h"
 
@@ -98,6 +99,13 @@ static void mexti_handler(void)
 	handle_mexti();
 }
 
+static void mlcofi_handler(void)
+{
+#ifdef PROFILING_ON
+	profiling_lcofi_handler();
+#endif
+}
+
 typedef void (* irq_handler_t)(void);
 static irq_handler_t mirq_handler[] = {
 	mexpt_handler,
@@ -112,16 +120,18 @@ static irq_handler_t mirq_handler[] = {
 	mexpt_handler,
 	mexpt_handler,
 	mexti_handler,
+	mexpt_handler,
+	mlcofi_handler,
 	mexpt_handler
 };
 
 void mint_handler(int irq)
 {
 	ASSERT(current != 0);
-	if (irq < 12)
+	if (irq < 14)
 		mirq_handler[irq]();
 	else
-		mirq_handler[12]();
+		mirq_handler[14]();
 
 	do_softirq();
 }
@@ -23,19 +23,33 @@ void kick_notification(void)
 	uint16_t pcpu_id = get_pcpu_id();
 	uint64_t flags;
 
-	spin_lock_irqsave(&smpcall_lock, &flags);
-	if (test_bit(pcpu_id, smp_call_mask)) {
-		struct smp_call_info_data *smp_call =
-			&per_cpu(smp_call_info, pcpu_id);
+	struct smp_call_info_data *smp_call = &per_cpu(smp_call_info, pcpu_id);
+	smp_call_func_t func = NULL;
+	void *data = NULL;
+	bool pending;
 
-		if (smp_call->func != NULL) {
-			smp_call->func(smp_call->data);
-		}
+	spin_lock_irqsave(&smpcall_lock, &flags);
+	pending = test_bit(pcpu_id, smp_call_mask);
+	if (pending) {
+		func = smp_call->func;
+		data = smp_call->data;
 		smp_call->func = NULL;
 		smp_call->data = NULL;
-		clear_bit(pcpu_id, &smp_call_mask);
 	}
 	spin_unlock_irqrestore(&smpcall_lock, flags);
+
+	/*
+	 * Run the function without the lock, so the pCPUs of one call run
+	 * it concurrently; the caller waits for the bit, not for the lock.
+	 */
+	if (pending) {
+		if (func != NULL) {
+			func(data);
+		}
+		spin_lock_irqsave(&smpcall_lock, &flags);
+		clear_bit(pcpu_id, &smp_call_mask);
+		spin_unlock_irqrestore(&smpcall_lock, flags);
+	}
 }
 
 /* wait until *sync == wake_sync */
@@ -46,12 +60,19 @@ void wait_sync_change(volatile const uint64_t *sync, uint64_t wake_sync)
 	}
 }
 
-void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+/*
+ * Post func to the other pCPUs in mask and return without waiting; pair
+ * with smp_call_function_wait(). The current pCPU is skipped, the caller
+ * runs its own share in between.
+ */
+void smp_call_function_async(uint64_t mask, smp_call_func_t func, void *data)
 {
 	uint16_t pcpu_id;
 	struct smp_call_info_data *smp_call;
 	uint64_t flags;
 
+	__clear_bit(get_pcpu_id(), &mask);
+
 	/* wait for previous smp call complete, which may run on other cpus */
 	while (smp_call_mask);
 	spin_lock_irqsave(&smpcall_lock, &flags);
@@ -60,11 +81,7 @@ void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
 	pcpu_id = ffs64(mask);
 	while (pcpu_id < CONFIG_NR_CPUS) {
 		__clear_bit(pcpu_id, &mask);
-		if (pcpu_id == get_pcpu_id()) {
-			func(data);
-			__clear_bit(pcpu_id, &mask);
-			__clear_bit(pcpu_id, &smp_call_mask);
-		} else if (cpu_online(pcpu_id)) {
+		if (cpu_online(pcpu_id)) {
 			smp_call = &per_cpu(smp_call_info, pcpu_id);
 			smp_call->func = func;
 			smp_call->data = data;
@@ -77,10 +94,26 @@ void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
 		pcpu_id = ffs64(mask);
 	}
 	spin_unlock_irqrestore(&smpcall_lock, flags);
-	/* wait for current smp call complete */
+}
+
+/* wait for the pCPUs of the last smp call to finish it */
+void smp_call_function_wait(void)
+{
 	wait_sync_change(&smp_call_mask, 0UL);
 }
 
+void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+{
+	smp_call_function_async(mask, func, data);
+
+	/* the current pCPU runs its share while the others run theirs */
+	if (test_bit(get_pcpu_id(), mask)) {
+		func(data);
+	}
+
+	smp_call_function_wait();
+}
+
 void smp_call_init(void)
 {
 	spinlock_init(&smpcall_lock);
@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifdef PROFILING_ON
+
+#include <types.h>
+#include <errno.h>
+#include <rtl.h>
+#include <asm/cpu.h>
+#include <asm/cpumask.h>
+#include <asm/per_cpu.h>
+#include <asm/vmx.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vpmu.h>
+#include <asm/guest/guest_memory.h>
+#include <sprintf.h>
+#include <logmsg.h>
+#include <ticks.h>
+#include <profiling.h>
+
+/*
+ * Hypervisor sampling with the hardware performance monitor, the RISC-V
+ * backend of the x86 SEP PMI sampling in debug/profiling.c.
+ *
+ * The first mhpmcounter above the ones the vPMU hands to guests is
+ * programmed with a cycle or instret event, counting in all modes, and
+ * preloaded with -period. Its Sscofpmf overflow interrupt (LCOFI, taken
+ * by the hypervisor instead of delegated while profiling runs) writes a
+ * CORE_PMU_SAMPLING record to the per-pCPU ACRN_SEP sbuf, in the format
+ * of the x86 samples. An overflow that caused a VM exit is attributed to
+ * the guest and its pc, any other to the hypervisor (os_id 0xFFFF, task
+ * "VMM"). Overflows of the guests' own counters are dropped meanwhile.
+ *
+ * It needs the M-mode counter CSRs and Sscofpmf, i.e. MACRN on QEMU.
+ */
+
+#define DBG_LEVEL_PROFILING		5U
+
+#define HPM_EVENT_OF			(1UL << 63U)
+#define MIP_LCOFIP			(1UL << 13U)
+#define MSTATUS_MPP			(3UL << 11U)
+#define CAUSE_LCOFI			((1UL << 63U) | HX_EXIT_IRQ_LCOF)
+#define HV_OS_ID			0xFFFFU
+
+#define MAJOR_VERSION			1
+#define MINOR_VERSION			0
+
+/* the PROFILING_OPS sampling setup, until PROFILING_CONFIG_PMI changes it */
+#define HPM_DEFAULT_EVENT		0x1UL	/* cycles on QEMU */
+#define HPM_DEFAULT_PERIOD		1000000UL
+
+static uint64_t sep_collection_switch;
+static uint64_t sep_hpm_period = HPM_DEFAULT_PERIOD;
+
+#if defined(CONFIG_MACRN) && defined(RUN_ON_QEMU)
+#define PROFILING_HPM
+#endif
+
+#ifdef PROFILING_HPM
+#define PROFILING_HPM_IDX		(VPMU_HPM_BASE + CONFIG_NR_HPM_COUNTERS)
+#if PROFILING_HPM_IDX != 5
+#error "the sampling counter is mhpmcounter5, above the vPMU counters"
+#endif
+
+static uint64_t hpm_event;	/* mhpmevent of the sampling counter */
+static uint64_t hpm_period;
+static bool in_pmu_profiling;
+
+/*
+ * Copy the core sample of this pCPU to its ACRN_SEP sbuf, dropped if the
+ * sbuf is not set up or full
+ */
+static void profiling_generate_sample(uint16_t pcpu_id)
+{
+	struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_SEP];
+	struct sep_state *ss = &per_cpu(profiling_info.s_state, pcpu_id);
+	void *payload = &per_cpu(profiling_info.p_sample, pcpu_id).csample;
+	struct data_header pkt_header;
+	uint32_t remaining_space;
+	uint64_t i;
+
+	if (sbuf == NULL) {
+		ss->samples_dropped++;
+		return;
+	}
+
+	if (sbuf->tail >= sbuf->head) {
+		remaining_space = sbuf->size - (sbuf->tail - sbuf->head);
+	} else {
+		remaining_space = sbuf->head - sbuf->tail;
+	}
+	if ((uint64_t)remaining_space < (DATA_HEADER_SIZE + CORE_PMU_SAMPLE_SIZE)) {
+		ss->samples_dropped++;
+		return;
+	}
+
+	pkt_header.tsc = cpu_ticks();
+	pkt_header.collector_id = COLLECT_PROFILE_DATA;
+	pkt_header.cpu_id = pcpu_id;
+	pkt_header.data_type = 1U << CORE_PMU_SAMPLING;
+	pkt_header.reserved = MAGIC_NUMBER;
+	pkt_header.payload_size = CORE_PMU_SAMPLE_SIZE;
+
+	for (i = 0U; i < (((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
+		(void)sbuf_put(sbuf, (uint8_t *)&pkt_header + i * SEP_BUF_ENTRY_SIZE);
+	}
+	for (i = 0U; i < (((CORE_PMU_SAMPLE_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
+		(void)sbuf_put(sbuf, (uint8_t *)payload + i * SEP_BUF_ENTRY_SIZE);
+	}
+
+	ss->samples_logged++;
+}
+
+/*
+ * LCOFI handler, called from mint_handler. An overflow in guest context
+ * exits the VM first and is taken once vm_exit enables the interrupts,
+ * with the VM exit cause still LCOFI.
+ */
+void profiling_lcofi_handler(void)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	struct sep_state *ss = &per_cpu(profiling_info.s_state, pcpu_id);
+	struct core_pmu_sample *csample = &per_cpu(profiling_info.p_sample, pcpu_id).csample;
+	struct acrn_vcpu *vcpu = per_cpu(profiling_info.vcpu, pcpu_id);
+	struct cpu_regs *regs = NULL;
+
+	cpu_csr_clear(mip, MIP_LCOFIP);
+	ss->total_pmi_count++;
+
+	if ((ss->pmu_state != PMU_RUNNING) ||
+	    ((cpu_csr_read(mhpmevent5) & HPM_EVENT_OF) == 0UL)) {
+		return;
+	}
+
+	(void)memset(csample, 0U, sizeof(struct core_pmu_sample));
+	csample->cpu_id = pcpu_id;
+	csample->overflow_status = 1UL << PROFILING_HPM_IDX;
+
+	if (vcpu != NULL) {
+		regs = &vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx.cpu_gp_regs.regs;
+		if (regs->cause != CAUSE_LCOFI) {
+			regs = NULL;
+		}
+	}
+	if (regs != NULL) {
+		csample->os_id = vcpu->vm->vm_id;
+		csample->rip = regs->ip;
+		csample->rflags = (uint32_t)regs->status;
+		/* the guest privilege mode, where x86 has the CPL in CS */
+		csample->cs = (uint32_t)((regs->status & MSTATUS_MPP) >> 11U);
+	} else {
+		csample->os_id = HV_OS_ID;
+		(void)memcpy_s(csample->task, 16, "VMM\0", 4);
+		csample->rip = cpu_csr_read(mepc);
+		csample->rflags = (uint32_t)cpu_csr_read(mstatus);
+		csample->cs = 3U;
+	}
+
+	profiling_generate_sample(pcpu_id);
+	ss->valid_pmi_count++;
+
+	cpu_csr_write(mhpmcounter5, -hpm_period);
+	cpu_csr_write(mhpmevent5, hpm_event);
+}
+
+static void profiling_enable_pmu(__unused void *data)
+{
+	struct sep_state *ss = &get_cpu_var(profiling_info.s_state);
+
+	cpu_csr_write(mhpmevent5, 0UL);
+	cpu_csr_write(mhpmcounter5, -hpm_period);
+	cpu_csr_clear(mip, MIP_LCOFIP);
+	cpu_csr_clear(mideleg, MIP_LCOFIP);
+	cpu_csr_set(mie, MIP_LCOFIP);
+	ss->pmu_state = PMU_RUNNING;
+	cpu_csr_write(mhpmevent5, hpm_event);
+}
+
+static void profiling_disable_pmu(__unused void *data)
+{
+	struct sep_state *ss = &get_cpu_var(profiling_info.s_state);
+
+	cpu_csr_write(mhpmevent5, 0UL);
+	ss->pmu_state = PMU_SETUP;
+	cpu_csr_clear(mie, MIP_LCOFIP);
+	cpu_csr_clear(mip, MIP_LCOFIP);
+	/* back to the guests, see start.s */
+	cpu_csr_set(mideleg, MIP_LCOFIP);
+}
+
+/*
+ * Start sampling on all pCPUs, every period events. The event is the
+ * mhpmevent value, 0x1 and 0x2 are cycles and instret on QEMU.
+ */
+int32_t profiling_hpm_start(uint64_t event, uint64_t period)
+{
+	uint16_t i;
+
+	if (in_pmu_profiling) {
+		return -EBUSY;
+	}
+	if ((event == 0UL) || ((event & HPM_EVENT_OF) != 0UL) || (period == 0UL)) {
+		return -EINVAL;
+	}
+
+	hpm_event = event;
+	hpm_period = period;
+	for (i = 0U; i < get_pcpu_nums(); i++) {
+		per_cpu(profiling_info.s_state, i).samples_logged = 0U;
+		per_cpu(profiling_info.s_state, i).samples_dropped = 0U;
+		per_cpu(profiling_info.s_state, i).valid_pmi_count = 0U;
+		per_cpu(profiling_info.s_state, i).total_pmi_count = 0U;
+		per_cpu(profiling_info.s_state, i).total_vmexit_count = 0U;
+	}
+
+	smp_call_function(cpu_online_map, profiling_enable_pmu, NULL);
+	in_pmu_profiling = true;
+
+	dev_dbg(DBG_LEVEL_PROFILING, "%s: event 0x%lx period %lu",
+		__func__, event, period);
+
+	return 0;
+}
+
+void profiling_hpm_stop(void)
+{
+	if (in_pmu_profiling) {
+		smp_call_function(cpu_online_map, profiling_disable_pmu, NULL);
+		in_pmu_profiling = false;
+	}
+}
+#else
+void profiling_lcofi_handler(void)
+{
+	cpu_csr_clear(mip, MIP_LCOFIP);
+}
+
+int32_t profiling_hpm_start(__unused uint64_t event, __unused uint64_t period)
+{
+	return -ENODEV;
+}
+
+void profiling_hpm_stop(void) {}
+#endif
+
+/**
+ * @brief Get the sampling statistics of all pCPUs
+ *
+ * It's for debug only.
+ *
+ * @param[in]	str_max	The max size of the string containing the statistics
+ * @param[inout]	str_arg	Pointer to the output information
+ */
+void get_profiling_hpm_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct sep_state *ss;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nCPU\tSTATE\tPMI\t\tVALID\t\tLOGGED\t\tDROPPED\t\tVMEXIT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < get_pcpu_nums(); i++) {
+		ss = &per_cpu(profiling_info.s_state, i);
+		len = snprintf(str, size, "\r\n%hu\t%s\t%u\t\t%u\t\t%u\t\t%u\t\t%u", i,
+			(ss->pmu_state == PMU_RUNNING) ? "run" :
+			((ss->pmu_state == PMU_SETUP) ? "stop" : "n/a"),
+			ss->total_pmi_count, ss->valid_pmi_count,
+			ss->samples_logged, ss->samples_dropped,
+			ss->total_vmexit_count);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+/*
+ * The PROFILING_OPS hypercall commands the RISC-V backend implements,
+ * so the Service VM tooling can drive it like SEP on x86: only core PMU
+ * sampling, with the hpm counter above.
+ */
+int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_version_info ver_info;
+
+	if (copy_from_gpa(vm, &ver_info, addr, sizeof(ver_info)) != 0) {
+		return -EINVAL;
+	}
+
+	ver_info.major = MAJOR_VERSION;
+	ver_info.minor = MINOR_VERSION;
+#ifdef PROFILING_HPM
+	ver_info.supported_features = (int64_t)(1U << (uint64_t)CORE_PMU_SAMPLING);
+#else
+	ver_info.supported_features = 0;
+#endif
+
+	if (copy_to_gpa(vm, &ver_info, addr, sizeof(ver_info)) != 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * The hypervisor first, as vm_id -1 with one entry per pCPU, then the VMs
+ */
+int32_t profiling_vm_list_info(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_vm_info_list vm_info_list;
+	struct profiling_vm_info *info;
+	struct acrn_vm *tmp_vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t i, j;
+
+	if (copy_from_gpa(vm, &vm_info_list, addr, sizeof(vm_info_list)) != 0) {
+		return -EINVAL;
+	}
+
+	info = &vm_info_list.vm_list[0];
+	info->vm_id_num = -1;
+	(void)memcpy_s((void *)info->vm_name, 4U, "VMM\0", 4U);
+	for (i = 0U; i < get_pcpu_nums(); i++) {
+		info->cpu_map[i].vcpu_id = i;
+		info->cpu_map[i].pcpu_id = i;
+		info->cpu_map[i].apic_id = i;
+	}
+	info->num_vcpus = i;
+	vm_info_list.num_vms = 1U;
+
+	for (j = 0U; j < CONFIG_MAX_VM_NUM; j++) {
+		tmp_vm = get_vm_from_vmid(j);
+		if (is_poweroff_vm(tmp_vm)) {
+			continue;
+		}
+
+		info = &vm_info_list.vm_list[vm_info_list.num_vms];
+		vm_info_list.num_vms++;
+		info->vm_id_num = tmp_vm->vm_id;
+		snprintf(info->vm_name, 16U, "vm_%d", tmp_vm->vm_id);
+		info->num_vcpus = 0U;
+		foreach_vcpu(i, tmp_vm, vcpu) {
+			info->cpu_map[i].vcpu_id = vcpu->vcpu_id;
+			info->cpu_map[i].pcpu_id = pcpuid_from_vcpu(vcpu);
+			info->cpu_map[i].apic_id = 0U;
+			info->num_vcpus++;
+		}
+	}
+
+	if (copy_to_gpa(vm, &vm_info_list, addr, sizeof(vm_info_list)) != 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int32_t profiling_get_control(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_control prof_control;
+
+	if (copy_from_gpa(vm, &prof_control, addr, sizeof(prof_control)) != 0) {
+		return -EINVAL;
+	}
+
+	if (prof_control.collector_id == COLLECT_PROFILE_DATA) {
+		prof_control.switches = sep_collection_switch;
+	} else {
+		prof_control.switches = 0UL;
+	}
+
+	if (copy_to_gpa(vm, &prof_control, addr, sizeof(prof_control)) != 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Start or stop the hpm sampling on a CORE_PMU_SAMPLING switch change
+ */
+int32_t profiling_set_control(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_control prof_control;
+	uint64_t changed;
+	int32_t ret = 0;
+
+	if (copy_from_gpa(vm, &prof_control, addr, sizeof(prof_control)) != 0) {
+		return -EINVAL;
+	}
+
+	if (prof_control.collector_id != COLLECT_PROFILE_DATA) {
+		pr_err("%s: unsupported collector %d", __func__, prof_control.collector_id);
+		return -EINVAL;
+	}
+
+	changed = (prof_control.switches ^ sep_collection_switch) & (1UL << CORE_PMU_SAMPLING);
+	if (changed != 0UL) {
+		if ((prof_control.switches & (1UL << CORE_PMU_SAMPLING)) != 0UL) {
+			ret = profiling_hpm_start(HPM_DEFAULT_EVENT, sep_hpm_period);
+		} else {
+			profiling_hpm_stop();
+		}
+	}
+	if (ret == 0) {
+		sep_collection_switch = prof_control.switches & (1UL << CORE_PMU_SAMPLING);
+	}
+
+	dev_dbg(DBG_LEVEL_PROFILING, "%s: switches 0x%lx ret %d",
+		__func__, prof_control.switches, ret);
+
+	return ret;
+}
+
+/*
+ * The MSR lists of the x86 PMI setup have no counterpart here, only the
+ * trigger count is taken, as the sampling period
+ */
+int32_t profiling_configure_pmi(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_pmi_config pmi_config;
+
+	if (copy_from_gpa(vm, &pmi_config, addr, sizeof(pmi_config)) != 0) {
+		return -EINVAL;
+	}
+
+	if (pmi_config.trigger_count == 0U) {
+		return -EINVAL;
+	}
+	sep_hpm_period = pmi_config.trigger_count;
+
+	return 0;
+}
+
+int32_t profiling_get_status_info(struct acrn_vm *vm, uint64_t gpa)
+{
+	struct profiling_status pstats[MAX_PCPU_NUM];
+	uint16_t i, pcpu_nums = get_pcpu_nums();
+
+	if (copy_from_gpa(vm, &pstats, gpa, pcpu_nums * sizeof(struct profiling_status)) != 0) {
+		return -EINVAL;
+	}
+
+	for (i = 0U; i < pcpu_nums; i++) {
+		pstats[i].samples_logged = per_cpu(profiling_info.s_state, i).samples_logged;
+		pstats[i].samples_dropped = per_cpu(profiling_info.s_state, i).samples_dropped;
+	}
+
+	if (copy_to_gpa(vm, &pstats, gpa, pcpu_nums * sizeof(struct profiling_status)) != 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void profiling_vmenter_handler(struct acrn_vcpu *vcpu)
+{
+	if (get_cpu_var(profiling_info.s_state).pmu_state == PMU_RUNNING) {
+		get_cpu_var(profiling_info.vm_info).vmenter_tsc = cpu_ticks();
+		get_cpu_var(profiling_info.vcpu) = vcpu;
+	}
+}
+
+void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	struct guest_vm_info *vm_info = &get_cpu_var(profiling_info.vm_info);
+
+	if (get_cpu_var(profiling_info.s_state).pmu_state == PMU_RUNNING) {
+		vm_info->vmexit_tsc = cpu_ticks();
+		vm_info->vmexit_reason = vcpu->arch.exit_reason;
+		vm_info->external_vector = -1;
+		vm_info->guest_rip = vcpu_get_gpreg(vcpu, CPU_REG_IP);
+		vm_info->guest_vm_id = vcpu->vm->vm_id;
+	}
+	get_cpu_var(profiling_info.vcpu) = NULL;
+}
+
+void profiling_post_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	per_cpu(profiling_info.s_state, pcpuid_from_vcpu(vcpu)).total_vmexit_count++;
+}
+
+/*
+ * Per pCPU init, on every pCPU before it runs vCPUs
+ */
+void profiling_setup(void)
+{
+	struct sep_state *ss = &get_cpu_var(profiling_info.s_state);
+
+	(void)memset(ss, 0U, sizeof(struct sep_state));
+	get_cpu_var(profiling_info.vcpu) = NULL;
+#ifdef PROFILING_HPM
+	ss->pmu_state = PMU_SETUP;
+#else
+	ss->pmu_state = PMU_UNINITIALIZED;
+#endif
+}
+
+#endif
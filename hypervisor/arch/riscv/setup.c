@@ -19,6 +19,7 @@
 #include <asm/guest/s2vm.h>
 #include <debug/console.h>
 #include <debug/logmsg.h>
+#include <profiling.h>
 
 struct bootinfo bootinfo;
 size_t dcache_line_bytes;
@@ -51,6 +52,7 @@ void start_acrn(uint32_t cpu, unsigned long boot_phys_offset,
 
 	timer_init();
 	pr_info("init timer\r\n");
+	profiling_setup();
 	console_init();
 //	console_setup_timer();
 	pr_info("console init \r\n");
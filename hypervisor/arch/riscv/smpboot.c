@@ -10,6 +10,7 @@
 #include <asm/per_cpu.h>
 #include <asm/init.h>
 #include <asm/lib/bits.h>
+#include <asm/lib/atomic.h>
 #include <asm/types.h>
 #include <asm/setup.h>
 #include <asm/smp.h>
@@ -19,9 +20,11 @@
 #include <asm/guest/vcpu.h>
 
 #include <errno.h>
+#include <ticks.h>
 #include <debug/console.h>
 #include <debug/logmsg.h>
 #include <debug/shell.h>
+#include <profiling.h>
 
 struct acrn_vcpu idle_vcpu[NR_CPUS];
 
@@ -41,13 +44,21 @@ uint64_t __cpu_logical_map[NR_CPUS] = { [0 ... NR_CPUS-1] = MP_INVALID_IDX};
 
 static unsigned char __initdata cpu0_boot_stack[STACK_SIZE] __attribute__((__aligned__(STACK_SIZE)));
 
-struct init_info init_data =
+/*
+ * One boot descriptor per CPU, so all secondary CPUs can be released at
+ * once instead of handing a single shared descriptor from one CPU to the
+ * next.
+ */
+struct init_info init_data[NR_CPUS] =
 {
-	.stack = cpu0_boot_stack,
+	[BSP_CPU_ID] = {
+		.stack = cpu0_boot_stack,
+		.cpuid = BSP_CPU_ID,
+	},
 };
 
-/* Shared state for coordinating CPU bringup */
-uint64_t smp_up_cpu = MP_INVALID_IDX;
+/* How long start_pcpus waits for the secondary CPUs to report online */
+#define CPU_UP_TIMEOUT_US	1000000U
 
 void __init
 smp_clear_cpu_maps (void)
@@ -82,12 +93,13 @@ int kick_pcpu(int cpu)
 	return smp_enable_ops[cpu].prepare_cpu(cpu);
 }
 
-/* Bring up a remote CPU */
-int __cpu_up(unsigned int cpu)
+/* Fill in the boot descriptor of a remote CPU */
+static int __cpu_prepare(unsigned int cpu)
 {
-	int rc;
+	struct init_info *info = &init_data[cpu];
+	int rc = 0;
 
-	pr_dbg("Bringing up CPU%d", cpu);
+	pr_dbg("Preparing CPU%d", cpu);
 
 #ifndef CONFIG_MACRN
 	rc = init_secondary_pagetables(cpu);
@@ -96,48 +108,69 @@ int __cpu_up(unsigned int cpu)
 #endif
 
 	/* Tell the remote CPU which stack to boot on. */
-	init_data.stack = (unsigned char *)&idle_vcpu[cpu].stack;
+	info->stack = (unsigned char *)&idle_vcpu[cpu].stack;
 
 	/* Tell the remote CPU what its logical CPU ID is. */
-	init_data.cpuid = cpu;
+	info->cpuid = cpu;
+	info->kick_ticks = 0UL;
+	info->up_ticks = 0UL;
+	clean_dcache(*info);
 
-	/* Open the gate for this CPU */
-	smp_up_cpu = cpu_logical_map(cpu);
-	clean_dcache(smp_up_cpu);
+	return rc;
+}
 
-	rc = kick_pcpu(cpu);
+/*
+ * Bring up all secondary CPUs in parallel: prepare every boot descriptor,
+ * kick all CPUs back to back and only then wait for them. Each CPU sets its
+ * bit in cpu_online_map at the end of start_secondary, so the per-CPU init
+ * of all secondary CPUs overlaps and the boot time no longer grows with the
+ * number of CPUs.
+ */
+void start_pcpus(void)
+{
+	uint64_t expected = 0UL, start, timeout;
+	uint32_t i;
+	int rc;
 
-	if ( rc < 0 )
-	{
-		pr_dbg("Failed to bring up CPU%d, rc = %d", cpu, rc);
-		return rc;
+	for (i = BSP_CPU_ID + 1U; i < NR_CPUS; i++) {
+		if (__cpu_prepare(i) == 0)
+			set_bit(i, &expected);
 	}
 
-	while (!cpu_online(cpu))
+	start = cpu_ticks();
+	for (i = BSP_CPU_ID + 1U; i < NR_CPUS; i++) {
+		if (!test_bit(i, expected))
+			continue;
+
+		init_data[i].kick_ticks = cpu_ticks();
+		rc = kick_pcpu(i);
+		if (rc < 0) {
+			pr_dbg("Failed to bring up CPU%d, rc = %d", i, rc);
+			clear_bit(i, &expected);
+		}
+	}
+
+	timeout = start + us_to_ticks(CPU_UP_TIMEOUT_US);
+	while (((cpu_online_map & expected) != expected) && (cpu_ticks() < timeout))
 	{
 		cpu_relax();
 	}
 
 	smp_rmb();
 
-	init_data.stack = NULL;
-	init_data.cpuid = ~0;
-	smp_up_cpu = MP_INVALID_IDX;
-	clean_dcache(smp_up_cpu);
-
-	if ( !cpu_online(cpu) )
-	{
-		pr_dbg("CPU%d never came online", cpu);
-		return -EIO;
-	}
+	pr_info("%d secondary CPUs up in %lu us", bit_weight(cpu_online_map & expected),
+		ticks_to_us(cpu_ticks() - start));
 
-	return 0;
-}
+	for (i = BSP_CPU_ID + 1U; i < NR_CPUS; i++) {
+		if (!test_bit(i, expected))
+			continue;
 
-void start_pcpus(void)
-{
-	for (uint32_t i = BSP_CPU_ID + 1U; i < NR_CPUS; i++) {
-		__cpu_up(i);
+		if (!cpu_online(i)) {
+			pr_err("CPU%d never came online", i);
+		} else {
+			pr_dbg("CPU%d up in %lu us", i,
+				ticks_to_us(init_data[i].up_ticks - init_data[i].kick_ticks));
+		}
 	}
 }
 
@@ -157,8 +190,6 @@ void start_secondary(uint32_t cpu)
 	set_current(idle);
 	set_pcpu_id(cpu);
 
-	/* Now report this CPU is up */
-	set_bit(cpu, &cpu_online_map);
 #ifndef CONFIG_MACRN
 	switch_satp(init_satp);
 	init_trap();
@@ -166,12 +197,18 @@ void start_secondary(uint32_t cpu)
 	init_mtrap();
 #endif
 	timer_init();
+	profiling_setup();
 	if (cpu == 4) {
 		shell_init();
 		console_setup_timer();
 	}
 	init_sched(cpu);
 
+	/* Now report this CPU is up */
+	init_data[cpu].up_ticks = cpu_ticks();
+	smp_wmb();
+	atomic_set_bit64(cpu, &cpu_online_map);
+
 	local_irq_enable();
 	run_idle_thread();
 }
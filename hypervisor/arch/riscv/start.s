@@ -26,7 +26,9 @@ _start:
 	or t0, t0, t1
 	csrw menvcfg, t1
 #endif
-	csrwi mcounteren, 0x7
+	/* cycle, time, instret and the mhpmcounters of the vPMU */
+	li t0, ((1 << (CONFIG_NR_HPM_COUNTERS + 3)) - 1)
+	csrw mcounteren, t0
 	csrwi scounteren, 0x7
 	jal init_mstack
 	call reset_mtimer
@@ -48,6 +50,11 @@ _start:
 
 	li t0, 0x222
 	csrs mideleg, t0
+#if defined(RUN_ON_QEMU) && defined(CONFIG_MACRN)
+	/* Sscofpmf counter overflow, straight to the guest */
+	li t0, 0x2000
+	csrs mideleg, t0
+#endif
 
 	li t0, 0xaaa
 	csrw mie, t0
@@ -78,9 +85,10 @@ hart_halt:
 	j  hart_halt
 
 secondary:
-	lw t0, g_cpus
-	addi t0, t0, 1
-	sw t0, g_cpus, t1
+	/* all secondary harts boot at once, count them atomically */
+	la t1, g_cpus
+	li t0, 1
+	amoadd.w zero, t0, (t1)
 #ifndef CONFIG_MACRN
 	call boot_trap
 #endif
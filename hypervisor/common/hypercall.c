@@ -1182,6 +1182,38 @@ int32_t hcall_get_cpu_pm_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
 	return ret;
 }
 
+/*
+ * Arm or disarm interrupt storm detection for target_vm, see
+ * INTR_CMD_SET_STORM for the layout of buffer.
+ */
+static int32_t set_intr_storm(struct acrn_vm *target_vm, const uint64_t *buffer)
+{
+	uint64_t window = us_to_ticks((uint32_t)buffer[1]);
+	int32_t ret = 0;
+
+	if (buffer[0] == 0UL) {
+		target_vm->intr_storm_threshold = 0U;
+		target_vm->intr_storm_notify_fd = 0UL;
+	} else if ((buffer[0] > window) || (buffer[0] > UINT32_MAX) || (buffer[2] == 0UL)) {
+		ret = -EINVAL;
+	} else {
+		target_vm->intr_storm_window = window;
+		target_vm->intr_storm_max_delay = us_to_ticks((uint32_t)buffer[2]);
+		target_vm->intr_storm_notify_fd = (buffer[3] != 0UL) ?
+			get_asyncio_fd(target_vm, ACRN_ASYNCIO_MMIO, buffer[3]) : 0UL;
+		if ((buffer[3] != 0UL) && (target_vm->intr_storm_notify_fd == 0UL)) {
+			/* nothing to signal, the DM has to poll instead */
+			ret = -ENODEV;
+		} else {
+			/* last, the irq handlers start using the settings above */
+			cpu_write_memory_barrier();
+			target_vm->intr_storm_threshold = (uint32_t)buffer[0];
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief Get VCPU a VM's interrupt count data.
  *
@@ -1212,20 +1244,30 @@ int32_t hcall_vm_intr_monitor(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 				case INTR_CMD_GET_DATA:
 					intr_hdr->buf_cnt = ptirq_get_intr_data(target_vm,
 						intr_hdr->buffer, intr_hdr->buf_cnt);
+					status = 0;
 					break;
 
 				case INTR_CMD_DELAY_INT:
 					/* buffer[0] is the delay time (in MS), if 0 to cancel delay */
 					target_vm->intr_inject_delay_delta =
 						intr_hdr->buffer[0] * TICKS_PER_MS;
+					status = 0;
+					break;
+
+				case INTR_CMD_SET_STORM:
+					status = set_intr_storm(target_vm, intr_hdr->buffer);
+					break;
+
+				case INTR_CMD_GET_STORM:
+					intr_hdr->buf_cnt = ptirq_get_storm_data(target_vm,
+						intr_hdr->buffer, intr_hdr->buf_cnt);
+					status = 0;
 					break;
 
 				default:
-					/* if cmd wrong it goes here should not happen */
+					/* tell the DM this hypervisor lacks the cmd */
 					break;
 				}
-
-				status = 0;
 			}
 			clac();
 		}
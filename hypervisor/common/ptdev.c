@@ -120,6 +120,7 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
 {
 	uint64_t rflags;
 	struct ptirq_remapping_info *entry = NULL;
+	struct acrn_vm *storm_vm = NULL;
 
 	CPU_INT_ALL_DISABLE(&rflags);
 
@@ -128,6 +129,12 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
 
 		list_del_init(&entry->softirq_node);
 
+		/* one wakeup per pass is enough, the DM reads every throttled irq */
+		if (entry->storm_pending && ((storm_vm == NULL) || (storm_vm == entry->vm))) {
+			entry->storm_pending = false;
+			storm_vm = entry->vm;
+		}
+
 		/* if Service VM, just dequeue, if User VM, check delay timer */
 		if (is_service_vm(entry->vm) || timer_expired(&entry->intr_delay_timer, cpu_ticks(), NULL)) {
 			break;
@@ -139,6 +146,12 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
 	}
 
 	CPU_INT_ALL_RESTORE(rflags);
+
+	/* signal out of the irq-off section, the asyncio lock is taken in vCPU context */
+	if ((storm_vm != NULL) && (storm_vm->intr_storm_notify_fd != 0UL)) {
+		(void)notify_asyncio(storm_vm, storm_vm->intr_storm_notify_fd);
+	}
+
 	return entry;
 }
 
@@ -182,11 +195,59 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry)
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
 }
 
+/*
+ * Count the interrupt into the current window of the entry and adapt its
+ * injection delay. The first window over the threshold delays injection
+ * to the threshold rate, each further one doubles the delay up to the
+ * limit, and each window back under it halves the delay again. Returns
+ * the injection delay to apply, in ticks.
+ *
+ * interrupt context
+ */
+static uint64_t ptirq_storm_check(struct ptirq_remapping_info *entry, uint64_t now)
+{
+	struct acrn_vm *vm = entry->vm;
+	uint64_t quiet;
+
+	if ((now - entry->storm_window_start) >= vm->intr_storm_window) {
+		/*
+		 * Every window since the last interrupt was quiet, and so was the
+		 * one that just ended unless it crossed the threshold itself.
+		 */
+		quiet = (now - entry->storm_window_start) / vm->intr_storm_window;
+		if (entry->storm_window_cnt > vm->intr_storm_threshold) {
+			quiet--;
+		}
+		if ((quiet != 0UL) && (entry->storm_delay != 0UL)) {
+			entry->storm_delay = (quiet < 64UL) ? (entry->storm_delay >> quiet) : 0UL;
+			if (entry->storm_delay < (vm->intr_storm_window / vm->intr_storm_threshold)) {
+				entry->storm_delay = 0UL;
+			}
+		}
+		entry->storm_window_start = now;
+		entry->storm_window_cnt = 0U;
+	}
+
+	entry->storm_window_cnt++;
+	if (entry->storm_window_cnt == (vm->intr_storm_threshold + 1U)) {
+		if (entry->storm_delay == 0UL) {
+			entry->storm_delay = min(vm->intr_storm_window / vm->intr_storm_threshold,
+						 vm->intr_storm_max_delay);
+		} else {
+			entry->storm_delay = min(entry->storm_delay << 1U, vm->intr_storm_max_delay);
+		}
+		entry->storm_pending = true;
+	}
+
+	return max(entry->storm_delay, vm->intr_inject_delay_delta);
+}
+
 /* interrupt context */
 static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 {
 	struct ptirq_remapping_info *entry = (struct ptirq_remapping_info *) data;
 	bool to_enqueue = true;
+	uint64_t delay, now;
 
 	/*
 	 * "interrupt storm" detection & delay intr injection just for User VM
@@ -195,15 +256,20 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 	if (!is_service_vm(entry->vm)) {
 		entry->intr_count++;
 
+		now = cpu_ticks();
+		delay = entry->vm->intr_inject_delay_delta;
+		if (entry->vm->intr_storm_threshold != 0U) {
+			delay = ptirq_storm_check(entry, now);
+		}
+
 		/* if delta > 0, set the delay TSC, dequeue to handle */
-		if (entry->vm->intr_inject_delay_delta > 0UL) {
+		if (delay > 0UL) {
 
 			/* if the timer started (entry is in timer-list), not need enqueue again */
 			if (timer_is_started(&entry->intr_delay_timer)) {
 				to_enqueue = false;
 			} else {
-				update_timer(&entry->intr_delay_timer,
-					     cpu_ticks() + entry->vm->intr_inject_delay_delta, 0UL);
+				update_timer(&entry->intr_delay_timer, now + delay, 0UL);
 			}
 		} else {
 			update_timer(&entry->intr_delay_timer, 0UL, 0UL);
@@ -308,3 +374,24 @@ uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer,
 
 	return index;
 }
+
+uint32_t ptirq_get_storm_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt)
+{
+	uint32_t index = 0U;
+	uint16_t i;
+	struct ptirq_remapping_info *entry;
+
+	for (i = 0U; (i < CONFIG_MAX_PT_IRQ_ENTRIES) && ((index + 2U) <= buffer_cnt); i++) {
+		entry = &ptirq_entries[i];
+		if (!is_entry_active(entry) || (entry->allocated_pirq == IRQ_INVALID)) {
+			continue;
+		}
+		if ((entry->vm == target_vm) && (entry->storm_delay != 0UL)) {
+			buffer[index] = entry->allocated_pirq;
+			buffer[index + 1U] = ticks_to_us(entry->storm_delay);
+			index += 2U;
+		}
+	}
+
+	return index;
+}
@@ -56,6 +56,12 @@ static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_reboot(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+#ifdef CONFIG_RISCV64
+static int32_t shell_show_sbi_stat(int32_t argc, char **argv);
+#ifdef PROFILING_ON
+static int32_t shell_profiling(int32_t argc, char **argv);
+#endif
+#endif
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -160,6 +166,22 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+#ifdef CONFIG_RISCV64
+	{
+		.str		= SHELL_CMD_SBI_STAT,
+		.cmd_param	= SHELL_CMD_SBI_STAT_PARAM,
+		.help_str	= SHELL_CMD_SBI_STAT_HELP,
+		.fcn		= shell_show_sbi_stat,
+	},
+#ifdef PROFILING_ON
+	{
+		.str		= SHELL_CMD_PROFILING,
+		.cmd_param	= SHELL_CMD_PROFILING_PARAM,
+		.help_str	= SHELL_CMD_PROFILING_HELP,
+		.fcn		= shell_profiling,
+	},
+#endif
+#endif
 };
 
 /* for function key: up/down/right/left/home/end and delete key */
@@ -1320,6 +1342,62 @@ static int32_t shell_cpuid(int32_t argc, char **argv) { return 0; }
 static int32_t shell_reboot(__unused int32_t argc, __unused char **argv) { return 0; }
 static int32_t shell_rdmsr(int32_t argc, char **argv) { return 0; }
 static int32_t shell_wrmsr(int32_t argc, char **argv) { return 0; }
+
+static int32_t shell_show_sbi_stat(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret >= 0) {
+		vmid = sanitize_vmid((uint16_t) ret);
+		get_sbi_stat_info(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+#ifdef PROFILING_ON
+#define PROFILING_EVENT_CYCLES		0x1UL
+#define PROFILING_EVENT_INSTRET		0x2UL
+#define PROFILING_PERIOD_DEFAULT	1000000UL
+
+static int32_t shell_profiling(int32_t argc, char **argv)
+{
+	uint64_t event = PROFILING_EVENT_CYCLES;
+	uint64_t period = PROFILING_PERIOD_DEFAULT;
+	int32_t ret = 0;
+
+	if (argc == 1) {
+		get_profiling_hpm_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+		shell_puts(shell_log_buf);
+	} else if ((argc == 2) && (strcmp(argv[1], "stop") == 0)) {
+		profiling_hpm_stop();
+	} else if ((argc <= 4) && (strcmp(argv[1], "start") == 0)) {
+		if (argc >= 3) {
+			if (strcmp(argv[2], "instret") == 0) {
+				event = PROFILING_EVENT_INSTRET;
+			} else if (strcmp(argv[2], "cycles") != 0) {
+				event = strtoul_hex(argv[2]);
+			}
+		}
+		if (argc == 4) {
+			period = (uint64_t)strtol_deci(argv[3]);
+		}
+		ret = profiling_hpm_start(event, period);
+	} else {
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+#endif
 #else
 static void get_ptdev_info(char *str_arg, size_t str_max)
 {
@@ -113,4 +113,14 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_SBI_STAT		"sbi_stat"
+#define SHELL_CMD_SBI_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_SBI_STAT_HELP		"Show the SBI call count and average cycles per extension and function for"\
+					" each vCPU of a specific VM"
+
+#define SHELL_CMD_PROFILING		"profiling"
+#define SHELL_CMD_PROFILING_PARAM	"[start [cycles|instret|<mhpmevent>] [period] | stop]"
+#define SHELL_CMD_PROFILING_HELP	"No argument: show the hpm sampling statistics per CPU. start: sample every"\
+					" period (Dec) events on all CPUs into the SEP sbuf. stop: stop the sampling"
 #endif /* SHELL_PRIV_H */
@@ -121,6 +121,51 @@ int remove_asyncio(struct acrn_vm *vm, uint32_t type, uint64_t addr, uint64_t fd
 	return ret;
 }
 
+/*
+ * Return the fd of the asyncio descriptor registered on (type, addr), or
+ * 0 if there is none. Lets the hypervisor raise its own events on an
+ * eventfd the Service VM already waits on.
+ */
+uint64_t get_asyncio_fd(struct acrn_vm *vm, uint32_t type, uint64_t addr)
+{
+	struct list_head *pos;
+	struct asyncio_desc *iter_desc;
+	uint64_t fd = 0UL;
+
+	if (vm->sw.asyncio_sbuf != NULL) {
+		spinlock_obtain(&vm->asyncio_lock);
+		list_for_each(pos, &vm->aiodesc_queue) {
+			iter_desc = container_of(pos, struct asyncio_desc, list);
+			if ((iter_desc->addr == addr) && (iter_desc->type == type)) {
+				fd = iter_desc->fd;
+				break;
+			}
+		}
+		spinlock_release(&vm->asyncio_lock);
+	}
+
+	return fd;
+}
+
+/*
+ * Post fd from outside of a vCPU. Unlike the I/O path this never waits
+ * for room: a full ring has wakeups pending already, so drop the event.
+ */
+int notify_asyncio(struct acrn_vm *vm, uint64_t fd)
+{
+	struct shared_buf *sbuf = (struct shared_buf *)vm->sw.asyncio_sbuf;
+	uint32_t ret = 0U;
+
+	if (sbuf != NULL) {
+		spinlock_obtain(&vm->asyncio_lock);
+		ret = sbuf_put(sbuf, (uint8_t *)&fd);
+		spinlock_release(&vm->asyncio_lock);
+		arch_fire_hsm_interrupt();
+	}
+
+	return (ret != 0U) ? 0 : -ENODEV;
+}
+
 static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 {
 	return (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_COMPLETE);
@@ -238,14 +238,32 @@ static inline void asm_hlt(void)
 #define CPU_IRQ_ENABLE cpu_enable_irq
 #define CPU_IRQ_DISABLE cpu_disable_irq
 
+/* FS field of [ms]status, the state of the F/D register file */
+#define STATUS_FS		(0x3UL << 13U)
+#define STATUS_FS_OFF		(0x0UL << 13U)
+#define STATUS_FS_INITIAL	(0x1UL << 13U)
+#define STATUS_FS_CLEAN		(0x2UL << 13U)
+#define STATUS_FS_DIRTY		(0x3UL << 13U)
+
+/* layout is shared with fpu_save/fpu_restore in sched.s */
+struct fpu_context {
+	uint64_t fpr[32];
+	uint64_t fcsr;
+};
+
 /*
  * extended context does not save/restore during vm exit/entry, it's mainly
- * used in trusty world switch
+ * used in trusty world switch, and the F/D registers that are switched
+ * lazily on vCPU scheduling.
  */
 struct ext_context {
 	uint64_t tsc_offset;
+	struct fpu_context fpu;
 };
 
+extern void fpu_save(struct fpu_context *fpu);
+extern void fpu_restore(const struct fpu_context *fpu);
+
 #define NUM_GPRS	(CPU_REG_ORIG_A0 + 1)
 
 struct run_context {
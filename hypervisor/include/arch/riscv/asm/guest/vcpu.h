@@ -17,6 +17,7 @@
 #include <asm/vmx.h>
 #include <asm/guest/guest_memory.h>
 #include <asm/guest/vclint.h>
+#include <asm/guest/vpmu.h>
 
 #define ACRN_REQUEST_EXCP			0U
 #define ACRN_REQUEST_EVENT			1U
@@ -49,7 +50,8 @@ enum vm_cpu_mode {
 #define	VCPU_EVENT_IOREQ		0
 #define	VCPU_EVENT_VIRTUAL_INTERRUPT	1
 #define	VCPU_EVENT_SYNC_WBINVD		2
-#define	VCPU_EVENT_NUM			3
+#define	VCPU_EVENT_HSM_START		3
+#define	VCPU_EVENT_NUM			4
 
 enum reset_mode;
 
@@ -64,6 +66,22 @@ enum reset_mode;
 
 #define EOI_EXIT_BITMAP_SIZE	256U
 
+/* guest S-mode CSRs switched by load_vmcs/save_vmcs, in run_context order */
+enum vcpu_vcsr_name {
+	VCSR_SSTATUS = 0U,
+	VCSR_SEPC,
+	VCSR_SIP,
+	VCSR_SIE,
+	VCSR_STVEC,
+	VCSR_SSCRATCH,
+	VCSR_STVAL,
+	VCSR_SCAUSE,
+	VCSR_SATP,
+	NUM_VCSRS,
+};
+
+#define VCSR_ALL		((1U << NUM_VCSRS) - 1U)
+
 struct guest_cpu_context {
 	struct run_context run_ctx;
 	struct ext_context ext_ctx;
@@ -89,6 +107,19 @@ struct csr_store_area {
 	uint32_t count;	/* actual count of entries to be loaded/restored during VMEntry/VMExit */
 };
 
+/*
+ * SBI call statistics, indexed by extension (enum sbi_type of sbi.c, the
+ * last slot counts the extensions ACRN does not implement) and function ID
+ * (IDs beyond the last slot share it).
+ */
+#define VCPU_SBI_STAT_EXTS	8U
+#define VCPU_SBI_STAT_FUNCS	8U
+
+struct vcpu_sbi_stat {
+	uint64_t count;
+	uint64_t cycles;
+};
+
 struct acrn_vcpu_arch {
 	struct guest_cpu_context contexts[NR_WORLD];
 	struct cpu_info cpu_info;
@@ -128,6 +159,27 @@ struct acrn_vcpu_arch {
 
 	struct csr_store_area csr_area;
 
+	/*
+	 * Bitmaps of enum vcpu_vcsr_name. vcsr_cached: the run_context copy
+	 * is up to date, vcsr_dirty: the run_context copy was changed by the
+	 * hypervisor and must be written to the CSR on next entry.
+	 */
+	uint32_t vcsr_cached;
+	uint32_t vcsr_dirty;
+
+	/* lazy F/D register switches, see context_switch_in/out */
+	uint64_t nr_fpu_save;
+	uint64_t nr_fpu_restore;
+
+	/* SBI HSM hart state and the parameters of the last HART_START */
+	uint32_t hsm_state;
+	uint64_t hsm_start_addr;
+	uint64_t hsm_opaque;
+
+	struct acrn_vpmu pmu;
+
+	struct vcpu_sbi_stat sbi_stat[VCPU_SBI_STAT_EXTS][VCPU_SBI_STAT_FUNCS];
+
 	/* EOI_EXIT_BITMAP buffer, for the bitmap update */
 	uint64_t eoi_exit_bitmap[EOI_EXIT_BITMAP_SIZE >> 6U];
 } __aligned(8);
@@ -238,6 +290,7 @@ extern int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id);
 extern uint64_t vcpumask2pcpumask(struct acrn_vm *vm, uint64_t vdmask);
 extern bool is_lapic_pt_enabled(struct acrn_vcpu *vcpu);
 extern void vcpu_set_state(struct acrn_vcpu *vcpu, enum vcpu_state new_state);
+extern void get_sbi_stat_info(char *str_arg, size_t str_max, uint16_t vm_id);
 
 #endif /* __ASSEMBLY__ */
 
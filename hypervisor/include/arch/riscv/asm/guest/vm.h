@@ -58,6 +58,7 @@ struct kernel_info {
 	paddr_t kernel_addr;
 	paddr_t kernel_len;
 	paddr_t text_offset; /* 64-bit Image only */
+	paddr_t image_size; /* from the Image header, 0 if unknown */
 };
 
 struct dtb_info {
@@ -67,11 +68,21 @@ struct dtb_info {
 	paddr_t dtb_len;
 };
 
+/* pristine copies of the kernel and DTB, to reboot from, in image cache memory */
+struct vm_image_cache {
+	uint64_t kernel_hpa;
+	uint64_t kernel_size;
+	uint64_t dtb_hpa;
+	uint64_t dtb_size;
+	bool valid;
+};
+
 struct vm_sw_info {
 	enum os_kernel_type kernel_type;	/* Guest kernel type */
 	/* Kernel information (common for all guest types) */
 	struct kernel_info kernel_info;
 	struct dtb_info dtb_info;
+	struct vm_image_cache image_cache;
 	struct sw_module_info bootargs_info;
 	struct sw_module_info ramdisk_info;
 	/* HVA to IO shared page */
@@ -165,6 +176,10 @@ struct acrn_vm {
 	uint8_t vrtc_offset;
 
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
+	uint32_t intr_storm_threshold;	/* intrs per window that make a storm, 0: off */
+	uint64_t intr_storm_window;	/* ticks */
+	uint64_t intr_storm_max_delay;	/* ticks */
+	uint64_t intr_storm_notify_fd;	/* asyncio fd signaled on a storm, 0: none */
 } __aligned(PAGE_SIZE);
 
 static inline uint64_t vm_active_cpus(const struct acrn_vm *vm)
@@ -222,6 +237,7 @@ extern void resume_vm_from_s3(struct acrn_vm *vm, uint32_t wakeup_vec);
 extern void start_vm(struct acrn_vm *vm);
 extern void start_sos_vm(void);
 extern int32_t reset_vm(struct acrn_vm *vm);
+extern int32_t reboot_vm(struct acrn_vm *vm, enum reset_mode mode);
 extern int32_t create_vm(struct acrn_vm *vm);
 extern void prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config);
 extern void launch_vms(uint16_t pcpu_id);
@@ -20,6 +20,9 @@
 extern void init_vmcs(struct acrn_vcpu *vcpu);
 extern void load_vmcs(struct acrn_vcpu *vcpu);
 extern void save_vmcs(struct acrn_vcpu *vcpu);
+extern void release_vmcs(struct acrn_vcpu *vcpu);
+extern uint64_t vcpu_get_vcsr(struct acrn_vcpu *vcpu, uint32_t csr);
+extern void vcpu_set_vcsr(struct acrn_vcpu *vcpu, uint32_t csr, uint64_t val);
 
 #endif /* __ASSEMBLY__ */
 
@@ -35,7 +35,9 @@ struct acrn_vplic_ops {
 enum reset_mode;
 
 void vplic_init(struct acrn_vm *vm);
+void vplic_reset(struct acrn_vplic *vplic, const struct acrn_vplic_ops *ops, enum reset_mode mode);
 void vplic_accept_intr(struct acrn_vcpu *vcpu, uint32_t vector, bool level);
+void vplic_accept_intrs(struct acrn_vcpu *vcpu, const uint32_t *vectors, uint32_t nr);
 void vcpu_inject_extint(struct acrn_vcpu *vcpu);
 
 #endif /* __RISCV_VLAPIC_H__ */
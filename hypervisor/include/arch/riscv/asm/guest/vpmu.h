@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2023-2024 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __RISCV_VPMU_H__
+#define __RISCV_VPMU_H__
+
+#include <types.h>
+
+/*
+ * Virtual counter indexes, as seen through the SBI PMU extension:
+ * 0 cycle, 1 time (never matched), 2 instret, 3.. mhpmcounter3.., then
+ * the firmware counters, which count events emulated by the hypervisor.
+ */
+#define VPMU_CYCLE		0U
+#define VPMU_INSTRET		2U
+#define VPMU_HPM_BASE		3U
+#ifdef CONFIG_MACRN
+#define VPMU_NR_HPM_COUNTERS	CONFIG_NR_HPM_COUNTERS
+#else
+#define VPMU_NR_HPM_COUNTERS	0U
+#endif
+#define VPMU_NR_HW_COUNTERS	(VPMU_HPM_BASE + VPMU_NR_HPM_COUNTERS)
+#define VPMU_NR_FW_COUNTERS	8U
+#define VPMU_NR_COUNTERS	(VPMU_NR_HW_COUNTERS + VPMU_NR_FW_COUNTERS)
+#define VPMU_HW_MASK		((1UL << VPMU_NR_HW_COUNTERS) - 1UL)
+
+enum vpmu_fw_event {
+	VPMU_FW_SET_TIMER = 0U,
+	VPMU_FW_IPI_SENT,
+	VPMU_FW_FENCE_I_SENT,
+	VPMU_FW_SFENCE_VMA_SENT,
+	VPMU_FW_SFENCE_VMA_ASID_SENT,
+	VPMU_FW_MMIO_EXIT,
+	VPMU_FW_SBI_CALL,
+	VPMU_FW_NUM,
+};
+
+struct acrn_vpmu {
+	uint64_t used;		/* counters handed out by CONFIG_MATCHING */
+	uint64_t running;	/* counters started */
+
+	/* hardware counters, saved while the vCPU is switched out */
+	uint64_t hw_value[VPMU_NR_HW_COUNTERS];
+	uint64_t hpm_event[VPMU_NR_HPM_COUNTERS];
+	bool lcofip;
+
+	/*
+	 * firmware counters: fw_value is the counter value while stopped, and
+	 * the value minus fw_events[fw_event[i]] while running
+	 */
+	uint32_t fw_event[VPMU_NR_FW_COUNTERS];
+	uint64_t fw_value[VPMU_NR_FW_COUNTERS];
+	uint64_t fw_events[VPMU_FW_NUM];
+};
+
+/* count an emulated event, for the firmware counters */
+static inline void vpmu_fw_event(struct acrn_vpmu *pmu, enum vpmu_fw_event event)
+{
+	pmu->fw_events[event]++;
+}
+
+struct acrn_vcpu;
+
+extern void vpmu_reset(struct acrn_vcpu *vcpu);
+extern void vpmu_save(struct acrn_vcpu *vcpu);
+extern void vpmu_restore(struct acrn_vcpu *vcpu);
+extern int64_t vpmu_counter_info(uint64_t idx, uint64_t *info);
+extern int64_t vpmu_config_matching(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags, uint64_t event_idx,
+		uint64_t event_data, uint64_t *idx);
+extern int64_t vpmu_counter_start(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags, uint64_t value);
+extern int64_t vpmu_counter_stop(struct acrn_vcpu *vcpu, uint64_t base,
+		uint64_t mask, uint64_t flags);
+extern int64_t vpmu_fw_read(struct acrn_vcpu *vcpu, uint64_t idx, uint64_t *value);
+
+#endif /* __RISCV_VPMU_H__ */
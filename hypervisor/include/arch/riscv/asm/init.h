@@ -10,11 +10,15 @@
 #include <types.h>
 
 #define SP_BOTTOM_MAGIC		0x696e746cUL
+/* Per-CPU boot descriptor, filled in by the BSP in start_pcpus */
 struct init_info
 {
 	unsigned char *stack;
 	/* Logical CPU ID, used by start_secondary */
 	unsigned int cpuid;
+	/* Bring-up timestamps in CPU ticks: when kicked and when online */
+	uint64_t kick_ticks;
+	uint64_t up_ticks;
 };
 
 extern void init_IRQ(void);
@@ -66,6 +66,17 @@ static inline int64_t atomic_sub64_return(int64_t i, int64_t *v)
 	return ret - i;
 }
 
+static inline void atomic_set_bit64(uint32_t nr, uint64_t *v)
+{
+	asm volatile (
+		"amoor.d zero, %1, %0\n\t"
+		: "+A"(*v)
+		: "r"(1UL << nr)
+		: "memory"
+	);
+	smp_mb();
+}
+
 static inline int64_t atomic_inc64_return(int64_t *v)
 {
 	return atomic_add64_return(1, v);
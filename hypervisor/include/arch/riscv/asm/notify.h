@@ -14,6 +14,8 @@ struct smp_call_info_data {
 };
 
 extern void smp_call_function(uint64_t mask, smp_call_func_t func, void *data);
+extern void smp_call_function_async(uint64_t mask, smp_call_func_t func, void *data);
+extern void smp_call_function_wait(void);
 extern void smp_call_init(void);
 extern void kick_notification(void);
 extern void send_dest_ipi_mask(uint64_t dest_mask, uint64_t vector);
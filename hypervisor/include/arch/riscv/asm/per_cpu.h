@@ -15,9 +15,11 @@
 #include <asm/guest/vcpu.h>
 #include <logmsg.h>
 #include <types.h>
+#include <sbuf.h>
 #include <irq.h>
 #include <schedule.h>
 #include <timer.h>
+#include <profiling.h>
 
 struct per_cpu_region {
 	struct shared_buf *sbuf[ACRN_SBUF_PER_PCPU_ID_MAX];
@@ -31,11 +33,16 @@ struct per_cpu_region {
 	struct acrn_vcpu *vcpu_array[CONFIG_MAX_VM_NUM];
 	struct acrn_vcpu *ever_run_vcpu;
 	void *vcpu_run;
+	struct acrn_vcpu *vcsr_owner;	/* whose guest CSRs are in hardware */
+	struct acrn_vcpu *fpu_owner;	/* whose F/D registers are in hardware */
 	struct sched_control sched_ctl;
 	uint32_t lapic_id;
 	struct smp_call_info_data smp_call_info;
 	uint32_t cpu_id;
 	struct per_cpu_timers cpu_timers;
+#ifdef PROFILING_ON
+	struct profiling_info_wrapper profiling_info;
+#endif
 	struct thread_object idle;
 	uint32_t mode_to_kick_pcpu;
 	uint32_t mode_to_idle;
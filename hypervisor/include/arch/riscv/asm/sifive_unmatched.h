@@ -27,6 +27,10 @@
 #define CONFIG_BSP_CPU_ID		1
 #define CONFIG_NR_CPUS			5
 #define CONFIG_MAX_VCPU			2
+#define CONFIG_NR_HPM_COUNTERS		2
+/* RAM left out of all guests' memory, for the kernel/DTB copies to reboot from */
+#define CONFIG_IMAGE_CACHE_BASE		0x200000000UL
+#define CONFIG_IMAGE_CACHE_SIZE		0x10000000UL
 #define CONFIG_SOS_MEM_START		0x81000000
 #define CONFIG_SOS_MEM_SIZE		0x100000000
 #define CONFIG_SOS_DTB_BASE		0x58000000
@@ -44,6 +44,7 @@
 #define HX_EXIT_IRQ_SEXT			0x00000009U
 #define HX_EXIT_IRQ_VSEXT			0x0000000AU
 #define HX_EXIT_IRQ_MEXT			0x0000000BU
+#define HX_EXIT_IRQ_LCOF			0x0000000DU
 #define HX_EXIT_IRQ_GUEST_SEXT			0x00000022U
 
 #define NR_HX_EXIT_IRQ_REASONS		(HX_EXIT_IRQ_GUEST_SEXT + 1)
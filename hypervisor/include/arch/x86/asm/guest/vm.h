@@ -178,6 +178,10 @@ struct acrn_vm {
 	struct acrn_vrtc vrtc;
 
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
+	uint32_t intr_storm_threshold;	/* intrs per window that make a storm, 0: off */
+	uint64_t intr_storm_window;	/* ticks */
+	uint64_t intr_storm_max_delay;	/* ticks */
+	uint64_t intr_storm_notify_fd;	/* asyncio fd signaled on a storm, 0: none */
 } __aligned(PAGE_SIZE);
 
 /*
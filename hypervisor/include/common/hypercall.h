@@ -751,10 +751,7 @@ static inline int32_t hcall_set_callback_vector(struct acrn_vcpu *vcpu, struct a
 	return -1;
 }
 
-static inline int32_t hcall_setup_sbuf(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2)
-{
-	return -1;
-}
+int32_t hcall_setup_sbuf(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
 static inline int32_t hcall_asyncio_assign(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 		 __unused uint64_t param1, uint64_t param2)
@@ -778,10 +775,14 @@ static inline int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *
 	return -1;
 }
 
+#ifdef PROFILING_ON
+int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+#else
 static inline int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2)
 {
 	return -1;
 }
+#endif
 
 static inline int32_t hcall_create_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2)
 {
@@ -143,6 +143,10 @@ struct ptirq_remapping_info {
 
 	uint64_t intr_count;
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
+	uint64_t storm_window_start;	/* ticks */
+	uint32_t storm_window_cnt;	/* intrs in the current window */
+	uint64_t storm_delay;		/* ticks, injection delay while storming */
+	bool storm_pending;		/* storm not yet reported to the DM */
 	ptirq_arch_release_fn_t release_cb;
 };
 
@@ -288,6 +292,18 @@ void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
  */
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
 
+/**
+ * @brief Get the interrupts throttled by storm detection.
+ *
+ * @param[in]    target_vm the VM to get the interrupt information.
+ * @param[out]   buffer where pairs of irq and injection delay (us) are stored.
+ * @param[in]    buffer_cnt the size of the buffer.
+ *
+ * @retval the actual size the buffer filled with the interrupt information
+ *
+ */
+uint32_t ptirq_get_storm_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
+
 /**
   * @}
   */
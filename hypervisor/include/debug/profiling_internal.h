@@ -214,8 +214,10 @@ struct sep_state {
 	uint32_t frozen_delayed;
 	uint32_t nofrozen_pmi;
 
+#ifndef CONFIG_RISCV64
 	struct msr_store_entry vmexit_msr_list[MAX_PROFILING_MSR_STORE_NUM + MAX_HV_MSR_LIST_NUM];
 	uint32_t vmexit_msr_cnt;
+#endif
 	uint64_t guest_debugctl_value;
 	uint64_t saved_debugctl_value;
 } __aligned(8);
@@ -297,6 +299,10 @@ struct profiling_info_wrapper {
 	socwatch_state soc_state;
 	struct sw_msr_op_info sw_msr_info;
 	spinlock_t sw_lock;
+#ifdef CONFIG_RISCV64
+	/* the vCPU entered, until its VM exit is handled */
+	struct acrn_vcpu *vcpu;
+#endif
 } __aligned(8);
 
 int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr);
@@ -310,6 +316,13 @@ int32_t profiling_configure_vmsw(struct acrn_vm *vm, uint64_t addr);
 void profiling_ipi_handler(void *data);
 int32_t profiling_get_status_info(struct acrn_vm *vm, uint64_t addr);
 
+#ifdef CONFIG_RISCV64
+void profiling_lcofi_handler(void);
+int32_t profiling_hpm_start(uint64_t event, uint64_t period);
+void profiling_hpm_stop(void);
+void get_profiling_hpm_info(char *str_arg, size_t str_max);
+#endif
+
 #endif
 
 #endif /* PROFILING_INTERNAL_H */
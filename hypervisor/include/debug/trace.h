@@ -20,6 +20,7 @@
 
 #define TRACE_VM_EXIT			0x10U
 #define TRACE_VM_ENTER			0X11U
+#define TRACE_SBI_CALL			0x12U
 #define TRACE_VMEXIT_ENTRY		0x10000U
 
 #define TRACE_VMEXIT_EXCEPTION_OR_NMI	    (TRACE_VMEXIT_ENTRY + 0x00000000U)
@@ -296,6 +296,10 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva);
 int add_asyncio(struct acrn_vm *vm, uint32_t type, uint64_t addr, uint64_t fd);
 
 int remove_asyncio(struct acrn_vm *vm, uint32_t type, uint64_t addr, uint64_t fd);
+
+uint64_t get_asyncio_fd(struct acrn_vm *vm, uint32_t type, uint64_t addr);
+
+int notify_asyncio(struct acrn_vm *vm, uint64_t fd);
 /**
  * @}
  */
@@ -606,6 +606,16 @@ struct acrn_intr_monitor {
 /** cmd for intr monitor **/
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
+/*
+ * Arm storm detection in the hypervisor:
+ *   buffer[0] interrupts per window that make a storm, 0 to disarm
+ *   buffer[1] window length in us
+ *   buffer[2] longest injection delay a storming interrupt gets, in us
+ *   buffer[3] address of the MMIO asyncio ioeventfd to signal, 0 for none
+ */
+#define INTR_CMD_SET_STORM 2U
+/* Throttled interrupts: buffer holds pairs of irq and delay in us */
+#define INTR_CMD_GET_STORM 3U
 
 /*
  * PRE_LAUNCHED_VM is launched by ACRN hypervisor, with LAPIC_PT;
@@ -132,6 +132,20 @@ CFLAGS += -DCONFIG_KTEST
 ASFLAGS += -DCONFIG_KTEST
 endif
 
+# hypervisor sampling with the hpm counters, see arch/riscv/profiling.c
+#CONFIG_PROFILING := 1
+
+ifdef CONFIG_PROFILING
+CFLAGS += -DPROFILING_ON
+endif
+
+# run the vCPUs of the ktest VM on one pCPU
+#CONFIG_KTEST_SHARED_PCPU := 1
+
+ifdef CONFIG_KTEST_SHARED_PCPU
+CFLAGS += -DCONFIG_KTEST_SHARED_PCPU
+endif
+
 # platform boot component
 BOOT_S_SRCS += arch/riscv/start.s
 BOOT_S_SRCS += arch/riscv/intr.s
@@ -171,6 +185,7 @@ BOOT_C_SRCS += arch/riscv/guest/vmcs.c
 BOOT_C_SRCS += arch/riscv/guest/vm.c
 BOOT_C_SRCS += arch/riscv/guest/vio.c
 BOOT_C_SRCS += arch/riscv/guest/sbi.c
+BOOT_C_SRCS += arch/riscv/guest/vpmu.c
 BOOT_C_SRCS += arch/riscv/guest/vuart.c
 BOOT_C_SRCS += arch/riscv/guest/vpci/vuart.c
 BOOT_C_SRCS += arch/riscv/guest/vpci/vdev.c
@@ -194,8 +209,12 @@ BOOT_C_SRCS += arch/riscv/guest/vmcall.c
 BOOT_C_SRCS += arch/riscv/guest/guest_memory.c
 BOOT_C_SRCS += arch/riscv/guest/instr_emul.c
 
+ifdef CONFIG_PROFILING
+BOOT_C_SRCS += arch/riscv/profiling.c
+else
 BOOT_C_SRCS += release/profiling.c
-BOOT_C_SRCS += release/trace.c
+endif
+BOOT_C_SRCS += debug/trace.c
 BOOT_C_SRCS += lib/sprintf.c
 BOOT_C_SRCS += lib/string.c
 BOOT_C_SRCS += common/timer.c
@@ -209,12 +228,14 @@ BOOT_C_SRCS += common/ticks.c
 BOOT_C_SRCS += common/hv_main.c
 #BOOT_C_SRCS += common/hypercall.c
 BOOT_C_SRCS += debug/printf.c
-BOOT_C_SRCS += release/sbuf.c
+BOOT_C_SRCS += debug/sbuf.c
 BOOT_C_SRCS += debug/shell.c
 BOOT_C_SRCS += debug/string.c
 BOOT_C_SRCS += debug/logmsg.c
 BOOT_C_SRCS += debug/console.c
+ifndef CONFIG_PROFILING
 BOOT_C_SRCS += release/hypercall.c
+endif
 #BOOT_C_SRCS += dm/vpic.c
 #BOOT_C_SRCS += dm/vuart.c
 BOOT_C_SRCS += dm/io_req.c
@@ -223,6 +244,11 @@ BOOT_C_SRCS += dm/io_req.c
 ifdef CONFIG_KTEST
 BOOT_C_SRCS += arch/riscv/ktest/app.c
 BOOT_C_SRCS += arch/riscv/ktest/smp.c
+BOOT_C_SRCS += arch/riscv/ktest/bench.c
+BOOT_C_SRCS += arch/riscv/ktest/fp.c
+BOOT_C_SRCS += arch/riscv/ktest/hsm.c
+BOOT_C_SRCS += arch/riscv/ktest/pmu.c
+BOOT_C_SRCS += arch/riscv/ktest/srst.c
 endif
 
 BOOT_C_OBJS := $(patsubst %.c,$(HV_OBJDIR)/%.o,$(BOOT_C_SRCS))
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Reads an emulated PCI BAR register from several User VM vCPUs at once
+ * and reports the latency of each access, to measure how acrn-dm serves
+ * concurrent MMIO exits, e.g. with and without --ioreq_threads:
+ *
+ *   (User VM) mmio-bench -r /sys/bus/pci/devices/0000:00:05.0/resource4 -j 4
+ *
+ * With several -r, thread i reads from BAR i modulo their number. Each
+ * vCPU then looks up its own range in the acrn-dm MMIO tables, the pattern
+ * that used to evict a lookup hint shared by all vCPUs. acrn-dm serves one
+ * device on one ioreq thread, so only BARs of different devices scale.
+ *
+ * Only reads are issued. Pick a register without read side effects, such
+ * as the device feature select of a virtio common configuration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_THREADS	64
+#define MAX_BARS	8
+
+/* one cache line each, so the counters do not skew the scaling */
+struct worker {
+	pthread_t tid;
+	int cpu;
+	int bar;
+	volatile uint32_t *reg;
+	uint64_t nr;
+	uint64_t total_ns;
+	uint64_t max_ns;
+} __attribute__((aligned(64)));
+
+static pthread_barrier_t barrier;
+static volatile bool stop;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -r resource [-r resource...] [-o offset] "
+		"[-j threads] [-t seconds]\n"
+		"  -r  sysfs resource file of an emulated BAR, up to %d;\n"
+		"      thread i reads from BAR i modulo their number\n"
+		"  -o  register offset in the BAR (default 0)\n"
+		"  -j  reader threads, thread i is pinned to cpu i (default 1)\n"
+		"  -t  run time in seconds (default 5)\n", prog, MAX_BARS);
+}
+
+static volatile uint32_t *
+map_register(const char *path, unsigned long offset)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long base = offset & ~(page - 1);
+	struct stat st;
+	void *va;
+	int fd;
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || offset + sizeof(uint32_t) > st.st_size) {
+		fprintf(stderr, "%s: offset 0x%lx is out of the BAR\n",
+			path, offset);
+		close(fd);
+		return NULL;
+	}
+
+	va = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, base);
+	close(fd);
+	if (va == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	return (volatile uint32_t *)((char *)va + (offset - base));
+}
+
+static void *
+reader(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t t0, t1, delta;
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(w->cpu, &cpuset);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+		fprintf(stderr, "failed to pin to cpu %d\n", w->cpu);
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		t0 = now_ns();
+		(void)*w->reg;
+		t1 = now_ns();
+
+		delta = t1 - t0;
+		w->total_ns += delta;
+		if (delta > w->max_ns)
+			w->max_ns = delta;
+		w->nr++;
+	}
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct worker workers[MAX_THREADS];
+	const char *paths[MAX_BARS];
+	volatile uint32_t *regs[MAX_BARS];
+	unsigned long offset = 0;
+	unsigned int seconds = 5;
+	uint64_t nr = 0;
+	int i, nbars = 0, nthreads = 1, opt;
+
+	while ((opt = getopt(argc, argv, "r:o:j:t:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			if (nbars == MAX_BARS) {
+				usage(argv[0]);
+				return 1;
+			}
+			paths[nbars++] = optarg;
+			break;
+		case 'o':
+			offset = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (nbars == 0 || nthreads <= 0 || nthreads > MAX_THREADS ||
+	    (offset & 3) != 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < nbars; i++) {
+		regs[i] = map_register(paths[i], offset);
+		if (regs[i] == NULL)
+			return 1;
+	}
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	memset(workers, 0, sizeof(workers));
+	for (i = 0; i < nthreads; i++) {
+		workers[i].cpu = i;
+		workers[i].bar = i % nbars;
+		workers[i].reg = regs[workers[i].bar];
+		if (pthread_create(&workers[i].tid, NULL, reader, &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	sleep(seconds);
+	stop = true;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		printf("cpu %2d bar %d: %10lu reads, avg %6lu ns, max %8lu ns\n",
+			workers[i].cpu, workers[i].bar, workers[i].nr,
+			workers[i].nr ? workers[i].total_ns / workers[i].nr : 0,
+			workers[i].max_ns);
+		nr += workers[i].nr;
+	}
+	printf("total: %lu reads, %.0f reads/s\n", nr, (double)nr / seconds);
+
+	pthread_barrier_destroy(&barrier);
+	return 0;
+}
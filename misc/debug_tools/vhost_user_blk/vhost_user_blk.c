@@ -0,0 +1,610 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * A minimal vhost-user-blk backend serving one disk image, meant to
+ * test the acrn-dm vhost-user frontend end to end on a single host:
+ *
+ *   vhost-user-blk -s /tmp/vub.sock -f disk.img &
+ *   acrn-dm ... -s 5,virtio-blk,vhost-user=/tmp/vub.sock ...
+ *
+ * One request queue, one worker thread, split rings without indirect
+ * descriptors. Guest memory is mapped from the memfds acrn-dm passes
+ * with SET_MEM_TABLE, so requests are read and written in place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <linux/virtio_blk.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ring.h>
+
+#include "vhost_user.h"
+
+#define VUB_SECTOR_SIZE		512
+#define VUB_SEG_MAX		126
+#define VUB_BLK_ID_BYTES	20
+
+struct vub_region {
+	uint64_t gpa;
+	uint64_t uva;
+	uint64_t size;
+	uint8_t *va;		/* where the region starts in this process */
+	uint8_t *map;
+	size_t map_len;
+};
+
+struct vub_vq {
+	unsigned int num;
+	struct vring_desc *desc;
+	struct vring_avail *avail;
+	struct vring_used *used;
+	uint16_t last_avail;
+	int kick_fd;
+	int call_fd;
+	bool started;
+	pthread_t tid;
+	int stop_fd;		/* wakes the worker to stop */
+};
+
+struct vub_dev {
+	int conn;
+	int img_fd;
+	bool readonly;
+	uint64_t capacity;	/* in sectors */
+	char id[VUB_BLK_ID_BYTES];
+	uint64_t features;
+	uint64_t acked_features;
+	uint64_t protocol_features;
+	struct vub_region regions[VHOST_USER_MAX_REGIONS];
+	int nregions;
+	struct vub_vq vq;
+};
+
+static int verbose;
+
+#define vub_dbg(fmt, args...) \
+	do { if (verbose) fprintf(stderr, fmt, ##args); } while (0)
+
+static void *
+vub_gpa_to_va(struct vub_dev *dev, uint64_t gpa, uint64_t len)
+{
+	struct vub_region *r;
+	int i;
+
+	for (i = 0; i < dev->nregions; i++) {
+		r = &dev->regions[i];
+		if (gpa >= r->gpa && gpa - r->gpa + len <= r->size)
+			return r->va + (gpa - r->gpa);
+	}
+	return NULL;
+}
+
+static void *
+vub_uva_to_va(struct vub_dev *dev, uint64_t uva)
+{
+	struct vub_region *r;
+	int i;
+
+	for (i = 0; i < dev->nregions; i++) {
+		r = &dev->regions[i];
+		if (uva >= r->uva && uva - r->uva < r->size)
+			return r->va + (uva - r->uva);
+	}
+	return NULL;
+}
+
+static void
+vub_unmap_regions(struct vub_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nregions; i++)
+		munmap(dev->regions[i].map, dev->regions[i].map_len);
+	dev->nregions = 0;
+}
+
+/* Serve one request; returns the bytes written into guest buffers. */
+static uint32_t
+vub_do_request(struct vub_dev *dev, uint16_t head)
+{
+	struct vub_vq *vq = &dev->vq;
+	struct iovec iov[VUB_SEG_MAX + 2];
+	struct virtio_blk_outhdr hdr;
+	struct vring_desc *d;
+	uint8_t *status;
+	uint16_t idx = head;
+	uint32_t written = 0;
+	size_t len = 0;
+	ssize_t rc;
+	off_t off;
+	int n = 0, i;
+
+	/* gather the chain: header, data segments, status byte */
+	for (;;) {
+		if (idx >= vq->num || n == VUB_SEG_MAX + 2)
+			return 0;
+		d = &vq->desc[idx];
+		iov[n].iov_base = vub_gpa_to_va(dev, d->addr, d->len);
+		iov[n].iov_len = d->len;
+		if (!iov[n].iov_base)
+			return 0;
+		n++;
+		if (!(d->flags & VRING_DESC_F_NEXT))
+			break;
+		idx = d->next;
+	}
+
+	if (iov[0].iov_len < sizeof(hdr) || iov[n - 1].iov_len < 1)
+		return 0;
+	memcpy(&hdr, iov[0].iov_base, sizeof(hdr));
+	iov[0].iov_base = (uint8_t *)iov[0].iov_base + sizeof(hdr);
+	iov[0].iov_len -= sizeof(hdr);
+	iov[n - 1].iov_len--;
+	status = (uint8_t *)iov[n - 1].iov_base + iov[n - 1].iov_len;
+	for (i = 0; i < n; i++)
+		len += iov[i].iov_len;
+
+	*status = VIRTIO_BLK_S_OK;
+	off = hdr.sector * VUB_SECTOR_SIZE;
+	switch (hdr.type) {
+	case VIRTIO_BLK_T_IN:
+		rc = preadv(dev->img_fd, iov, n, off);
+		if (rc < 0)
+			*status = VIRTIO_BLK_S_IOERR;
+		else
+			written = rc;
+		break;
+	case VIRTIO_BLK_T_OUT:
+		if (dev->readonly)
+			*status = VIRTIO_BLK_S_IOERR;
+		else if (pwritev(dev->img_fd, iov, n, off) != (ssize_t)len)
+			*status = VIRTIO_BLK_S_IOERR;
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		if (fdatasync(dev->img_fd) < 0)
+			*status = VIRTIO_BLK_S_IOERR;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		for (i = 0, off = 0; i < n && off < VUB_BLK_ID_BYTES; i++) {
+			len = iov[i].iov_len < VUB_BLK_ID_BYTES - off ?
+				iov[i].iov_len : VUB_BLK_ID_BYTES - off;
+			memcpy(iov[i].iov_base, dev->id + off, len);
+			off += len;
+		}
+		written = off;
+		break;
+	default:
+		*status = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+
+	return written + 1;
+}
+
+/* Drain the avail ring; returns true if anything was completed. */
+static bool
+vub_process(struct vub_dev *dev)
+{
+	struct vub_vq *vq = &dev->vq;
+	struct vring_used_elem *ue;
+	uint16_t avail_idx, head;
+	bool done = false;
+
+	for (;;) {
+		avail_idx = __atomic_load_n(&vq->avail->idx, __ATOMIC_ACQUIRE);
+		if (vq->last_avail == avail_idx)
+			break;
+		head = vq->avail->ring[vq->last_avail % vq->num];
+		ue = &vq->used->ring[vq->used->idx % vq->num];
+		ue->id = head;
+		ue->len = vub_do_request(dev, head);
+		__atomic_store_n(&vq->used->idx, vq->used->idx + 1,
+			__ATOMIC_RELEASE);
+		vq->last_avail++;
+		done = true;
+	}
+	return done;
+}
+
+static void *
+vub_worker(void *arg)
+{
+	struct vub_dev *dev = arg;
+	struct vub_vq *vq = &dev->vq;
+	struct pollfd pfd[2];
+	eventfd_t cnt;
+	bool done;
+
+	pfd[0].fd = vq->kick_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = vq->stop_fd;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		/*
+		 * Run with guest kicks off while draining, then turn them
+		 * back on and look once more so a request that raced with
+		 * the flag change isn't left behind.
+		 */
+		done = false;
+		for (;;) {
+			vq->used->flags = VRING_USED_F_NO_NOTIFY;
+			while (vub_process(dev))
+				done = true;
+			vq->used->flags = 0;
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (!vub_process(dev))
+				break;
+			done = true;
+		}
+
+		if (done && vq->call_fd >= 0)
+			eventfd_write(vq->call_fd, 1);
+
+		if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		if (pfd[1].revents)
+			break;
+		if (pfd[0].revents)
+			eventfd_read(vq->kick_fd, &cnt);
+	}
+	return NULL;
+}
+
+static int
+vub_vq_start(struct vub_dev *dev)
+{
+	struct vub_vq *vq = &dev->vq;
+
+	if (vq->started)
+		return 0;
+	if (!vq->num || !vq->desc || !vq->avail || !vq->used ||
+	    vq->kick_fd < 0) {
+		fprintf(stderr, "ring enabled before it was set up\n");
+		return -1;
+	}
+
+	vq->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (vq->stop_fd < 0)
+		return -1;
+	if (pthread_create(&vq->tid, NULL, vub_worker, dev) != 0) {
+		close(vq->stop_fd);
+		return -1;
+	}
+	vq->started = true;
+	vub_dbg("ring started at %u\n", vq->last_avail);
+	return 0;
+}
+
+static void
+vub_vq_stop(struct vub_dev *dev)
+{
+	struct vub_vq *vq = &dev->vq;
+
+	if (vq->started) {
+		eventfd_write(vq->stop_fd, 1);
+		pthread_join(vq->tid, NULL);
+		close(vq->stop_fd);
+		vq->started = false;
+		vub_dbg("ring stopped at %u\n", vq->last_avail);
+	}
+	if (vq->kick_fd >= 0)
+		close(vq->kick_fd);
+	if (vq->call_fd >= 0)
+		close(vq->call_fd);
+	vq->kick_fd = vq->call_fd = -1;
+}
+
+static int
+vub_recv(struct vub_dev *dev, struct vhost_user_msg *msg, int *fds,
+	 int *nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * VHOST_USER_MAX_REGIONS)];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	rc = recvmsg(dev->conn, &mh, MSG_CMSG_CLOEXEC);
+	if (rc != VHOST_USER_HDR_SIZE || msg->size > sizeof(msg->payload))
+		return -1;
+
+	*nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+		}
+	}
+
+	if (msg->size && recv(dev->conn, &msg->payload, msg->size,
+			MSG_WAITALL) != msg->size)
+		return -1;
+	return 0;
+}
+
+static int
+vub_reply(struct vub_dev *dev, struct vhost_user_msg *msg, uint32_t size)
+{
+	msg->flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+	msg->size = size;
+	if (send(dev->conn, msg, VHOST_USER_HDR_SIZE + size, 0) !=
+			VHOST_USER_HDR_SIZE + size)
+		return -1;
+	return 0;
+}
+
+static int
+vub_set_mem_table(struct vub_dev *dev, struct vhost_user_msg *msg, int *fds,
+		  int nfds)
+{
+	struct vhost_user_memory mem;
+	struct vub_region *r;
+	uint32_t i;
+
+	memcpy(&mem, (uint8_t *)msg + VHOST_USER_HDR_SIZE, sizeof(mem));
+	if (mem.nregions != nfds || nfds > VHOST_USER_MAX_REGIONS)
+		return -1;
+
+	vub_unmap_regions(dev);
+	for (i = 0; i < mem.nregions; i++) {
+		r = &dev->regions[i];
+		r->gpa = mem.regions[i].guest_phys_addr;
+		r->uva = mem.regions[i].userspace_addr;
+		r->size = mem.regions[i].memory_size;
+		r->map_len = r->size + mem.regions[i].mmap_offset;
+		r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fds[i], 0);
+		close(fds[i]);
+		if (r->map == MAP_FAILED) {
+			fprintf(stderr, "mmap of region %u failed: %d\n",
+				i, errno);
+			vub_unmap_regions(dev);
+			return -1;
+		}
+		r->va = r->map + mem.regions[i].mmap_offset;
+		dev->nregions++;
+		vub_dbg("region %u: gpa 0x%lx size 0x%lx\n", i,
+			(unsigned long)r->gpa, (unsigned long)r->size);
+	}
+	return 0;
+}
+
+static void
+vub_get_config(struct vub_dev *dev, struct vhost_user_msg *msg)
+{
+	struct virtio_blk_config cfg;
+	uint32_t size = msg->payload.config.size;
+
+	if (size > VHOST_USER_MAX_CONFIG_SIZE)
+		size = VHOST_USER_MAX_CONFIG_SIZE;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.capacity = dev->capacity;
+	cfg.seg_max = VUB_SEG_MAX;
+	cfg.blk_size = VUB_SECTOR_SIZE;
+
+	memset(msg->payload.config.region, 0, size);
+	memcpy(msg->payload.config.region, &cfg,
+		size < sizeof(cfg) ? size : sizeof(cfg));
+	msg->payload.config.size = size;
+}
+
+/* Handle one message; returns < 0 when the connection should go. */
+static int
+vub_handle(struct vub_dev *dev)
+{
+	struct vhost_user_msg msg;
+	struct vub_vq *vq = &dev->vq;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int nfds, fd, rc = 0;
+
+	if (vub_recv(dev, &msg, fds, &nfds) != 0)
+		return -1;
+	vub_dbg("request %u, size %u, %d fds\n", msg.request, msg.size, nfds);
+
+	fd = nfds > 0 ? fds[0] : -1;
+	switch (msg.request) {
+	case VHOST_USER_GET_FEATURES:
+		msg.payload.u64 = dev->features;
+		rc = vub_reply(dev, &msg, sizeof(msg.payload.u64));
+		break;
+	case VHOST_USER_SET_FEATURES:
+		dev->acked_features = msg.payload.u64;
+		break;
+	case VHOST_USER_SET_OWNER:
+		break;
+	case VHOST_USER_RESET_OWNER:
+		vub_vq_stop(dev);
+		vub_unmap_regions(dev);
+		break;
+	case VHOST_USER_GET_PROTOCOL_FEATURES:
+		msg.payload.u64 = 1UL << VHOST_USER_PROTOCOL_F_CONFIG;
+		rc = vub_reply(dev, &msg, sizeof(msg.payload.u64));
+		break;
+	case VHOST_USER_SET_PROTOCOL_FEATURES:
+		dev->protocol_features = msg.payload.u64;
+		break;
+	case VHOST_USER_SET_MEM_TABLE:
+		rc = vub_set_mem_table(dev, &msg, fds, nfds);
+		nfds = 0;
+		break;
+	case VHOST_USER_SET_VRING_NUM:
+		vq->num = msg.payload.state.num;
+		break;
+	case VHOST_USER_SET_VRING_BASE:
+		vq->last_avail = msg.payload.state.num;
+		break;
+	case VHOST_USER_SET_VRING_ADDR:
+		vq->desc = vub_uva_to_va(dev, msg.payload.addr.desc_user_addr);
+		vq->avail = vub_uva_to_va(dev, msg.payload.addr.avail_user_addr);
+		vq->used = vub_uva_to_va(dev, msg.payload.addr.used_user_addr);
+		break;
+	case VHOST_USER_GET_VRING_BASE:
+		vub_vq_stop(dev);
+		msg.payload.state.num = vq->last_avail;
+		rc = vub_reply(dev, &msg, sizeof(msg.payload.state));
+		break;
+	case VHOST_USER_SET_VRING_KICK:
+	case VHOST_USER_SET_VRING_CALL:
+		if (msg.payload.u64 & VHOST_USER_VRING_NOFD_MASK)
+			fd = -1;
+		if (msg.request == VHOST_USER_SET_VRING_KICK) {
+			if (vq->kick_fd >= 0)
+				close(vq->kick_fd);
+			vq->kick_fd = fd;
+			/* without protocol features the kick starts the ring */
+			if (!(dev->acked_features &
+			      (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+				rc = vub_vq_start(dev);
+		} else {
+			if (vq->call_fd >= 0)
+				close(vq->call_fd);
+			vq->call_fd = fd;
+		}
+		nfds = 0;
+		break;
+	case VHOST_USER_SET_VRING_ENABLE:
+		if (msg.payload.state.num)
+			rc = vub_vq_start(dev);
+		break;
+	case VHOST_USER_GET_CONFIG:
+		vub_get_config(dev, &msg);
+		rc = vub_reply(dev, &msg,
+			VHOST_USER_CONFIG_HDR_SIZE + msg.payload.config.size);
+		break;
+	default:
+		fprintf(stderr, "unsupported request %u\n", msg.request);
+		rc = -1;
+		break;
+	}
+
+	/* close whatever fds the request didn't take */
+	while (nfds > 0)
+		close(fds[--nfds]);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -s <socket> -f <image> [-r] [-v]\n"
+		"  -s  unix socket path to listen on\n"
+		"  -f  disk image to serve\n"
+		"  -r  serve the image read-only\n"
+		"  -v  log every vhost-user request\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	struct vub_dev dev;
+	struct stat st;
+	char *sock_path = NULL, *img_path = NULL;
+	int lfd, opt;
+
+	memset(&dev, 0, sizeof(dev));
+	while ((opt = getopt(argc, argv, "s:f:rvh")) != -1) {
+		switch (opt) {
+		case 's':
+			sock_path = optarg;
+			break;
+		case 'f':
+			img_path = optarg;
+			break;
+		case 'r':
+			dev.readonly = true;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!sock_path || !img_path ||
+	    strnlen(sock_path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dev.img_fd = open(img_path, dev.readonly ? O_RDONLY : O_RDWR);
+	if (dev.img_fd < 0 || fstat(dev.img_fd, &st) < 0) {
+		perror(img_path);
+		return 1;
+	}
+	dev.capacity = st.st_size / VUB_SECTOR_SIZE;
+	strncpy(dev.id, "vhost-user-blk", sizeof(dev.id));
+	dev.features = (1UL << VIRTIO_BLK_F_SEG_MAX) |
+		(1UL << VIRTIO_BLK_F_BLK_SIZE) |
+		(1UL << VIRTIO_BLK_F_FLUSH) |
+		(1UL << VIRTIO_F_VERSION_1) |
+		(1UL << VHOST_USER_F_PROTOCOL_FEATURES);
+	if (dev.readonly)
+		dev.features |= 1UL << VIRTIO_BLK_F_RO;
+	dev.vq.kick_fd = dev.vq.call_fd = -1;
+
+	signal(SIGPIPE, SIG_IGN);
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+	unlink(sock_path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 1) < 0) {
+		perror(sock_path);
+		return 1;
+	}
+	printf("serving %s (%lu sectors) on %s\n", img_path,
+		(unsigned long)dev.capacity, sock_path);
+
+	/* one frontend at a time; a new acrn-dm may connect after it exits */
+	for (;;) {
+		dev.conn = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (dev.conn < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		while (vub_handle(&dev) == 0)
+			;
+		vub_vq_stop(&dev);
+		vub_unmap_regions(&dev);
+		dev.acked_features = dev.protocol_features = 0;
+		close(dev.conn);
+		printf("frontend disconnected\n");
+	}
+
+	close(lfd);
+	close(dev.img_fd);
+	return 0;
+}
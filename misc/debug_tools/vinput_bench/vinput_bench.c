@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Pushes numbered input events through a virtio-input device and checks
+ * that the User VM receives all of them, in order, to exercise the
+ * virtqueue of the acrn-dm virtio-input backend (split or packed ring):
+ *
+ *   (Service VM) vinput-bench -m source -n 1000000
+ *   acrn-dm ... -s 6,virtio-input,/dev/input/eventX
+ *   (User VM) vinput-bench -m sink -e /dev/input/eventY
+ *
+ * Every report carries a 16-bit sequence number in ABS_X, so the sink
+ * can count the reports lost between the two ends.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#define SEQ_MASK		0xffffU
+#define EVENT_BATCH		64
+#define VIRTIO_F_RING_PACKED	34
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+	stop = 1;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -m source|sink [-e evdev] [-n reports] "
+		"[-r rate]\n"
+		"  -m  source creates a uinput device in the Service VM and\n"
+		"      feeds it, sink reads the events in the User VM\n"
+		"  -e  evdev node of the virtio-input device (sink)\n"
+		"  -n  stop after this many reports\n"
+		"  -r  reports per second (source, default unlimited)\n", prog);
+}
+
+static int
+emit(int fd, unsigned short type, unsigned short code, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	return (write(fd, &ev, sizeof(ev)) == sizeof(ev)) ? 0 : -1;
+}
+
+/* print the evdev node that acrn-dm has to be given */
+static void
+print_evdev(int fd)
+{
+	char sysname[64], path[128];
+	struct dirent *de;
+	DIR *dir;
+
+	if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		perror("UI_GET_SYSNAME");
+		return;
+	}
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (!strncmp(de->d_name, "event", 5)) {
+			printf("input device: /dev/input/%s\n", de->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+}
+
+static int
+run_source(unsigned long long limit, unsigned long rate)
+{
+	struct uinput_setup setup;
+	struct uinput_abs_setup abs;
+	unsigned long long seq = 0;
+	double start, now;
+	int fd;
+
+	fd = open("/dev/uinput", O_WRONLY);
+	if (fd < 0) {
+		perror("/dev/uinput");
+		return 1;
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_VIRTUAL;
+	strncpy(setup.name, "vinput-bench", UINPUT_MAX_NAME_SIZE - 1);
+	memset(&abs, 0, sizeof(abs));
+	abs.code = ABS_X;
+	abs.absinfo.maximum = SEQ_MASK;
+
+	if (ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0 ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_X) < 0 ||
+	    ioctl(fd, UI_DEV_SETUP, &setup) < 0 ||
+	    ioctl(fd, UI_ABS_SETUP, &abs) < 0 ||
+	    ioctl(fd, UI_DEV_CREATE) < 0) {
+		perror("uinput setup");
+		close(fd);
+		return 1;
+	}
+	print_evdev(fd);
+	printf("start acrn-dm and the sink, then press Enter\n");
+	fflush(stdout);
+	getchar();
+
+	start = now_sec();
+	while (!stop && (limit == 0 || seq < limit)) {
+		/* consecutive values always differ, so evdev never filters one */
+		if (emit(fd, EV_ABS, ABS_X, seq & SEQ_MASK) < 0 ||
+		    emit(fd, EV_SYN, SYN_REPORT, 0) < 0) {
+			perror("write");
+			break;
+		}
+		seq++;
+
+		if (rate != 0) {
+			now = now_sec();
+			if (seq > (now - start) * rate)
+				usleep((seq / (double)rate - (now - start)) * 1e6);
+		}
+	}
+
+	now = now_sec();
+	printf("sent %llu reports in %.2fs, %.0f reports/s\n", seq,
+		now - start, seq / (now - start));
+
+	/* let acrn-dm drain the tail before the device goes away */
+	sleep(1);
+	ioctl(fd, UI_DEV_DESTROY);
+	close(fd);
+	return 0;
+}
+
+/* report whether the virtio device under the evdev node runs a packed ring */
+static void
+print_ring_layout(const char *evdev)
+{
+	char path[PATH_MAX], features[128], *name, *copy;
+	FILE *fp;
+
+	copy = strdup(evdev);
+	if (copy == NULL)
+		return;
+	name = basename(copy);
+	snprintf(path, sizeof(path), "/sys/class/input/%s/device/device/features",
+		name);
+	free(copy);
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("ring layout: unknown\n");
+		return;
+	}
+	if (fgets(features, sizeof(features), fp) &&
+	    strlen(features) > VIRTIO_F_RING_PACKED)
+		printf("ring layout: %s\n",
+			(features[VIRTIO_F_RING_PACKED] == '1') ? "packed" : "split");
+	else
+		printf("ring layout: unknown\n");
+	fclose(fp);
+}
+
+static int
+run_sink(const char *evdev, unsigned long long limit)
+{
+	struct input_event ev[EVENT_BATCH];
+	unsigned long long received = 0, lost = 0, overruns = 0;
+	unsigned long long last_received = 0;
+	unsigned int expect = 0;
+	bool synced = false;
+	double start = 0, last = 0, now;
+	ssize_t n;
+	int fd, i;
+
+	fd = open(evdev, O_RDONLY);
+	if (fd < 0) {
+		perror(evdev);
+		return 1;
+	}
+	print_ring_layout(evdev);
+
+	while (!stop && (limit == 0 || received + lost < limit)) {
+		n = read(fd, ev, sizeof(ev));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+			if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED) {
+				/* lost in an evdev buffer, not the ring */
+				overruns++;
+				synced = false;
+				continue;
+			}
+			if (ev[i].type != EV_ABS || ev[i].code != ABS_X)
+				continue;
+
+			if (!synced) {
+				synced = true;
+				if (start == 0)
+					start = last = now_sec();
+			} else
+				lost += (ev[i].value - expect) & SEQ_MASK;
+			expect = (ev[i].value + 1) & SEQ_MASK;
+			received++;
+		}
+
+		now = now_sec();
+		if (start != 0 && now - last >= 1.0) {
+			printf("%10.0f reports/s, %llu lost\n",
+				(received - last_received) / (now - last), lost);
+			fflush(stdout);
+			last_received = received;
+			last = now;
+		}
+	}
+
+	now = now_sec();
+	if (start != 0 && now > start)
+		printf("received %llu reports in %.2fs, %.0f reports/s, "
+			"%llu lost, %llu evdev overruns\n", received,
+			now - start, received / (now - start), lost, overruns);
+
+	close(fd);
+	return (lost == 0) ? 0 : 2;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *evdev = NULL;
+	unsigned long long limit = 0;
+	unsigned long rate = 0;
+	int mode = -1, opt;
+
+	while ((opt = getopt(argc, argv, "m:e:n:r:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "source"))
+				mode = 0;
+			else if (!strcmp(optarg, "sink"))
+				mode = 1;
+			break;
+		case 'e':
+			evdev = optarg;
+			break;
+		case 'n':
+			limit = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (mode < 0 || (mode == 1 && evdev == NULL)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+
+	return (mode == 0) ? run_source(limit, rate) : run_sink(evdev, limit);
+}
@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Sends or receives UDP frames on a network interface from several
+ * threads, to measure how the throughput of the acrn-dm virtio-net
+ * backend scales with its queue pairs:
+ *
+ *   acrn-dm ... -s 4,virtio-net,tap=tap0,mq=4
+ *   (User VM) ethtool -L eth0 combined 4
+ *   (Service VM) vnet-bench -m rx -i tap0 -j 4
+ *   (User VM) vnet-bench -m tx -i eth0 -j 4
+ *
+ * Thread i runs on CPU i and sends from UDP source port VNB_PORT + i, so
+ * in the User VM its frames take the TX queue of that CPU, and the tap
+ * steers each flow to a queue of its own on the way in. The receiver
+ * spreads the flows over its threads with a packet fanout group.
+ *
+ * Every frame carries a sequence number of its flow, so the receiver
+ * counts the frames lost on the way. With small frames and -r below what
+ * the other end sustains, nothing may be lost: acrn-dm has to hold the
+ * frames back rather than drop them when the guest runs out of buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#define MAX_THREADS	64
+#define BATCH		32
+#define VNB_PORT	9000
+#define VNB_MAGIC	0x766e6231U
+#define MIN_FRAME	60
+#define MAX_FRAME	1514
+
+struct vnb_payload {
+	uint32_t magic;
+	uint32_t flow;
+	uint64_t seq;
+} __attribute__((packed));
+
+#define HDR_LEN		(ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+/* one cache line each, so the counters do not skew the scaling */
+struct worker {
+	pthread_t tid;
+	int id;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint64_t lost;		/* gaps in the sequence numbers */
+	uint64_t reordered;
+	uint64_t drops;		/* dropped by the receiving socket */
+	uint64_t expect[MAX_THREADS];
+} __attribute__((aligned(64)));
+
+static struct worker workers[MAX_THREADS];
+static pthread_barrier_t barrier;
+static volatile sig_atomic_t stop;
+static int ifindex, frame_size = MAX_FRAME, nthreads = 1;
+static unsigned long rate;
+static uint8_t ifmac[ETH_ALEN];
+
+static void
+on_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -m tx|rx -i ifname [-j threads] [-s size] "
+		"[-r rate] [-t seconds]\n"
+		"  -m  tx sends, rx receives and counts\n"
+		"  -i  network interface, the tap in the Service VM or the\n"
+		"      virtio-net interface in the User VM\n"
+		"  -j  threads, thread i is pinned to cpu i (default 1)\n"
+		"  -s  frame size without FCS, %d to %d (default %d)\n"
+		"  -r  frames per second of each tx thread (default unlimited)\n"
+		"  -t  run time in seconds, counted from the first frame for\n"
+		"      rx (default 10)\n", prog, MIN_FRAME, MAX_FRAME, MAX_FRAME);
+}
+
+static void
+pin_to_cpu(int cpu)
+{
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+		fprintf(stderr, "failed to pin to cpu %d\n", cpu);
+}
+
+static int
+open_socket(uint16_t proto)
+{
+	struct sockaddr_ll sll;
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(proto));
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(proto);
+	sll.sll_ifindex = ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static uint16_t
+ip_checksum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* a broadcast UDP/IPv4 frame of flow id, padded to frame_size */
+static void
+build_frame(uint8_t *frame, int id)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	struct iphdr *ip = (struct iphdr *)(eth + 1);
+	struct udphdr *udp = (struct udphdr *)(ip + 1);
+	struct vnb_payload *pl = (struct vnb_payload *)(udp + 1);
+
+	memset(frame, 0, frame_size);
+	memset(eth->h_dest, 0xff, ETH_ALEN);
+	memcpy(eth->h_source, ifmac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	ip->version = 4;
+	ip->ihl = sizeof(*ip) / 4;
+	ip->tot_len = htons(frame_size - ETH_HLEN);
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->saddr = htonl(0x0a000001);
+	ip->daddr = htonl(0xffffffff);
+	ip->check = ip_checksum(ip, sizeof(*ip));
+
+	udp->source = htons(VNB_PORT + id);
+	udp->dest = htons(VNB_PORT);
+	udp->len = htons(frame_size - ETH_HLEN - sizeof(*ip));
+
+	pl->magic = htonl(VNB_MAGIC);
+	pl->flow = htonl(id);
+}
+
+static void *
+sender(void *arg)
+{
+	struct worker *w = arg;
+	static __thread uint8_t frames[BATCH][MAX_FRAME];
+	struct mmsghdr msgs[BATCH];
+	struct iovec iov[BATCH];
+	struct vnb_payload *pl;
+	uint64_t seq = 0, now;
+	int fd, i, n;
+
+	pin_to_cpu(w->id);
+	fd = open_socket(0);
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < BATCH; i++) {
+		build_frame(frames[i], w->id);
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = frame_size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	pthread_barrier_wait(&barrier);
+	if (fd < 0)
+		return NULL;
+
+	w->first_ns = now_ns();
+	while (!stop) {
+		for (i = 0; i < BATCH; i++) {
+			pl = (struct vnb_payload *)(frames[i] + HDR_LEN);
+			pl->seq = htobe64(seq + i);
+		}
+		n = sendmmsg(fd, msgs, BATCH, 0);
+		if (n < 0) {
+			/* the qdisc or the device queue is full */
+			if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+				sched_yield();
+				continue;
+			}
+			perror("sendmmsg");
+			break;
+		}
+		seq += n;
+		w->frames += n;
+		w->bytes += (uint64_t)n * frame_size;
+
+		if (rate != 0) {
+			now = now_ns();
+			if (seq * 1000000000ULL > (now - w->first_ns) * rate)
+				usleep((seq * 1000000000ULL / rate -
+					(now - w->first_ns)) / 1000);
+		}
+	}
+	w->last_ns = now_ns();
+
+	close(fd);
+	return NULL;
+}
+
+/* whether frame is one of ours, not sent from this end of the link */
+static bool
+is_bench_frame(const uint8_t *frame, ssize_t len, const struct sockaddr_ll *sll)
+{
+	const struct iphdr *ip = (const struct iphdr *)(frame + ETH_HLEN);
+	const struct udphdr *udp = (const struct udphdr *)(ip + 1);
+	const struct vnb_payload *pl = (const struct vnb_payload *)(udp + 1);
+
+	return sll->sll_pkttype != PACKET_OUTGOING &&
+		len >= (ssize_t)(HDR_LEN + sizeof(*pl)) &&
+		ip->protocol == IPPROTO_UDP &&
+		udp->dest == htons(VNB_PORT) &&
+		pl->magic == htonl(VNB_MAGIC);
+}
+
+/* account for the sequence number of a frame of flow */
+static void
+check_seq(struct worker *w, uint32_t flow, uint64_t seq)
+{
+	if (flow >= MAX_THREADS)
+		return;
+
+	if (seq >= w->expect[flow]) {
+		w->lost += seq - w->expect[flow];
+		w->expect[flow] = seq + 1;
+	} else {
+		/* counted as lost when the later frames overtook it */
+		w->reordered++;
+		if (w->lost > 0)
+			w->lost--;
+	}
+}
+
+static void *
+receiver(void *arg)
+{
+	struct worker *w = arg;
+	static __thread uint8_t frames[BATCH][MAX_FRAME];
+	struct sockaddr_ll names[BATCH];
+	struct mmsghdr msgs[BATCH];
+	struct iovec iov[BATCH];
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+	struct tpacket_stats stats;
+	const struct vnb_payload *pl;
+	socklen_t len = sizeof(stats);
+	int fd, i, n, fanout, rcvbuf = 4 << 20;
+
+	pin_to_cpu(w->id);
+	fd = open_socket(ETH_P_IP);
+	if (fd >= 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		fanout = (getpid() & 0xffff) | (PACKET_FANOUT_HASH << 16);
+		if (nthreads > 1 && setsockopt(fd, SOL_PACKET, PACKET_FANOUT,
+				&fanout, sizeof(fanout)) < 0) {
+			perror("PACKET_FANOUT");
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	for (i = 0; i < BATCH; i++) {
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = MAX_FRAME;
+	}
+
+	pthread_barrier_wait(&barrier);
+	if (fd < 0)
+		return NULL;
+
+	while (!stop) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < BATCH; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &names[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+		}
+		n = recvmmsg(fd, msgs, BATCH, MSG_WAITFORONE, NULL);
+		if (n <= 0)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (!is_bench_frame(frames[i], msgs[i].msg_len, &names[i]))
+				continue;
+			pl = (const struct vnb_payload *)(frames[i] + HDR_LEN);
+			check_seq(w, ntohl(pl->flow), be64toh(pl->seq));
+			w->frames++;
+			w->bytes += msgs[i].msg_len;
+		}
+		if (w->frames != 0) {
+			w->last_ns = now_ns();
+			if (w->first_ns == 0)
+				w->first_ns = w->last_ns;
+		}
+	}
+
+	if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+		w->drops = stats.tp_drops;
+	close(fd);
+	return NULL;
+}
+
+static int
+get_ifmac(const char *ifname)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror(ifname);
+		close(fd);
+		return -1;
+	}
+	memcpy(ifmac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(fd);
+	return 0;
+}
+
+static void
+sum_workers(uint64_t *frames, uint64_t *bytes, uint64_t *first, uint64_t *last,
+	    uint64_t *lost)
+{
+	int i;
+
+	*frames = *bytes = *first = *last = *lost = 0;
+	for (i = 0; i < nthreads; i++) {
+		*frames += workers[i].frames;
+		*bytes += workers[i].bytes;
+		*lost += workers[i].lost;
+		if (workers[i].first_ns &&
+		    (*first == 0 || workers[i].first_ns < *first))
+			*first = workers[i].first_ns;
+		if (workers[i].last_ns > *last)
+			*last = workers[i].last_ns;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *ifname = NULL;
+	unsigned int seconds = 10;
+	uint64_t frames, bytes, first, last, lost, prev_frames = 0, prev_bytes = 0;
+	uint64_t reordered = 0, drops = 0;
+	double secs;
+	int i, mode = -1, opt;
+
+	while ((opt = getopt(argc, argv, "m:i:j:s:r:t:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "tx"))
+				mode = 0;
+			else if (!strcmp(optarg, "rx"))
+				mode = 1;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			frame_size = atoi(optarg);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (mode < 0 || ifname == NULL || nthreads <= 0 ||
+	    nthreads > MAX_THREADS || frame_size < MIN_FRAME ||
+	    frame_size > MAX_FRAME || seconds == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		perror(ifname);
+		return 1;
+	}
+	if (get_ifmac(ifname) < 0)
+		return 1;
+
+	signal(SIGINT, on_signal);
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].tid, NULL,
+				mode == 0 ? sender : receiver, &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	/* report once a second; rx counts its time from the first frame */
+	for (i = 0; !stop && i < (int)seconds; ) {
+		sleep(1);
+		sum_workers(&frames, &bytes, &first, &last, &lost);
+		if (frames == 0)
+			continue;
+		printf("%10.0f frames/s, %8.1f Mbit/s", (double)(frames - prev_frames),
+			(bytes - prev_bytes) * 8 / 1e6);
+		if (mode == 1)
+			printf(", %lu lost", lost);
+		printf("\n");
+		fflush(stdout);
+		prev_frames = frames;
+		prev_bytes = bytes;
+		i++;
+	}
+	stop = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		printf("thread %2d: %12lu frames\n", i, workers[i].frames);
+		reordered += workers[i].reordered;
+		drops += workers[i].drops;
+	}
+
+	sum_workers(&frames, &bytes, &first, &last, &lost);
+	secs = (last > first) ? (last - first) / 1e9 : 0;
+	if (secs > 0)
+		printf("%s %lu frames in %.2fs, %.0f frames/s, %.1f Mbit/s\n",
+			mode == 0 ? "sent" : "received", frames, secs,
+			frames / secs, bytes * 8 / secs / 1e6);
+	if (mode == 1)
+		printf("%lu lost, %lu reordered, %lu dropped by the receiving "
+			"socket\n", lost, reordered, drops);
+
+	pthread_barrier_destroy(&barrier);
+
+	/* frames the socket dropped show up as lost too, but not in acrn-dm */
+	return (mode == 1 && lost > drops) ? 2 : 0;
+}
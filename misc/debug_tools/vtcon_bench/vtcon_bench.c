@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Streams data through a virtio-console socket backend and reports the
+ * throughput, to measure the acrn-dm console data path:
+ *
+ *   acrn-dm ... -s 5,virtio-console,socket:bench=/tmp/vtcon.sock:server:bulk
+ *   vtcon-bench -s /tmp/vtcon.sock -m sink
+ *   (guest) dd if=/dev/zero of=/dev/vport0p1 bs=1M count=4096
+ *
+ * In source mode it writes a pattern for the guest to read instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define BUF_SIZE	(256 * 1024)
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+	stop = 1;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -s socket [-m sink|source] [-l] [-n MB]\n"
+		"  -s  unix socket of the virtio-console backend\n"
+		"  -m  sink reads what the guest writes (default),\n"
+		"      source writes for the guest to read\n"
+		"  -l  listen on the socket, for a backend of client type\n"
+		"  -n  stop after this many MB\n", prog);
+}
+
+static int
+open_socket(const char *path, bool listen_mode)
+{
+	struct sockaddr_un addr;
+	int fd, conn;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (!listen_mode) {
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("connect");
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 1) < 0) {
+		perror("bind/listen");
+		close(fd);
+		return -1;
+	}
+	conn = accept(fd, NULL, NULL);
+	if (conn < 0)
+		perror("accept");
+	close(fd);
+	return conn;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	bool source = false, listen_mode = false;
+	unsigned long long limit = 0, total = 0, last_total = 0;
+	double start, last, now;
+	char *buf;
+	ssize_t n;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "s:m:ln:h")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "source"))
+				source = true;
+			else if (strcmp(optarg, "sink")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'l':
+			listen_mode = true;
+			break;
+		case 'n':
+			limit = strtoull(optarg, NULL, 0) << 20;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (path == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	buf = malloc(BUF_SIZE);
+	if (buf == NULL)
+		return 1;
+	for (n = 0; n < BUF_SIZE; n++)
+		buf[n] = 'a' + n % 26;
+
+	signal(SIGINT, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	fd = open_socket(path, listen_mode);
+	if (fd < 0) {
+		free(buf);
+		return 1;
+	}
+
+	start = last = now_sec();
+	while (!stop && (limit == 0 || total < limit)) {
+		if (source)
+			n = write(fd, buf, BUF_SIZE);
+		else
+			n = read(fd, buf, BUF_SIZE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		total += n;
+
+		now = now_sec();
+		if (now - last >= 1.0) {
+			printf("%8.1f MB/s\n",
+				(total - last_total) / (now - last) / (1 << 20));
+			fflush(stdout);
+			last_total = total;
+			last = now;
+		}
+	}
+
+	now = now_sec();
+	if (now > start)
+		printf("%llu MB in %.2fs, %.1f MB/s\n", total >> 20, now - start,
+			total / (now - start) / (1 << 20));
+
+	close(fd);
+	free(buf);
+	return 0;
+}